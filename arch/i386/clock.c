@@ -0,0 +1,160 @@
+/*************************************************************************
+ * clock.c -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <i386/features.h>
+#include <libk/libk.h>
+#include <sys/clock.h>
+#include <sys/io.h>
+#include <sys/process.h>
+#include <sys/timer.h>
+
+#define CLOCK_SHIFT        24
+#define CLOCK_CALIBRATE_MS 10
+
+extern time_t rtc_time;
+
+ClockVtimePage clock_vtime __attribute__ ((aligned (PAGE_SIZE)));
+uint64_t clock_tsc_hz;
+
+static uint32_t clock_tick_ns;
+
+static inline uint64_t
+clock_rdtsc (void)
+{
+  uint64_t tsc;
+  __asm__ volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+static inline uint64_t
+clock_scale (uint64_t cycles)
+{
+  uint64_t high = (cycles >> 32) * clock_vtime.cv_vtime.vt_mult;
+  uint64_t low = (cycles & 0xffffffff) * clock_vtime.cv_vtime.vt_mult;
+  return (high << (32 - CLOCK_SHIFT)) + (low >> CLOCK_SHIFT);
+}
+
+/* Counts TSC cycles elapsed during a one-shot countdown of PIT channel 2,
+   which is gated through the PC speaker port and can be polled without
+   interrupts */
+
+static uint64_t
+clock_calibrate_tsc (void)
+{
+  uint32_t count = TIMER_FREQ * CLOCK_CALIBRATE_MS / 1000;
+  unsigned char port = inb (PCSPK_PORT);
+  uint64_t start;
+  uint64_t end;
+
+  /* Speaker off and gate low while loading the count in mode 0 */
+  outb (port & 0xfc, PCSPK_PORT);
+  outb (0xb0, TIMER_PORT_COMMAND);
+  outb (count & 0xff, TIMER_PORT_CHANNEL2);
+  outb ((count >> 8) & 0xff, TIMER_PORT_CHANNEL2);
+
+  /* Raising the gate starts the countdown, OUT2 goes high when it ends */
+  start = clock_rdtsc ();
+  outb ((port & 0xfc) | 0x01, PCSPK_PORT);
+  while (!(inb (PCSPK_PORT) & 0x20))
+    ;
+  end = clock_rdtsc ();
+
+  outb (port, PCSPK_PORT);
+  return (end - start) * 1000 / CLOCK_CALIBRATE_MS;
+}
+
+void
+clock_init (void)
+{
+  uint32_t freq = timer_get_freq (TIMER_PORT_CHANNEL0);
+  clock_tick_ns = NSEC_PER_SEC / freq;
+  if (cpu_features_edx & CPU_FEATURE_TSC)
+    {
+      uint64_t mult;
+      clock_tsc_hz = clock_calibrate_tsc ();
+      mult = clock_tsc_hz == 0 ? 0 :
+	(NSEC_PER_SEC << CLOCK_SHIFT) / clock_tsc_hz;
+      if (mult != 0 && mult <= UINT32_MAX)
+	{
+	  clock_vtime.cv_vtime.vt_mult = mult;
+	  clock_vtime.cv_vtime.vt_shift = CLOCK_SHIFT;
+	  clock_vtime.cv_vtime.vt_tsc_base = clock_rdtsc ();
+	  clock_vtime.cv_vtime.vt_flags |= VTIME_FLAG_TSC;
+	  printk ("clock: using TSC at %lu kHz\n",
+		  (unsigned long) (clock_tsc_hz / 1000));
+	}
+    }
+  clock_vtime.cv_vtime.vt_realtime_offset =
+    (int64_t) rtc_time * NSEC_PER_SEC - clock_monotonic ();
+}
+
+void
+clock_tick (void)
+{
+  if (clock_vtime.cv_vtime.vt_flags & VTIME_FLAG_TSC)
+    return;
+  clock_vtime.cv_vtime.vt_seq++;
+  clock_vtime.cv_vtime.vt_mono += clock_tick_ns;
+  clock_vtime.cv_vtime.vt_seq++;
+}
+
+uint64_t
+clock_monotonic (void)
+{
+  uint32_t seq;
+  uint64_t ns;
+  if (clock_vtime.cv_vtime.vt_flags & VTIME_FLAG_TSC)
+    return clock_scale (clock_rdtsc () - clock_vtime.cv_vtime.vt_tsc_base);
+  do
+    {
+      seq = clock_vtime.cv_vtime.vt_seq;
+      ns = clock_vtime.cv_vtime.vt_mono;
+    }
+  while ((seq & 1) || seq != clock_vtime.cv_vtime.vt_seq);
+  return ns;
+}
+
+uint64_t
+clock_realtime (void)
+{
+  return clock_monotonic () + clock_vtime.cv_vtime.vt_realtime_offset;
+}
+
+uint64_t
+clock_resolution (void)
+{
+  return clock_vtime.cv_vtime.vt_flags & VTIME_FLAG_TSC ? 1 : clock_tick_ns;
+}
+
+void
+clock_task_switch (pid_t prev, pid_t next)
+{
+  uint64_t now = clock_monotonic ();
+  process_table[prev].p_runtime += now - process_table[prev].p_runstart;
+  process_table[next].p_runstart = now;
+}
+
+uint64_t
+clock_process_cputime (pid_t pid)
+{
+  Process *proc = &process_table[pid];
+  uint64_t ns = proc->p_runtime;
+  if (pid == task_getpid ())
+    ns += clock_monotonic () - proc->p_runstart;
+  return ns;
+}
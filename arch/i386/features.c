@@ -17,17 +17,44 @@
  *************************************************************************/
 
 #include <i386/features.h>
+#include <sys/memory.h>
+#include <vm/paging.h>
 #include <cpuid.h>
 
 uint32_t cpu_features_edx;
 uint32_t cpu_features_ecx;
+int cpu_sysenter;
 
 void
 cpu_features_init (void)
 {
+  uint32_t signature = 0;
   uint32_t ignore;
-  __get_cpuid (1, &ignore, &ignore, &cpu_features_ecx, &cpu_features_edx);
+  __get_cpuid (1, &signature, &ignore, &cpu_features_ecx, &cpu_features_edx);
 
   if (cpu_features_edx & bit_SSE)
     cpu_enable_sse ();
+
+#ifdef INVLPG_SUPPORT
+  /* Global pages are only flushed by invlpg, so without it they can't be
+     used for kernel mappings that change at runtime */
+  if (cpu_features_edx & CPU_FEATURE_PGE)
+    {
+      paging_enable_global ();
+      cpu_enable_pge ();
+    }
+#endif
+
+  /* Early Pentium Pro models report SEP without supporting SYSENTER */
+  if (cpu_features_edx & CPU_FEATURE_SEP)
+    {
+      uint32_t family = (signature >> 8) & 0x0f;
+      uint32_t model = (signature >> 4) & 0x0f;
+      uint32_t stepping = signature & 0x0f;
+      if (family != 6 || model >= 3 || stepping >= 3)
+	{
+	  cpu_enable_sysenter ();
+	  cpu_sysenter = 1;
+	}
+    }
 }
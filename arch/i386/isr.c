@@ -24,6 +24,34 @@
 #include <sys/io.h>
 #include <sys/kbd.h>
 #include <sys/process.h>
+#include <sys/trace.h>
+#include <vm/paging.h>
+
+/* Kernel instructions that may fault on user addresses are listed in the
+   .ex_table section along with the address to continue at if they do */
+
+typedef struct
+{
+  uint32_t ee_insn;
+  uint32_t ee_fixup;
+} ExceptionTableEntry;
+
+extern ExceptionTableEntry ex_table_start[];
+extern ExceptionTableEntry ex_table_end[];
+
+volatile int irq_depth;
+
+static uint32_t
+exception_fixup (uint32_t eip)
+{
+  ExceptionTableEntry *entry;
+  for (entry = ex_table_start; entry < ex_table_end; entry++)
+    {
+      if (entry->ee_insn == eip)
+	return entry->ee_fixup;
+    }
+  return 0;
+}
 
 void
 exc0_handler (uint32_t eip)
@@ -143,14 +171,27 @@ exc13_handler (uint32_t err, uint32_t eip)
   process_send_signal (pid, SIGILL);
 }
 
-void
+uint32_t
 exc14_handler (uint32_t err, uint32_t eip)
 {
-  /* Page fault raises segmentation fault
-     TODO Add swap support */
+  /* Page faults outside of lazily mapped, zero-filled and swapped out pages
+     raise a segmentation fault, or resume at a fixup address if they
+     happened in kernel code listed in the exception table */
   pid_t pid = task_getpid ();
+  uint32_t fixup;
   uint32_t addr;
   __asm__ volatile ("mov %%cr2, %0" : "=r" (addr));
+  TRACE (TRACE_PAGE_FAULT, addr, err);
+  if (!(err & (PF_FLAG_PROT | PF_FLAG_USER)) && paging_sync_kernel (addr))
+    return 0;
+  if (pid != 0 && process_page_fault (addr, err) == 0)
+    return 0;
+  if (!(err & PF_FLAG_USER))
+    {
+      fixup = exception_fixup (eip);
+      if (fixup != 0)
+	return fixup;
+    }
   if (pid == 0)
     {
       /* Page fault in kernel task is fatal. Panic with info about the fault */
@@ -172,6 +213,7 @@ exc14_handler (uint32_t err, uint32_t eip)
       proc->p_siginfo.si_addr = (void *) addr;
       process_send_signal (pid, SIGSEGV);
     }
+  return 0;
 }
 
 void
@@ -23,8 +23,11 @@
 #include <sys/task.h>
 #include <vm/paging.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
+#include <vm/swap.h>
 
-static const char page_empty [PAGE_SIZE];
+/* Also mapped read-only into anonymous pages that have only been read */
+const char page_empty[PAGE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
 
 extern uint32_t _kernel_heap_start;
 extern uint32_t _kernel_heap_end;
@@ -32,11 +35,32 @@ extern uint32_t _kernel_heap_end;
 uint32_t kernel_page_dir[PAGE_DIR_SIZE];
 uint32_t kernel_page_table[2][PAGE_TBL_SIZE];
 uint32_t kernel_stack_table[PAGE_TBL_SIZE];
-uint32_t kernel_vmap[PAGE_DIR_SIZE];
+uint32_t kernel_vmap[PAGE_DIR_SIZE * 2];
 uint32_t kheap_page_table[65][PAGE_TBL_SIZE];
 uint32_t page_stack_table[PAGE_TBL_SIZE];
 uint32_t *curr_page_dir;
 
+static uint32_t page_global_flag;
+
+/* Page directory entries between RELOC_VADDR and TASK_LOCAL_BOUND point to
+   kernel page tables shared by every address space. They are only changed
+   in kernel_page_dir and copied to other directories when missing. */
+
+static inline int
+paging_shared_pde (uint32_t pdi)
+{
+  return pdi >= RELOC_VADDR >> 22 && pdi < TASK_LOCAL_BOUND >> 22;
+}
+
+/* The second half of the table address map of a directory counts the
+   entries in use in each page table, including swap entries */
+
+static inline uint32_t *
+page_table_used (uint32_t *dir, uint32_t pdi)
+{
+  return (uint32_t *) dir[PAGE_DIR_SIZE - 1] + PAGE_DIR_SIZE + pdi;
+}
+
 void
 paging_init (uint32_t stack)
 {
@@ -103,53 +127,128 @@ paging_init (uint32_t stack)
        i++, addr += PAGE_SIZE)
     page_stack_table[i] = addr | PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE;
 
-  /* Map kernel stack and exec data pages */
+  /* Map kernel stack */
   for (i = 0, addr = 0; addr < TASK_STACK_SIZE; i++, addr += PAGE_SIZE)
     kernel_stack_table[i] = (stack + addr - RELOC_VADDR)
       | PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE | PAGE_FLAG_USER;
-  for (addr = 0; addr < EXEC_DATA_LEN; i++, addr += PAGE_SIZE)
-    {
-      uint32_t pti = addr >> 12 & (PAGE_DIR_SIZE - 1);
-      kernel_stack_table[pti] = (addr + EXEC_DATA_PADDR)
-	| PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE | PAGE_FLAG_USER;
-    }
 
   /* Map last page table to page directory virtual addresses */
   kernel_page_dir[PAGE_DIR_SIZE - 1] = (uint32_t) kernel_vmap;
+  for (i = 0; i < PAGE_DIR_SIZE - 1; i++)
+    {
+      uint32_t *table = (uint32_t *) kernel_vmap[i];
+      int j;
+      if (table == NULL)
+	continue;
+      for (j = 0; j < PAGE_TBL_SIZE; j++)
+	{
+	  if (table[j] != 0)
+	    kernel_vmap[PAGE_DIR_SIZE + i]++;
+	}
+    }
 
   paging_loaddir ((uint32_t) kernel_page_dir - RELOC_VADDR);
 }
 
+/* Marks the mappings of all shared kernel page tables as global, so they
+   stay in the TLB across address space switches once PGE is enabled */
+
+void
+paging_enable_global (void)
+{
+  uint32_t i;
+  page_global_flag = PAGE_FLAG_GLOBAL;
+  for (i = RELOC_VADDR >> 22; i < TASK_LOCAL_BOUND >> 22; i++)
+    {
+      uint32_t *table = (uint32_t *) kernel_vmap[i];
+      int j;
+      if (!(kernel_page_dir[i] & PAGE_FLAG_PRESENT))
+	continue;
+      for (j = 0; j < PAGE_TBL_SIZE; j++)
+	{
+	  if (table[j] & PAGE_FLAG_PRESENT)
+	    table[j] |= PAGE_FLAG_GLOBAL;
+	}
+    }
+}
+
+/* Copies the entry of a kernel page table created after the current
+   directory was cloned. Returns nonzero if a fault at ADDR was caused by
+   such a missing entry. */
+
+int
+paging_sync_kernel (uint32_t addr)
+{
+  uint32_t pdi = addr >> 22;
+  if (!paging_shared_pde (pdi) || curr_page_dir == kernel_page_dir
+      || (curr_page_dir[pdi] & PAGE_FLAG_PRESENT)
+      || !(kernel_page_dir[pdi] & PAGE_FLAG_PRESENT))
+    return 0;
+  curr_page_dir[pdi] = kernel_page_dir[pdi];
+  ((uint32_t *) curr_page_dir[PAGE_DIR_SIZE - 1])[pdi] = kernel_vmap[pdi];
+  return 1;
+}
+
 uint32_t
 get_paddr (uint32_t *dir, void *vaddr)
 {
   uint32_t pdi = (uint32_t) vaddr >> 22;
   uint32_t pti = (uint32_t) vaddr >> 12 & (PAGE_DIR_SIZE - 1);
   uint32_t *table;
+  if (paging_shared_pde (pdi))
+    dir = kernel_page_dir;
   if (!(dir[pdi] & PAGE_FLAG_PRESENT))
     return 0;
   table = (uint32_t *) ((uint32_t *) dir[PAGE_DIR_SIZE - 1])[pdi];
   return (table[pti] & 0xfffff000) + ((uint32_t) vaddr & 0xfff);
 }
 
+/* Returns the page table entry for VADDR, or NULL if it has no page table */
+
+uint32_t *
+get_pte (uint32_t *dir, uint32_t vaddr)
+{
+  uint32_t pdi = vaddr >> 22;
+  uint32_t pti = vaddr >> 12 & (PAGE_DIR_SIZE - 1);
+  if (paging_shared_pde (pdi))
+    dir = kernel_page_dir;
+  if (!(dir[pdi] & PAGE_FLAG_PRESENT))
+    return NULL;
+  return (uint32_t *) ((uint32_t *) dir[PAGE_DIR_SIZE - 1])[pdi] + pti;
+}
+
 void
 map_page (uint32_t *dir, uint32_t paddr, uint32_t vaddr, uint32_t flags)
 {
   uint32_t pdi = vaddr >> 22;
   uint32_t pti = vaddr >> 12 & (PAGE_DIR_SIZE - 1);
+  uint32_t *master = dir;
   uint32_t *table;
-  if (dir[pdi] & PAGE_FLAG_PRESENT)
-    table = (uint32_t *) ((uint32_t *) dir[PAGE_DIR_SIZE - 1])[pdi];
+  if (paging_shared_pde (pdi))
+    {
+      master = kernel_page_dir;
+      flags |= page_global_flag;
+    }
+  if (master[pdi] & PAGE_FLAG_PRESENT)
+    table = (uint32_t *) ((uint32_t *) master[PAGE_DIR_SIZE - 1])[pdi];
   else
     {
       table = kvalloc (PAGE_TBL_SIZE << 2);
       if (unlikely (table == NULL))
         panic ("Failed to allocate page table");
       memset (table, 0, PAGE_TBL_SIZE << 2);
-      dir[pdi] = get_paddr (curr_page_dir, table) | PAGE_FLAG_WRITE
+      master[pdi] = get_paddr (curr_page_dir, table) | PAGE_FLAG_WRITE
 	| PAGE_FLAG_USER | PAGE_FLAG_PRESENT;
+      ((uint32_t *) master[PAGE_DIR_SIZE - 1])[pdi] = (uint32_t) table;
+      *page_table_used (master, pdi) = 0;
+    }
+  if (master != dir && !(dir[pdi] & PAGE_FLAG_PRESENT))
+    {
+      dir[pdi] = master[pdi];
       ((uint32_t *) dir[PAGE_DIR_SIZE - 1])[pdi] = (uint32_t) table;
     }
+  if (table[pti] == 0)
+    ++*page_table_used (master, pdi);
   table[pti] = paddr | PAGE_FLAG_PRESENT | (flags & 0xfff);
 }
 
@@ -158,10 +257,55 @@ unmap_page (uint32_t *dir, uint32_t vaddr)
 {
   uint32_t pdi = vaddr >> 22;
   uint32_t pti = vaddr >> 12 & (PAGE_DIR_SIZE - 1);
-  if (dir[pdi] & PAGE_FLAG_PRESENT)
+  uint32_t *table;
+  if (paging_shared_pde (pdi))
+    dir = kernel_page_dir;
+  if (!(dir[pdi] & PAGE_FLAG_PRESENT))
+    return;
+  table = (uint32_t *) ((uint32_t *) dir[PAGE_DIR_SIZE - 1])[pdi];
+  if (table[pti] != 0)
+    {
+      table[pti] = 0;
+      --*page_table_used (dir, pdi);
+    }
+}
+
+void
+tlb_gather_flush (TLBGather *tlb)
+{
+  if (tlb->tg_count == 0)
+    return;
+#ifdef INVLPG_SUPPORT
+  if (tlb->tg_count <= TLB_GATHER_MAX)
+    {
+      int i;
+      for (i = 0; i < tlb->tg_count; i++)
+	vm_page_inval (tlb->tg_addrs[i]);
+    }
+  else
+#endif
+    vm_tlb_reset ();
+  tlb_gather_init (tlb);
+}
+
+/* Drops the references taken by page_table_clone for the first COUNT
+   entries of TABLE, which maps the 4 MiB region numbered INDEX */
+
+static void
+page_table_release (uint32_t index, uint32_t *table, int count)
+{
+  int i;
+  for (i = 0; i < count; i++)
     {
-      uint32_t *table = (uint32_t *) dir[PAGE_DIR_SIZE - 1];
-      ((uint32_t *) table[pdi])[pti] = 0;
+      uint32_t vaddr = (index << 22) | (i << 12);
+      if (table[i] & PAGE_FLAG_SWAP)
+	swap_free (table[i]);
+      else if (!(table[i] & PAGE_FLAG_PRESENT) || (table[i] & PAGE_FLAG_ZERO))
+	continue;
+      else if (table[i] & PAGE_FLAG_SHARED)
+	page_cache_unmap_frame (table[i] & 0xfffff000, 0);
+      else if (vaddr >= TASK_LOCAL_BOUND)
+	free_page (table[i] & 0xfffff000);
     }
 }
 
@@ -176,13 +320,34 @@ page_table_clone (uint32_t index, uint32_t *orig)
     {
       uint32_t vaddr = (index << 22) | (i << 12);
       uint32_t buffer;
+      if (orig[i] & PAGE_FLAG_SWAP)
+	{
+	  table[i] = orig[i];
+	  swap_dup (orig[i]);
+	  continue;
+	}
       if (!(orig[i] & PAGE_FLAG_PRESENT))
 	{
 	  table[i] = 0;
 	  continue;
 	}
 
-      /* If cloning kernel code or heap, link instead of copy */
+      if (orig[i] & PAGE_FLAG_ZERO)
+	{
+	  table[i] = orig[i];
+	  continue;
+	}
+
+      /* File mappings use the same page cache frame. Private ones have it
+	 mapped read-only until they write to it. */
+      if (orig[i] & PAGE_FLAG_SHARED)
+	{
+	  table[i] = orig[i];
+	  page_cache_ref_frame (orig[i] & 0xfffff000);
+	  continue;
+	}
+
+      /* Pages below the task-local area are linked instead of copied */
       if (vaddr < TASK_LOCAL_BOUND)
 	{
 	  table[i] = orig[i];
@@ -193,6 +358,7 @@ page_table_clone (uint32_t index, uint32_t *orig)
       buffer = alloc_page ();
       if (unlikely (buffer == 0))
 	{
+	  page_table_release (index, table, i);
 	  kfree (table);
 	  table = NULL;
 	  goto end;
@@ -221,42 +387,104 @@ page_dir_clone (uint32_t *orig)
   if (unlikely (dir == NULL))
     return NULL;
   memset (dir, 0, PAGE_DIR_SIZE << 2);
-  vmap = kvalloc (PAGE_DIR_SIZE << 2);
+  vmap = kvalloc (PAGE_DIR_SIZE << 3);
   if (unlikely (vmap == NULL))
     {
       kfree (dir);
       return NULL;
     }
+  memset (vmap, 0, PAGE_DIR_SIZE << 3);
   dir[PAGE_DIR_SIZE - 1] = (uint32_t) vmap;
   vtable = (uint32_t *) orig[PAGE_DIR_SIZE - 1];
   for (i = 0; i < PAGE_DIR_SIZE - 1; i++)
     {
-      if (!(orig[i] & PAGE_FLAG_PRESENT))
+      if (paging_shared_pde (i))
 	{
-	  vmap[i] = 0;
+	  dir[i] = kernel_page_dir[i];
+	  vmap[i] = kernel_vmap[i];
 	  continue;
 	}
-      if (memcmp ((const void *) vtable[i], page_empty, PAGE_SIZE) == 0)
-	{
-	  /* Table has no present entries, no need to copy */
-	  dir[i] = 0;
-	  vmap[i] = 0;
-	}
-      else
+
+      /* Tables with no entries in use don't need to be copied */
+      if (!(orig[i] & PAGE_FLAG_PRESENT) || *page_table_used (orig, i) == 0)
+	continue;
+      vmap[i] = (uint32_t) page_table_clone (i, (uint32_t *) vtable[i]);
+      if (unlikely (vmap[i] == 0))
 	{
-	  vmap[i] = (uint32_t) page_table_clone (i, (uint32_t *) vtable[i]);
-	  if (unlikely (vmap[i] == 0))
+	  while (i-- > 0)
 	    {
-	      page_dir_free (dir);
-	      return NULL;
+	      if (!paging_shared_pde (i) && vmap[i] != 0)
+		page_table_release (i, (uint32_t *) vmap[i], PAGE_TBL_SIZE);
 	    }
-	  dir[i] = get_paddr (curr_page_dir, (void *) vmap[i])
-	    | PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE | PAGE_FLAG_USER;
+	  page_dir_free (dir);
+	  return NULL;
 	}
+      dir[i] = get_paddr (curr_page_dir, (void *) vmap[i])
+	| PAGE_FLAG_PRESENT | PAGE_FLAG_WRITE | PAGE_FLAG_USER;
+      vmap[PAGE_DIR_SIZE + i] = *page_table_used (orig, i);
     }
   return dir;
 }
 
+/* Creates a page directory that uses the user page tables of ORIG, for a
+   vfork child. The tables are given back with page_dir_vfork_return. */
+
+uint32_t *
+page_dir_vfork (uint32_t *orig)
+{
+  int i;
+  uint32_t *dir = kvalloc (PAGE_DIR_SIZE << 2);
+  uint32_t *vmap;
+  uint32_t *vtable;
+  if (unlikely (dir == NULL))
+    return NULL;
+  memset (dir, 0, PAGE_DIR_SIZE << 2);
+  vmap = kvalloc (PAGE_DIR_SIZE << 3);
+  if (unlikely (vmap == NULL))
+    {
+      kfree (dir);
+      return NULL;
+    }
+  memset (vmap, 0, PAGE_DIR_SIZE << 3);
+  dir[PAGE_DIR_SIZE - 1] = (uint32_t) vmap;
+  vtable = (uint32_t *) orig[PAGE_DIR_SIZE - 1];
+  for (i = 0; i < RELOC_VADDR >> 22; i++)
+    {
+      dir[i] = orig[i];
+      vmap[i] = vtable[i];
+      vmap[PAGE_DIR_SIZE + i] = vtable[PAGE_DIR_SIZE + i];
+    }
+  for (i = RELOC_VADDR >> 22; i < TASK_LOCAL_BOUND >> 22; i++)
+    {
+      dir[i] = kernel_page_dir[i];
+      vmap[i] = kernel_vmap[i];
+    }
+  return dir;
+}
+
+/* Gives the user page tables of the vfork directory DIR back to ORIG,
+   including any created while DIR was in use */
+
+void
+page_dir_vfork_return (uint32_t *dir, uint32_t *orig)
+{
+  uint32_t *vmap = (uint32_t *) dir[PAGE_DIR_SIZE - 1];
+  uint32_t *vtable = (uint32_t *) orig[PAGE_DIR_SIZE - 1];
+  int i;
+  for (i = 0; i < RELOC_VADDR >> 22; i++)
+    {
+      if (dir[i] & PAGE_FLAG_PRESENT)
+	{
+	  orig[i] = dir[i];
+	  vtable[i] = vmap[i];
+	  vtable[PAGE_DIR_SIZE + i] = vmap[PAGE_DIR_SIZE + i];
+	}
+      dir[i] = 0;
+      vmap[i] = 0;
+      vmap[PAGE_DIR_SIZE + i] = 0;
+    }
+}
+
 void
 page_dir_free (uint32_t *dir)
 {
@@ -264,6 +492,9 @@ page_dir_free (uint32_t *dir)
   int i;
   for (i = 0; i < PAGE_DIR_SIZE - 1; i++)
     {
+      if (paging_shared_pde (i))
+	continue;
+
       /* If page table is on kernel heap, free it */
       if (vmap[i] >= kernel_heap.mh_addr
 	  && vmap[i] < kernel_heap.mh_addr + kernel_heap.mh_size)
@@ -291,6 +522,7 @@ page_dir_exec_free (uint32_t *dir)
         kfree ((uint32_t *) vmap[i]);
       dir[i] = 0;
       vmap[i] = 0;
+      vmap[PAGE_DIR_SIZE + i] = 0;
     }
   vm_tlb_reset ();
 }
@@ -23,9 +23,13 @@ static IDTEntry idt_entries[IDT_SIZE];
 static DTPtr idt;
 
 #define EXC(x) void exc ## x (void);
+#define EXC_ERR(x) EXC (x)
+#define EXC_FIXUP(x) EXC (x)
 #define IRQ(x) void irq ## x (void);
 #include "irq.inc"
 #undef EXC
+#undef EXC_ERR
+#undef EXC_FIXUP
 #undef IRQ
 
 void syscall (void);
@@ -61,10 +65,14 @@ idt_init (void)
   idt.dp_base = (uint32_t) &idt_entries;
 
 #define EXC(x) idt_set_gate (x, (uint32_t) exc ## x, 0x08, 3, IDT_GATE_TRAP);
+#define EXC_ERR(x) EXC (x)
+#define EXC_FIXUP(x) EXC (x)
 #define IRQ(x) idt_set_gate (x + 32, (uint32_t) irq ## x, 0x08, 3, \
 			     IDT_GATE_TRAP);
 #include "irq.inc"
 #undef EXC
+#undef EXC_ERR
+#undef EXC_FIXUP
 #undef IRQ
   idt_set_gate (0x80, (uint32_t) syscall, 0x08, 3, IDT_GATE_TRAP);
   idt_set_gate (0x81, (uint32_t) task_set_fini_funcs, 0x08, 3, IDT_GATE_TRAP);
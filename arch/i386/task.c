@@ -19,8 +19,11 @@
 #include <kconfig.h>
 
 #include <fs/vfs.h>
+#include <i386/features.h>
 #include <i386/tss.h>
 #include <libk/libk.h>
+#include <libk/random.h>
+#include <sys/clock.h>
 #include <sys/process.h>
 #include <sys/rtld.h>
 #include <sys/syscall.h>
@@ -28,6 +31,8 @@
 #include <vm/paging.h>
 
 void sys_exit_halt (void) __attribute__ ((noreturn));
+void vsyscall_sysenter (void);
+void vsyscall_int80 (void);
 void signal_trampoline (void) __attribute__ ((aligned (PAGE_SIZE)));
 
 volatile ProcessTask *task_current;
@@ -51,9 +56,11 @@ scheduler_init (void)
   task_current->t_priority = PRIO_MIN;
   task_current->t_prev = task_current;
   task_current->t_next = NULL;
+  task_current->t_vfork = 0;
 
   task_queue = task_current;
   process_table[0].p_task = task_current;
+  process_region_init (&process_table[0].p_mregions);
   for (i = 0; i < NSIG; i++)
     process_table[0].p_sigactions[i].sa_handler = SIG_DFL;
   process_table[0].p_umask = S_IWGRP | S_IWOTH;
@@ -75,7 +82,7 @@ scheduler_init (void)
 }
 
 void
-task_timer_tick (void)
+task_timer_tick (unsigned long usec)
 {
   uint32_t esp;
   struct timeval *tp;
@@ -94,8 +101,8 @@ task_timer_tick (void)
     tp = &proc->p_rusage.ru_utime;
   else
     tp = &proc->p_rusage.ru_stime;
-  tp->tv_usec += 1000; /* Timer tick happens every millisecond */
-  if (tp->tv_usec >= 1000000)
+  tp->tv_usec += usec;
+  while (tp->tv_usec >= 1000000)
     {
       tp->tv_sec++;
       tp->tv_usec -= 1000000;
@@ -104,33 +111,57 @@ task_timer_tick (void)
   /* Update real-time interval timer for all processes */
   for (i = 0; i < PROCESS_LIMIT; i++)
     {
+      long rem;
       if (process_table[i].p_task == NULL)
 	continue;
       tp = &process_table[i].p_itimers[ITIMER_REAL].it_value;
-      if (tp->tv_sec != 0 || tp->tv_usec != 0)
+      if (tp->tv_sec == 0 && tp->tv_usec == 0)
+	continue;
+
+      rem = tp->tv_usec - usec;
+      while (rem < 0 && tp->tv_sec > 0)
+	{
+	  tp->tv_sec--;
+	  rem += 1000000;
+	}
+      tp->tv_usec = rem < 0 ? 0 : rem;
+
+      if (tp->tv_sec == 0 && tp->tv_usec == 0)
 	{
-	  if (tp->tv_usec >= 1000)
-	    tp->tv_usec -= 1000;
-	  else if (tp->tv_sec > 0)
-	    {
-	      tp->tv_sec--;
-	      tp->tv_usec = 999000 - tp->tv_usec;
-	    }
-
-	  if (tp->tv_sec == 0 && tp->tv_usec == 0)
-	    {
-	      /* Reset the timer and send a signal */
-	      tp->tv_sec =
-		process_table[i].p_itimers[ITIMER_REAL].it_interval.tv_sec;
-	      tp->tv_usec =
-		process_table[i].p_itimers[ITIMER_REAL].it_interval.tv_usec;
-	      process_table[i].p_siginfo.si_code = SI_TIMER;
-	      process_send_signal (i, SIGALRM);
-	    }
+	  /* Reset the timer and send a signal */
+	  tp->tv_sec =
+	    process_table[i].p_itimers[ITIMER_REAL].it_interval.tv_sec;
+	  tp->tv_usec =
+	    process_table[i].p_itimers[ITIMER_REAL].it_interval.tv_usec;
+	  process_table[i].p_siginfo.si_code = SI_TIMER;
+	  process_send_signal (i, SIGALRM);
 	}
     }
 }
 
+unsigned long
+task_timer_next (void)
+{
+  unsigned long next = ULONG_MAX;
+  int i;
+  for (i = 0; i < PROCESS_LIMIT; i++)
+    {
+      struct timeval *tp;
+      unsigned long usec;
+      if (process_table[i].p_task == NULL)
+	continue;
+      tp = &process_table[i].p_itimers[ITIMER_REAL].it_value;
+      if (tp->tv_sec == 0 && tp->tv_usec == 0)
+	continue;
+      if (tp->tv_sec >= ULONG_MAX / 1000000)
+	continue;
+      usec = tp->tv_sec * 1000000 + tp->tv_usec;
+      if (usec < next)
+	next = usec;
+    }
+  return next;
+}
+
 void
 task_free (ProcessTask *task)
 {
@@ -143,7 +174,7 @@ task_free (ProcessTask *task)
     task->t_next->t_prev = task->t_prev;
 
   /* Free task stack */
-  for (i = TASK_STACK_BOTTOM; i < TASK_STACK_ADDR; i += PAGE_SIZE)
+  for (i = TASK_STACK_LIMIT; i < TASK_STACK_ADDR; i += PAGE_SIZE)
     {
       uint32_t paddr = get_paddr (task->t_pgdir, (void *) i);
       if (paddr != 0)
@@ -151,7 +182,17 @@ task_free (ProcessTask *task)
     }
 
   if (task->t_pgcopied)
-    page_dir_free (task->t_pgdir);
+    {
+      /* Free any pages left in the exec data window */
+      for (i = EXEC_DATA_VADDR; i < EXEC_DATA_VADDR + EXEC_DATA_LEN;
+	   i += PAGE_SIZE)
+	{
+	  uint32_t paddr = get_paddr (task->t_pgdir, (void *) i);
+	  if (paddr != 0)
+	    free_page (paddr);
+	}
+      page_dir_free (task->t_pgdir);
+    }
   kfree (task);
 }
 
@@ -167,109 +208,352 @@ task_getppid (void)
   return task_current->t_ppid;
 }
 
+/* Returns the address in the exec data window of ADDR in the initial stack
+   described by ARGS */
+
+static inline void *
+task_exec_window (const ExecArgs *args, uint32_t addr)
+{
+  return (void *) (addr - (SYSCALL_STACK_ADDR - args->ea_pages * PAGE_SIZE)
+		   + EXEC_DATA_VADDR);
+}
+
+/* Frees the pages left in the exec data window by an exec that failed */
+
+static void
+task_free_exec_data (void)
+{
+  TLBGather tlb;
+  uint32_t vaddr;
+  tlb_gather_init (&tlb);
+  for (vaddr = EXEC_DATA_VADDR; vaddr < EXEC_DATA_VADDR + EXEC_DATA_LEN;
+       vaddr += PAGE_SIZE)
+    {
+      uint32_t paddr = get_paddr (curr_page_dir, (void *) vaddr);
+      if (paddr == 0)
+	continue;
+      free_page (paddr);
+      unmap_page (curr_page_dir, vaddr);
+      tlb_gather_page (&tlb, vaddr);
+    }
+  tlb_gather_flush (&tlb);
+}
+
+/* Builds the initial stack of a new program in new pages mapped in the exec
+   data window. From the lowest address it holds argc, argv, envp and the
+   auxiliary vector, followed by 16 random bytes, the argument and
+   environment strings and a copy of the dynamic linking info. */
+
 int
-task_setup_exec (char *const *argv, char *const *envp)
+task_setup_exec (ExecArgs *args, char *const *argv, char *const *envp)
 {
-  void *data = (void *) EXEC_DATA_VADDR + sizeof (void *) * 2;
+  static char *const empty[] = {NULL};
+  TLBGather tlb;
+  uint32_t *vec;
+  uint32_t random;
+  uint32_t start;
+  uint32_t base;
+  uint32_t str;
   char *ptr;
   size_t len = 0;
   size_t narg;
   size_t nenv;
   size_t i;
 
+  if (argv == NULL)
+    argv = empty;
+  if (envp == NULL)
+    envp = empty;
   for (narg = 0; argv[narg] != NULL; narg++)
     len += strlen (argv[narg]) + 1;
   for (nenv = 0; envp[nenv] != NULL; nenv++)
     len += strlen (envp[nenv]) + 1;
-
-  if (len + sizeof (void *) * (narg + nenv + 4) >= ARG_MAX)
+  if (len + sizeof (void *) * (narg + nenv + 2) > ARG_MAX)
     return -E2BIG;
 
-  /* Copy argv data and pointers */
-  ((void **) EXEC_DATA_VADDR)[0] = (void **) EXEC_DATA_VADDR + 2;
-  ptr = data + sizeof (void *) * (narg + 1);
-  for (i = 0; i < narg; i++)
+  str = TASK_EXEC_DLINFO - len;
+  random = (str - 16) & ~15;
+  start = (random - sizeof (Elf32_auxv_t) * TASK_AUXV_MAX
+	   - sizeof (void *) * (narg + nenv + 3)) & ~15;
+  base = start & ~(PAGE_SIZE - 1);
+  args->ea_pages = (SYSCALL_STACK_ADDR - base) / PAGE_SIZE;
+  args->ea_esp = start;
+
+  task_free_exec_data ();
+  tlb_gather_init (&tlb);
+  for (i = 0; i < args->ea_pages; i++)
     {
-      ((char **) data)[i] = ptr;
-      ptr = stpcpy (ptr, argv[i]) + 1;
+      uint32_t vaddr = EXEC_DATA_VADDR + i * PAGE_SIZE;
+      uint32_t paddr = alloc_page ();
+      if (unlikely (paddr == 0))
+	{
+	  task_free_exec_data ();
+	  return -ENOMEM;
+	}
+      map_page (curr_page_dir, paddr, vaddr,
+		PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+      tlb_gather_page (&tlb, vaddr);
     }
-  ((char **) data)[i] = NULL;
+  tlb_gather_flush (&tlb);
 
-  /* Copy envp data and pointers */
-  data = (void *) (((uintptr_t) ptr - 1) | (PAGE_SIZE - 1)) + 1;
-  ((void **) EXEC_DATA_VADDR)[1] = data;
-  ptr = data + sizeof (void *) * (nenv + 1);
+  /* Only clear the parts that aren't written below */
+  memset (task_exec_window (args, base), 0, start - base);
+  memset (task_exec_window (args, TASK_EXEC_DLINFO), 0,
+	  TASK_EXEC_DLINFO_SIZE);
+
+  vec = task_exec_window (args, start);
+  ptr = task_exec_window (args, str);
+  *vec++ = narg;
+  for (i = 0; i < narg; i++)
+    {
+      size_t n = strlen (argv[i]) + 1;
+      memcpy (ptr, argv[i], n);
+      *vec++ = str;
+      ptr += n;
+      str += n;
+    }
+  *vec++ = 0;
   for (i = 0; i < nenv; i++)
     {
-      ((char **) data)[i] = ptr;
-      ptr = stpcpy (ptr, envp[i]) + 1;
+      size_t n = strlen (envp[i]) + 1;
+      memcpy (ptr, envp[i], n);
+      *vec++ = str;
+      ptr += n;
+      str += n;
     }
-  ((char **) data)[i] = NULL;
+  *vec++ = 0;
+
+  /* Unused entries of the auxiliary vector are left as AT_NULL */
+  args->ea_auxv = (Elf32_auxv_t *) vec;
+  args->ea_nauxv = 0;
+  memset (vec, 0, task_exec_window (args, TASK_EXEC_DLINFO - len)
+	  - (void *) vec);
+  get_entropy (task_exec_window (args, random), 16);
+  task_set_auxv (args, AT_PAGESZ, PAGE_SIZE);
+  task_set_auxv (args, AT_CLKTCK, CLK_TCK);
+  task_set_auxv (args, AT_HWCAP, cpu_features_edx);
+  task_set_auxv (args, AT_SYSINFO, TASK_VSYSCALL_PAGE);
+  task_set_auxv (args, AT_RANDOM, random);
   return 0;
 }
 
+void
+task_set_auxv (ExecArgs *args, uint32_t type, uint32_t value)
+{
+  Elf32_auxv_t *auxv;
+  if (args->ea_nauxv >= TASK_AUXV_MAX - 1)
+    return;
+  auxv = &args->ea_auxv[args->ea_nauxv++];
+  auxv->a_type = type;
+  auxv->a_un.a_val = value;
+}
+
+/* Moves the pages of the initial stack from the exec data window to the top
+   of the user stack and the stack pages of the old program below them,
+   freeing any others. The old stack pages are cleared so the new program
+   can't read the data of the old one. Returns the initial stack pointer.
+   This is called by task_exec on the kernel stack, since the kernel
+   starting init runs on the user stack. */
+
+uint32_t
+task_map_exec_args (const ExecArgs *args, const DynamicLinkInfo *dlinfo)
+{
+  uint32_t pages = args->ea_pages;
+  uint32_t esp = args->ea_esp;
+  uint32_t shift = pages * PAGE_SIZE;
+  uint32_t paddr;
+  uint32_t vaddr;
+  uint32_t i;
+
+  memcpy (task_exec_window (args, TASK_EXEC_DLINFO), dlinfo,
+	  sizeof (DynamicLinkInfo));
+  for (vaddr = TASK_STACK_LIMIT; vaddr < TASK_STACK_BOTTOM;
+       vaddr += PAGE_SIZE)
+    {
+      paddr = get_paddr (curr_page_dir, (void *) vaddr);
+      if (paddr == 0)
+	continue;
+      free_page (paddr);
+      unmap_page (curr_page_dir, vaddr);
+    }
+
+  /* Each page is moved down to an address already vacated */
+  for (vaddr = TASK_STACK_BOTTOM; vaddr < SYSCALL_STACK_ADDR;
+       vaddr += PAGE_SIZE)
+    {
+      paddr = get_paddr (curr_page_dir, (void *) vaddr);
+      if (paddr == 0)
+	continue;
+      memset ((void *) vaddr, 0, PAGE_SIZE);
+      unmap_page (curr_page_dir, vaddr);
+      map_page (curr_page_dir, paddr, vaddr - shift,
+		PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+    }
+
+  for (i = 0; i < pages; i++)
+    {
+      vaddr = EXEC_DATA_VADDR + i * PAGE_SIZE;
+      paddr = get_paddr (curr_page_dir, (void *) vaddr);
+      unmap_page (curr_page_dir, vaddr);
+      map_page (curr_page_dir, paddr, SYSCALL_STACK_ADDR - shift
+		+ i * PAGE_SIZE, PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+    }
+  vm_tlb_reset ();
+  return esp;
+}
+
+/* Frees the frames of the heap pages of a child with page directory DIR
+   below END that were copied by task_copy_heap */
+
+static void
+task_free_heap (uint32_t *dir, const Process *proc, uint32_t end)
+{
+  uint32_t vaddr;
+  uint32_t *pte;
+  for (vaddr = proc->p_initbreak; vaddr < end; vaddr += PAGE_SIZE)
+    {
+      pte = get_pte (dir, vaddr);
+      if (pte != NULL && (*pte & PAGE_FLAG_PRESENT)
+	  && !(*pte & (PAGE_FLAG_SHARED | PAGE_FLAG_ZERO)))
+	{
+	  free_page (*pte & 0xfffff000);
+	  *pte = 0;
+	}
+    }
+}
+
+/* Gives a child with page directory DIR its own copy of the heap pages of
+   PROC, which were linked to the frames of the parent when the directory
+   was cloned, so each process can free its heap when it exits. */
+
+static int
+task_copy_heap (uint32_t *dir, const Process *proc)
+{
+  uint32_t end = ((proc->p_break - 1) | (PAGE_SIZE - 1)) + 1;
+  uint32_t vaddr;
+  uint32_t paddr;
+  uint32_t *pte;
+  int ret = 0;
+  for (vaddr = proc->p_initbreak; vaddr < end; vaddr += PAGE_SIZE)
+    {
+      pte = get_pte (dir, vaddr);
+      if (pte == NULL || !(*pte & PAGE_FLAG_PRESENT)
+	  || (*pte & (PAGE_FLAG_SHARED | PAGE_FLAG_ZERO)))
+	continue;
+      paddr = alloc_page ();
+      if (unlikely (paddr == 0))
+	{
+	  ret = -ENOMEM;
+	  break;
+	}
+      map_page (curr_page_dir, paddr, PAGE_COPY_VADDR, PAGE_FLAG_WRITE);
+      vm_page_inval_386 (PAGE_COPY_VADDR);
+      memcpy ((void *) PAGE_COPY_VADDR, (const void *) vaddr, PAGE_SIZE);
+      *pte = paddr | (*pte & 0xfff);
+    }
+  unmap_page (curr_page_dir, PAGE_COPY_VADDR);
+  vm_page_inval_386 (PAGE_COPY_VADDR);
+  if (ret != 0)
+    task_free_heap (dir, proc, vaddr);
+  return ret;
+}
+
 ProcessTask *
 _task_fork (int copy_pgdir)
 {
   volatile ProcessTask *temp;
   ProcessTask *task;
-  SortedArray *mregions;
+  RBTree mregions;
+  TLBGather tlb;
   Process *proc;
   Process *parent;
   char *cwdpath;
   uint32_t *dir;
   uint32_t paddr;
+  uint32_t newpages = 0;
   uint32_t i;
-  pid_t tpid;
   pid_t pid;
 
   for (pid = 1; pid < PROCESS_LIMIT; pid++)
     {
-      if (process_table[pid].p_task == NULL)
+      if (process_table[pid].p_task == NULL && !process_table[pid].p_zombie)
 	goto found;
     }
   return NULL;
 
  found:
+  process_region_init (&mregions);
   if (copy_pgdir)
+    dir = page_dir_clone (task_current->t_pgdir);
+  else
+    dir = page_dir_vfork (task_current->t_pgdir);
+  if (dir == NULL)
+    return NULL;
+  if (copy_pgdir
+      && task_copy_heap (dir, &process_table[task_getpid ()]) != 0)
     {
-      dir = page_dir_clone (task_current->t_pgdir);
-      if (dir == NULL)
-	return NULL;
+      page_dir_free (dir);
+      return NULL;
     }
-  else
-    dir = task_current->t_pgdir;
 
-  /* Allocate and copy the stack */
+  /* A cloned directory already has its own copy of the stack. A vfork
+     child runs on the user stack of its parent and only gets its own
+     kernel stack. Map the stack to build the child's interrupt frame. */
+  tlb_gather_init (&tlb);
   for (i = 0; i < TASK_STACK_SIZE; i += PAGE_SIZE)
     {
-      paddr = alloc_page ();
-      if (unlikely (paddr == 0))
+      uint32_t vaddr = TASK_STACK_BOTTOM + i;
+      if (copy_pgdir || vaddr < SYSCALL_STACK_ADDR)
 	{
-	  int j;
-	  for (j = 0; j < i; j += PAGE_SIZE)
-	    {
-	      paddr = get_paddr (curr_page_dir, (void *) (PAGE_COPY_VADDR + i));
-	      if (paddr != 0)
-		free_page (paddr);
-	    }
-	  page_dir_free (dir);
-	  return NULL;
+	  paddr = get_paddr (copy_pgdir ? dir : curr_page_dir, (void *) vaddr);
+	  if (paddr == 0)
+	    continue;
+	  if (!copy_pgdir)
+	    map_page (dir, paddr, vaddr, PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+	}
+      else
+	{
+	  paddr = alloc_page ();
+	  if (unlikely (paddr == 0))
+	    goto err;
+	  map_page (dir, paddr, vaddr, PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+	  newpages |= 1 << (i / PAGE_SIZE);
 	}
-      map_page (dir, paddr, TASK_STACK_BOTTOM + i,
-		PAGE_FLAG_WRITE | PAGE_FLAG_USER);
       map_page (curr_page_dir, paddr, PAGE_COPY_VADDR + i,
 		PAGE_FLAG_WRITE | PAGE_FLAG_USER);
-      vm_page_inval (PAGE_COPY_VADDR + i);
+      tlb_gather_page (&tlb, PAGE_COPY_VADDR + i);
+    }
+  tlb_gather_flush (&tlb);
+  if (!copy_pgdir)
+    {
+      /* The user stack may have been moved down by an exec */
+      for (i = TASK_STACK_LIMIT; i < TASK_STACK_BOTTOM; i += PAGE_SIZE)
+	{
+	  paddr = get_paddr (curr_page_dir, (void *) i);
+	  if (paddr != 0)
+	    map_page (dir, paddr, i, PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+	}
+    }
+  for (i = 0; i < TASK_STACK_SIZE; i += PAGE_SIZE)
+    {
+      if (newpages & (1 << (i / PAGE_SIZE)))
+	memcpy ((void *) (PAGE_COPY_VADDR + i),
+		(void *) (TASK_STACK_BOTTOM + i), PAGE_SIZE);
     }
-  vm_tlb_reset_386 ();
-  memcpy ((void *) PAGE_COPY_VADDR, (void *) TASK_STACK_BOTTOM,
-	  TASK_STACK_SIZE);
 
   /* Map the exit busy-wait page as user mode so process can exit */
   map_page (dir, get_paddr (curr_page_dir, sys_exit_halt), TASK_EXIT_PAGE,
 	    PAGE_FLAG_USER);
 
+  /* Map the shared clock data page read-only */
+  map_page (dir, get_paddr (curr_page_dir, &clock_vtime), TASK_TIME_PAGE,
+	    PAGE_FLAG_USER);
+
+  /* Map the system call entry stub matching the CPU */
+  map_page (dir, get_paddr (curr_page_dir, cpu_sysenter ? vsyscall_sysenter :
+			    vsyscall_int80), TASK_VSYSCALL_PAGE,
+	    PAGE_FLAG_USER);
+
   /* Allow user mode code to execute the functions in this page */
   map_page (dir, get_paddr (curr_page_dir, signal_trampoline),
 	    (uint32_t) signal_trampoline, PAGE_FLAG_USER);
@@ -282,32 +566,23 @@ _task_fork (int copy_pgdir)
   task->t_eip = 0;
   task->t_pgdir = dir;
   task->t_fini = NULL;
-  task->t_pgcopied = copy_pgdir;
+  task->t_pgcopied = 1;
   task->t_priority = 0;
   task->t_next = NULL;
+  task->t_vfork = copy_pgdir ? 0 : task_getpid ();
 
   proc = &process_table[pid];
   parent = &process_table[task_getpid ()];
+  proc->p_runtime = 0;
 
-  /* Copy memory region array */
-  mregions = sorted_array_new (PROCESS_MMAP_LIMIT, process_mregion_cmp);
-  if (parent->p_mregions != NULL)
+  /* Copy memory region tree. A vfork child uses the regions of its parent
+     until it calls exec or exits. */
+  if (copy_pgdir
+      && unlikely (process_region_clone (&mregions,
+					 &parent->p_mregions) != 0))
     {
-      for (i = 0; i < parent->p_mregions->sa_size; i++)
-	{
-	  ProcessMemoryRegion *region = kmalloc (sizeof (ProcessMemoryRegion));
-	  ProcessMemoryRegion *pmem;
-	  if (unlikely (region == NULL))
-	    goto err;
-	  pmem = parent->p_mregions->sa_elems[i];
-	  region->pm_base = pmem->pm_base;
-	  region->pm_len = pmem->pm_len;
-	  region->pm_prot = pmem->pm_prot;
-	  region->pm_flags = pmem->pm_flags;
-	  region->pm_ino = pmem->pm_ino;
-	  vfs_ref_inode (region->pm_ino);
-	  sorted_array_insert (mregions, region);
-	}
+      kfree (task);
+      goto err;
     }
 
   cwdpath = strdup (parent->p_cwdpath);
@@ -318,21 +593,14 @@ _task_fork (int copy_pgdir)
     }
 
   /* Copy file descriptors */
-  for (i = 0; i < PROCESS_FILE_LIMIT; i++)
+  if (unlikely (process_copy_fds (proc, parent) != 0))
     {
-      proc->p_files[i] = parent->p_files[i];
-      if (proc->p_files[i] != NULL)
-	proc->p_files[i]->pf_refcnt++;
+      kfree (cwdpath);
+      kfree (task);
+      goto err;
     }
 
-  /* Add one to child count of each parent process */
-  tpid = parent->p_task->t_pid;
-  while (tpid != 0)
-    {
-      process_table[tpid].p_children++;
-      tpid = process_table[tpid].p_task->t_ppid;
-    }
-  process_table[0].p_children++;
+  process_add_child (task->t_ppid, pid);
 
   /* Inherit parent working directory, real/effective/saved UID/GID,
      process group ID, session ID, resource limits, and blocked signal mask */
@@ -348,6 +616,14 @@ _task_fork (int copy_pgdir)
   proc->p_pgid = parent->p_pgid;
   proc->p_sid = parent->p_sid;
   proc->p_maxbreak = parent->p_maxbreak;
+
+  /* A vfork child uses the heap of its parent until it calls exec */
+  if (copy_pgdir)
+    {
+      proc->p_initbreak = parent->p_initbreak;
+      proc->p_break = parent->p_break;
+    }
+  proc->p_vmsize = copy_pgdir ? parent->p_vmsize : 0;
   proc->p_maxfds = parent->p_maxfds;
   memcpy (&proc->p_addrspace, &parent->p_addrspace, sizeof (struct rlimit));
   memcpy (&proc->p_coresize, &parent->p_coresize, sizeof (struct rlimit));
@@ -369,14 +645,19 @@ _task_fork (int copy_pgdir)
  err:
   for (i = 0; i < TASK_STACK_SIZE; i += PAGE_SIZE)
     {
-      uint32_t paddr =
-	get_paddr (curr_page_dir, (void *) (PAGE_COPY_VADDR + i));
-      if (paddr != 0)
-	free_page (paddr);
+      if (newpages & (1 << (i / PAGE_SIZE)))
+	free_page (get_paddr (dir, (void *) (TASK_STACK_BOTTOM + i)));
     }
   if (copy_pgdir)
-    page_dir_free (dir);
-  sorted_array_destroy (mregions, process_region_free, dir);
+    {
+      parent = &process_table[task_getpid ()];
+      task_free_heap (dir, parent, ((parent->p_break - 1)
+				    | (PAGE_SIZE - 1)) + 1);
+    }
+  process_region_destroy (&mregions, dir);
+  if (!copy_pgdir)
+    page_dir_vfork_return (dir, task_current->t_pgdir);
+  page_dir_free (dir);
   return NULL;
 }
 
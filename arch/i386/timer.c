@@ -16,22 +16,109 @@
  * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
  *************************************************************************/
 
+#include <i386/pic.h>
+#include <sys/clock.h>
 #include <sys/io.h>
 #include <sys/process.h>
 #include <sys/timer.h>
 #include <sys/types.h>
 
+#define TIMER_ONESHOT_MAX 0xffff
+
 extern time_t rtc_time;
 
 static unsigned long tick;
 static uint32_t timer_freq[TIMER_CHANNEL_COUNT];
+static uint32_t timer_oneshot;  /* PIT counts programmed while idle */
+static uint32_t timer_rem;      /* Idle PIT counts not yet making a tick */
+
+static void
+timer_advance (unsigned long ticks)
+{
+  unsigned long i;
+  for (i = 0; i < ticks; i++)
+    {
+      if (++tick % timer_freq[0] == 0)
+	rtc_time++;
+      clock_tick ();
+    }
+}
+
+/* Switches channel 0 back to periodic mode and accounts the time that
+   passed since timer_idle programmed the one-shot countdown. EXPIRED is
+   nonzero if the countdown reached zero. */
+
+static void
+timer_idle_end (int expired)
+{
+  uint32_t div = TIMER_FREQ / timer_freq[0];
+  uint32_t elapsed = timer_oneshot;
+  unsigned long ticks;
+  if (!expired)
+    {
+      uint32_t count;
+      outb (0x00, TIMER_PORT_COMMAND); /* Latch channel 0 count */
+      count = inb (TIMER_PORT_CHANNEL0);
+      count |= inb (TIMER_PORT_CHANNEL0) << 8;
+      if (count <= timer_oneshot)
+	elapsed = timer_oneshot - count;
+    }
+  timer_oneshot = 0;
+  timer_set_freq (TIMER_PORT_CHANNEL0, timer_freq[0]);
+
+  elapsed += timer_rem;
+  ticks = elapsed / div;
+  timer_rem = elapsed % div;
+  timer_advance (ticks);
+  task_timer_tick (ticks * 1000000 / timer_freq[0]);
+}
 
 void
 timer_tick (void)
 {
-  if (++tick % timer_freq[0] == 0)
-    rtc_time++;
-  task_timer_tick ();
+  if (timer_oneshot != 0)
+    {
+      timer_idle_end (1);
+      return;
+    }
+  timer_advance (1);
+  task_timer_tick (1000000 / timer_freq[0]);
+}
+
+void
+timer_idle (void)
+{
+  uint32_t div = TIMER_FREQ / timer_freq[0];
+  uint32_t flags = irq_save ();
+  unsigned long usec = task_timer_next ();
+  uint64_t count = (uint64_t) usec * TIMER_FREQ / 1000000;
+  if (count > TIMER_ONESHOT_MAX)
+    count = TIMER_ONESHOT_MAX;
+
+  /* Only stop the periodic tick if it saves at least two ticks */
+  if (count >= div * 2)
+    {
+      timer_oneshot = count;
+      outb (0x30, TIMER_PORT_COMMAND); /* Channel 0, mode 0 */
+      outb (count & 0xff, TIMER_PORT_CHANNEL0);
+      outb ((count >> 8) & 0xff, TIMER_PORT_CHANNEL0);
+    }
+
+  /* STI takes effect after the next instruction, so no wakeup can be lost
+     between enabling interrupts and halting */
+  __asm__ volatile ("sti; hlt");
+  __asm__ volatile ("cli");
+  timer_idle_exit ();
+  irq_restore (flags);
+}
+
+void
+timer_idle_exit (void)
+{
+  uint32_t flags = irq_save ();
+  if (timer_oneshot != 0)
+    timer_idle_end (0);
+  irq_restore (flags);
 }
 
 void
@@ -53,14 +140,14 @@ timer_get_freq (unsigned char channel)
 uint32_t
 timer_get_rem_ms (void)
 {
-  return tick % 1000;
+  return tick % timer_freq[0] * 1000 / timer_freq[0];
 }
 
 void
 msleep (uint32_t ms)
 {
-  long start = tick;
-  while (tick < start + ms)
+  unsigned long end = tick + (uint64_t) ms * timer_freq[0] / 1000;
+  while (tick < end)
     ;
 }
 
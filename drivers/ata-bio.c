@@ -212,3 +212,74 @@ ata_device_write (SpecDevice *dev, const void *buffer, size_t len, off_t offset)
     }
   return 0;
 }
+
+/* Vectored transfers are issued as one command when they start on a sector
+   boundary, cover whole sectors and every buffer is suitable for DMA.
+   Anything else is split into separate transfers of each buffer. */
+
+static int
+ata_device_rwv (SpecDevice *dev, unsigned char op, const struct iovec *vec,
+		int vlen, off_t offset)
+{
+  unsigned char drive = dev->sd_major - 1;
+  off_t part_offset;
+  size_t len = 0;
+  int aligned = offset % ATA_SECTSIZE == 0;
+  int err;
+  int i;
+
+  for (i = 0; i < vlen; i++)
+    {
+      if (((uintptr_t) vec[i].iov_base | vec[i].iov_len) & 1)
+	aligned = 0;
+      len += vec[i].iov_len;
+    }
+  if (len % ATA_SECTSIZE != 0 || len / ATA_SECTSIZE > 255)
+    aligned = 0;
+  if (drive > 3 || ata_devices[drive].id_type != IDE_ATA)
+    aligned = 0;
+
+  if (!aligned)
+    {
+      for (i = 0; i < vlen; i++)
+	{
+	  if (op == ATA_WRITE)
+	    err = ata_device_write (dev, vec[i].iov_base, vec[i].iov_len,
+				    offset);
+	  else
+	    err = ata_device_read (dev, vec[i].iov_base, vec[i].iov_len,
+				   offset);
+	  if (err != 0)
+	    return err;
+	  offset += vec[i].iov_len;
+	}
+      return 0;
+    }
+
+  if (len == 0)
+    return 0;
+  if (dev->sd_minor != 0)
+    part_offset = (uint32_t) dev->sd_private;
+  else
+    part_offset = 0;
+  offset = offset / ATA_SECTSIZE + part_offset;
+  if (!ata_devices[drive].id_reserved
+      || offset + len / ATA_SECTSIZE > ata_devices[drive].id_size)
+    return -EINVAL;
+  err = ata_access_vec (op, drive, offset, len / ATA_SECTSIZE, vec, vlen);
+  return ata_perror (drive, err);
+}
+
+int
+ata_device_readv (SpecDevice *dev, const struct iovec *vec, int vlen,
+		  off_t offset)
+{
+  return ata_device_rwv (dev, ATA_READ, vec, vlen, offset);
+}
+
+int
+ata_device_writev (SpecDevice *dev, const struct iovec *vec, int vlen,
+		   off_t offset)
+{
+  return ata_device_rwv (dev, ATA_WRITE, vec, vlen, offset);
+}
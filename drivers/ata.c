@@ -21,9 +21,11 @@
 #include <sys/io.h>
 #include <sys/pci.h>
 #include <sys/timer.h>
+#include <sys/trace.h>
 #include <vm/paging.h>
 
 static unsigned char ata_buffer[2048];
+static char ata_pio_buffer[ATA_SECTSIZE];
 
 static const char *ide_channel_names[] = {
   "primary",
@@ -338,9 +340,107 @@ ata_perror (unsigned char drive, int err)
   return err;
 }
 
+#ifdef ATA_DMA
+
+/* Appends PRDT entries for LEN bytes at PTR. Regions are split at sector
+   boundaries so no entry spans two pages, and physically contiguous pieces
+   are merged as long as they don't cross a 64K boundary. PREV holds the
+   physical end of the last entry. Returns nonzero if the table is full. */
+
+static int
+ata_prdt_add (ATAPRDT *base, ATAPRDT **prdt, uint32_t *prev, char *ptr,
+	      size_t len)
+{
+  char *end = ptr + len;
+  while (ptr < end)
+    {
+      char *next = (char *) (((uintptr_t) ptr & ~(ATA_SECTSIZE - 1))
+			     + ATA_SECTSIZE);
+      uint32_t addr = get_paddr (curr_page_dir, ptr);
+      size_t chunk;
+      if (next > end)
+	next = end;
+      chunk = next - ptr;
+      if (*prev == addr && (addr & 0xffff) != 0)
+	(*prdt)[-1].pr_len += chunk;
+      else
+	{
+	  if (*prdt - base >= ATA_PRDT_MAX)
+	    return -1;
+	  (*prdt)->pr_addr = addr;
+	  (*prdt)->pr_len = chunk;
+	  (*prdt)->pr_end = 0;
+	  (*prdt)++;
+	}
+      *prev = addr + chunk;
+      ptr = next;
+    }
+  return 0;
+}
+
+#endif
+
+/* Returns a pointer to the next sector in VEC if it is contiguous in one
+   buffer, or NULL if it is split and has to go through ata_vec_copy */
+
+static char *
+ata_vec_direct (const struct iovec *vec, int *seg, size_t *off)
+{
+  char *ptr;
+  while (*off == vec[*seg].iov_len)
+    {
+      (*seg)++;
+      *off = 0;
+    }
+  if (vec[*seg].iov_len - *off < ATA_SECTSIZE)
+    return NULL;
+  ptr = (char *) vec[*seg].iov_base + *off;
+  *off += ATA_SECTSIZE;
+  return ptr;
+}
+
+static void
+ata_vec_copy (const struct iovec *vec, int *seg, size_t *off, char *sector,
+	      int gather)
+{
+  size_t done = 0;
+  while (done < ATA_SECTSIZE)
+    {
+      char *ptr = (char *) vec[*seg].iov_base + *off;
+      size_t amt = MIN (vec[*seg].iov_len - *off, ATA_SECTSIZE - done);
+      if (gather)
+	memcpy (sector + done, ptr, amt);
+      else
+	memcpy (ptr, sector + done, amt);
+      done += amt;
+      *off += amt;
+      if (*off == vec[*seg].iov_len)
+	{
+	  (*seg)++;
+	  *off = 0;
+	}
+    }
+}
+
 int
 ata_access (unsigned char op, unsigned char drive, uint32_t lba,
 	    unsigned char nsects, void *buffer)
+{
+  struct iovec vec;
+  vec.iov_base = buffer;
+  vec.iov_len = nsects * ATA_SECTSIZE;
+  return ata_access_vec (op, drive, lba, nsects, &vec, 1);
+}
+
+/* Transfers NSECTS sectors starting at LBA to or from the buffers in VEC
+   with a single command. The buffers may have any even size as long as
+   they add up to at least NSECTS sectors. DMA uses their physical
+   addresses without faulting them in, so user buffers must be pinned with
+   swap_pin_iov. */
+
+int
+ata_access_vec (unsigned char op, unsigned char drive, uint32_t lba,
+		unsigned char nsects, const struct iovec *vec, int vlen)
 {
   unsigned char lba_mode;
   unsigned char lba_io[6];
@@ -351,6 +451,8 @@ ata_access (unsigned char op, unsigned char drive, uint32_t lba,
   uint16_t cyl;
   unsigned char head;
   unsigned char sect;
+  int seg = 0;
+  size_t off = 0;
   int err;
   char cmd;
   uint16_t i;
@@ -360,42 +462,23 @@ ata_access (unsigned char op, unsigned char drive, uint32_t lba,
  retry:
   if (dma)
     {
-      /* Setup PRDT */
+      /* Setup PRDT with the entries of all buffers chained together */
       ATAPRDT *prdt = ata_devices[drive].id_prdt;
-      char *ptr = buffer;
-      char *end = buffer + nsects * ATA_SECTSIZE;
       uint32_t paddr = get_paddr (curr_page_dir, prdt);
       uint32_t prev = 0;
-      if ((uintptr_t) buffer & 0x1ff)
-	{
-	  prdt->pr_addr = get_paddr (curr_page_dir, buffer);
-	  prdt->pr_len = ATA_SECTSIZE - ((uintptr_t) buffer & 0x1ff);
-	  prdt->pr_end = 0;
-	  prev = prdt->pr_addr + prdt->pr_len;
-	  prdt++;
-	  ptr = (char *) ((uintptr_t) buffer & 0xfffffe00) + ATA_SECTSIZE;
-	}
-      for (; ptr < end; ptr += ATA_SECTSIZE)
+      size_t left = nsects * ATA_SECTSIZE;
+      int v;
+      for (v = 0; v < vlen && left > 0; v++)
 	{
-	  size_t len = ptr + ATA_SECTSIZE > end ?
-	    (uint16_t) ((uintptr_t) buffer & 0x1ff) : ATA_SECTSIZE;
-	  uint32_t addr = get_paddr (curr_page_dir, ptr);
-	  if (prev == addr)
-	    prdt[-1].pr_len += len;
-	  else
+	  size_t len = MIN (vec[v].iov_len, left);
+	  if (ata_prdt_add (ata_devices[drive].id_prdt, &prdt, &prev,
+			    vec[v].iov_base, len) != 0)
 	    {
-	      if (prdt - ata_devices[drive].id_prdt >= ATA_PRDT_MAX)
-		{
-		  /* Too many entries in PRDT, we have to use PIO */
-		  dma = 0;
-		  goto retry;
-		}
-	      prdt->pr_addr = addr;
-	      prdt->pr_len = len;
-	      prdt->pr_end = 0;
-	      prdt++;
+	      /* Too many entries in PRDT, we have to use PIO */
+	      dma = 0;
+	      goto retry;
 	    }
-	  prev = prdt[-1].pr_addr + prdt[-1].pr_len;
+	  left -= len;
 	}
       prdt[-1].pr_end = ATA_PRDT_END;
       ata_write (channel, ATA_REG_BM_PRDT0, paddr & 0xff);
@@ -522,6 +605,7 @@ ata_access (unsigned char op, unsigned char drive, uint32_t lba,
 	}
     }
   ata_write (channel, ATA_REG_COMMAND, cmd);
+  TRACE (TRACE_ATA_SUBMIT, lba, op << 16 | drive << 8 | nsects);
 
   /* Run the command */
 #ifdef ATA_DMA
@@ -543,9 +627,14 @@ ata_access (unsigned char op, unsigned char drive, uint32_t lba,
 	{
 	  for (i = 0; i < nsects; i++)
 	    {
+	      char *ptr = ata_vec_direct (vec, &seg, &off);
+	      if (ptr == NULL)
+		{
+		  ata_vec_copy (vec, &seg, &off, ata_pio_buffer, 1);
+		  ptr = ata_pio_buffer;
+		}
 	      ata_poll (channel, 0);
-	      outsw (bus, buffer, words);
-	      buffer += words * 2;
+	      outsw (bus, ptr, words);
 	    }
 
 	  ata_write (channel, ATA_REG_COMMAND, ata_flush_cmds[lba_mode]);
@@ -555,14 +644,20 @@ ata_access (unsigned char op, unsigned char drive, uint32_t lba,
 	{
 	  for (i = 0; i < nsects; i++)
 	    {
+	      char *ptr = ata_vec_direct (vec, &seg, &off);
 	      err = ata_poll (channel, 1);
 	      if (err != 0)
-		return err;
-	      insw (bus, buffer, words);
-	      buffer += words * 2;
+		{
+		  TRACE (TRACE_ATA_COMPLETE, lba, err);
+		  return err;
+		}
+	      insw (bus, ptr == NULL ? ata_pio_buffer : ptr, words);
+	      if (ptr == NULL)
+		ata_vec_copy (vec, &seg, &off, ata_pio_buffer, 0);
 	    }
 	}
     }
+  TRACE (TRACE_ATA_COMPLETE, lba, 0);
   return 0;
 }
 
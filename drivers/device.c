@@ -18,9 +18,12 @@
 
 #include <libk/libk.h>
 #include <sys/ata.h>
+#include <sys/kmsg.h>
 #include <sys/sysmacros.h>
+#include <sys/trace.h>
 #include <video/vga.h>
 #include <vm/heap.h>
+#include <vm/swap.h>
 
 #define STDIN_BUFSIZ 1024
 
@@ -90,6 +93,10 @@ device_disk_init (int drive, SpecDevice *dev)
       part = device_register (drive + 1, i + 1, DEVICE_TYPE_BLOCK, name,
 			      ata_device_read, ata_device_write);
       part->sd_private = (void *) mbr[i].mpi_lba;
+      part->sd_readv = ata_device_readv;
+      part->sd_writev = ata_device_writev;
+      if (mbr[i].mpi_type == SWAP_PART_TYPE)
+	swap_probe (part, mbr[i].mpi_sects / (PAGE_SIZE / ATA_SECTSIZE));
     }
 }
 
@@ -113,6 +120,8 @@ devices_init (void)
       name[2] = 'a' + j++;
       dev = device_register (i + 2, 0, DEVICE_TYPE_BLOCK, name, ata_device_read,
 			     ata_device_write);
+      dev->sd_readv = ata_device_readv;
+      dev->sd_writev = ata_device_writev;
 
       /* Create more block devices for each partition */
       device_disk_init (i, dev);
@@ -125,6 +134,12 @@ devices_init (void)
 		   device_discard_write);
   device_register (1, 5, DEVICE_TYPE_CHAR, "full", device_zero_read,
 		   device_full_write);
+  device_register (KMSG_MAJOR, KMSG_MINOR, DEVICE_TYPE_CHAR, "kmsg",
+		   kmsg_device_read, device_discard_write);
+  device_register (TRACE_MAJOR, TRACE_EVENTS_MINOR, DEVICE_TYPE_CHAR, "trace",
+		   trace_events_read, trace_events_write);
+  device_register (TRACE_MAJOR, TRACE_SYSLAT_MINOR, DEVICE_TYPE_CHAR, "syslat",
+		   trace_syslat_read, trace_syslat_write);
 }
 
 SpecDevice *
@@ -146,6 +161,8 @@ device_register (dev_t major, dev_t minor, unsigned char type, const char *name,
       dev->sd_name[15] = '\0';
       dev->sd_read = read;
       dev->sd_write = write;
+      dev->sd_readv = NULL;
+      dev->sd_writev = NULL;
       return dev;
     }
   return NULL;
@@ -163,3 +180,42 @@ device_lookup (dev_t major, dev_t minor)
     }
   return NULL;
 }
+
+/* Vectored transfers go to the driver in one request if it supports them,
+   otherwise each buffer is transferred separately */
+
+int
+device_readv (SpecDevice *dev, const struct iovec *vec, int vlen,
+	      off_t offset)
+{
+  int ret;
+  int i;
+  if (dev->sd_readv != NULL)
+    return dev->sd_readv (dev, vec, vlen, offset);
+  for (i = 0; i < vlen; i++)
+    {
+      ret = dev->sd_read (dev, vec[i].iov_base, vec[i].iov_len, offset);
+      if (ret < 0)
+	return ret;
+      offset += vec[i].iov_len;
+    }
+  return 0;
+}
+
+int
+device_writev (SpecDevice *dev, const struct iovec *vec, int vlen,
+	       off_t offset)
+{
+  int ret;
+  int i;
+  if (dev->sd_writev != NULL)
+    return dev->sd_writev (dev, vec, vlen, offset);
+  for (i = 0; i < vlen; i++)
+    {
+      ret = dev->sd_write (dev, vec[i].iov_base, vec[i].iov_len, offset);
+      if (ret < 0)
+	return ret;
+      offset += vec[i].iov_len;
+    }
+  return 0;
+}
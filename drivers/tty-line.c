@@ -61,7 +61,8 @@ int active_tty;
 static const VFSInodeOps tty_iops = {
   .vfs_read = tty_read,
   .vfs_write = tty_write,
-  .vfs_getattr = tty_getattr
+  .vfs_getattr = tty_getattr,
+  .vfs_poll = tty_poll
 };
 
 static VFSInode *
@@ -110,6 +111,8 @@ tty_input_buffer_add_char (TTY *tty, char c)
       return;
     }
   buffer->tb_data[buffer->tb_end++] = c;
+  if (!(tty->t_termios.c_lflag & ICANON))
+    wait_queue_wake (&tty->t_waitq, POLLIN | POLLRDNORM);
 }
 
 void
@@ -118,6 +121,7 @@ tty_flush_input_line (TTY *tty, char delim)
   if (delim != '\0')
     tty_input_buffer_add_char (tty, delim);
   tty->t_flags |= TTY_INPUT_READY;
+  wait_queue_wake (&tty->t_waitq, POLLIN | POLLRDNORM);
 }
 
 size_t
@@ -431,3 +435,21 @@ tty_getattr (VFSInode *inode, struct stat64 *st)
   st->st_blksize = 512;
   return 0;
 }
+
+unsigned int
+tty_poll (VFSInode *inode, PollTable *pt)
+{
+  TTYInputBuffer *inbuf = &CURRENT_TTY->t_inbuf;
+  unsigned int mask = POLLOUT | POLLWRNORM;
+  poll_wait (pt, &CURRENT_TTY->t_waitq);
+
+  /* Canonical mode input is only available once a line is complete */
+  if (CURRENT_TTY->t_termios.c_lflag & ICANON)
+    {
+      if (CURRENT_TTY->t_flags & TTY_INPUT_READY)
+	mask |= POLLIN | POLLRDNORM;
+    }
+  else if (inbuf->tb_end > inbuf->tb_start)
+    mask |= POLLIN | POLLRDNORM;
+  return mask;
+}
@@ -61,6 +61,23 @@ const struct
   {NULL, 0}
 };
 
+/* Devfs directory offsets are entry indexes, so the cursor needs no
+   validation */
+
+static int
+devfs_fill_dir (VFSDirCursor *cursor, off64_t n, const char *name,
+		ino64_t ino, unsigned char type, VFSDirEntryFillFunc func,
+		void *private)
+{
+  int ret;
+  if (n < cursor->dc_pos)
+    return 0;
+  ret = func (name, strlen (name), ino, type, n + 1, private);
+  if (ret == 0)
+    cursor->dc_pos = n + 1;
+  return ret;
+}
+
 int
 devfs_mount (VFSMount *mp, int flags, void *data)
 {
@@ -214,7 +231,8 @@ devfs_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
 }
 
 int
-devfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
+devfs_readdir (VFSInode *inode, VFSDirCursor *cursor, VFSDirEntryFillFunc func,
+	       void *private)
 {
   Process *proc = &process_table[task_getpid ()];
   off64_t n = 0;
@@ -228,38 +246,39 @@ devfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
 	  SpecDevice *dev = &device_table[i];
 	  if (*dev->sd_name != '\0')
 	    {
-	      ret = func (dev->sd_name, strlen (dev->sd_name),
-			  DEVFS_DEVICE_INODE (dev->sd_major, dev->sd_minor),
-			  dev->sd_type == DEVICE_TYPE_BLOCK ? DT_BLK : DT_CHR,
-			  n++, private);
+	      ret = devfs_fill_dir (cursor, n++, dev->sd_name,
+				    DEVFS_DEVICE_INODE (dev->sd_major,
+							dev->sd_minor),
+				    dev->sd_type == DEVICE_TYPE_BLOCK ?
+				    DT_BLK : DT_CHR, func, private);
 	      if (ret > 0)
 		return 0;
 	      if (ret < 0)
 		return ret;
-	    }						
+	    }
 	}
       for (i = 0; devfs_links[i].name != NULL; i++)
 	{
-	  ret = func (devfs_links[i].name, strlen (devfs_links[i].name),
-		      DEVFS_LINK_INODE (i), DT_LNK, n++, private);
+	  ret = devfs_fill_dir (cursor, n++, devfs_links[i].name,
+				DEVFS_LINK_INODE (i), DT_LNK, func, private);
 	  if (ret > 0)
 	    return 0;
 	  if (ret < 0)
 	    return ret;
 	}
-      ret = func ("fd", 2, 1, DT_DIR, n, private);
+      ret = devfs_fill_dir (cursor, n, "fd", 1, DT_DIR, func, private);
       if (ret > 0)
 	ret = 0;
       break;
     case DEVFS_FDS_INODE:
-      for (i = 0; i < PROCESS_FILE_LIMIT; i++)
+      for (i = 0; i < proc->p_fdsize; i++)
 	{
 	  if (proc->p_files[i] != NULL)
 	    {
-	      char buffer[4];
+	      char buffer[12];
 	      itoa (i, buffer, 10);
-	      ret = func (buffer, strlen (buffer), DEVFS_FD_INODE (i), DT_BLK,
-			  i, private);
+	      ret = devfs_fill_dir (cursor, i, buffer, DEVFS_FD_INODE (i),
+				    DT_BLK, func, private);
 	      if (ret > 0)
 		return 0;
 	      if (ret < 0)
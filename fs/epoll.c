@@ -0,0 +1,511 @@
+/*************************************************************************
+ * epoll.c -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <fs/epoll.h>
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/clock.h>
+#include <sys/fcntl.h>
+#include <vm/heap.h>
+
+static VFSInode *epoll_alloc_inode (VFSSuperblock *sb);
+
+const VFSSuperblockOps epoll_sops = {
+  .sb_alloc_inode = epoll_alloc_inode,
+  .sb_destroy_inode = epoll_destroy_inode
+};
+
+const VFSInodeOps epoll_iops = {
+  .vfs_poll = epoll_poll
+};
+
+VFSSuperblock epoll_sb = {
+  .sb_ops = &epoll_sops
+};
+
+static VFSInode *
+epoll_alloc_inode (VFSSuperblock *sb)
+{
+  VFSInode *inode = kzalloc (sizeof (VFSInode));
+  time_t t;
+  if (unlikely (inode == NULL))
+    return NULL;
+  inode->vi_ops = &epoll_iops;
+  inode->vi_sb = sb;
+  t = time (NULL);
+  inode->vi_mode = S_IRUSR | S_IWUSR;
+  inode->vi_atime.tv_sec = t;
+  inode->vi_mtime.tv_sec = t;
+  inode->vi_ctime.tv_sec = t;
+  return inode;
+}
+
+/* The ready list is also modified by wakeups from interrupt handlers, so
+   these must be called with interrupts disabled. epoll_ready_add () returns
+   nonzero if the item was not already ready. */
+
+static int
+epoll_ready_add (Epoll *ep, EpollItem *item)
+{
+  if (item->ei_ready)
+    return 0;
+  item->ei_ready = 1;
+  item->ei_rnext = NULL;
+  item->ei_rprev = ep->ep_rtail;
+  if (ep->ep_rtail != NULL)
+    ep->ep_rtail->ei_rnext = item;
+  else
+    ep->ep_rhead = item;
+  ep->ep_rtail = item;
+  return 1;
+}
+
+static void
+epoll_ready_remove (Epoll *ep, EpollItem *item)
+{
+  if (!item->ei_ready)
+    return;
+  item->ei_ready = 0;
+  if (item->ei_rprev != NULL)
+    item->ei_rprev->ei_rnext = item->ei_rnext;
+  else
+    ep->ep_rhead = item->ei_rnext;
+  if (item->ei_rnext != NULL)
+    item->ei_rnext->ei_rprev = item->ei_rprev;
+  else
+    ep->ep_rtail = item->ei_rprev;
+}
+
+static void
+epoll_item_wake (WaitQueueEntry *entry, unsigned int events)
+{
+  EpollItem *item = entry->we_private;
+  Epoll *ep = item->ei_epoll;
+
+  /* Ignore wakeups for events the item is not interested in, and items
+     disabled by EPOLLONESHOT */
+  if (events != 0 && !(events & item->ei_event.events))
+    return;
+  if (!(item->ei_event.events & ~EPOLL_PRIVATE_BITS))
+    return;
+
+  /* Waiters were already woken when the item became ready */
+  if (!epoll_ready_add (ep, item))
+    return;
+  wait_queue_wake (&ep->ep_waitq, POLLIN);
+}
+
+static void
+epoll_wait_wake (WaitQueueEntry *entry, unsigned int events)
+{
+  PollTable *pt = entry->we_private;
+  pt->pt_woken = 1;
+}
+
+static void
+epoll_queue (PollTable *pt, WaitQueue *wq)
+{
+  EpollItem *item = pt->pt_private;
+
+  /* All of our inodes signal readiness through a single queue */
+  if (item->ei_wait.we_queue != NULL)
+    return;
+  item->ei_wait.we_func = epoll_item_wake;
+  item->ei_wait.we_private = item;
+  wait_queue_add (wq, &item->ei_wait);
+}
+
+static unsigned int
+epoll_item_poll (EpollItem *item, PollTable *pt)
+{
+  return vfs_poll (item->ei_file->pf_inode, pt) & item->ei_event.events;
+}
+
+static EpollItem *
+epoll_find (Epoll *ep, ProcessFile *file, int fd)
+{
+  EpollItem *item;
+  for (item = ep->ep_items; item != NULL; item = item->ei_next)
+    {
+      if (item->ei_file == file && item->ei_fd == fd)
+	return item;
+    }
+  return NULL;
+}
+
+static void
+epoll_item_free (EpollItem *item)
+{
+  Epoll *ep = item->ei_epoll;
+  EpollItem **link;
+  uint32_t flags;
+  wait_queue_remove (&item->ei_wait);
+  flags = irq_save ();
+  epoll_ready_remove (ep, item);
+  irq_restore (flags);
+
+  if (item->ei_prev != NULL)
+    item->ei_prev->ei_next = item->ei_next;
+  else
+    ep->ep_items = item->ei_next;
+  if (item->ei_next != NULL)
+    item->ei_next->ei_prev = item->ei_prev;
+
+  for (link = (EpollItem **) &item->ei_file->pf_epoll; *link != NULL;
+       link = &(*link)->ei_fnext)
+    {
+      if (*link == item)
+	{
+	  *link = item->ei_fnext;
+	  break;
+	}
+    }
+  kfree (item);
+}
+
+static int
+epoll_add (Epoll *ep, ProcessFile *file, int fd, struct epoll_event *event)
+{
+  EpollItem *item = kzalloc (sizeof (EpollItem));
+  PollTable pt;
+  uint32_t flags;
+  if (unlikely (item == NULL))
+    return -ENOMEM;
+  item->ei_epoll = ep;
+  item->ei_file = file;
+  item->ei_fd = fd;
+  item->ei_event = *event;
+  item->ei_event.events |= EPOLLERR | EPOLLHUP;
+
+  item->ei_next = ep->ep_items;
+  if (ep->ep_items != NULL)
+    ep->ep_items->ei_prev = item;
+  ep->ep_items = item;
+  item->ei_fnext = file->pf_epoll;
+  file->pf_epoll = item;
+
+  /* Register with the file and queue the item if it is already ready */
+  pt.pt_func = epoll_queue;
+  pt.pt_private = item;
+  pt.pt_woken = 0;
+  if (epoll_item_poll (item, &pt) != 0)
+    {
+      int wake;
+      flags = irq_save ();
+      wake = epoll_ready_add (ep, item);
+      irq_restore (flags);
+      if (wake)
+	wait_queue_wake (&ep->ep_waitq, POLLIN);
+    }
+  return 0;
+}
+
+static int
+epoll_modify (EpollItem *item, struct epoll_event *event)
+{
+  Epoll *ep = item->ei_epoll;
+  uint32_t flags;
+  item->ei_event = *event;
+  item->ei_event.events |= EPOLLERR | EPOLLHUP;
+  if (epoll_item_poll (item, NULL) != 0)
+    {
+      int wake;
+      flags = irq_save ();
+      wake = epoll_ready_add (ep, item);
+      irq_restore (flags);
+      if (wake)
+	wait_queue_wake (&ep->ep_waitq, POLLIN);
+    }
+  return 0;
+}
+
+/* Moves up to MAXEVENTS ready items into EVENTS. Only items on the ready
+   list are polled, so the cost does not depend on the number of watched
+   files. Level-triggered items that are still ready go back on the list. */
+
+static int
+epoll_collect (Epoll *ep, struct epoll_event *events, int maxevents)
+{
+  EpollItem *item;
+  EpollItem *tail;
+  uint32_t flags;
+  int count = 0;
+
+  /* Detach the ready list so items readied while collecting are not
+     reported twice. Detached items stay marked ready until polled. */
+  flags = irq_save ();
+  item = ep->ep_rhead;
+  tail = ep->ep_rtail;
+  ep->ep_rhead = NULL;
+  ep->ep_rtail = NULL;
+  irq_restore (flags);
+
+  while (item != NULL && count < maxevents)
+    {
+      EpollItem *next = item->ei_rnext;
+      unsigned int mask;
+      flags = irq_save ();
+      item->ei_ready = 0;
+      irq_restore (flags);
+
+      mask = epoll_item_poll (item, NULL);
+      if (mask != 0)
+	{
+	  events[count].events = mask;
+	  events[count].data = item->ei_event.data;
+	  count++;
+	  if (item->ei_event.events & EPOLLONESHOT)
+	    item->ei_event.events &= EPOLL_PRIVATE_BITS;
+	  else if (!(item->ei_event.events & EPOLLET))
+	    {
+	      flags = irq_save ();
+	      epoll_ready_add (ep, item);
+	      irq_restore (flags);
+	    }
+	}
+      item = next;
+    }
+
+  /* Put back the items there was no room for ahead of newer ones */
+  if (item != NULL)
+    {
+      flags = irq_save ();
+      item->ei_rprev = NULL;
+      tail->ei_rnext = ep->ep_rhead;
+      if (ep->ep_rhead != NULL)
+	ep->ep_rhead->ei_rprev = tail;
+      else
+	ep->ep_rtail = tail;
+      ep->ep_rhead = item;
+      irq_restore (flags);
+    }
+  return count;
+}
+
+/* Returns the length of the longest chain of epoll sets watched by EP, or
+   -ELOOP if TARGET is among them or the chain is too long */
+
+static int
+epoll_depth_down (Epoll *ep, Epoll *target, int depth)
+{
+  EpollItem *item;
+  int max = depth;
+  if (ep == target || depth > EPOLL_MAX_NESTS)
+    return -ELOOP;
+  for (item = ep->ep_items; item != NULL; item = item->ei_next)
+    {
+      VFSInode *inode = item->ei_file->pf_inode;
+      if (inode->vi_sb == &epoll_sb)
+	{
+	  int ret = epoll_depth_down (inode->vi_private, target, depth + 1);
+	  if (ret < 0)
+	    return ret;
+	  max = MAX (max, ret);
+	}
+    }
+  return max;
+}
+
+/* Returns the length of the longest chain of epoll sets watching FILE */
+
+static int
+epoll_depth_up (ProcessFile *file, int depth)
+{
+  EpollItem *item;
+  int max = depth;
+  if (depth > EPOLL_MAX_NESTS)
+    return depth;
+  for (item = file->pf_epoll; item != NULL; item = item->ei_fnext)
+    max = MAX (max, epoll_depth_up (item->ei_epoll->ep_file, depth + 1));
+  return max;
+}
+
+/* Wakeups are delivered synchronously up through epoll sets watching each
+   other, so adding FILE to EP must not create a loop or a chain deeper
+   than EPOLL_MAX_NESTS */
+
+static int
+epoll_check_nesting (Epoll *ep, ProcessFile *file)
+{
+  int down;
+  if (file->pf_inode->vi_sb != &epoll_sb)
+    return 0;
+  down = epoll_depth_down (file->pf_inode->vi_private, ep, 1);
+  if (down < 0)
+    return down;
+  if (epoll_depth_up (ep->ep_file, down) > EPOLL_MAX_NESTS)
+    return -ELOOP;
+  return 0;
+}
+
+static Epoll *
+epoll_from_fd (Process *proc, int epfd)
+{
+  ProcessFile *file = process_get_file (proc, epfd);
+  if (file == NULL || file->pf_inode->vi_sb != &epoll_sb)
+    return NULL;
+  return file->pf_inode->vi_private;
+}
+
+void
+epoll_destroy_inode (VFSInode *inode)
+{
+  Epoll *ep = inode->vi_private;
+  if (ep != NULL)
+    {
+      while (ep->ep_items != NULL)
+	epoll_item_free (ep->ep_items);
+      kfree (ep);
+    }
+  kfree (inode);
+}
+
+unsigned int
+epoll_poll (VFSInode *inode, PollTable *pt)
+{
+  Epoll *ep = inode->vi_private;
+  poll_wait (pt, &ep->ep_waitq);
+  return ep->ep_rhead != NULL ? POLLIN | POLLRDNORM : 0;
+}
+
+/* Called when the last descriptor referring to FILE is closed */
+
+void
+epoll_release_file (ProcessFile *file)
+{
+  while (file->pf_epoll != NULL)
+    epoll_item_free (file->pf_epoll);
+}
+
+int
+epoll_create1 (int flags)
+{
+  Process *proc = &process_table[task_getpid ()];
+  VFSInode *inode;
+  Epoll *ep;
+  int fd;
+  if (flags & ~EPOLL_CLOEXEC)
+    return -EINVAL;
+
+  inode = vfs_alloc_inode (&epoll_sb);
+  if (unlikely (inode == NULL))
+    return -ENOMEM;
+  ep = kzalloc (sizeof (Epoll));
+  if (unlikely (ep == NULL))
+    {
+      vfs_unref_inode (inode);
+      return -ENOMEM;
+    }
+  inode->vi_private = ep;
+
+  fd = process_alloc_fd (proc, 0);
+  if (unlikely (fd < 0))
+    {
+      vfs_unref_inode (inode);
+      return fd;
+    }
+  ep->ep_file = proc->p_files[fd];
+  proc->p_files[fd]->pf_inode = inode;
+  proc->p_files[fd]->pf_path = NULL;
+  proc->p_files[fd]->pf_mode = O_RDONLY;
+  proc->p_files[fd]->pf_offset = 0;
+  if (flags & EPOLL_CLOEXEC)
+    proc->p_fdflags[fd] = FD_CLOEXEC;
+  return fd;
+}
+
+int
+epoll_ctl (int epfd, int op, int fd, struct epoll_event *event)
+{
+  Process *proc = &process_table[task_getpid ()];
+  ProcessFile *file = process_get_file (proc, fd);
+  EpollItem *item;
+  Epoll *ep;
+  int ret;
+  if (file == NULL || process_get_file (proc, epfd) == NULL)
+    return -EBADF;
+  ep = epoll_from_fd (proc, epfd);
+  if (ep == NULL || file == proc->p_files[epfd])
+    return -EINVAL;
+
+  item = epoll_find (ep, file, fd);
+  switch (op)
+    {
+    case EPOLL_CTL_ADD:
+      if (item != NULL)
+	return -EEXIST;
+      ret = epoll_check_nesting (ep, file);
+      if (ret != 0)
+	return ret;
+      return epoll_add (ep, file, fd, event);
+    case EPOLL_CTL_MOD:
+      if (item == NULL)
+	return -ENOENT;
+      return epoll_modify (item, event);
+    case EPOLL_CTL_DEL:
+      if (item == NULL)
+	return -ENOENT;
+      epoll_item_free (item);
+      return 0;
+    default:
+      return -EINVAL;
+    }
+}
+
+int
+epoll_wait (int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  Process *proc = &process_table[task_getpid ()];
+  WaitQueueEntry entry;
+  PollTable pt;
+  uint64_t deadline = 0;
+  Epoll *ep;
+  int ret;
+  if (process_get_file (proc, epfd) == NULL)
+    return -EBADF;
+  ep = epoll_from_fd (proc, epfd);
+  if (ep == NULL || maxevents <= 0)
+    return -EINVAL;
+  if (timeout > 0)
+    deadline = clock_monotonic () + timeout * 1000000ULL;
+
+  /* Each waiter has its own entry on the queue, so a wakeup is seen by
+     every waiter instead of only the first to run */
+  pt.pt_func = NULL;
+  pt.pt_private = NULL;
+  pt.pt_woken = 0;
+  entry.we_func = epoll_wait_wake;
+  entry.we_private = &pt;
+  wait_queue_add (&ep->ep_waitq, &entry);
+  while (1)
+    {
+      ret = epoll_collect (ep, events, maxevents);
+      if (ret > 0 || timeout == 0)
+	break;
+      ret = poll_sleep (&pt, deadline);
+      if (ret == -ETIMEDOUT)
+	{
+	  ret = 0;
+	  break;
+	}
+      if (ret != 0)
+	break;
+    }
+  wait_queue_remove (&entry);
+  return ret;
+}
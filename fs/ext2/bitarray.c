@@ -70,21 +70,23 @@ ext2_bitarray_free_bmap (Ext2Bitmap64 *bmap)
   Ext2BitArrayPrivate *priv = bmap->b_private;
   if (priv->p_bitarray != NULL)
     kfree (priv->p_bitarray);
-  kfree (bmap);
+  kfree (priv);
 }
 
-static void
+static int
 ext2_bitarray_mark_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
 {
   Ext2BitArrayPrivate *priv = bmap->b_private;
   fast_set_bit (priv->p_bitarray, arg - bmap->b_start);
+  return 0;
 }
 
-static void
+static int
 ext2_bitarray_unmark_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
 {
   Ext2BitArrayPrivate *priv = bmap->b_private;
   fast_clear_bit (priv->p_bitarray, arg - bmap->b_start);
+  return 0;
 }
 
 static int
@@ -94,7 +96,7 @@ ext2_bitarray_test_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
   return fast_test_bit (priv->p_bitarray, arg - bmap->b_start);
 }
 
-static void
+static int
 ext2_bitarray_mark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg,
 				unsigned int num)
 {
@@ -102,9 +104,10 @@ ext2_bitarray_mark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg,
   unsigned int i;
   for (i = 0; i < num; i++)
     fast_set_bit (priv->p_bitarray, arg + i - bmap->b_start);
+  return 0;
 }
 
-static void
+static int
 ext2_bitarray_unmark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg,
 				  unsigned int num)
 {
@@ -112,14 +115,16 @@ ext2_bitarray_unmark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg,
   unsigned int i;
   for (i = 0; i < num; i++)
     fast_clear_bit (priv->p_bitarray, arg + i - bmap->b_start);
+  return 0;
 }
 
-static void
+static int
 ext2_bitarray_set_bmap_range (Ext2Bitmap64 *bmap, uint64_t start, size_t num,
 			      void *data)
 {
   Ext2BitArrayPrivate *priv = bmap->b_private;
   memcpy (priv->p_bitarray + (start >> 3), data, (num + 7) >> 3);
+  return 0;
 }
 
 static void
@@ -39,6 +39,7 @@ ext2_reserve_super_bgd (VFSSuperblock *sb, unsigned int group, Ext2Bitmap *bmap)
   block_t used;
   int old_desc_blocks;
   int nblocks;
+  int ret;
   ext2_super_bgd_loc (sb, group, &super, &old_desc, &new_desc, &used);
 
   if (fs->f_super.s_feature_incompat & EXT2_FT_INCOMPAT_META_BG)
@@ -47,19 +48,33 @@ ext2_reserve_super_bgd (VFSSuperblock *sb, unsigned int group, Ext2Bitmap *bmap)
     old_desc_blocks = fs->f_desc_blocks + fs->f_super.s_reserved_gdt_blocks;
 
   if (super != 0 || group == 0)
-    ext2_mark_bitmap (bmap, super);
+    {
+      ret = ext2_mark_bitmap (bmap, super);
+      if (ret != 0)
+	return ret;
+    }
   if (group == 0 && sb->sb_blksize == 1024 && EXT2_CLUSTER_RATIO (fs) > 1)
-    ext2_mark_bitmap (bmap, 0);
+    {
+      ret = ext2_mark_bitmap (bmap, 0);
+      if (ret != 0)
+	return ret;
+    }
 
   if (old_desc != 0)
     {
       nblocks = old_desc_blocks;
       if (old_desc + nblocks >= ext2_blocks_count (&fs->f_super))
 	nblocks = ext2_blocks_count (&fs->f_super) - old_desc;
-      ext2_mark_block_bitmap_range (bmap, old_desc, nblocks);
+      ret = ext2_mark_block_bitmap_range (bmap, old_desc, nblocks);
+      if (ret != 0)
+	return ret;
     }
   if (new_desc != 0)
-    ext2_mark_bitmap (bmap, new_desc);
+    {
+      ret = ext2_mark_bitmap (bmap, new_desc);
+      if (ret != 0)
+	return ret;
+    }
 
   nblocks = ext2_group_blocks_count (fs, group);
   nblocks -= fs->f_inode_blocks_per_group + used + 2;
@@ -67,28 +82,35 @@ ext2_reserve_super_bgd (VFSSuperblock *sb, unsigned int group, Ext2Bitmap *bmap)
 }
 
 static int
-ext2_mark_uninit_bg_group_blocks (VFSSuperblock *sb)
+ext2_mark_uninit_bg_group_blocks (VFSSuperblock *sb, unsigned int group)
 {
   Ext2Filesystem *fs = sb->sb_private;
   Ext2Bitmap *bmap = fs->f_block_bitmap;
   block_t block;
-  unsigned int i;
-  for (i = 0; i < fs->f_group_desc_count; i++)
+  int ret;
+  if (!ext2_bg_test_flags (sb, group, EXT2_BG_BLOCK_UNINIT))
+    return 0;
+  ret = ext2_reserve_super_bgd (sb, group, bmap);
+  if (ret < 0)
+    return ret;
+  block = ext2_inode_table_loc (sb, group);
+  if (block != 0)
     {
-      if (!ext2_bg_test_flags (sb, i, EXT2_BG_BLOCK_UNINIT))
-	continue;
-      ext2_reserve_super_bgd (sb, i, bmap);
-      block = ext2_inode_table_loc (sb, i);
-      if (block != 0)
-	ext2_mark_block_bitmap_range (bmap, block,
-				      fs->f_inode_blocks_per_group);
-      block = ext2_block_bitmap_loc (sb, i);
-      if (block != 0)
-	ext2_mark_bitmap (bmap, block);
-      block = ext2_inode_bitmap_loc (sb, i);
-      if (block != 0)
-	ext2_mark_bitmap (bmap, block);
+      ret = ext2_mark_block_bitmap_range (bmap, block,
+					  fs->f_inode_blocks_per_group);
+      if (ret != 0)
+	return ret;
+    }
+  block = ext2_block_bitmap_loc (sb, group);
+  if (block != 0)
+    {
+      ret = ext2_mark_bitmap (bmap, block);
+      if (ret != 0)
+	return ret;
     }
+  block = ext2_inode_bitmap_loc (sb, group);
+  if (block != 0)
+    return ext2_mark_bitmap (bmap, block);
   return 0;
 }
 
@@ -126,8 +148,6 @@ ext2_make_bitmap_32 (VFSSuperblock *sb, int magic, uint32_t start, uint32_t end,
   return 0;
 }
 
-/* TODO Support making rbtree bitmaps */
-
 static int
 ext2_make_bitmap_64 (VFSSuperblock *sb, int magic, Ext2BitmapType type,
 		     uint64_t start, uint64_t end, uint64_t real_end,
@@ -140,6 +160,8 @@ ext2_make_bitmap_64 (VFSSuperblock *sb, int magic, Ext2BitmapType type,
 
   if (type == EXT2_BMAP64_BITARRAY)
     ops = &ext2_bitarray_ops;
+  else if (type == EXT2_BMAP64_RBTREE)
+    ops = &ext2_rbtree_ops;
   else
     return -EINVAL;
 
@@ -167,6 +189,20 @@ ext2_make_bitmap_64 (VFSSuperblock *sb, int magic, Ext2BitmapType type,
   return 0;
 }
 
+/* Large bitmaps are mostly long runs of set or clear bits, so storing them
+   as extents makes memory use depend on fragmentation instead of volume
+   size */
+
+static Ext2BitmapType
+ext2_bitmap_type (Ext2Filesystem *fs, uint64_t start, uint64_t real_end)
+{
+  if (fs->f_default_bitmap_type != EXT2_BMAP64_AUTODIR)
+    return fs->f_default_bitmap_type;
+  if ((real_end - start) / 8 + 1 > EXT2_BITARRAY_MAX_SIZE)
+    return EXT2_BMAP64_RBTREE;
+  return EXT2_BMAP64_BITARRAY;
+}
+
 static int
 ext2_allocate_block_bitmap (VFSSuperblock *sb, Ext2Bitmap **result)
 {
@@ -175,10 +211,10 @@ ext2_allocate_block_bitmap (VFSSuperblock *sb, Ext2Bitmap **result)
   uint64_t end = EXT2_B2C (fs, ext2_blocks_count (&fs->f_super) - 1);
   uint64_t real_end = (uint64_t) fs->f_super.s_clusters_per_group *
     (uint64_t) fs->f_group_desc_count - 1 + start;
-  if (fs->f_flags & EXT2_FLAG_64BIT)
-    return ext2_make_bitmap_64 (sb, EXT2_BMAP_MAGIC_BLOCK64,
-				EXT2_BMAP64_BITARRAY, start, end, real_end,
-				result);
+  Ext2BitmapType type = ext2_bitmap_type (fs, start, real_end);
+  if ((fs->f_flags & EXT2_FLAG_64BIT) || type != EXT2_BMAP64_BITARRAY)
+    return ext2_make_bitmap_64 (sb, EXT2_BMAP_MAGIC_BLOCK64, type, start, end,
+				real_end, result);
   if (end > 0xffffffff || real_end > 0xffffffff)
     return -EINVAL;
   return ext2_make_bitmap_32 (sb, EXT2_BMAP_MAGIC_BLOCK, start, end, real_end,
@@ -193,10 +229,10 @@ ext2_allocate_inode_bitmap (VFSSuperblock *sb, Ext2Bitmap **result)
   uint64_t end = fs->f_super.s_inodes_count;
   uint64_t real_end =
     (uint64_t) fs->f_super.s_inodes_per_group * fs->f_group_desc_count;
-  if (fs->f_flags & EXT2_FLAG_64BIT)
-    return ext2_make_bitmap_64 (sb, EXT2_BMAP_MAGIC_BLOCK64,
-				EXT2_BMAP64_BITARRAY, start, end, real_end,
-				result);
+  Ext2BitmapType type = ext2_bitmap_type (fs, start, real_end);
+  if ((fs->f_flags & EXT2_FLAG_64BIT) || type != EXT2_BMAP64_BITARRAY)
+    return ext2_make_bitmap_64 (sb, EXT2_BMAP_MAGIC_INODE64, type, start, end,
+				real_end, result);
   if (end > 0xffffffff || real_end > 0xffffffff)
     return -EINVAL;
   return ext2_make_bitmap_32 (sb, EXT2_BMAP_MAGIC_BLOCK, start, end, real_end,
@@ -382,18 +418,6 @@ ext2_read_bitmap_start (VFSSuperblock *sb, int flags, unsigned int start,
   return ret;
 }
 
-static int
-ext2_read_bitmap_end (VFSSuperblock *sb, int flags)
-{
-  if (flags & EXT2_BITMAP_BLOCK)
-    {
-      int ret = ext2_mark_uninit_bg_group_blocks (sb);
-      if (ret != 0)
-	return ret;
-    }
-  return 0;
-}
-
 static void
 ext2_clean_bitmap (VFSSuperblock *sb, int flags)
 {
@@ -410,33 +434,87 @@ ext2_clean_bitmap (VFSSuperblock *sb, int flags)
     }
 }
 
+/* Reads the bitmaps of groups START through END that are not loaded yet */
+
 int
 ext2_read_bitmap (VFSSuperblock *sb, int flags, unsigned int start,
 		  unsigned int end)
 {
-  int ret = ext2_prepare_read_bitmap (sb, flags);
-  if (ret != 0)
-    return ret;
-  ret = ext2_read_bitmap_start (sb, flags, start, end);
-  if (ret == 0)
-    ret = ext2_read_bitmap_end (sb, flags);
-  if (ret != 0)
-    ext2_clean_bitmap (sb, flags);
-  return ret;
+  unsigned int i;
+  for (i = start; i <= end; i++)
+    {
+      int ret = ext2_load_group_bitmaps (sb, flags, i);
+      if (ret != 0)
+	return ret;
+    }
+  return 0;
 }
 
+/* Allocates empty in-memory bitmaps. The bitmaps of each group are read
+   and their checksums verified by ext2_load_group_bitmaps the first time
+   an allocation or free touches the group. */
+
 int
 ext2_read_bitmaps (VFSSuperblock *sb)
 {
   Ext2Filesystem *fs = sb->sb_private;
   int flags = 0;
+  unsigned int i;
+  int ret;
   if (fs->f_inode_bitmap == NULL)
     flags |= EXT2_BITMAP_INODE;
   if (fs->f_block_bitmap == NULL)
     flags |= EXT2_BITMAP_BLOCK;
   if (flags == 0)
     return 0;
-  return ext2_read_bitmap (sb, flags, 0, fs->f_group_desc_count - 1);
+  if (fs->f_bitmap_loaded == NULL)
+    {
+      fs->f_bitmap_loaded = kzalloc (fs->f_group_desc_count);
+      if (unlikely (fs->f_bitmap_loaded == NULL))
+	return -ENOMEM;
+    }
+  ret = ext2_prepare_read_bitmap (sb, flags);
+  if (ret != 0)
+    return ret;
+  if (flags & EXT2_BITMAP_BLOCK)
+    flags |= EXT2_BITMAP_BLOCK_DIRTY;
+  if (flags & EXT2_BITMAP_INODE)
+    flags |= EXT2_BITMAP_INODE_DIRTY;
+  for (i = 0; i < fs->f_group_desc_count; i++)
+    fs->f_bitmap_loaded[i] &= ~flags;
+  return 0;
+}
+
+int
+ext2_load_group_bitmaps (VFSSuperblock *sb, int flags, unsigned int group)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  int ret = ext2_read_bitmaps (sb);
+  if (ret != 0)
+    return ret;
+  flags &= ~fs->f_bitmap_loaded[group];
+  if (flags == 0)
+    return 0;
+  ret = ext2_read_bitmap_start (sb, flags, group, group);
+  if (ret != 0)
+    return ret;
+  if (flags & EXT2_BITMAP_BLOCK)
+    {
+      ret = ext2_mark_uninit_bg_group_blocks (sb, group);
+      if (ret != 0)
+	return ret;
+    }
+  fs->f_bitmap_loaded[group] |= flags;
+  return 0;
+}
+
+void
+ext2_free_bitmaps (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  ext2_clean_bitmap (sb, EXT2_BITMAP_BLOCK | EXT2_BITMAP_INODE);
+  kfree (fs->f_bitmap_loaded);
+  fs->f_bitmap_loaded = NULL;
 }
 
 int
@@ -497,6 +575,10 @@ ext2_write_bitmaps (VFSSuperblock *sb)
       if (csum_flag && ext2_bg_test_flags (sb, i, EXT2_BG_BLOCK_UNINIT))
 	goto skip_curr_block;
 
+      /* Only groups changed since the last write need to be written */
+      if (!(fs->f_bitmap_loaded[i] & EXT2_BITMAP_BLOCK_DIRTY))
+	goto skip_curr_block;
+
       ret = ext2_get_bitmap_range (fs->f_block_bitmap, blkitr,
 				   block_nbytes << 3, blockbuf);
       if (ret != 0)
@@ -524,6 +606,7 @@ ext2_write_bitmaps (VFSSuperblock *sb)
 	  if (ret != 0)
 	    goto err;
 	}
+      fs->f_bitmap_loaded[i] &= ~EXT2_BITMAP_BLOCK_DIRTY;
 
     skip_curr_block:
       blkitr += block_nbytes << 3;
@@ -533,6 +616,8 @@ ext2_write_bitmaps (VFSSuperblock *sb)
 	continue;
       if (csum_flag && ext2_bg_test_flags (sb, i, EXT2_BG_INODE_UNINIT))
 	goto skip_curr_inode;
+      if (!(fs->f_bitmap_loaded[i] & EXT2_BITMAP_INODE_DIRTY))
+	goto skip_curr_inode;
 
       ret = ext2_get_bitmap_range (fs->f_inode_bitmap, inoitr,
 				   inode_nbytes << 3, inodebuf);
@@ -550,6 +635,7 @@ ext2_write_bitmaps (VFSSuperblock *sb)
 	  if (ret != 0)
 	    goto err;
 	}
+      fs->f_bitmap_loaded[i] &= ~EXT2_BITMAP_INODE_DIRTY;
 
     skip_curr_inode:
       inoitr += inode_nbytes << 3;
@@ -575,51 +661,53 @@ ext2_write_bitmaps (VFSSuperblock *sb)
   return ret;
 }
 
-void
+int
 ext2_mark_bitmap (Ext2Bitmap *bmap, uint64_t arg)
 {
   Ext2Bitmap64 *b = (Ext2Bitmap64 *) bmap;
   if (b == NULL)
-    return;
+    return 0;
   if (EXT2_BITMAP_IS_32 (b))
     {
       Ext2Bitmap32 *b32 = (Ext2Bitmap32 *) bmap;
       if (arg & ~0xffffffffULL)
-	return;
+	return 0;
       if (arg < b32->b_start || arg > b32->b_end)
-	return;
+	return 0;
       fast_set_bit (b32->b_bitmap, arg - b32->b_start);
+      return 0;
     }
   else
     {
       arg >>= b->b_cluster_bits;
       if (arg < b->b_start || arg > b->b_end)
-	return;
-      b->b_ops->b_mark_bmap (b, arg);
+	return 0;
+      return b->b_ops->b_mark_bmap (b, arg);
     }
 }
 
-void
+int
 ext2_unmark_bitmap (Ext2Bitmap *bmap, uint64_t arg)
 {
   Ext2Bitmap64 *b = (Ext2Bitmap64 *) bmap;
   if (b == NULL)
-    return;
+    return 0;
   if (EXT2_BITMAP_IS_32 (b))
     {
       Ext2Bitmap32 *b32 = (Ext2Bitmap32 *) bmap;
       if (arg & ~0xffffffffULL)
-	return;
+	return 0;
       if (arg < b32->b_start || arg > b32->b_end)
-	return;
+	return 0;
       fast_clear_bit (b32->b_bitmap, arg - b32->b_start);
+      return 0;
     }
   else
     {
       arg >>= b->b_cluster_bits;
       if (arg < b->b_start || arg > b->b_end)
-	return;
-      b->b_ops->b_unmark_bmap (b, arg);
+	return 0;
+      return b->b_ops->b_unmark_bmap (b, arg);
     }
 }
 
@@ -647,34 +735,34 @@ ext2_test_bitmap (Ext2Bitmap *bmap, uint64_t arg)
     }
 }
 
-void
+int
 ext2_mark_block_bitmap_range (Ext2Bitmap *bmap, block_t block, blkcnt64_t num)
 {
   Ext2Bitmap64 *b = (Ext2Bitmap64 *) bmap;
   block_t end = block + num;
   if (b == NULL)
-    return;
+    return 0;
   if (EXT2_BITMAP_IS_32 (b))
     {
       Ext2Bitmap32 *b32 = (Ext2Bitmap32 *) bmap;
       int i;
       if ((block & ~0xffffffffULL) || ((block + num - 1) & ~0xffffffffULL))
-	return;
+	return 0;
       if (block < b32->b_start || block > b32->b_end
 	  || block + num - 1 > b32->b_end)
-	return;
+	return 0;
       for (i = 0; i < num; i++)
 	fast_set_bit (b32->b_bitmap, block + i - b32->b_start);
     }
   if (!EXT2_BITMAP_IS_64 (b))
-    return;
+    return 0;
   block >>= b->b_cluster_bits;
   end += (1 << b->b_cluster_bits) - 1;
   end >>= b->b_cluster_bits;
   num = end - block;
   if (block < b->b_start || block > b->b_end || block + num - 1 > b->b_end)
-    return;
-  b->b_ops->b_mark_bmap_extent (b, block, num);
+    return 0;
+  return b->b_ops->b_mark_bmap_extent (b, block, num);
 }
 
 int
@@ -697,8 +785,7 @@ ext2_set_bitmap_range (Ext2Bitmap *bmap, uint64_t start, unsigned int num,
     }
   if (!EXT2_BITMAP_IS_64 (b))
     return -EINVAL;
-  b->b_ops->b_set_bmap_range (b, start, num, data);
-  return 0;
+  return b->b_ops->b_set_bmap_range (b, start, num, data);
 }
 
 int
@@ -761,7 +848,7 @@ ext2_find_first_zero_bitmap (Ext2Bitmap *bmap, block_t start, block_t end,
     return -EINVAL;
 
   cstart = start >> b->b_cluster_bits;
-  cend = start >> b->b_cluster_bits;
+  cend = end >> b->b_cluster_bits;
   if (cstart < b->b_start || cend > b->b_end || start > end)
     return -EINVAL;
   if (b->b_ops->b_find_first_zero != NULL)
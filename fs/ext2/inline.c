@@ -0,0 +1,314 @@
+/*************************************************************************
+ * inline.c -- This file is part of OS/0.                                *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <fs/ext2.h>
+#include <libk/libk.h>
+#include <sys/param.h>
+#include <vm/heap.h>
+
+/* Replaces the inline data of INODE, updating its size first. The old size
+   is restored if the data does not fit in the inode. */
+
+static int
+ext2_inline_data_store (VFSInode *inode, const char *data, off64_t size)
+{
+  Ext2File *file = inode->vi_private;
+  off64_t old_size = EXT2_I_SIZE (file->f_inode);
+  int ret = ext2_inode_set_size (inode->vi_sb, &file->f_inode, size);
+  if (ret != 0)
+    return ret;
+  ret = ext2_inline_data_set (inode, data, size);
+  if (ret != 0)
+    {
+      ext2_inode_set_size (inode->vi_sb, &file->f_inode, old_size);
+      return ret;
+    }
+  inode->vi_size = size;
+  return 0;
+}
+
+/* Drops the system.data attribute and writes the rest of the inode, which
+   the caller has already converted to use blocks */
+
+static int
+ext2_inline_data_remove (VFSInode *inode)
+{
+  Ext2File *file = inode->vi_private;
+  int ret = ext2_xattr_set_index (inode, EXT2_XATTR_INDEX_SYSTEM, "data",
+				  NULL, 0, 0);
+  if (ret == -ENODATA)
+    ret = ext2_update_inode (inode->vi_sb, inode->vi_ino, &file->f_inode,
+			     sizeof (Ext2Inode));
+  return ret;
+}
+
+static int
+ext2_inline_data_expand_file (VFSInode *inode, const char *data, size_t size)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  Ext2Inode old;
+  int ret;
+
+  memcpy (&old, &file->f_inode, sizeof (Ext2Inode));
+  file->f_inode.i_flags &= ~EXT4_INLINE_DATA_FL;
+  memset (file->f_inode.i_block, 0, sizeof (file->f_inode.i_block));
+  if (fs->f_super.s_feature_incompat & EXT3_FT_INCOMPAT_EXTENTS)
+    file->f_inode.i_flags |= EXT4_EXTENTS_FL;
+  ret = ext2_inline_data_remove (inode);
+  if (ret != 0)
+    {
+      memcpy (&file->f_inode, &old, sizeof (Ext2Inode));
+      return ret;
+    }
+
+  file->f_flags &= ~EXT2_FILE_BUFFER_VALID;
+  size = MIN (size, EXT2_I_SIZE (file->f_inode));
+  if (size == 0)
+    return 0;
+  ret = ext2_write (inode, data, size, 0);
+  return ret < 0 ? ret : 0;
+}
+
+static int
+ext2_inline_data_expand_dir (VFSInode *dir, const char *data, size_t size)
+{
+  VFSSuperblock *sb = dir->vi_sb;
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2File *file = dir->vi_private;
+  Ext2DirEntry *dirent;
+  Ext2Inode old;
+  unsigned int csum_size = 0;
+  unsigned int offset;
+  unsigned int rec_len;
+  unsigned int end;
+  char *block;
+  block_t b;
+  int ret;
+
+  if (size < EXT4_INLINE_DOTDOT_SIZE)
+    return -EUCLEAN;
+  if (fs->f_super.s_feature_ro_compat & EXT4_FT_RO_COMPAT_METADATA_CSUM)
+    csum_size = sizeof (Ext2DirEntryTail);
+  ret = ext2_new_dir_block (sb, dir->vi_ino, *((const uint32_t *) data),
+			    &block);
+  if (ret != 0)
+    return ret;
+
+  /* Entries follow `..' in the order they had inline, and the last one is
+     extended to the end of the block */
+  offset = ext2_dir_rec_len (1, 0) + ext2_dir_rec_len (2, 0);
+  end = offset + size - EXT4_INLINE_DOTDOT_SIZE;
+  if (end > sb->sb_blksize - csum_size)
+    {
+      ret = -ENOSPC;
+      goto end;
+    }
+  dirent = (Ext2DirEntry *) (block + ext2_dir_rec_len (1, 0));
+  if (end > offset)
+    {
+      ret = ext2_set_rec_len (sb, ext2_dir_rec_len (2, 0), dirent);
+      if (ret != 0)
+	goto end;
+      memcpy (block + offset, data + EXT4_INLINE_DOTDOT_SIZE,
+	      size - EXT4_INLINE_DOTDOT_SIZE);
+      while (offset < end)
+	{
+	  dirent = (Ext2DirEntry *) (block + offset);
+	  ext2_get_rec_len (sb, dirent, &rec_len);
+	  if (rec_len < 8 || rec_len % 4 != 0 || offset + rec_len > end)
+	    {
+	      ret = -EUCLEAN;
+	      goto end;
+	    }
+	  offset += rec_len;
+	}
+      ret = ext2_set_rec_len (sb, sb->sb_blksize - csum_size -
+			      ((char *) dirent - block), dirent);
+      if (ret != 0)
+	goto end;
+    }
+
+  ret = ext2_new_block (sb, ext2_find_inode_goal (sb, dir->vi_ino,
+						  &file->f_inode, 0),
+			NULL, &b, NULL);
+  if (ret != 0)
+    goto end;
+  ret = ext2_write_dir_block (sb, b, block, 0, dir);
+  if (ret != 0)
+    goto end;
+  ret = ext2_block_alloc_stats (sb, b, 1);
+  if (ret != 0)
+    goto end;
+
+  memcpy (&old, &file->f_inode, sizeof (Ext2Inode));
+  file->f_inode.i_flags &= ~EXT4_INLINE_DATA_FL;
+  memset (file->f_inode.i_block, 0, sizeof (file->f_inode.i_block));
+  if (fs->f_super.s_feature_incompat & EXT3_FT_INCOMPAT_EXTENTS)
+    file->f_inode.i_flags |= EXT4_EXTENTS_FL;
+  ext2_inode_set_size (sb, &file->f_inode, sb->sb_blksize);
+  ext2_iblk_add_blocks (sb, &file->f_inode, 1);
+  ret = ext2_bmap (sb, dir->vi_ino, &file->f_inode, NULL, BMAP_SET, 0, NULL,
+		   &b);
+  if (ret == 0)
+    ret = ext2_inline_data_remove (dir);
+  if (ret != 0)
+    {
+      memcpy (&file->f_inode, &old, sizeof (Ext2Inode));
+      ext2_block_alloc_stats (sb, b, -1);
+      goto end;
+    }
+  ext2_update_vfs_inode (dir);
+
+ end:
+  kfree (block);
+  return ret;
+}
+
+int
+ext2_inline_data_get (VFSInode *inode, char **data, size_t *size)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  size_t max = EXT4_MIN_INLINE_DATA_SIZE + EXT2_INODE_SIZE (fs->f_super);
+  char *buffer = kzalloc (max);
+  int ret;
+  if (unlikely (buffer == NULL))
+    return -ENOMEM;
+
+  /* The first part of the data is in i_block and the rest is the value of
+     the system.data attribute */
+  memcpy (buffer, file->f_inode.i_block, EXT4_MIN_INLINE_DATA_SIZE);
+  ret = ext2_xattr_get_index (inode, EXT2_XATTR_INDEX_SYSTEM, "data",
+			      buffer + EXT4_MIN_INLINE_DATA_SIZE,
+			      max - EXT4_MIN_INLINE_DATA_SIZE);
+  if (ret == -ENODATA)
+    ret = 0;
+  if (ret < 0)
+    {
+      kfree (buffer);
+      return ret;
+    }
+  *data = buffer;
+  *size = EXT4_MIN_INLINE_DATA_SIZE + ret;
+  return 0;
+}
+
+int
+ext2_inline_data_set (VFSInode *inode, const char *data, size_t size)
+{
+  Ext2File *file = inode->vi_private;
+  uint32_t i_block[EXT2_N_BLOCKS];
+  size_t len = MIN (size, EXT4_MIN_INLINE_DATA_SIZE);
+  int ret;
+
+  memcpy (i_block, file->f_inode.i_block, sizeof (i_block));
+  memset (file->f_inode.i_block, 0, sizeof (i_block));
+  memcpy (file->f_inode.i_block, data, len);
+  ret = ext2_xattr_set_index (inode, EXT2_XATTR_INDEX_SYSTEM, "data",
+			      size > len ? data + len : "", size - len,
+			      EXT2_XATTR_IBODY);
+  if (ret != 0)
+    memcpy (file->f_inode.i_block, i_block, sizeof (i_block));
+  return ret;
+}
+
+int
+ext2_inline_data_read (VFSInode *inode, void *buffer, size_t len,
+		       off_t offset)
+{
+  Ext2File *file = inode->vi_private;
+  off64_t isize = EXT2_I_SIZE (file->f_inode);
+  char *data;
+  size_t size;
+  size_t amt;
+  int ret;
+  if (offset >= isize)
+    return 0;
+  len = MIN (len, isize - offset);
+
+  ret = ext2_inline_data_get (inode, &data, &size);
+  if (ret != 0)
+    return ret;
+  amt = offset < size ? MIN (len, size - offset) : 0;
+  memcpy (buffer, data + offset, amt);
+  memset (buffer + amt, 0, len - amt);
+  kfree (data);
+  return len;
+}
+
+int
+ext2_inline_data_write (VFSInode *inode, const void *buffer, size_t len,
+			off_t offset)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  off64_t size = MAX (EXT2_I_SIZE (file->f_inode), offset + len);
+  char *data;
+  size_t curr;
+  int ret;
+  if (size > EXT4_MIN_INLINE_DATA_SIZE + EXT2_INODE_SIZE (fs->f_super))
+    return -ENOSPC;
+
+  ret = ext2_inline_data_get (inode, &data, &curr);
+  if (ret != 0)
+    return ret;
+  memcpy (data + offset, buffer, len);
+  ret = ext2_inline_data_store (inode, data, size);
+  kfree (data);
+  return ret == 0 ? (int) len : ret;
+}
+
+int
+ext2_inline_data_set_size (VFSInode *inode, off64_t size)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  char *data;
+  size_t curr;
+  int ret;
+  if (size > EXT4_MIN_INLINE_DATA_SIZE + EXT2_INODE_SIZE (fs->f_super))
+    return -ENOSPC;
+
+  ret = ext2_inline_data_get (inode, &data, &curr);
+  if (ret != 0)
+    return ret;
+  if (size < curr)
+    memset (data + size, 0, curr - size);
+  ret = ext2_inline_data_store (inode, data, size);
+  kfree (data);
+  return ret;
+}
+
+/* Moves the inline data of INODE to a newly allocated block, for when it
+   no longer fits in the inode */
+
+int
+ext2_inline_data_expand (VFSInode *inode)
+{
+  char *data;
+  size_t size;
+  int ret = ext2_inline_data_get (inode, &data, &size);
+  if (ret != 0)
+    return ret;
+  if (S_ISDIR (inode->vi_mode))
+    ret = ext2_inline_data_expand_dir (inode, data, size);
+  else
+    ret = ext2_inline_data_expand_file (inode, data, size);
+  kfree (data);
+  return ret;
+}
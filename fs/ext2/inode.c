@@ -24,28 +24,228 @@
 #include <sys/process.h>
 #include <sys/sysmacros.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
+#include <vm/swap.h>
 
 static int
 ext2_process_readdir (VFSInode *dir, int entry, Ext2DirEntry *dirent,
 		      int offset, int blocksize, char *buffer, void *priv)
 {
+  Ext2Filesystem *fs = dir->vi_sb->sb_private;
   Ext2Readdir *r = priv;
-  if (offset < r->r_offset)
-    r->r_block++;
-  r->r_offset = offset;
+  off64_t pos = r->r_block * dir->vi_sb->sb_blksize + offset;
+  unsigned int rec_len;
+
+  /* Entries before an unvalidated cursor are found by rescanning the block
+     they are in and skipped here */
+  if (pos < r->r_cursor->dc_pos)
+    return 0;
+  r->r_err = ext2_get_rec_len (dir->vi_sb, dirent, &rec_len);
+  if (r->r_err != 0)
+    return DIRENT_ABORT;
   r->r_err = r->r_func (dirent->d_name, dirent->d_name_len & 0xff,
 			dirent->d_inode, (dirent->d_name_len >> 8) & 0xff,
-			r->r_block * dir->vi_sb->sb_blksize + r->r_offset,
-			r->r_private);
+			pos + rec_len, r->r_private);
   if (r->r_err != 0)
     {
       if (r->r_err > 0)
 	r->r_err = 0;
       return DIRENT_ABORT;
     }
+  r->r_cursor->dc_pos = pos + rec_len;
+  r->r_cursor->dc_version = fs->f_dir_version;
+  return 0;
+}
+
+/* Fills OUT with the parts of the buffers in VEC that cover LEN bytes
+   starting START bytes into them and returns the number of entries used */
+
+static int
+ext2_iov_slice (struct iovec *out, const struct iovec *vec, int vlen,
+		size_t start, size_t len)
+{
+  int n = 0;
+  int i;
+  for (i = 0; i < vlen && len > 0; i++)
+    {
+      size_t amt;
+      if (start >= vec[i].iov_len)
+	{
+	  start -= vec[i].iov_len;
+	  continue;
+	}
+      amt = MIN (vec[i].iov_len - start, len);
+      out[n].iov_base = (char *) vec[i].iov_base + start;
+      out[n++].iov_len = amt;
+      len -= amt;
+      start = 0;
+    }
+  return n;
+}
+
+static int
+ext2_rw_buffered (VFSInode *inode, const struct iovec *vec, int vlen,
+		  off_t offset, int write)
+{
+  int ret;
+  int i;
+  for (i = 0; i < vlen; i++)
+    {
+      if (write)
+	ret = ext2_write (inode, vec[i].iov_base, vec[i].iov_len, offset);
+      else
+	ret = ext2_read (inode, vec[i].iov_base, vec[i].iov_len, offset);
+      if (ret < 0)
+	return ret;
+      offset += vec[i].iov_len;
+    }
   return 0;
 }
 
+/* Maps logical block BLOCK of FILE for a direct transfer. Holes and
+   uninitialized extents map to zero for reads, and are allocated or
+   marked initialized for writes. */
+
+static int
+ext2_rw_map (Ext2File *file, block_t block, int write, block_t *result)
+{
+  char *blockbuf = file->f_buffer + file->f_sb->sb_blksize;
+  int retflags = 0;
+  int ret = ext2_bmap (file->f_sb, file->f_ino, &file->f_inode, blockbuf,
+		       write && file->f_ino != 0 ? BMAP_ALLOC : 0, block,
+		       &retflags, result);
+  if (ret != 0)
+    return ret;
+  if (retflags & BMAP_RET_UNINIT)
+    {
+      if (!write)
+	{
+	  *result = 0;
+	  return 0;
+	}
+      return ext2_bmap (file->f_sb, file->f_ino, &file->f_inode, blockbuf,
+			BMAP_SET, block, 0, result);
+    }
+  return 0;
+}
+
+static int
+ext2_rw_iter (VFSInode *inode, const struct iovec *vec, int vlen, off_t offset,
+	      int write)
+{
+  Ext2File *file = inode->vi_private;
+  VFSSuperblock *sb = inode->vi_sb;
+  blksize_t blksize = sb->sb_blksize;
+  struct iovec *slice;
+  SwapPin pin;
+  size_t total = 0;
+  size_t pos = 0;
+  size_t head;
+  int ret;
+  int n;
+  int i;
+
+  for (i = 0; i < vlen; i++)
+    total += vec[i].iov_len;
+  if (!write)
+    {
+      if (offset >= EXT2_I_SIZE (file->f_inode))
+	return 0;
+      total = MIN (total, EXT2_I_SIZE (file->f_inode) - offset);
+    }
+  if (total == 0)
+    return 0;
+
+  /* Transfers that could disagree with cached pages go through the cache,
+     and so does inline data which has no blocks to transfer directly */
+  if (page_cache_busy (inode, write)
+      || (file->f_inode.i_flags & EXT4_INLINE_DATA_FL))
+    {
+      ret = ext2_rw_buffered (inode, vec, vlen, offset, write);
+      return ret == 0 ? (int) total : ret;
+    }
+
+  /* Blocks transferred directly must not be shadowed by the file buffer */
+  ret = ext2_file_flush (file);
+  if (ret != 0)
+    return ret;
+  file->f_flags &= ~EXT2_FILE_BUFFER_VALID;
+
+  slice = kmalloc (sizeof (struct iovec) * vlen);
+  if (unlikely (slice == NULL))
+    return -ENOMEM;
+
+  /* A partial first block goes through the file buffer */
+  head = MIN ((blksize - offset % blksize) % blksize, total);
+  n = ext2_iov_slice (slice, vec, vlen, 0, head);
+  ret = ext2_rw_buffered (inode, slice, n, offset, write);
+  if (ret != 0)
+    goto end;
+  pos = head;
+
+  /* Whole blocks are transferred with one request per run of physically
+     contiguous blocks, straight to or from the caller's buffers. Their
+     pages are faulted in and pinned so they stay in memory meanwhile. */
+  while (total - pos >= blksize)
+    {
+      block_t block = (offset + pos) / blksize;
+      block_t phys;
+      block_t next;
+      size_t run;
+      ret = ext2_rw_map (file, block, write, &phys);
+      if (ret != 0)
+	goto end;
+      for (run = blksize; run < EXT2_IO_MAX && total - pos - run >= blksize;
+	   run += blksize)
+	{
+	  ret = ext2_rw_map (file, block + run / blksize, write, &next);
+	  if (ret != 0)
+	    goto end;
+	  if (phys == 0 ? next != 0 : next != phys + run / blksize)
+	    break;
+	}
+
+      n = ext2_iov_slice (slice, vec, vlen, pos, run);
+      if (phys == 0 && write)
+	ret = ext2_rw_buffered (inode, slice, n, offset + pos, 1);
+      else if (phys == 0)
+	{
+	  for (i = 0; i < n; i++)
+	    memset (slice[i].iov_base, 0, slice[i].iov_len);
+	}
+      else
+	{
+	  ret = swap_pin_iov (&pin, slice, n, !write);
+	  if (ret != 0)
+	    goto end;
+	  if (write)
+	    ret = device_writev (sb->sb_dev, slice, n, (off_t) phys * blksize);
+	  else
+	    ret = device_readv (sb->sb_dev, slice, n, (off_t) phys * blksize);
+	  swap_unpin (&pin);
+	}
+      if (ret != 0)
+	goto end;
+      pos += run;
+    }
+
+  /* The partial last block also goes through the file buffer */
+  n = ext2_iov_slice (slice, vec, vlen, pos, total - pos);
+  ret = ext2_rw_buffered (inode, slice, n, offset + pos, write);
+  if (ret == 0)
+    pos = total;
+
+ end:
+  kfree (slice);
+  if (write && pos != 0 && EXT2_I_SIZE (file->f_inode) < offset + pos)
+    {
+      int ret2 = ext2_file_set_size (file, offset + pos);
+      if (ret == 0)
+	ret = ret2;
+    }
+  return ret == 0 ? (int) total : ret;
+}
+
 int
 ext2_create (VFSInode *dir, const char *name, mode_t mode)
 {
@@ -115,16 +315,22 @@ ext2_lookup (VFSInode **inode, VFSInode *dir, VFSSuperblock *sb,
 int
 ext2_link (VFSInode *old, VFSInode *dir, const char *new)
 {
+  int ret;
   if (old->vi_sb != dir->vi_sb)
     return -EXDEV;
-  return ext2_add_link (dir->vi_sb, dir, new, old->vi_ino,
-			ext2_dir_type (old->vi_mode));
+  ext2_journal_start (dir->vi_sb);
+  ret = ext2_add_link (dir->vi_sb, dir, new, old->vi_ino,
+		       ext2_dir_type (old->vi_mode));
+  return ext2_journal_end (dir->vi_sb, ret);
 }
 
 int
 ext2_unlink (VFSInode *dir, const char *name)
 {
-  return ext2_unlink_dirent (dir->vi_sb, dir, name, 0);
+  int ret;
+  ext2_journal_start (dir->vi_sb);
+  ret = ext2_unlink_dirent (dir->vi_sb, dir, name, 0);
+  return ext2_journal_end (dir->vi_sb, ret);
 }
 
 int
@@ -154,6 +360,7 @@ ext2_symlink (VFSInode *dir, const char *old, const char *new)
     return -ENOMEM;
   strncpy (blockbuf, old, blksize);
 
+  ext2_journal_start (dir->vi_sb);
   fast_link = target_len < 60;
   if (!fast_link)
     {
@@ -180,7 +387,10 @@ ext2_symlink (VFSInode *dir, const char *old, const char *new)
   if (fast_link)
     strcpy ((char *) &inode.i_block, old);
   else if (inline_link)
-    return -ENOTSUP;
+    {
+      ret = -ENOTSUP;
+      goto end;
+    }
   else
     {
       ext2_iblk_set (dir->vi_sb, &inode, 1);
@@ -205,9 +415,17 @@ ext2_symlink (VFSInode *dir, const char *old, const char *new)
       ret = ext2_write_blocks (blockbuf, dir->vi_sb, block, 1);
       if (ret != 0)
 	goto end;
-      ext2_block_alloc_stats (dir->vi_sb, block, 1);
+      ret = ext2_block_alloc_stats (dir->vi_sb, block, 1);
+      if (ret != 0)
+	goto end;
+    }
+  ret = ext2_inode_alloc_stats (dir->vi_sb, ino, 1, 0);
+  if (ret != 0)
+    {
+      if (!fast_link && !inline_link)
+	ext2_block_alloc_stats (dir->vi_sb, block, -1);
+      goto end;
     }
-  ext2_inode_alloc_stats (dir->vi_sb, ino, 1, 0);
   drop_ref = 1;
 
   ret = ext2_add_link (dir->vi_sb, dir, new, ino, EXT2_DIRTYPE_LINK);
@@ -223,11 +441,11 @@ ext2_symlink (VFSInode *dir, const char *old, const char *new)
 	ext2_block_alloc_stats (dir->vi_sb, block, -1);
       ext2_inode_alloc_stats (dir->vi_sb, ino, -1, 0);
     }
-  return ret;
+  return ext2_journal_end (dir->vi_sb, ret);
 }
 
-int
-ext2_read (VFSInode *inode, void *buffer, size_t len, off_t offset)
+static int
+ext2_read_uncached (VFSInode *inode, void *buffer, size_t len, off_t offset)
 {
   Ext2File *file = inode->vi_private;
   unsigned int count = 0;
@@ -239,7 +457,7 @@ ext2_read (VFSInode *inode, void *buffer, size_t len, off_t offset)
   file->f_pos = offset;
 
   if (file->f_inode.i_flags & EXT4_INLINE_DATA_FL)
-    return -ENOTSUP;
+    return ext2_inline_data_read (inode, buffer, len, offset);
 
   while (file->f_pos < EXT2_I_SIZE (file->f_inode) && len > 0)
     {
@@ -265,8 +483,9 @@ ext2_read (VFSInode *inode, void *buffer, size_t len, off_t offset)
   return count;
 }
 
-int
-ext2_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
+static int
+ext2_write_uncached (VFSInode *inode, const void *buffer, size_t len,
+		     off_t offset)
 {
   Ext2File *file = inode->vi_private;
   blksize_t blksize = inode->vi_sb->sb_blksize;
@@ -277,8 +496,16 @@ ext2_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
   int ret = 0;
   file->f_pos = offset;
 
+  /* Inline data moves to a block once it outgrows the inode */
   if (file->f_inode.i_flags & EXT4_INLINE_DATA_FL)
-    return -ENOTSUP;
+    {
+      ret = ext2_inline_data_write (inode, buffer, len, offset);
+      if (ret != -ENOSPC)
+	return ret;
+      ret = ext2_inline_data_expand (inode);
+      if (ret != 0)
+	return ret;
+    }
 
   while (len > 0)
     {
@@ -322,17 +549,116 @@ ext2_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
 }
 
 int
-ext2_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
+ext2_read (VFSInode *inode, void *buffer, size_t len, off_t offset)
+{
+  Ext2File *file = inode->vi_private;
+  if (offset >= EXT2_I_SIZE (file->f_inode))
+    return 0;
+  len = MIN (len, EXT2_I_SIZE (file->f_inode) - offset);
+  return page_cache_read (inode, buffer, len, offset);
+}
+
+int
+ext2_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
+{
+  int ret;
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_write_uncached (inode, buffer, len, offset);
+  if (ret > 0)
+    {
+      page_cache_update (inode, buffer, ret, offset);
+      rtld_cache_invalidate (inode->vi_sb, inode->vi_ino);
+    }
+  return ext2_journal_end (inode->vi_sb, ret);
+}
+
+int
+ext2_read_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		off_t offset)
+{
+  return ext2_rw_iter (inode, vec, vlen, offset, 0);
+}
+
+int
+ext2_write_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		 off_t offset)
 {
+  int ret;
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_rw_iter (inode, vec, vlen, offset, 1);
+  if (ret > 0)
+    rtld_cache_invalidate (inode->vi_sb, inode->vi_ino);
+  return ext2_journal_end (inode->vi_sb, ret);
+}
+
+/* Reloads the on-disk inode into FILE since another open of the file may
+   have changed its size since FILE was opened */
+
+static int
+ext2_reload_file (Ext2File *file)
+{
+  int ret = ext2_file_flush (file);
+  if (ret != 0 || file->f_ino == 0)
+    return ret;
+  file->f_flags &= ~EXT2_FILE_BUFFER_VALID;
+  return ext2_read_inode (file->f_sb, file->f_ino, &file->f_inode);
+}
+
+int
+ext2_readpage (VFSInode *inode, void *buffer, off64_t offset)
+{
+  int ret = ext2_reload_file (inode->vi_private);
+  if (ret != 0)
+    return ret;
+  ret = ext2_read_uncached (inode, buffer, PAGE_SIZE, offset);
+  if (ret < 0)
+    return ret;
+  memset (buffer + ret, 0, PAGE_SIZE - ret);
+  return 0;
+}
+
+int
+ext2_writepage (VFSInode *inode, const void *buffer, off64_t offset)
+{
+  Ext2File *file = inode->vi_private;
+  int ret = ext2_reload_file (file);
+  if (ret != 0)
+    return ret;
+
+  /* Never extend the file, the end of the last page is past its end */
+  if (offset >= EXT2_I_SIZE (file->f_inode))
+    return 0;
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_write_uncached (inode, buffer,
+			     MIN (PAGE_SIZE,
+				  EXT2_I_SIZE (file->f_inode) - offset),
+			     offset);
+  if (ret >= 0)
+    ret = ext2_file_flush (file);
+  return ext2_journal_end (inode->vi_sb, ret);
+}
+
+int
+ext2_readdir (VFSInode *inode, VFSDirCursor *cursor, VFSDirEntryFillFunc func,
+	      void *private)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  blksize_t blksize = inode->vi_sb->sb_blksize;
+  unsigned int offset = 0;
   Ext2Readdir r;
   int ret;
   r.r_func = func;
   r.r_private = private;
-  r.r_block = 0;
-  r.r_offset = 0;
+  r.r_cursor = cursor;
+  r.r_block = cursor->dc_pos / blksize;
   r.r_err = 0;
-  ret = ext2_dir_iterate (inode->vi_sb, inode, DIRENT_FLAG_EMPTY, NULL,
-			  ext2_process_readdir, &r);
+
+  /* Jump straight to the next entry unless the directory blocks changed
+     since the cursor was saved */
+  if (cursor->dc_version == fs->f_dir_version)
+    offset = cursor->dc_pos % blksize;
+  ret = ext2_dir_iterate_from (inode->vi_sb, inode, 0, NULL, &r.r_block,
+			       offset, ext2_process_readdir, &r);
   if (ret != 0)
     return ret;
   return r.r_err;
@@ -369,7 +695,9 @@ ext2_mkdir (VFSInode *dir, const char *name, mode_t mode)
   ino64_t ino;
   char *block = NULL;
   int drop_ref = 0;
-  int ret = ret = ext2_read_bitmaps (dir->vi_sb);
+  int ret;
+  ext2_journal_start (dir->vi_sb);
+  ret = ext2_read_bitmaps (dir->vi_sb);
   if (ret != 0)
     goto end;
 
@@ -438,8 +766,15 @@ ext2_mkdir (VFSInode *dir, const char *name, mode_t mode)
 	goto end;
     }
 
-  ext2_block_alloc_stats (dir->vi_sb, b, 1);
-  ext2_inode_alloc_stats (dir->vi_sb, ino, 1, 1);
+  ret = ext2_block_alloc_stats (dir->vi_sb, b, 1);
+  if (ret != 0)
+    goto end;
+  ret = ext2_inode_alloc_stats (dir->vi_sb, ino, 1, 1);
+  if (ret != 0)
+    {
+      ext2_block_alloc_stats (dir->vi_sb, b, -1);
+      goto end;
+    }
   drop_ref = 1;
 
   ret = ext2_add_link (dir->vi_sb, dir, name, ino, EXT2_DIRTYPE_DIR);
@@ -463,13 +798,16 @@ ext2_mkdir (VFSInode *dir, const char *name, mode_t mode)
       ext2_block_alloc_stats (dir->vi_sb, b, -1);
       ext2_inode_alloc_stats (dir->vi_sb, ino, -1, 1);
     }
-  return ret;
+  return ext2_journal_end (dir->vi_sb, ret);
 }
 
 int
 ext2_rmdir (VFSInode *dir, const char *name)
 {
-  return ext2_unlink_dirent (dir->vi_sb, dir, name, 0);
+  int ret;
+  ext2_journal_start (dir->vi_sb);
+  ret = ext2_unlink_dirent (dir->vi_sb, dir, name, 0);
+  return ext2_journal_end (dir->vi_sb, ret);
 }
 
 int
@@ -499,20 +837,24 @@ ext2_rename (VFSInode *olddir, const char *oldname, VFSInode *newdir,
     return ret;
 
   /* Remove existing link, if any */
+  ext2_journal_start (newdir->vi_sb);
   ret = ext2_unlink_dirent (newdir->vi_sb, newdir, newname, 0);
   if (ret != 0 && ret != -ENOENT)
-    return ret;
+    goto end;
 
   /* Determine mode and replace link */
   ret = ext2_read_inode (newdir->vi_sb, ino, &inode);
   if (ret != 0)
-    return ret;
+    goto end;
   ret = ext2_add_link (newdir->vi_sb, newdir, newname, ino, inode.i_mode);
   if (ret != 0)
-    return ret;
+    goto end;
 
   /* Remove old entry */
-  return ext2_unlink_dirent (olddir->vi_sb, olddir, oldname, 0);
+  ret = ext2_unlink_dirent (olddir->vi_sb, olddir, oldname, 0);
+
+ end:
+  return ext2_journal_end (newdir->vi_sb, ret);
 }
 
 int
@@ -546,7 +888,27 @@ ext2_readlink (VFSInode *inode, char *buffer, size_t len)
 int
 ext2_truncate (VFSInode *inode)
 {
-  return ext2_file_set_size (inode->vi_private, inode->vi_size);
+  Ext2File *file = inode->vi_private;
+  int ret;
+  ext2_journal_start (inode->vi_sb);
+  if (file->f_inode.i_flags & EXT4_INLINE_DATA_FL)
+    {
+      ret = ext2_inline_data_set_size (inode, inode->vi_size);
+      if (ret != -ENOSPC)
+	goto end;
+      ret = ext2_inline_data_expand (inode);
+      if (ret != 0)
+	goto end;
+    }
+  ret = ext2_file_set_size (file, inode->vi_size);
+
+ end:
+  if (ret == 0)
+    {
+      page_cache_truncate (inode, inode->vi_size);
+      rtld_cache_invalidate (inode->vi_sb, inode->vi_ino);
+    }
+  return ext2_journal_end (inode->vi_sb, ret);
 }
 
 int
@@ -562,23 +924,32 @@ int
 ext2_setxattr (VFSInode *inode, const char *name, const void *value,
 	       size_t len, int flags)
 {
-  return -ENOSYS;
+  int ret;
+  /* A null value means removal to ext2_xattr_set () */
+  if (value == NULL)
+    value = "";
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_xattr_set (inode, name, value, len, flags);
+  return ext2_journal_end (inode->vi_sb, ret);
 }
 
 int
 ext2_getxattr (VFSInode *inode, const char *name, void *buffer, size_t len)
 {
-  return -ENOSYS;
+  return ext2_xattr_get (inode, name, buffer, len);
 }
 
 int
 ext2_listxattr (VFSInode *inode, char *buffer, size_t len)
 {
-  return -ENOSYS;
+  return ext2_xattr_list (inode, buffer, len);
 }
 
 int
 ext2_removexattr (VFSInode *inode, const char *name)
 {
-  return -ENOSYS;
+  int ret;
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_xattr_set (inode, name, NULL, 0, 0);
+  return ext2_journal_end (inode->vi_sb, ret);
 }
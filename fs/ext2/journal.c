@@ -0,0 +1,1145 @@
+/*************************************************************************
+ * journal.c -- This file is part of OS/0.                               *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <bits/mount.h>
+#include <fs/ext2.h>
+#include <libk/libk.h>
+#include <sys/kmsg.h>
+#include <sys/param.h>
+#include <vm/heap.h>
+#include <vm/pagecache.h>
+
+#define JOURNAL_PASS_SCAN   0
+#define JOURNAL_PASS_REVOKE 1
+#define JOURNAL_PASS_REPLAY 2
+
+static inline int
+ext2_journal_tid_geq (uint32_t a, uint32_t b)
+{
+  return (int32_t) (a - b) >= 0;
+}
+
+static inline int
+ext2_journal_has_incompat (Ext2Journal *journal, uint32_t mask)
+{
+  return journal->j_super->s_feature_incompat & htobe32 (mask) ? 1 : 0;
+}
+
+static inline int
+ext2_journal_has_csum (Ext2Journal *journal)
+{
+  return ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V2
+				    | JBD2_FT_INCOMPAT_CSUM_V3);
+}
+
+static inline size_t
+ext2_journal_tail_size (Ext2Journal *journal)
+{
+  return ext2_journal_has_csum (journal) ? sizeof (Jbd2BlockTail) : 0;
+}
+
+static inline int
+ext2_journal_escaped (const char *data)
+{
+  uint32_t magic;
+  memcpy (&magic, data, sizeof (uint32_t));
+  return magic == htobe32 (JBD2_MAGIC_NUMBER);
+}
+
+static unsigned int
+ext2_journal_tag_size (Ext2Journal *journal)
+{
+  unsigned int size = sizeof (Jbd2BlockTag);
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V3))
+    return sizeof (Jbd2BlockTag3);
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V2))
+    size += sizeof (uint16_t);
+  if (!ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_64BIT))
+    size -= sizeof (uint32_t);
+  return size;
+}
+
+static void
+ext2_journal_put_tag (Ext2Journal *journal, char *ptr, block_t block,
+		      uint32_t flags, uint32_t csum)
+{
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V3))
+    {
+      Jbd2BlockTag3 *tag = (Jbd2BlockTag3 *) ptr;
+      tag->t_blocknr = htobe32 (block & 0xffffffff);
+      tag->t_flags = htobe32 (flags);
+      tag->t_blocknr_high = htobe32 (block >> 32);
+      tag->t_checksum = htobe32 (csum);
+    }
+  else
+    {
+      Jbd2BlockTag *tag = (Jbd2BlockTag *) ptr;
+      tag->t_blocknr = htobe32 (block & 0xffffffff);
+      tag->t_checksum = htobe16 (csum & 0xffff);
+      tag->t_flags = htobe16 (flags);
+      if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_64BIT))
+	tag->t_blocknr_high = htobe32 (block >> 32);
+    }
+}
+
+static void
+ext2_journal_get_tag (Ext2Journal *journal, const char *ptr, block_t *block,
+		      uint32_t *flags, uint32_t *csum)
+{
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V3))
+    {
+      const Jbd2BlockTag3 *tag = (const Jbd2BlockTag3 *) ptr;
+      *block = be32toh (tag->t_blocknr);
+      *block |= (block_t) be32toh (tag->t_blocknr_high) << 32;
+      *flags = be32toh (tag->t_flags);
+      *csum = be32toh (tag->t_checksum);
+    }
+  else
+    {
+      const Jbd2BlockTag *tag = (const Jbd2BlockTag *) ptr;
+      *block = be32toh (tag->t_blocknr);
+      if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_64BIT))
+	*block |= (block_t) be32toh (tag->t_blocknr_high) << 32;
+      *flags = be16toh (tag->t_flags);
+      *csum = be16toh (tag->t_checksum);
+    }
+}
+
+/* Checksum of a logged copy of a metadata block. If ESCAPED is set the
+   copy has its first word zeroed, which is not done to DATA itself. */
+
+static uint32_t
+ext2_journal_block_csum (VFSSuperblock *sb, Ext2Journal *journal,
+			 uint32_t tid, const char *data, int escaped)
+{
+  uint32_t seq = htobe32 (tid);
+  uint32_t zero = 0;
+  uint32_t csum = crc32 (journal->j_csum_seed, &seq, sizeof (uint32_t));
+  if (escaped)
+    {
+      csum = crc32 (csum, &zero, sizeof (uint32_t));
+      return crc32 (csum, data + sizeof (uint32_t),
+		    sb->sb_blksize - sizeof (uint32_t));
+    }
+  return crc32 (csum, data, sb->sb_blksize);
+}
+
+static int
+ext2_journal_tag_csum_valid (VFSSuperblock *sb, Ext2Journal *journal,
+			     uint32_t tid, const char *data, uint32_t csum)
+{
+  uint32_t calc;
+  if (!ext2_journal_has_csum (journal))
+    return 1;
+  calc = ext2_journal_block_csum (sb, journal, tid, data, 0);
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V3))
+    return csum == calc;
+  return csum == (calc & 0xffff);
+}
+
+/* Descriptor, revoke and commit blocks are checksummed as a whole with the
+   checksum field at FIELD zeroed */
+
+static void
+ext2_journal_csum_set (VFSSuperblock *sb, Ext2Journal *journal, char *block,
+		       uint32_t *field)
+{
+  if (!ext2_journal_has_csum (journal))
+    return;
+  *field = 0;
+  *field = htobe32 (crc32 (journal->j_csum_seed, block, sb->sb_blksize));
+}
+
+static int
+ext2_journal_csum_valid (VFSSuperblock *sb, Ext2Journal *journal, char *block,
+			 uint32_t *field)
+{
+  uint32_t csum;
+  int valid;
+  if (!ext2_journal_has_csum (journal))
+    return 1;
+  csum = *field;
+  *field = 0;
+  valid =
+    csum == htobe32 (crc32 (journal->j_csum_seed, block, sb->sb_blksize));
+  *field = csum;
+  return valid;
+}
+
+static inline uint32_t *
+ext2_journal_tail (VFSSuperblock *sb, char *block)
+{
+  return &((Jbd2BlockTail *) (block + sb->sb_blksize -
+			      sizeof (Jbd2BlockTail)))->t_checksum;
+}
+
+static uint32_t
+ext2_journal_super_csum (Jbd2Superblock *jsb)
+{
+  uint32_t old = jsb->s_checksum;
+  uint32_t csum;
+  jsb->s_checksum = 0;
+  csum = crc32 (0xffffffff, jsb, sizeof (Jbd2Superblock));
+  jsb->s_checksum = old;
+  return htobe32 (csum);
+}
+
+static void
+ext2_journal_header (Jbd2Header *header, uint32_t type, uint32_t tid)
+{
+  header->h_magic = htobe32 (JBD2_MAGIC_NUMBER);
+  header->h_blocktype = htobe32 (type);
+  header->h_sequence = htobe32 (tid);
+}
+
+/* Transfers to the journal itself and to home locations of journaled blocks
+   must not go through the buffer hash */
+
+static int
+ext2_journal_read_raw (VFSSuperblock *sb, void *buffer, block_t block,
+		       size_t nblocks)
+{
+  return sb->sb_dev->sd_read (sb->sb_dev, buffer, nblocks * sb->sb_blksize,
+			      block * sb->sb_blksize);
+}
+
+static int
+ext2_journal_write_raw (VFSSuperblock *sb, const void *buffer, block_t block,
+			size_t nblocks)
+{
+  return sb->sb_dev->sd_write (sb->sb_dev, buffer, nblocks * sb->sb_blksize,
+			       block * sb->sb_blksize);
+}
+
+static int
+ext2_journal_write_super (VFSSuperblock *sb, Ext2Journal *journal,
+			  block_t start, uint32_t sequence)
+{
+  Jbd2Superblock *jsb = journal->j_super;
+  jsb->s_start = htobe32 (start);
+  jsb->s_sequence = htobe32 (sequence);
+  if (ext2_journal_has_csum (journal))
+    jsb->s_checksum = ext2_journal_super_csum (jsb);
+  return ext2_journal_write_raw (sb, jsb, journal->j_map[0], 1);
+}
+
+static inline void
+ext2_journal_advance (Ext2Journal *journal, block_t *block)
+{
+  if (++*block == journal->j_last)
+    *block = journal->j_first;
+}
+
+static int
+ext2_journal_read_log (VFSSuperblock *sb, Ext2Journal *journal, block_t *block,
+		       void *buffer)
+{
+  int ret = ext2_journal_read_raw (sb, buffer, journal->j_map[*block], 1);
+  ext2_journal_advance (journal, block);
+  return ret;
+}
+
+static Ext2JournalBuffer **
+ext2_journal_lookup (Ext2Journal *journal, block_t block)
+{
+  Ext2JournalBuffer **b =
+    &journal->j_hash[block & (EXT2_JOURNAL_HASH_SIZE - 1)];
+  while (*b != NULL && (*b)->jb_block != block)
+    b = &(*b)->jb_next;
+  return b;
+}
+
+static void
+ext2_journal_free_buffers (Ext2Journal *journal)
+{
+  Ext2JournalBuffer *b;
+  Ext2JournalBuffer *next;
+  int i;
+  for (i = 0; i < EXT2_JOURNAL_HASH_SIZE; i++)
+    {
+      for (b = journal->j_hash[i]; b != NULL; b = next)
+	{
+	  next = b->jb_next;
+	  kfree (b);
+	}
+      journal->j_hash[i] = NULL;
+    }
+  journal->j_count = 0;
+  journal->j_running = 0;
+}
+
+static void
+ext2_journal_destroy (Ext2Journal *journal)
+{
+  ext2_journal_free_buffers (journal);
+  kfree (journal->j_super);
+  kfree (journal->j_map);
+  kfree (journal->j_group);
+  kfree (journal->j_scratch);
+  kfree (journal->j_batch);
+  kfree (journal);
+}
+
+/* During recovery the buffer hash holds the newest transaction that revoked
+   each block instead of block contents */
+
+static int
+ext2_journal_scan_revoke (VFSSuperblock *sb, Ext2Journal *journal,
+			  uint32_t tid)
+{
+  Jbd2RevokeHeader *r = (Jbd2RevokeHeader *) journal->j_scratch;
+  size_t rsize = ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_64BIT) ?
+    sizeof (uint64_t) : sizeof (uint32_t);
+  size_t count = be32toh (r->r_count);
+  size_t offset;
+  if (count > sb->sb_blksize - ext2_journal_tail_size (journal))
+    return -EINVAL;
+
+  for (offset = sizeof (Jbd2RevokeHeader); offset + rsize <= count;
+       offset += rsize)
+    {
+      Ext2JournalBuffer **ptr;
+      block_t block;
+      if (rsize == sizeof (uint64_t))
+	{
+	  uint64_t b;
+	  memcpy (&b, journal->j_scratch + offset, sizeof (uint64_t));
+	  block = be64toh (b);
+	}
+      else
+	{
+	  uint32_t b;
+	  memcpy (&b, journal->j_scratch + offset, sizeof (uint32_t));
+	  block = be32toh (b);
+	}
+
+      ptr = ext2_journal_lookup (journal, block);
+      if (*ptr == NULL)
+	{
+	  *ptr = kzalloc (sizeof (Ext2JournalBuffer));
+	  if (unlikely (*ptr == NULL))
+	    return -ENOMEM;
+	  (*ptr)->jb_block = block;
+	  (*ptr)->jb_tid = tid;
+	  (*ptr)->jb_revoked = 1;
+	  journal->j_count++;
+	}
+      else if (ext2_journal_tid_geq (tid, (*ptr)->jb_tid))
+	(*ptr)->jb_tid = tid;
+    }
+  return 0;
+}
+
+static int
+ext2_journal_revoked (Ext2Journal *journal, block_t block, uint32_t tid)
+{
+  Ext2JournalBuffer *b = *ext2_journal_lookup (journal, block);
+  return b != NULL && ext2_journal_tid_geq (b->jb_tid, tid);
+}
+
+/* Walks the tags of the descriptor block in the scratch buffer, replaying
+   the blocks they describe if PASS is JOURNAL_PASS_REPLAY. Returns the
+   number of blocks written back. */
+
+static int
+ext2_journal_replay_tags (VFSSuperblock *sb, Ext2Journal *journal, int pass,
+			  uint32_t tid, block_t *next)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  char *desc = journal->j_scratch;
+  char *data = journal->j_batch;
+  size_t offset = sizeof (Jbd2Header);
+  size_t end = sb->sb_blksize - ext2_journal_tail_size (journal);
+  int count = 0;
+  int ret;
+  while (offset + journal->j_tag_size <= end)
+    {
+      block_t block;
+      uint32_t flags;
+      uint32_t csum;
+      ext2_journal_get_tag (journal, desc + offset, &block, &flags, &csum);
+      if (pass != JOURNAL_PASS_REPLAY || ext2_journal_revoked (journal, block,
+							      tid))
+	ext2_journal_advance (journal, next);
+      else
+	{
+	  ret = ext2_journal_read_log (sb, journal, next, data);
+	  if (ret != 0)
+	    return ret;
+
+	  /* Blocks that fail their checksum or lie outside the filesystem
+	     are left alone */
+	  if (block < ext2_blocks_count (&fs->f_super)
+	      && ext2_journal_tag_csum_valid (sb, journal, tid, data, csum))
+	    {
+	      if (flags & JBD2_FLAG_ESCAPE)
+		{
+		  uint32_t magic = htobe32 (JBD2_MAGIC_NUMBER);
+		  memcpy (data, &magic, sizeof (uint32_t));
+		}
+	      ret = ext2_journal_write_raw (sb, data, block, 1);
+	      if (ret != 0)
+		return ret;
+	      count++;
+	    }
+	}
+
+      offset += journal->j_tag_size;
+      if (!(flags & JBD2_FLAG_SAME_UUID))
+	offset += JBD2_UUID_SIZE;
+      if (flags & JBD2_FLAG_LAST_TAG)
+	break;
+    }
+  return count;
+}
+
+/* Makes one pass over the log starting at its oldest transaction. The scan
+   pass finds the first transaction without a valid commit block and stores
+   it in END, the other passes stop there. */
+
+static int
+ext2_journal_pass (VFSSuperblock *sb, Ext2Journal *journal, int pass,
+		   uint32_t *end)
+{
+  Jbd2Superblock *jsb = journal->j_super;
+  Jbd2Header *header = (Jbd2Header *) journal->j_scratch;
+  Jbd2CommitHeader *commit = (Jbd2CommitHeader *) journal->j_scratch;
+  uint32_t tid = be32toh (jsb->s_sequence);
+  block_t next = be32toh (jsb->s_start);
+  int count = 0;
+  int ret;
+  while (pass == JOURNAL_PASS_SCAN || tid != *end)
+    {
+      ret = ext2_journal_read_log (sb, journal, &next, journal->j_scratch);
+      if (ret != 0)
+	return ret;
+      if (header->h_magic != htobe32 (JBD2_MAGIC_NUMBER)
+	  || be32toh (header->h_sequence) != tid)
+	break;
+
+      switch (be32toh (header->h_blocktype))
+	{
+	case JBD2_DESCRIPTOR_BLOCK:
+	  if (!ext2_journal_csum_valid (sb, journal, journal->j_scratch,
+					ext2_journal_tail (sb,
+							   journal->j_scratch)))
+	    goto end;
+	  ret = ext2_journal_replay_tags (sb, journal, pass, tid, &next);
+	  if (ret < 0)
+	    return ret;
+	  count += ret;
+	  break;
+	case JBD2_COMMIT_BLOCK:
+	  if (!ext2_journal_csum_valid (sb, journal, journal->j_scratch,
+					&commit->h_chksum[0]))
+	    goto end;
+	  tid++;
+	  break;
+	case JBD2_REVOKE_BLOCK:
+	  if (!ext2_journal_csum_valid (sb, journal, journal->j_scratch,
+					ext2_journal_tail (sb,
+							   journal->j_scratch)))
+	    goto end;
+	  if (pass == JOURNAL_PASS_REVOKE)
+	    {
+	      ret = ext2_journal_scan_revoke (sb, journal, tid);
+	      if (ret != 0)
+		return ret;
+	    }
+	  break;
+	default:
+	  goto end;
+	}
+    }
+
+ end:
+  if (pass == JOURNAL_PASS_SCAN)
+    *end = tid;
+  return count;
+}
+
+/* Replays all committed transactions in the log to their home locations.
+   Returns the number of blocks written. */
+
+static int
+ext2_journal_recover (VFSSuperblock *sb, Ext2Journal *journal)
+{
+  uint32_t end;
+  int count;
+  int ret = ext2_journal_pass (sb, journal, JOURNAL_PASS_SCAN, &end);
+  if (ret >= 0)
+    ret = ext2_journal_pass (sb, journal, JOURNAL_PASS_REVOKE, &end);
+  if (ret >= 0)
+    ret = ext2_journal_pass (sb, journal, JOURNAL_PASS_REPLAY, &end);
+  count = ret;
+  ext2_journal_free_buffers (journal);
+  if (ret < 0)
+    return ret;
+
+  /* The first transaction that was not committed may have left blocks in
+     the log, so don't reuse its ID */
+  journal->j_tid = end + 1;
+  return count;
+}
+
+static int
+ext2_journal_check_super (VFSSuperblock *sb, Ext2Journal *journal,
+			  block_t nblocks)
+{
+  Jbd2Superblock *jsb = journal->j_super;
+  if (jsb->s_header.h_magic != htobe32 (JBD2_MAGIC_NUMBER))
+    return -EINVAL;
+  if (jsb->s_header.h_blocktype != htobe32 (JBD2_SUPERBLOCK_V2))
+    return -ENOTSUP;
+  if (be32toh (jsb->s_blocksize) != sb->sb_blksize
+      || be32toh (jsb->s_maxlen) > nblocks
+      || be32toh (jsb->s_maxlen) < JBD2_MIN_JOURNAL_BLOCKS
+      || be32toh (jsb->s_first) == 0
+      || be32toh (jsb->s_first) >= be32toh (jsb->s_maxlen))
+    return -EINVAL;
+
+  if (jsb->s_feature_incompat & ~htobe32 (JBD2_INCOMPAT_SUPPORTED))
+    return -ENOTSUP;
+  if (ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V2)
+      && ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_CSUM_V3))
+    return -EINVAL;
+  if (ext2_journal_has_csum (journal))
+    {
+      if (jsb->s_checksum_type != JBD2_CRC32C_CHKSUM
+	  || jsb->s_checksum != ext2_journal_super_csum (jsb))
+	return -EINVAL;
+      journal->j_csum_seed = crc32 (0xffffffff, jsb->s_uuid, JBD2_UUID_SIZE);
+    }
+  return 0;
+}
+
+/* Appends a block to the log. Writes to consecutive blocks of the journal
+   are batched into one request. If COPY is not NULL the block's place in
+   the batch is returned there. */
+
+static int
+ext2_journal_append (VFSSuperblock *sb, Ext2Journal *journal,
+		     const void *data, char **copy)
+{
+  block_t phys = journal->j_map[journal->j_head];
+  char *ptr;
+  int ret;
+  if (journal->j_batch_count > 0
+      && (journal->j_batch_count == EXT2_JOURNAL_BATCH
+	  || phys != journal->j_batch_block + journal->j_batch_count))
+    {
+      ret = ext2_journal_write_raw (sb, journal->j_batch,
+				    journal->j_batch_block,
+				    journal->j_batch_count);
+      journal->j_batch_count = 0;
+      if (ret != 0)
+	return ret;
+    }
+  if (journal->j_batch_count == 0)
+    journal->j_batch_block = phys;
+  ptr = journal->j_batch + journal->j_batch_count++ * sb->sb_blksize;
+  memcpy (ptr, data, sb->sb_blksize);
+  if (copy != NULL)
+    *copy = ptr;
+  ext2_journal_advance (journal, &journal->j_head);
+  journal->j_free--;
+  return 0;
+}
+
+static int
+ext2_journal_flush_batch (VFSSuperblock *sb, Ext2Journal *journal)
+{
+  int ret;
+  if (journal->j_batch_count == 0)
+    return 0;
+  ret = ext2_journal_write_raw (sb, journal->j_batch, journal->j_batch_block,
+				journal->j_batch_count);
+  journal->j_batch_count = 0;
+  return ret;
+}
+
+/* Logs a descriptor block for the first COUNT buffers of the group array,
+   followed by the buffers themselves */
+
+static int
+ext2_journal_write_group (VFSSuperblock *sb, Ext2Journal *journal,
+			  unsigned int count)
+{
+  char *desc = journal->j_scratch;
+  size_t offset = sizeof (Jbd2Header);
+  unsigned int i;
+  int ret;
+
+  memset (desc, 0, sb->sb_blksize);
+  ext2_journal_header ((Jbd2Header *) desc, JBD2_DESCRIPTOR_BLOCK,
+		       journal->j_tid);
+  for (i = 0; i < count; i++)
+    {
+      Ext2JournalBuffer *b = journal->j_group[i];
+      uint32_t flags = i > 0 ? JBD2_FLAG_SAME_UUID : 0;
+      if (ext2_journal_escaped (b->jb_data))
+	flags |= JBD2_FLAG_ESCAPE;
+      if (i == count - 1)
+	flags |= JBD2_FLAG_LAST_TAG;
+      ext2_journal_put_tag (journal, desc + offset, b->jb_block, flags,
+			    ext2_journal_block_csum (sb, journal,
+						     journal->j_tid,
+						     b->jb_data,
+						     flags & JBD2_FLAG_ESCAPE));
+      offset += journal->j_tag_size;
+      if (i == 0)
+	{
+	  memcpy (desc + offset, journal->j_super->s_uuid, JBD2_UUID_SIZE);
+	  offset += JBD2_UUID_SIZE;
+	}
+    }
+  ext2_journal_csum_set (sb, journal, desc, ext2_journal_tail (sb, desc));
+  ret = ext2_journal_append (sb, journal, desc, NULL);
+  if (ret != 0)
+    return ret;
+
+  for (i = 0; i < count; i++)
+    {
+      Ext2JournalBuffer *b = journal->j_group[i];
+      char *copy;
+      ret = ext2_journal_append (sb, journal, b->jb_data, &copy);
+      if (ret != 0)
+	return ret;
+      if (ext2_journal_escaped (copy))
+	memset (copy, 0, sizeof (uint32_t));
+      b->jb_logged = 1;
+    }
+  return 0;
+}
+
+static int
+ext2_journal_write_descriptors (VFSSuperblock *sb, Ext2Journal *journal)
+{
+  Ext2JournalBuffer *b;
+  unsigned int count = 0;
+  int ret;
+  int i;
+  for (i = 0; i < EXT2_JOURNAL_HASH_SIZE; i++)
+    {
+      for (b = journal->j_hash[i]; b != NULL; b = b->jb_next)
+	{
+	  if (b->jb_tid != journal->j_tid || b->jb_revoked)
+	    continue;
+	  journal->j_group[count++] = b;
+	  if (count == journal->j_tags_per_block)
+	    {
+	      ret = ext2_journal_write_group (sb, journal, count);
+	      if (ret != 0)
+		return ret;
+	      count = 0;
+	    }
+	}
+    }
+  return count > 0 ? ext2_journal_write_group (sb, journal, count) : 0;
+}
+
+static int
+ext2_journal_finish_revoke (VFSSuperblock *sb, Ext2Journal *journal,
+			    size_t count)
+{
+  Jbd2RevokeHeader *r = (Jbd2RevokeHeader *) journal->j_scratch;
+  r->r_count = htobe32 (count);
+  ext2_journal_csum_set (sb, journal, journal->j_scratch,
+			 ext2_journal_tail (sb, journal->j_scratch));
+  return ext2_journal_append (sb, journal, journal->j_scratch, NULL);
+}
+
+static int
+ext2_journal_write_revokes (VFSSuperblock *sb, Ext2Journal *journal,
+			    size_t rsize)
+{
+  Jbd2RevokeHeader *r = (Jbd2RevokeHeader *) journal->j_scratch;
+  size_t end = sb->sb_blksize - ext2_journal_tail_size (journal);
+  size_t offset = 0;
+  Ext2JournalBuffer *b;
+  int ret;
+  int i;
+  for (i = 0; i < EXT2_JOURNAL_HASH_SIZE; i++)
+    {
+      for (b = journal->j_hash[i]; b != NULL; b = b->jb_next)
+	{
+	  if (b->jb_tid != journal->j_tid || !b->jb_revoked)
+	    continue;
+	  if (offset == 0)
+	    {
+	      memset (r, 0, sb->sb_blksize);
+	      ext2_journal_header (&r->r_header, JBD2_REVOKE_BLOCK,
+				   journal->j_tid);
+	      offset = sizeof (Jbd2RevokeHeader);
+	    }
+	  if (rsize == sizeof (uint64_t))
+	    {
+	      uint64_t block = htobe64 (b->jb_block);
+	      memcpy (journal->j_scratch + offset, &block, rsize);
+	    }
+	  else
+	    {
+	      uint32_t block = htobe32 (b->jb_block);
+	      memcpy (journal->j_scratch + offset, &block, rsize);
+	    }
+	  offset += rsize;
+	  if (offset + rsize > end)
+	    {
+	      ret = ext2_journal_finish_revoke (sb, journal, offset);
+	      if (ret != 0)
+		return ret;
+	      offset = 0;
+	    }
+	}
+    }
+  return offset > 0 ? ext2_journal_finish_revoke (sb, journal, offset) : 0;
+}
+
+/* Writes every journaled block to its home location and empties the log */
+
+static int
+ext2_journal_checkpoint (VFSSuperblock *sb, Ext2Journal *journal)
+{
+  Ext2JournalBuffer *b;
+  int ret;
+  int i;
+  if (journal->j_count == 0 && journal->j_tail == 0)
+    return 0;
+  for (i = 0; i < EXT2_JOURNAL_HASH_SIZE; i++)
+    {
+      for (b = journal->j_hash[i]; b != NULL; b = b->jb_next)
+	{
+	  if (b->jb_revoked)
+	    continue;
+	  ret = ext2_journal_write_raw (sb, b->jb_data, b->jb_block, 1);
+	  if (ret != 0)
+	    return ret;
+	}
+    }
+
+  if (journal->j_running > 0)
+    journal->j_tid++;
+  ext2_journal_free_buffers (journal);
+  journal->j_head = journal->j_first;
+  journal->j_free = journal->j_last - journal->j_first;
+  journal->j_tail = 0;
+  return ext2_journal_write_super (sb, journal, 0, journal->j_tid);
+}
+
+static int
+ext2_journal_write_transaction (VFSSuperblock *sb, Ext2Journal *journal)
+{
+  Jbd2CommitHeader *commit = (Jbd2CommitHeader *) journal->j_scratch;
+  Ext2JournalBuffer *b;
+  block_t start = journal->j_head;
+  block_t free = journal->j_free;
+  block_t ndata = 0;
+  block_t nrevoke = 0;
+  block_t needed;
+  size_t rsize;
+  size_t per_revoke;
+  int ret;
+  int i;
+
+  for (i = 0; i < EXT2_JOURNAL_HASH_SIZE; i++)
+    {
+      for (b = journal->j_hash[i]; b != NULL; b = b->jb_next)
+	{
+	  if (b->jb_tid != journal->j_tid)
+	    continue;
+	  if (b->jb_revoked)
+	    nrevoke++;
+	  else
+	    ndata++;
+	}
+    }
+
+  rsize = ext2_journal_has_incompat (journal, JBD2_FT_INCOMPAT_64BIT) ?
+    sizeof (uint64_t) : sizeof (uint32_t);
+  per_revoke = (sb->sb_blksize - sizeof (Jbd2RevokeHeader) -
+		ext2_journal_tail_size (journal)) / rsize;
+  needed = ndata + div64_ceil (ndata, journal->j_tags_per_block) +
+    div64_ceil (nrevoke, per_revoke) + 1;
+  if (needed > journal->j_free)
+    {
+      /* The transaction doesn't fit in the log, so it is written in place
+	 along with everything already committed. This is not atomic, but
+	 commits leave at least half of the log free so only transactions
+	 much larger than the commit threshold get here. */
+      printk (KERN_WARNING "ext2: transaction %lu of %lu blocks does not "
+	      "fit in the journal, writing it in place\n",
+	      (unsigned long) journal->j_tid, (unsigned long) needed);
+      return ext2_journal_checkpoint (sb, journal);
+    }
+
+  ret = ext2_journal_write_descriptors (sb, journal);
+  if (ret == 0)
+    ret = ext2_journal_write_revokes (sb, journal, rsize);
+  if (ret == 0)
+    ret = ext2_journal_flush_batch (sb, journal);
+  if (ret != 0)
+    goto err;
+
+  /* The commit block is written only once the rest of the transaction is
+     on disk */
+  memset (commit, 0, sb->sb_blksize);
+  ext2_journal_header (&commit->h_header, JBD2_COMMIT_BLOCK, journal->j_tid);
+  commit->h_commit_sec = htobe64 (time (NULL));
+  ext2_journal_csum_set (sb, journal, journal->j_scratch,
+			 &commit->h_chksum[0]);
+  ret = ext2_journal_append (sb, journal, commit, NULL);
+  if (ret == 0)
+    ret = ext2_journal_flush_batch (sb, journal);
+  if (ret != 0)
+    goto err;
+
+  if (journal->j_tail == 0)
+    {
+      ret = ext2_journal_write_super (sb, journal, start, journal->j_tid);
+      if (ret != 0)
+	goto err;
+      journal->j_tail = start;
+    }
+  journal->j_tid++;
+  journal->j_running = 0;
+  return 0;
+
+ err:
+  journal->j_head = start;
+  journal->j_free = free;
+  journal->j_batch_count = 0;
+  return ret;
+}
+
+int
+ext2_journal_load (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal;
+  block_t nblocks;
+  block_t i;
+  int count = 0;
+  int ret;
+
+  /* External journal devices are not supported */
+  if (fs->f_super.s_journal_inum == 0)
+    return -ENOTSUP;
+
+  journal = kzalloc (sizeof (Ext2Journal));
+  if (unlikely (journal == NULL))
+    return -ENOMEM;
+  journal->j_ino = fs->f_super.s_journal_inum;
+  ret = ext2_read_inode (sb, journal->j_ino, &journal->j_inode);
+  if (ret != 0)
+    goto err;
+  nblocks = EXT2_I_SIZE (journal->j_inode) >>
+    (EXT2_MIN_BLOCK_LOG_SIZE + fs->f_super.s_log_block_size);
+  if (nblocks < JBD2_MIN_JOURNAL_BLOCKS)
+    {
+      ret = -EINVAL;
+      goto err;
+    }
+
+  journal->j_map = kmalloc (sizeof (block_t) * nblocks);
+  journal->j_super = kmalloc (sb->sb_blksize);
+  journal->j_scratch = kmalloc (sb->sb_blksize);
+  journal->j_batch = kmalloc (sb->sb_blksize * EXT2_JOURNAL_BATCH);
+  if (unlikely (journal->j_map == NULL || journal->j_super == NULL
+		|| journal->j_scratch == NULL || journal->j_batch == NULL))
+    {
+      ret = -ENOMEM;
+      goto err;
+    }
+
+  /* Map the journal once so log writes don't have to walk the inode */
+  for (i = 0; i < nblocks; i++)
+    {
+      ret = ext2_bmap (sb, journal->j_ino, &journal->j_inode, NULL, 0, i,
+		       NULL, &journal->j_map[i]);
+      if (ret != 0)
+	goto err;
+      if (journal->j_map[i] == 0)
+	{
+	  ret = -EINVAL;
+	  goto err;
+	}
+    }
+
+  ret = ext2_journal_read_raw (sb, journal->j_super, journal->j_map[0], 1);
+  if (ret != 0)
+    goto err;
+  ret = ext2_journal_check_super (sb, journal, nblocks);
+  if (ret != 0)
+    goto err;
+
+  journal->j_first = be32toh (journal->j_super->s_first);
+  journal->j_last = be32toh (journal->j_super->s_maxlen);
+  journal->j_tag_size = ext2_journal_tag_size (journal);
+  journal->j_tags_per_block = (sb->sb_blksize - sizeof (Jbd2Header) -
+			       JBD2_UUID_SIZE -
+			       ext2_journal_tail_size (journal)) /
+    journal->j_tag_size;
+  journal->j_max_transaction = MIN ((journal->j_last - journal->j_first) / 4,
+				    EXT2_JOURNAL_MAX_BUFFERS);
+  journal->j_group =
+    kmalloc (sizeof (Ext2JournalBuffer *) * journal->j_tags_per_block);
+  if (unlikely (journal->j_group == NULL))
+    {
+      ret = -ENOMEM;
+      goto err;
+    }
+
+  if (journal->j_super->s_start != 0)
+    {
+      count = ext2_journal_recover (sb, journal);
+      if (count < 0)
+	{
+	  ret = count;
+	  goto err;
+	}
+    }
+  else
+    journal->j_tid = be32toh (journal->j_super->s_sequence);
+
+  journal->j_head = journal->j_first;
+  journal->j_free = journal->j_last - journal->j_first;
+  journal->j_commit_time = time (NULL);
+  if (!(sb->sb_mntflags & MS_RDONLY) || journal->j_super->s_start != 0)
+    {
+      journal->j_super->s_feature_incompat |=
+	htobe32 (JBD2_FT_INCOMPAT_REVOKE);
+      ret = ext2_journal_write_super (sb, journal, 0, journal->j_tid);
+      if (ret != 0)
+	goto err;
+    }
+  fs->f_journal = journal;
+
+  /* Replayed blocks may be cached from before recovery */
+  if (count > 0 && fs->f_icache != NULL)
+    {
+      ext2_free_inode_cache (fs->f_icache);
+      fs->f_icache = NULL;
+    }
+  return count > 0;
+
+ err:
+  ext2_journal_destroy (journal);
+  return ret;
+}
+
+void
+ext2_journal_free (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  if (fs->f_journal == NULL)
+    return;
+  ext2_journal_destroy (fs->f_journal);
+  fs->f_journal = NULL;
+}
+
+int
+ext2_journal_close (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  int ret;
+  if (fs->f_journal == NULL)
+    return 0;
+  ret = ext2_journal_commit (sb);
+  if (ret == 0)
+    ret = ext2_journal_checkpoint (sb, fs->f_journal);
+  if (ret != 0)
+    return ret;
+  ext2_journal_free (sb);
+  return 0;
+}
+
+void
+ext2_journal_start (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  if (fs->f_journal != NULL)
+    fs->f_journal->j_handles++;
+}
+
+/* Ends an update started with ext2_journal_start. The running transaction
+   is committed once no updates are in progress and it is either full or
+   older than the commit interval, so several updates share one commit. */
+
+int
+ext2_journal_stop (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal = fs->f_journal;
+  if (journal == NULL || --journal->j_handles > 0 || journal->j_committing)
+    return 0;
+  if (journal->j_commit_request
+      || time (NULL) - journal->j_commit_time >= EXT2_JOURNAL_COMMIT_INTERVAL)
+    return ext2_journal_commit (sb);
+  return 0;
+}
+
+/* Ends an update like ext2_journal_stop. RET is the result of the update,
+   which is returned unless it succeeded and the commit failed. */
+
+int
+ext2_journal_end (VFSSuperblock *sb, int ret)
+{
+  int err = ext2_journal_stop (sb);
+  return ret >= 0 && err != 0 ? err : ret;
+}
+
+int
+ext2_journal_commit (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal = fs->f_journal;
+  int ret = 0;
+  if (journal == NULL || journal->j_committing)
+    return 0;
+  if (journal->j_handles > 0)
+    {
+      journal->j_commit_request = 1;
+      return 0;
+    }
+
+  journal->j_committing = 1;
+  journal->j_commit_time = time (NULL);
+  if (journal->j_running == 0 && !(fs->f_flags & EXT2_FLAG_DIRTY))
+    goto end;
+
+  /* Ordered mode: file data reaches the disk before any metadata that
+     refers to it is committed */
+  ret = page_cache_sync_sb (sb);
+  if (ret != 0)
+    goto end;
+  ext2_flush_files (sb);
+  if (fs->f_flags & EXT2_FLAG_DIRTY)
+    {
+      ret = ext2_flush (sb, 0);
+      if (ret != 0)
+	goto end;
+    }
+
+  if (journal->j_running > 0)
+    {
+      ret = ext2_journal_write_transaction (sb, journal);
+      if (ret != 0)
+	goto end;
+    }
+  if (journal->j_free < (journal->j_last - journal->j_first) / 2
+      || journal->j_count >= EXT2_JOURNAL_MAX_BUFFERS)
+    ret = ext2_journal_checkpoint (sb, journal);
+
+ end:
+  journal->j_commit_request = 0;
+  journal->j_committing = 0;
+  return ret;
+}
+
+void
+ext2_journal_read_blocks (VFSSuperblock *sb, void *buffer, block_t block,
+			  size_t nblocks)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal = fs->f_journal;
+  size_t i;
+  if (journal->j_count == 0)
+    return;
+  for (i = 0; i < nblocks; i++)
+    {
+      Ext2JournalBuffer *b = *ext2_journal_lookup (journal, block + i);
+      if (b != NULL && !b->jb_revoked)
+	memcpy (buffer + i * sb->sb_blksize, b->jb_data, sb->sb_blksize);
+    }
+}
+
+int
+ext2_journal_write_blocks (VFSSuperblock *sb, const void *buffer,
+			   block_t block, size_t nblocks)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal = fs->f_journal;
+  size_t i;
+  for (i = 0; i < nblocks; i++)
+    {
+      Ext2JournalBuffer **ptr = ext2_journal_lookup (journal, block + i);
+      Ext2JournalBuffer *b = *ptr;
+      if (b == NULL)
+	{
+	  b = kmalloc (sizeof (Ext2JournalBuffer) + sb->sb_blksize);
+	  if (unlikely (b == NULL))
+	    return -ENOMEM;
+	  b->jb_block = block + i;
+	  b->jb_tid = journal->j_tid;
+	  b->jb_logged = 0;
+	  b->jb_next = NULL;
+	  *ptr = b;
+	  journal->j_count++;
+	  journal->j_running++;
+	}
+      else if (b->jb_tid != journal->j_tid)
+	{
+	  b->jb_tid = journal->j_tid;
+	  journal->j_running++;
+	}
+
+      /* Journaling a revoked block again cancels the revoke */
+      b->jb_revoked = 0;
+      memcpy (b->jb_data, buffer + i * sb->sb_blksize, sb->sb_blksize);
+    }
+  if (journal->j_running >= journal->j_max_transaction)
+    journal->j_commit_request = 1;
+  return 0;
+}
+
+/* Called when blocks are freed. Buffers that were never logged are dropped,
+   logged ones are turned into revoke records so replay does not overwrite
+   the blocks after they have been reused. */
+
+void
+ext2_journal_forget (VFSSuperblock *sb, block_t block, size_t nblocks)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2Journal *journal = fs->f_journal;
+  size_t i;
+  if (journal == NULL)
+    return;
+  for (i = 0; i < nblocks; i++)
+    {
+      Ext2JournalBuffer **ptr = ext2_journal_lookup (journal, block + i);
+      Ext2JournalBuffer *b = *ptr;
+      if (b == NULL || b->jb_revoked)
+	continue;
+      if (b->jb_logged)
+	{
+	  if (b->jb_tid != journal->j_tid)
+	    {
+	      b->jb_tid = journal->j_tid;
+	      journal->j_running++;
+	    }
+	  b->jb_revoked = 1;
+	}
+      else
+	{
+	  *ptr = b->jb_next;
+	  journal->j_count--;
+	  journal->j_running--;
+	  kfree (b);
+	}
+    }
+}
@@ -19,7 +19,9 @@
 #include <bits/mount.h>
 #include <fs/ext2.h>
 #include <libk/libk.h>
+#include <sys/rtld.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
 
 static int
 ext2_check_empty (VFSInode *dir, int entry, Ext2DirEntry *dirent, int offset,
@@ -139,6 +141,9 @@ ext2_process_unlink (VFSInode *dir, int entry, Ext2DirEntry *dirent, int offset,
       ext2_inode_alloc_stats (l->l_sb, dirent->d_inode, -1,
 			      S_ISDIR (inode.i_mode));
       ext2_dealloc_blocks (l->l_sb, dirent->d_inode, &inode, NULL, 0, ~0ULL);
+      ext2_xattr_delete_inode (l->l_sb, dirent->d_inode, &inode);
+      page_cache_invalidate (l->l_sb, dirent->d_inode);
+      rtld_cache_invalidate (l->l_sb, dirent->d_inode);
     }
   ext2_update_inode (l->l_sb, dirent->d_inode, &inode, sizeof (Ext2Inode));
 
@@ -0,0 +1,388 @@
+/*************************************************************************
+ * rbtree.c -- This file is part of OS/0.                                *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <fs/ext2.h>
+#include <libk/libk.h>
+#include <libk/rbtree.h>
+#include <vm/heap.h>
+
+/* Bitmaps are stored as a tree of extents of set bits, keyed by their first
+   bit relative to the start of the bitmap. Adjacent and overlapping extents
+   are always merged, so the bit after an extent is never set. */
+
+typedef struct
+{
+  RBNode e_node;
+  uint64_t e_start;
+  uint64_t e_count;
+} Ext2BmapExtent;
+
+#define extent_entry(node) rb_entry (node, Ext2BmapExtent, e_node)
+
+typedef struct
+{
+  RBTree p_tree;
+} Ext2RBPrivate;
+
+static inline uint64_t
+ext2_rb_extent_end (Ext2BmapExtent *ext)
+{
+  return ext->e_start + ext->e_count;
+}
+
+/* Returns the extent with the highest start not greater than BIT */
+
+static Ext2BmapExtent *
+ext2_rb_lookup (Ext2RBPrivate *priv, uint64_t bit)
+{
+  RBNode *node = priv->p_tree.rbt_root;
+  Ext2BmapExtent *best = NULL;
+  while (node != NULL)
+    {
+      Ext2BmapExtent *ext = extent_entry (node);
+      if (bit < ext->e_start)
+	node = node->rb_left;
+      else
+	{
+	  best = ext;
+	  node = node->rb_right;
+	}
+    }
+  return best;
+}
+
+static Ext2BmapExtent *
+ext2_rb_next (Ext2BmapExtent *ext)
+{
+  RBNode *node = rb_next (&ext->e_node);
+  return node == NULL ? NULL : extent_entry (node);
+}
+
+static Ext2BmapExtent *
+ext2_rb_new_extent (Ext2RBPrivate *priv, uint64_t start, uint64_t count)
+{
+  RBNode **link = &priv->p_tree.rbt_root;
+  RBNode *parent = NULL;
+  Ext2BmapExtent *ext = kmalloc (sizeof (Ext2BmapExtent));
+  if (unlikely (ext == NULL))
+    return NULL;
+  ext->e_start = start;
+  ext->e_count = count;
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (start < extent_entry (parent)->e_start)
+	link = &parent->rb_left;
+      else
+	link = &parent->rb_right;
+    }
+  rb_link (&priv->p_tree, &ext->e_node, parent, link);
+  return ext;
+}
+
+static void
+ext2_rb_free_extent (Ext2RBPrivate *priv, Ext2BmapExtent *ext)
+{
+  rb_erase (&priv->p_tree, &ext->e_node);
+  kfree (ext);
+}
+
+static int
+ext2_rb_insert_extent (Ext2RBPrivate *priv, uint64_t start, uint64_t count)
+{
+  Ext2BmapExtent *ext = ext2_rb_lookup (priv, start);
+  Ext2BmapExtent *next;
+  uint64_t end = start + count;
+  if (count == 0)
+    return 0;
+
+  /* Extend the extent before START if it touches the new one */
+  if (ext != NULL && start <= ext2_rb_extent_end (ext))
+    {
+      if (end <= ext2_rb_extent_end (ext))
+	return 0;
+      ext->e_count = end - ext->e_start;
+    }
+  else
+    {
+      ext = ext2_rb_new_extent (priv, start, count);
+      if (unlikely (ext == NULL))
+	return -ENOMEM;
+    }
+
+  /* Absorb following extents that now overlap or touch it */
+  while ((next = ext2_rb_next (ext)) != NULL
+	 && next->e_start <= ext2_rb_extent_end (ext))
+    {
+      if (ext2_rb_extent_end (next) > ext2_rb_extent_end (ext))
+	ext->e_count = ext2_rb_extent_end (next) - ext->e_start;
+      ext2_rb_free_extent (priv, next);
+    }
+  return 0;
+}
+
+static int
+ext2_rb_remove_extent (Ext2RBPrivate *priv, uint64_t start, uint64_t count)
+{
+  Ext2BmapExtent *ext = ext2_rb_lookup (priv, start);
+  uint64_t end = start + count;
+  if (count == 0)
+    return 0;
+  if (ext == NULL)
+    {
+      RBNode *first = rb_first (&priv->p_tree);
+      ext = first == NULL ? NULL : extent_entry (first);
+    }
+  else if (ext2_rb_extent_end (ext) <= start)
+    ext = ext2_rb_next (ext);
+
+  /* Removed range is inside the extent, split it. The new node is linked
+     before the old one shrinks so a failed allocation changes nothing. */
+  if (ext != NULL && ext->e_start < start && ext2_rb_extent_end (ext) > end)
+    {
+      if (ext2_rb_new_extent (priv, end, ext2_rb_extent_end (ext) - end)
+	  == NULL)
+	return -ENOMEM;
+      ext->e_count = start - ext->e_start;
+      return 0;
+    }
+
+  while (ext != NULL && ext->e_start < end)
+    {
+      Ext2BmapExtent *next = ext2_rb_next (ext);
+      uint64_t ext_end = ext2_rb_extent_end (ext);
+      if (ext->e_start < start)
+	ext->e_count = start - ext->e_start;
+      else if (ext_end > end)
+	{
+	  /* Moving the start forward keeps the extent in order */
+	  ext->e_start = end;
+	  ext->e_count = ext_end - end;
+	  return 0;
+	}
+      else
+	ext2_rb_free_extent (priv, ext);
+      ext = next;
+    }
+  return 0;
+}
+
+static void
+ext2_rb_set_bits (unsigned char *data, uint64_t first, uint64_t count)
+{
+  while (count > 0 && (first & 7) != 0)
+    {
+      fast_set_bit (data, first++);
+      count--;
+    }
+  memset (data + (first >> 3), 0xff, count >> 3);
+  first += count & ~7ULL;
+  count &= 7;
+  while (count-- > 0)
+    fast_set_bit (data, first++);
+}
+
+static int
+ext2_rb_new_bmap (VFSSuperblock *sb, Ext2Bitmap64 *bmap)
+{
+  Ext2RBPrivate *priv = kzalloc (sizeof (Ext2RBPrivate));
+  if (unlikely (priv == NULL))
+    return -ENOMEM;
+  bmap->b_private = priv;
+  return 0;
+}
+
+static void
+ext2_rb_free_bmap (Ext2Bitmap64 *bmap)
+{
+  Ext2RBPrivate *priv = bmap->b_private;
+  RBNode *node = priv->p_tree.rbt_root;
+  while (node != NULL)
+    {
+      RBNode *parent;
+      if (node->rb_left != NULL)
+	{
+	  node = node->rb_left;
+	  continue;
+	}
+      if (node->rb_right != NULL)
+	{
+	  node = node->rb_right;
+	  continue;
+	}
+      parent = node->rb_parent;
+      if (parent != NULL)
+	{
+	  if (parent->rb_left == node)
+	    parent->rb_left = NULL;
+	  else
+	    parent->rb_right = NULL;
+	}
+      kfree (extent_entry (node));
+      node = parent;
+    }
+  kfree (priv);
+}
+
+static int
+ext2_rb_mark_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
+{
+  return ext2_rb_insert_extent (bmap->b_private, arg - bmap->b_start, 1);
+}
+
+static int
+ext2_rb_unmark_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
+{
+  return ext2_rb_remove_extent (bmap->b_private, arg - bmap->b_start, 1);
+}
+
+static int
+ext2_rb_test_bmap (Ext2Bitmap64 *bmap, uint64_t arg)
+{
+  uint64_t bit = arg - bmap->b_start;
+  Ext2BmapExtent *ext = ext2_rb_lookup (bmap->b_private, bit);
+  return ext != NULL && bit < ext2_rb_extent_end (ext);
+}
+
+static int
+ext2_rb_mark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg, unsigned int num)
+{
+  return ext2_rb_insert_extent (bmap->b_private, arg - bmap->b_start, num);
+}
+
+static int
+ext2_rb_unmark_bmap_extent (Ext2Bitmap64 *bmap, uint64_t arg,
+			    unsigned int num)
+{
+  return ext2_rb_remove_extent (bmap->b_private, arg - bmap->b_start, num);
+}
+
+static int
+ext2_rb_set_bmap_range (Ext2Bitmap64 *bmap, uint64_t start, size_t num,
+			void *data)
+{
+  Ext2RBPrivate *priv = bmap->b_private;
+  const unsigned char *bytes = data;
+  uint64_t bit = start - bmap->b_start;
+  size_t run = 0;
+  size_t i = 0;
+  int ret = ext2_rb_remove_extent (priv, bit, num);
+  if (ret != 0)
+    return ret;
+
+  while (i < num)
+    {
+      /* Skip over whole bytes with no bits set */
+      if ((i & 7) == 0 && run == 0 && num - i >= 8 && bytes[i >> 3] == 0)
+	{
+	  i += 8;
+	  continue;
+	}
+      if (fast_test_bit (bytes, i))
+	run++;
+      else if (run > 0)
+	{
+	  ret = ext2_rb_insert_extent (priv, bit + i - run, run);
+	  if (ret != 0)
+	    return ret;
+	  run = 0;
+	}
+      i++;
+    }
+  if (run > 0)
+    return ext2_rb_insert_extent (priv, bit + num - run, run);
+  return 0;
+}
+
+static void
+ext2_rb_get_bmap_range (Ext2Bitmap64 *bmap, uint64_t start, size_t num,
+			void *data)
+{
+  Ext2RBPrivate *priv = bmap->b_private;
+  uint64_t bit = start - bmap->b_start;
+  uint64_t end = bit + num;
+  Ext2BmapExtent *ext = ext2_rb_lookup (priv, bit);
+
+  memset (data, 0, (num + 7) >> 3);
+  if (ext == NULL)
+    {
+      RBNode *first = rb_first (&priv->p_tree);
+      ext = first == NULL ? NULL : extent_entry (first);
+    }
+  for (; ext != NULL && ext->e_start < end; ext = ext2_rb_next (ext))
+    {
+      uint64_t first = MAX (ext->e_start, bit);
+      uint64_t last = MIN (ext2_rb_extent_end (ext), end);
+      if (first < last)
+	ext2_rb_set_bits (data, first - bit, last - first);
+    }
+}
+
+static int
+ext2_rb_find_first_zero (Ext2Bitmap64 *bmap, uint64_t start, uint64_t end,
+			 uint64_t *result)
+{
+  uint64_t bit = start - bmap->b_start;
+  Ext2BmapExtent *ext = ext2_rb_lookup (bmap->b_private, bit);
+  if (ext != NULL && bit < ext2_rb_extent_end (ext))
+    bit = ext2_rb_extent_end (ext);
+  if (bit > end - bmap->b_start)
+    return -ENOENT;
+  *result = bit + bmap->b_start;
+  return 0;
+}
+
+static int
+ext2_rb_find_first_set (Ext2Bitmap64 *bmap, uint64_t start, uint64_t end,
+			uint64_t *result)
+{
+  Ext2RBPrivate *priv = bmap->b_private;
+  uint64_t bit = start - bmap->b_start;
+  Ext2BmapExtent *ext = ext2_rb_lookup (priv, bit);
+  if (ext != NULL && bit < ext2_rb_extent_end (ext))
+    {
+      *result = start;
+      return 0;
+    }
+  if (ext == NULL)
+    {
+      RBNode *first = rb_first (&priv->p_tree);
+      ext = first == NULL ? NULL : extent_entry (first);
+    }
+  else
+    ext = ext2_rb_next (ext);
+  if (ext == NULL || ext->e_start > end - bmap->b_start)
+    return -ENOENT;
+  *result = ext->e_start + bmap->b_start;
+  return 0;
+}
+
+Ext2BitmapOps ext2_rbtree_ops = {
+  .b_type = EXT2_BMAP64_RBTREE,
+  .b_new_bmap = ext2_rb_new_bmap,
+  .b_free_bmap = ext2_rb_free_bmap,
+  .b_mark_bmap = ext2_rb_mark_bmap,
+  .b_unmark_bmap = ext2_rb_unmark_bmap,
+  .b_test_bmap = ext2_rb_test_bmap,
+  .b_mark_bmap_extent = ext2_rb_mark_bmap_extent,
+  .b_unmark_bmap_extent = ext2_rb_unmark_bmap_extent,
+  .b_set_bmap_range = ext2_rb_set_bmap_range,
+  .b_get_bmap_range = ext2_rb_get_bmap_range,
+  .b_find_first_zero = ext2_rb_find_first_zero,
+  .b_find_first_set = ext2_rb_find_first_set
+};
@@ -45,6 +45,10 @@ const VFSInodeOps ext2_iops = {
   .vfs_symlink = ext2_symlink,
   .vfs_read = ext2_read,
   .vfs_write = ext2_write,
+  .vfs_read_iter = ext2_read_iter,
+  .vfs_write_iter = ext2_write_iter,
+  .vfs_readpage = ext2_readpage,
+  .vfs_writepage = ext2_writepage,
   .vfs_readdir = ext2_readdir,
   .vfs_chmod = ext2_chmod,
   .vfs_chown = ext2_chown,
@@ -99,7 +103,7 @@ ext2_openfs (SpecDevice *dev, VFSSuperblock *sb, Ext2Filesystem *fs)
 	  && (fs->f_super.s_feature_ro_compat & ~EXT2_RO_COMPAT_SUPPORTED)))
     return -ENOTSUP;
   if (fs->f_super.s_feature_incompat & EXT3_FT_INCOMPAT_JOURNAL_DEV)
-    return -ENOTSUP; /* Journals are currently not supported */
+    return -ENOTSUP; /* External journal devices are not supported */
 
   /* Check for valid block and cluster sizes */
   if (fs->f_super.s_log_block_size >
@@ -244,6 +248,7 @@ ext2_mount (VFSMount *mp, int flags, void *data)
   SpecDevice *dev;
   Ext2Filesystem *fs;
   int ret;
+  int i;
   if (data == NULL)
     return -EINVAL;
 
@@ -265,6 +270,10 @@ ext2_mount (VFSMount *mp, int flags, void *data)
   fs = kzalloc (sizeof (Ext2Filesystem));
   if (unlikely (fs == NULL))
     return -ENOMEM;
+  fs->f_dir_version = 1;
+  for (i = 0; i < EXT2_XATTR_VERSION_SIZE; i++)
+    fs->f_xattr_version[i] = 1;
+  fs->f_default_bitmap_type = EXT2_BMAP64_AUTODIR;
   mp->vfs_sb.sb_dev = dev;
   mp->vfs_sb.sb_private = fs;
   ret = ext2_openfs (dev, &mp->vfs_sb, fs);
@@ -274,6 +283,27 @@ ext2_mount (VFSMount *mp, int flags, void *data)
       return ret;
     }
 
+  if (fs->f_super.s_feature_compat & EXT3_FT_COMPAT_HAS_JOURNAL)
+    {
+      ret = ext2_journal_load (&mp->vfs_sb);
+      if (ret > 0)
+	{
+	  /* Recovery replayed metadata that was read above */
+	  kfree (fs->f_group_desc);
+	  ret = ext2_openfs (dev, &mp->vfs_sb, fs);
+	}
+      else if (ret < 0)
+	kfree (fs->f_group_desc);
+      if (ret != 0)
+	{
+	  ext2_journal_free (&mp->vfs_sb);
+	  kfree (fs);
+	  return ret;
+	}
+      if (mp->vfs_sb.sb_mntflags & MS_RDONLY)
+	ext2_journal_free (&mp->vfs_sb);
+    }
+
   if (!(mp->vfs_sb.sb_mntflags & MS_RDONLY))
     {
       /* Update mount time and count */
@@ -282,6 +312,23 @@ ext2_mount (VFSMount *mp, int flags, void *data)
       fs->f_super.s_state &= ~EXT2_STATE_VALID;
       fs->f_flags |= EXT2_FLAG_CHANGED | EXT2_FLAG_DIRTY;
       ext2_flush (&mp->vfs_sb, 0);
+
+      /* The superblock is otherwise only journaled. Write the home copy
+	 directly so it says the journal needs recovery and the filesystem
+	 is not clean even if nothing is checkpointed before a crash. */
+      if (fs->f_journal != NULL)
+	{
+	  ret = dev->sd_write (dev, &fs->f_super, sizeof (Ext2Superblock),
+			       1024);
+	  if (ret != 0)
+	    {
+	      ext2_journal_free (&mp->vfs_sb);
+	      kfree (fs->f_group_desc);
+	      kfree (fs);
+	      return ret;
+	    }
+	}
+      ext2_journal_commit (&mp->vfs_sb);
     }
 
   mp->vfs_sb.sb_root = vfs_alloc_inode (&mp->vfs_sb);
@@ -299,6 +346,9 @@ ext2_mount (VFSMount *mp, int flags, void *data)
 int
 ext2_unmount (VFSMount *mp, int flags)
 {
+  int ret = ext2_journal_close (&mp->vfs_sb);
+  if (ret != 0)
+    return ret;
   return ext2_flush (&mp->vfs_sb, FLUSH_VALID);
 }
 
@@ -315,8 +365,10 @@ ext2_alloc_inode (VFSSuperblock *sb)
 void
 ext2_destroy_inode (VFSInode *inode)
 {
-  ext2_file_flush (inode->vi_private);
-  kfree (inode->vi_private);
+  Ext2File *file = inode->vi_private;
+  ext2_file_flush (file);
+  kfree (file->f_xattr);
+  kfree (file);
   kfree (inode);
 }
 
@@ -340,6 +392,7 @@ ext2_write_inode (VFSInode *inode)
 {
   Ext2Filesystem *fs = inode->vi_sb->sb_private;
   Ext2Inode *ei = inode->vi_private;
+  int ret;
 
   /* Update disk inode structure */
   ei->i_mode = inode->vi_mode;
@@ -356,19 +409,24 @@ ext2_write_inode (VFSInode *inode)
     ei->i_size_high = inode->vi_size >> 32;
 
   /* Write new inode to disk */
-  return ext2_update_inode (inode->vi_sb, inode->vi_ino, ei,
-			    sizeof (Ext2Inode));
+  ext2_journal_start (inode->vi_sb);
+  ret = ext2_update_inode (inode->vi_sb, inode->vi_ino, ei,
+			   sizeof (Ext2Inode));
+  return ext2_journal_end (inode->vi_sb, ret);
 }
 
 void
 ext2_free (VFSSuperblock *sb)
 {
   vfs_unref_inode (sb->sb_root);
+  ext2_free_bitmaps (sb);
+  ext2_xattr_free_cache (sb);
+  ext2_journal_free (sb);
   kfree (sb->sb_private);
 }
 
 void
-ext2_update (VFSSuperblock *sb)
+ext2_flush_files (VFSSuperblock *sb)
 {
   int i;
   for (i = 0; i < PROCESS_SYS_FILE_LIMIT; i++)
@@ -377,7 +435,17 @@ ext2_update (VFSSuperblock *sb)
 	  && process_fd_table[i].pf_inode->vi_sb == sb)
         ext2_file_flush (process_fd_table[i].pf_inode->vi_private);
     }
-  ext2_flush (sb, 0);
+}
+
+void
+ext2_update (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  ext2_flush_files (sb);
+  if (fs->f_journal != NULL)
+    ext2_journal_commit (sb);
+  else
+    ext2_flush (sb, 0);
 }
 
 int
@@ -38,6 +38,17 @@ ext2_bg_super_test_root (unsigned int group, unsigned int x)
     }
 }
 
+/* Marks bitmaps of GROUP to be written by the next flush. Bitmaps of groups
+   that were never loaded are not in memory and are left alone. */
+
+static void
+ext2_group_bitmap_dirty (Ext2Filesystem *fs, unsigned int group, int flags,
+			 int dirty)
+{
+  if (fs->f_bitmap_loaded != NULL && (fs->f_bitmap_loaded[group] & flags))
+    fs->f_bitmap_loaded[group] |= dirty;
+}
+
 static void
 ext2_clear_block_uninit (VFSSuperblock *sb, unsigned int group)
 {
@@ -48,6 +59,8 @@ ext2_clear_block_uninit (VFSSuperblock *sb, unsigned int group)
     return;
   ext2_bg_clear_flags (sb, group, EXT2_BG_BLOCK_UNINIT);
   ext2_group_desc_checksum_update (sb, group);
+  ext2_group_bitmap_dirty (fs, group, EXT2_BITMAP_BLOCK,
+			   EXT2_BITMAP_BLOCK_DIRTY);
   fs->f_flags |= EXT2_FLAG_CHANGED | EXT2_FLAG_DIRTY | EXT2_FLAG_BB_DIRTY;
 }
 
@@ -66,6 +79,8 @@ ext2_check_inode_uninit (VFSSuperblock *sb, Ext2Bitmap *map, unsigned int group)
     ext2_unmark_bitmap (map, ino);
   ext2_bg_clear_flags (sb, group, EXT2_BG_INODE_UNINIT | EXT2_BG_BLOCK_UNINIT);
   ext2_group_desc_checksum_update (sb, group);
+  ext2_group_bitmap_dirty (fs, group, EXT2_BITMAP_INODE,
+			   EXT2_BITMAP_INODE_DIRTY);
   fs->f_flags |= EXT2_FLAG_CHANGED | EXT2_FLAG_DIRTY | EXT2_FLAG_IB_DIRTY;
 }
 
@@ -102,7 +117,7 @@ ext2_file_zero_remainder (Ext2File *file, off64_t offset)
       return ret;
     }
   memset (b + off, 0, blksize - off);
-  ret = ext2_write_blocks (b, file->f_sb, block, 1);
+  ret = ext2_write_data_blocks (b, file->f_sb, block, 1);
   kfree (b);
   return ret;
 }
@@ -606,6 +621,14 @@ ext2_process_dir_block (VFSSuperblock *sb, block_t *blockno, blkcnt64_t blkcnt,
   int inline_data;
   int ret = 0;
 
+  /* Metadata blocks have negative block counts and are never directory
+     blocks, and blocks before the starting point are skipped unread */
+  if (blkcnt < ctx->d_start)
+    return 0;
+  *ctx->d_blkcnt = blkcnt;
+  if (blkcnt == ctx->d_start)
+    offset = next_real_entry = ctx->d_start_offset;
+
   entry = blkcnt == 0 ? DIRENT_DOT_FILE : DIRENT_OTHER_FILE;
   inline_data = ctx->d_flags & DIRENT_FLAG_INLINE ? 1 : 0;
   if (!inline_data)
@@ -736,13 +759,18 @@ ext2_process_dir_expand (VFSSuperblock *sb, block_t *blockno, blkcnt64_t blkcnt,
     {
       e->de_goal &= ~EXT2_CLUSTER_MASK (fs);
       ret = ext2_new_block (sb, e->de_goal, NULL, &newblock, NULL);
+      if (ret != 0)
+	{
+	  e->de_err = ret;
+	  return BLOCK_ABORT;
+	}
+      ret = ext2_block_alloc_stats (sb, newblock, 1);
       if (ret != 0)
 	{
 	  e->de_err = ret;
 	  return BLOCK_ABORT;
 	}
       e->de_newblocks++;
-      ext2_block_alloc_stats (sb, newblock, 1);
     }
 
   if (blkcnt > 0)
@@ -1180,17 +1208,23 @@ ext2_map_cluster_block (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
   return 0;
 }
 
-void
+int
 ext2_inode_alloc_stats (VFSSuperblock *sb, ino64_t ino, int inuse, int isdir)
 {
   Ext2Filesystem *fs = sb->sb_private;
   unsigned int group = ext2_group_of_inode (fs, ino);
+  int ret;
   if (ino > fs->f_super.s_inodes_count)
-    return;
+    return -EINVAL;
+  ret = ext2_load_group_bitmaps (sb, EXT2_BITMAP_INODE, group);
+  if (ret != 0)
+    return ret;
   if (inuse > 0)
-    ext2_mark_bitmap (fs->f_inode_bitmap, ino);
+    ret = ext2_mark_bitmap (fs->f_inode_bitmap, ino);
   else
-    ext2_unmark_bitmap (fs->f_inode_bitmap, ino);
+    ret = ext2_unmark_bitmap (fs->f_inode_bitmap, ino);
+  if (ret != 0)
+    return ret;
   ext2_bg_free_inodes_count_set (sb, group,
 				 ext2_bg_free_inodes_count (sb, group) - inuse);
   if (isdir)
@@ -1209,27 +1243,41 @@ ext2_inode_alloc_stats (VFSSuperblock *sb, ino64_t ino, int inuse, int isdir)
       ext2_group_desc_checksum_update (sb, group);
     }
   fs->f_super.s_free_inodes_count -= inuse;
+  fs->f_bitmap_loaded[group] |= EXT2_BITMAP_INODE_DIRTY;
   fs->f_flags |= EXT2_FLAG_CHANGED | EXT2_FLAG_DIRTY | EXT2_FLAG_IB_DIRTY;
+  return 0;
 }
 
-void
+int
 ext2_block_alloc_stats (VFSSuperblock *sb, block_t block, int inuse)
 {
   Ext2Filesystem *fs = sb->sb_private;
   unsigned int group = ext2_group_of_block (fs, block);
+  int ret;
   if (block >= ext2_blocks_count (&fs->f_super))
-    return;
+    return -EINVAL;
+  ret = ext2_load_group_bitmaps (sb, EXT2_BITMAP_BLOCK, group);
+  if (ret != 0)
+    return ret;
+
+  /* A block that cannot be unmarked stays allocated, which only leaks it */
   if (inuse > 0)
-    ext2_mark_bitmap (fs->f_block_bitmap, block);
+    ret = ext2_mark_bitmap (fs->f_block_bitmap, block);
   else
-    ext2_unmark_bitmap (fs->f_block_bitmap, block);
+    ret = ext2_unmark_bitmap (fs->f_block_bitmap, block);
+  if (ret != 0)
+    return ret;
+  if (inuse <= 0)
+    ext2_journal_forget (sb, block, 1);
   ext2_bg_free_blocks_count_set (sb, group,
 				 ext2_bg_free_blocks_count (sb, group) - inuse);
   ext2_bg_clear_flags (sb, group, EXT2_BG_BLOCK_UNINIT);
   ext2_group_desc_checksum_update (sb, group);
   ext2_free_blocks_count_add (&fs->f_super,
 			      -inuse * (blkcnt64_t) EXT2_CLUSTER_RATIO (fs));
+  fs->f_bitmap_loaded[group] |= EXT2_BITMAP_BLOCK_DIRTY;
   fs->f_flags |= EXT2_FLAG_CHANGED | EXT2_FLAG_DIRTY | EXT2_FLAG_BB_DIRTY;
+  return 0;
 }
 
 int
@@ -1248,7 +1296,25 @@ ext2_write_backup_superblock (VFSSuperblock *sb, unsigned int group,
 int
 ext2_write_primary_superblock (VFSSuperblock *sb, Ext2Superblock *s)
 {
-  return sb->sb_dev->sd_write (sb->sb_dev, s, sizeof (Ext2Superblock), 1024);
+  Ext2Filesystem *fs = sb->sb_private;
+  char *buffer;
+  int ret;
+  if (fs->f_journal == NULL)
+    return sb->sb_dev->sd_write (sb->sb_dev, s, sizeof (Ext2Superblock),
+				 1024);
+
+  /* Journal the block containing the superblock */
+  buffer = kmalloc (sb->sb_blksize);
+  if (unlikely (buffer == NULL))
+    return -ENOMEM;
+  ret = ext2_read_blocks (buffer, sb, 1024 / sb->sb_blksize, 1);
+  if (ret == 0)
+    {
+      memcpy (buffer + 1024 % sb->sb_blksize, s, sizeof (Ext2Superblock));
+      ret = ext2_write_blocks (buffer, sb, 1024 / sb->sb_blksize, 1);
+    }
+  kfree (buffer);
+  return ret;
 }
 
 int
@@ -1272,7 +1338,10 @@ ext2_flush (VFSSuperblock *sb, int flags)
   fs->f_super.s_wtime = fs->f_now != 0 ? fs->f_now : time (NULL);
   fs->f_super.s_block_group_nr = 0;
   fs->f_super.s_state &= ~EXT2_STATE_VALID;
-  fs->f_super.s_feature_incompat &= ~EXT3_FT_INCOMPAT_RECOVER;
+  if (fs->f_journal != NULL)
+    fs->f_super.s_feature_incompat |= EXT3_FT_INCOMPAT_RECOVER;
+  else
+    fs->f_super.s_feature_incompat &= ~EXT3_FT_INCOMPAT_RECOVER;
 
   ret = ext2_write_bitmaps (sb);
   if (ret != 0)
@@ -1301,6 +1370,16 @@ ext2_flush (VFSSuperblock *sb, int flags)
       block_t new_desc_block;
       ext2_super_bgd_loc (sb, i, &super_block, &old_desc_block, &new_desc_block,
 			  NULL);
+
+      /* Only the primary copies are journaled, backups are written when
+	 the journal is closed */
+      if (fs->f_journal != NULL && i > 0)
+	{
+	  super_block = 0;
+	  old_desc_block = 0;
+	  if (i % EXT2_DESC_PER_BLOCK (fs->f_super))
+	    new_desc_block = 0;
+	}
       if (i > 0 && super_block != 0)
 	{
 	  ret = ext2_write_backup_superblock (sb, i, super_block, super_shadow);
@@ -1346,6 +1425,7 @@ ext2_open_file (VFSSuperblock *sb, ino64_t inode, Ext2File *file)
   file->f_ino = inode;
   file->f_sb = sb;
   file->f_flags = 0;
+  file->f_xattr = NULL;
   file->f_buffer = kmalloc (sb->sb_blksize * 3);
   if (unlikely (file->f_buffer == NULL))
     return -ENOMEM;
@@ -1413,10 +1493,16 @@ ext2_file_set_size (Ext2File *file, off64_t size)
 
 int
 ext2_read_inode (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode)
+{
+  return ext2_read_inode_full (sb, ino, inode, sizeof (Ext2Inode));
+}
+
+int
+ext2_read_inode_full (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
+		      size_t bufsize)
 {
   Ext2Filesystem *fs = sb->sb_private;
   int len = EXT2_INODE_SIZE (fs->f_super);
-  size_t bufsize = sizeof (Ext2Inode);
   Ext2LargeInode *iptr;
   char *ptr;
   block_t blockno;
@@ -1816,7 +1902,8 @@ ext2_file_flush (Ext2File *file)
 	return ret;
     }
 
-  ret = ext2_write_blocks (file->f_buffer, file->f_sb, file->f_physblock, 1);
+  ret = ext2_write_data_blocks (file->f_buffer, file->f_sb, file->f_physblock,
+				1);
   if (ret != 0)
     return ret;
   file->f_flags &= ~EXT2_FILE_BUFFER_DIRTY;
@@ -1976,7 +2063,7 @@ ext2_zero_blocks (VFSSuperblock *sb, block_t block, int num, block_t *result,
 	  if (c > stride_len)
 	    c = stride_len;
 	}
-      ret = ext2_write_blocks (buffer, sb, block, c);
+      ret = ext2_write_data_blocks (buffer, sb, block, c);
       if (ret != 0)
 	{
 	  if (count != NULL)
@@ -2058,9 +2145,12 @@ int
 ext2_write_dir_block (VFSSuperblock *sb, block_t block, char *buffer, int flags,
 		      VFSInode *inode)
 {
+  Ext2Filesystem *fs = sb->sb_private;
   int ret = ext2_dir_block_checksum_update (sb, inode, (Ext2DirEntry *) buffer);
   if (ret != 0)
     return ret;
+  if (++fs->f_dir_version == 0)
+    fs->f_dir_version = 1;
   return ext2_write_blocks (buffer, sb, block, 1);
 }
 
@@ -2070,22 +2160,53 @@ ext2_new_block (VFSSuperblock *sb, block_t goal, Ext2Bitmap *map,
 {
   Ext2Filesystem *fs = sb->sb_private;
   block_t b = 0;
+  block_t start;
+  block_t end;
+  unsigned int group;
+  unsigned int i;
   int ret;
   if (map == NULL)
-    map = fs->f_block_bitmap;
-  if (map == NULL)
-    return -EINVAL;
-
-  if (goal == 0 || goal >= ext2_blocks_count (&fs->f_super))
-    goal &= ~EXT2_CLUSTER_MASK (fs);
-
-  ret = ext2_find_first_zero_bitmap (map, goal,
-				     ext2_blocks_count (&fs->f_super) - 1, &b);
-  if (ret == -ENOENT && goal != fs->f_super.s_first_data_block)
-    ret = ext2_find_first_zero_bitmap (map, fs->f_super.s_first_data_block,
-				       goal - 1, &b);
-  if (ret == -ENOENT)
-    return -ENOENT;
+    {
+      ret = ext2_read_bitmaps (sb);
+      if (ret != 0)
+	return ret;
+      map = fs->f_block_bitmap;
+    }
+
+  if (goal < fs->f_super.s_first_data_block
+      || goal >= ext2_blocks_count (&fs->f_super))
+    goal = fs->f_super.s_first_data_block;
+  goal &= ~EXT2_CLUSTER_MASK (fs);
+  if (goal < fs->f_super.s_first_data_block)
+    goal = fs->f_super.s_first_data_block;
+
+  /* Search group by group starting at the goal, so only the bitmaps of
+     groups the search reaches have to be read. The group of the goal is
+     visited again at the end for the blocks before the goal. */
+  group = ext2_group_of_block (fs, goal);
+  for (i = 0; i <= fs->f_group_desc_count; i++)
+    {
+      unsigned int g = (group + i) % fs->f_group_desc_count;
+      start = i == 0 ? goal : ext2_group_first_block (fs, g);
+      end = ext2_group_last_block (fs, g);
+      if (i == fs->f_group_desc_count)
+	{
+	  if (goal == start)
+	    break;
+	  end = goal - 1;
+	}
+      if (map == fs->f_block_bitmap)
+	{
+	  ret = ext2_load_group_bitmaps (sb, EXT2_BITMAP_BLOCK, g);
+	  if (ret != 0)
+	    return ret;
+	}
+      ret = ext2_find_first_zero_bitmap (map, start, end, &b);
+      if (ret == 0)
+	break;
+      if (ret != -ENOENT)
+	return ret;
+    }
   if (ret != 0)
     return ret;
   ext2_clear_block_uninit (sb, ext2_group_of_block (fs, b));
@@ -2106,9 +2227,12 @@ ext2_new_inode (VFSSuperblock *sb, ino64_t dir, Ext2Bitmap *map,
   unsigned int group;
   int ret;
   if (map == NULL)
-    map = fs->f_inode_bitmap;
-  if (map == NULL)
-    return -EINVAL;
+    {
+      ret = ext2_read_bitmaps (sb);
+      if (ret != 0)
+	return ret;
+      map = fs->f_inode_bitmap;
+    }
 
   if (dir > 0)
     {
@@ -2127,6 +2251,12 @@ ext2_new_inode (VFSSuperblock *sb, ino64_t dir, Ext2Bitmap *map,
       ino_in_group = (i - 1) % fs->f_super.s_inodes_per_group;
       group = (i - 1) / fs->f_super.s_inodes_per_group;
 
+      if (map == fs->f_inode_bitmap)
+	{
+	  ret = ext2_load_group_bitmaps (sb, EXT2_BITMAP_INODE, group);
+	  if (ret != 0)
+	    return ret;
+	}
       ext2_check_inode_uninit (sb, map, group);
       upto = i + fs->f_super.s_inodes_per_group - ino_in_group;
 
@@ -2233,9 +2363,12 @@ ext2_new_file (VFSInode *dir, const char *name, mode_t mode, VFSInode **result)
   ei->i_uid = proc->p_euid;
   ei->i_gid = proc->p_egid;
   ei->i_links_count = 1;
+  ext2_journal_start (dir->vi_sb);
   ext2_write_new_inode (dir->vi_sb, ino, ei);
-  ext2_inode_alloc_stats (dir->vi_sb, ino, 1, S_ISDIR (ei->i_mode));
-  ret = ext2_add_link (dir->vi_sb, dir, name, ino, ext2_dir_type (mode));
+  ret = ext2_inode_alloc_stats (dir->vi_sb, ino, 1, S_ISDIR (ei->i_mode));
+  if (ret == 0)
+    ret = ext2_add_link (dir->vi_sb, dir, name, ino, ext2_dir_type (mode));
+  ret = ext2_journal_end (dir->vi_sb, ret);
 
   inode->vi_ino = ino;
   inode->vi_mode = ei->i_mode;
@@ -2254,31 +2387,24 @@ int
 ext2_alloc_block (VFSSuperblock *sb, block_t goal, char *blockbuf,
 		  block_t *result, Ext2BlockAllocContext *ctx)
 {
-  Ext2Filesystem *fs = sb->sb_private;
   block_t block;
-  int ret;
-  if (fs->f_block_bitmap == NULL)
-    {
-      ret =
-	ext2_read_bitmap (sb, EXT2_BITMAP_BLOCK, 0, fs->f_group_desc_count - 1);
-      if (ret != 0)
-	return ret;
-    }
-  ret = ext2_new_block (sb, goal, NULL, &block, ctx);
+  int ret = ext2_new_block (sb, goal, NULL, &block, ctx);
   if (ret != 0)
     return ret;
   if (blockbuf != NULL)
     {
       memset (blockbuf, 0, sb->sb_blksize);
-      ret = ext2_write_blocks (blockbuf, sb, block, 1);
+      ret = ext2_write_data_blocks (blockbuf, sb, block, 1);
     }
   else
     ret = ext2_zero_blocks (sb, block, 1, NULL, NULL);
   if (ret != 0)
     return ret;
-  ext2_block_alloc_stats (sb, block, 1);
+  ret = ext2_block_alloc_stats (sb, block, 1);
+  if (ret != 0)
+    return ret;
   *result = block;
-  return ret;
+  return 0;
 }
 
 int
@@ -2335,6 +2461,8 @@ ext2_expand_dir (VFSInode *dir)
     return -EROFS;
   if (!S_ISDIR (dir->vi_mode))
     return -ENOTDIR;
+  if (file->f_inode.i_flags & EXT4_INLINE_DATA_FL)
+    return ext2_inline_data_expand (dir);
   e.de_done = 0;
   e.de_err = 0;
   e.de_goal = ext2_find_inode_goal (dir->vi_sb, dir->vi_ino, &file->f_inode, 0);
@@ -2361,13 +2489,29 @@ int
 ext2_read_blocks (void *buffer, VFSSuperblock *sb, uint32_t block,
 		  size_t nblocks)
 {
-  return sb->sb_dev->sd_read (sb->sb_dev, buffer, nblocks * sb->sb_blksize,
-			      block * sb->sb_blksize);
+  Ext2Filesystem *fs = sb->sb_private;
+  int ret = sb->sb_dev->sd_read (sb->sb_dev, buffer, nblocks * sb->sb_blksize,
+				 block * sb->sb_blksize);
+  if (ret == 0 && fs->f_journal != NULL)
+    ext2_journal_read_blocks (sb, buffer, block, nblocks);
+  return ret;
 }
 
+/* Metadata blocks go through the journal if there is one */
+
 int
 ext2_write_blocks (const void *buffer, VFSSuperblock *sb, uint32_t block,
 		   size_t nblocks)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  if (fs->f_journal != NULL)
+    return ext2_journal_write_blocks (sb, buffer, block, nblocks);
+  return ext2_write_data_blocks (buffer, sb, block, nblocks);
+}
+
+int
+ext2_write_data_blocks (const void *buffer, VFSSuperblock *sb, uint32_t block,
+			size_t nblocks)
 {
   return sb->sb_dev->sd_write (sb->sb_dev, buffer, nblocks * sb->sb_blksize,
 			       block * sb->sb_blksize);
@@ -2653,11 +2797,94 @@ ext2_block_iterate (VFSSuperblock *sb, VFSInode *dir, int flags, char *blockbuf,
   return ret & BLOCK_ERROR ? ctx.b_err : 0;
 }
 
+/* Iterates over the entries of an inline directory. The implicit `.' and
+   `..' entries are passed as block 0, the entries stored in i_block as
+   block 1 and the entries in the system.data attribute as block 2. */
+
+static int
+ext2_inline_dir_iterate (VFSSuperblock *sb, Ext2DirContext *ctx)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  VFSInode *dir = ctx->d_dir;
+  Ext2DirEntry *dirent;
+  Ext2DirEntry dots[2];
+  char *buffer = ctx->d_buffer;
+  char *data;
+  size_t size;
+  block_t block = 0;
+  int filetype = 0;
+  int changed = 0;
+  int ret = ext2_inline_data_get (dir, &data, &size);
+  if (ret != 0)
+    return ret;
+
+  if (fs->f_super.s_feature_incompat & EXT2_FT_INCOMPAT_FILETYPE)
+    filetype = EXT2_DIRTYPE_DIR << 8;
+  memset (dots, 0, sizeof (dots));
+  dirent = dots;
+  dirent->d_inode = dir->vi_ino;
+  dirent->d_rec_len = ext2_dir_rec_len (1, 0);
+  dirent->d_name_len = filetype | 1;
+  dirent->d_name[0] = '.';
+  dirent = (Ext2DirEntry *) ((char *) dots + ext2_dir_rec_len (1, 0));
+  dirent->d_inode = *((uint32_t *) data);
+  dirent->d_rec_len = ext2_dir_rec_len (2, 0);
+  dirent->d_name_len = filetype | 2;
+  dirent->d_name[0] = '.';
+  dirent->d_name[1] = '.';
+
+  ctx->d_flags |= DIRENT_FLAG_INLINE;
+  ctx->d_buffer = (char *) dots;
+  ctx->d_bufsize = ext2_dir_rec_len (1, 0) + ext2_dir_rec_len (2, 0);
+  ret = ext2_process_dir_block (sb, &block, 0, 0, 0, ctx);
+  if (!(ret & BLOCK_ABORT))
+    {
+      ctx->d_buffer = data + EXT4_INLINE_DOTDOT_SIZE;
+      ctx->d_bufsize = EXT4_MIN_INLINE_DATA_SIZE - EXT4_INLINE_DOTDOT_SIZE;
+      ret = ext2_process_dir_block (sb, &block, 1, 0, 0, ctx);
+      changed |= ret & BLOCK_INLINE_CHANGED;
+    }
+  if (!(ret & BLOCK_ABORT) && size > EXT4_MIN_INLINE_DATA_SIZE)
+    {
+      ctx->d_buffer = data + EXT4_MIN_INLINE_DATA_SIZE;
+      ctx->d_bufsize = size - EXT4_MIN_INLINE_DATA_SIZE;
+      ret = ext2_process_dir_block (sb, &block, 2, 0, 0, ctx);
+      changed |= ret & BLOCK_INLINE_CHANGED;
+    }
+  ctx->d_buffer = buffer;
+
+  ret = 0;
+  if (changed)
+    {
+      ret = ext2_inline_data_set (dir, data, size);
+      if (ret == 0 && ++fs->f_dir_version == 0)
+	fs->f_dir_version = 1;
+    }
+  kfree (data);
+  return ret;
+}
+
 int
 ext2_dir_iterate (VFSSuperblock *sb, VFSInode *dir, int flags, char *blockbuf,
 		  int (*func) (VFSInode *, int, Ext2DirEntry *, int, blksize_t,
 			       char *, void *), void *private)
 {
+  blkcnt64_t blkcnt = 0;
+  return ext2_dir_iterate_from (sb, dir, flags, blockbuf, &blkcnt, 0, func,
+				private);
+}
+
+/* Like ext2_dir_iterate, but starts at byte OFFSET of logical block
+   *BLKCNT, which must be the start of an entry. *BLKCNT is updated to the
+   block being processed so the callback can locate each entry. */
+
+int
+ext2_dir_iterate_from (VFSSuperblock *sb, VFSInode *dir, int flags,
+		       char *blockbuf, blkcnt64_t *blkcnt, unsigned int offset,
+		       int (*func) (VFSInode *, int, Ext2DirEntry *, int,
+				    blksize_t, char *, void *), void *private)
+{
+  Ext2File *file = dir->vi_private;
   Ext2DirContext ctx;
   int ret;
   if (!S_ISDIR (dir->vi_mode))
@@ -2676,13 +2903,17 @@ ext2_dir_iterate (VFSSuperblock *sb, VFSInode *dir, int flags, char *blockbuf,
   ctx.d_func = func;
   ctx.d_private = private;
   ctx.d_err = 0;
-  ret = ext2_block_iterate (sb, dir, BLOCK_FLAG_READ_ONLY, 0,
-			    ext2_process_dir_block, &ctx);
+  ctx.d_blkcnt = blkcnt;
+  ctx.d_start = *blkcnt;
+  ctx.d_start_offset = offset;
+  if (file->f_inode.i_flags & EXT4_INLINE_DATA_FL)
+    ret = ext2_inline_dir_iterate (sb, &ctx);
+  else
+    ret = ext2_block_iterate (sb, dir, BLOCK_FLAG_READ_ONLY, 0,
+			      ext2_process_dir_block, &ctx);
 
   if (blockbuf == NULL)
     kfree (ctx.d_buffer);
-  if (ret == -ENOTSUP)
-    return -ENOTSUP; /* TODO Support iterating over inline data */
   if (ret != 0)
     return ret;
   return ctx.d_err;
@@ -2917,6 +3148,41 @@ ext3_extent_block_checksum_update (VFSSuperblock *sb, ino64_t ino,
   return 0;
 }
 
+uint32_t
+ext2_xattr_block_checksum (VFSSuperblock *sb, block_t block,
+			   Ext2XattrHeader *h)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  uint64_t blockno = block;
+  uint32_t old = h->h_checksum;
+  uint32_t crc;
+  h->h_checksum = 0;
+  crc = crc32 (fs->f_checksum_seed, &blockno, sizeof (uint64_t));
+  crc = crc32 (crc, h, sb->sb_blksize);
+  h->h_checksum = old;
+  return crc;
+}
+
+int
+ext2_xattr_block_checksum_valid (VFSSuperblock *sb, block_t block,
+				 Ext2XattrHeader *h)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  if (!(fs->f_super.s_feature_ro_compat & EXT4_FT_RO_COMPAT_METADATA_CSUM))
+    return 1;
+  return h->h_checksum == ext2_xattr_block_checksum (sb, block, h);
+}
+
+void
+ext2_xattr_block_checksum_update (VFSSuperblock *sb, block_t block,
+				  Ext2XattrHeader *h)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  if (!(fs->f_super.s_feature_ro_compat & EXT4_FT_RO_COMPAT_METADATA_CSUM))
+    return;
+  h->h_checksum = ext2_xattr_block_checksum (sb, block, h);
+}
+
 uint32_t
 ext2_block_bitmap_checksum (VFSSuperblock *sb, unsigned int group)
 {
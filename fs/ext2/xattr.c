@@ -0,0 +1,854 @@
+/*************************************************************************
+ * xattr.c -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <bits/xattr.h>
+#include <fs/ext2.h>
+#include <libk/libk.h>
+#include <sys/ata.h>
+#include <sys/process.h>
+#include <vm/heap.h>
+
+typedef struct
+{
+  const char *xp_prefix;
+  int xp_index;
+  int xp_exact;
+} Ext2XattrPrefix;
+
+typedef struct
+{
+  int xi_index;
+  size_t xi_name_len;
+  const char *xi_name;
+  const void *xi_value;
+  size_t xi_value_len;
+  int xi_ibody;
+} Ext2XattrItem;
+
+static const Ext2XattrPrefix ext2_xattr_prefixes[] = {
+  {"user.", EXT2_XATTR_INDEX_USER, 0},
+  {"system.posix_acl_access", EXT2_XATTR_INDEX_POSIX_ACL_ACCESS, 1},
+  {"system.posix_acl_default", EXT2_XATTR_INDEX_POSIX_ACL_DEFAULT, 1},
+  {"trusted.", EXT2_XATTR_INDEX_TRUSTED, 0},
+  {"security.", EXT2_XATTR_INDEX_SECURITY, 0},
+  {NULL, 0, 0}
+};
+
+static int
+ext2_xattr_parse_name (const char *name, int *index, const char **suffix)
+{
+  const Ext2XattrPrefix *p;
+  for (p = ext2_xattr_prefixes; p->xp_prefix != NULL; p++)
+    {
+      size_t len = strlen (p->xp_prefix);
+      if (strncmp (name, p->xp_prefix, len) != 0)
+	continue;
+      if (p->xp_exact && name[len] != '\0')
+	continue;
+      if (!p->xp_exact && name[len] == '\0')
+	return -EINVAL;
+      if (strlen (name + len) > EXT2_MAX_NAME_LEN)
+	return -ERANGE;
+      *index = p->xp_index;
+      *suffix = name + len;
+      return 0;
+    }
+  return -ENOTSUP;
+}
+
+static const char *
+ext2_xattr_prefix (int index)
+{
+  const Ext2XattrPrefix *p;
+  for (p = ext2_xattr_prefixes; p->xp_prefix != NULL; p++)
+    {
+      if (p->xp_index == index)
+	return p->xp_prefix;
+    }
+  return NULL;
+}
+
+static int
+ext2_xattr_access (VFSInode *inode, int index, int write)
+{
+  if (index == EXT2_XATTR_INDEX_TRUSTED
+      && process_table[task_getpid ()].p_euid != 0)
+    return -EPERM;
+  if (index == EXT2_XATTR_INDEX_USER && !S_ISREG (inode->vi_mode)
+      && !S_ISDIR (inode->vi_mode))
+    return write ? -EPERM : -ENODATA;
+  return 0;
+}
+
+static uint32_t
+ext2_xattr_hash_entry (const Ext2XattrEntry *entry, const char *value)
+{
+  const unsigned char *name = (const unsigned char *) entry->e_name;
+  const uint32_t *v = (const uint32_t *) value;
+  uint32_t hash = 0;
+  size_t i;
+  for (i = 0; i < entry->e_name_len; i++)
+    hash = (hash << 5) ^ (hash >> 27) ^ name[i];
+  for (i = 0; i < EXT2_XATTR_SIZE (entry->e_value_size) / 4; i++)
+    hash = (hash << 16) ^ (hash >> 16) ^ v[i];
+  return hash;
+}
+
+static uint32_t
+ext2_xattr_hash_block (const char *block)
+{
+  const Ext2XattrEntry *entry =
+    (const Ext2XattrEntry *) (block + sizeof (Ext2XattrHeader));
+  uint32_t hash = 0;
+  while (*((const uint32_t *) entry) != 0)
+    {
+      if (entry->e_hash == 0)
+	return 0;
+      hash = (hash << 16) ^ (hash >> 16) ^ entry->e_hash;
+      entry = (const Ext2XattrEntry *) ((const char *) entry +
+					EXT2_XATTR_LEN (entry->e_name_len));
+    }
+  return hash;
+}
+
+static Ext2XattrCacheEntry **
+ext2_xattr_cache_find (Ext2Filesystem *fs, uint32_t hash, block_t block)
+{
+  Ext2XattrCacheEntry **entry = &fs->f_xattr_cache[hash %
+						     EXT2_XATTR_CACHE_SIZE];
+  for (; *entry != NULL; entry = &(*entry)->xc_next)
+    {
+      if ((*entry)->xc_block == block)
+	return entry;
+    }
+  return NULL;
+}
+
+static void
+ext2_xattr_cache_remove (Ext2Filesystem *fs, uint32_t hash, block_t block)
+{
+  Ext2XattrCacheEntry **entry = ext2_xattr_cache_find (fs, hash, block);
+  Ext2XattrCacheEntry *temp;
+  if (entry == NULL)
+    return;
+  temp = *entry;
+  *entry = temp->xc_next;
+  kfree (temp);
+  fs->f_xattr_cache_count--;
+}
+
+/* Remembers BLOCK as a candidate for sharing if it can take more
+   references. Failing to remember a block is harmless. */
+
+static void
+ext2_xattr_cache_insert (Ext2Filesystem *fs, block_t block,
+			 const Ext2XattrHeader *h)
+{
+  Ext2XattrCacheEntry *entry;
+  if (h->h_hash == 0 || h->h_refcount >= EXT2_XATTR_REFCOUNT_MAX)
+    {
+      ext2_xattr_cache_remove (fs, h->h_hash, block);
+      return;
+    }
+  if (ext2_xattr_cache_find (fs, h->h_hash, block) != NULL
+      || fs->f_xattr_cache_count >= EXT2_XATTR_CACHE_MAX)
+    return;
+  entry = kmalloc (sizeof (Ext2XattrCacheEntry));
+  if (unlikely (entry == NULL))
+    return;
+  entry->xc_hash = h->h_hash;
+  entry->xc_block = block;
+  entry->xc_next = fs->f_xattr_cache[h->h_hash % EXT2_XATTR_CACHE_SIZE];
+  fs->f_xattr_cache[h->h_hash % EXT2_XATTR_CACHE_SIZE] = entry;
+  fs->f_xattr_cache_count++;
+}
+
+/* Looks for a block other than EXCLUDE with the same attributes as BLOCK
+   that can take another reference. On success the block is read into
+   BUFFER and its number is returned, otherwise zero is returned. */
+
+static block_t
+ext2_xattr_cache_share (VFSSuperblock *sb, const char *block, block_t exclude,
+			char *buffer)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  const Ext2XattrHeader *h = (const Ext2XattrHeader *) block;
+  Ext2XattrHeader *bh = (Ext2XattrHeader *) buffer;
+  Ext2XattrCacheEntry *entry;
+  Ext2XattrCacheEntry *next;
+  if (h->h_hash == 0)
+    return 0;
+  for (entry = fs->f_xattr_cache[h->h_hash % EXT2_XATTR_CACHE_SIZE];
+       entry != NULL; entry = next)
+    {
+      block_t b = entry->xc_block;
+      next = entry->xc_next;
+      if (entry->xc_hash != h->h_hash || b == exclude)
+	continue;
+      if (ext2_read_blocks (buffer, sb, b, 1) != 0)
+	continue;
+
+      /* The block may have changed since it was remembered */
+      if (bh->h_magic != EXT2_XATTR_MAGIC || bh->h_blocks != 1
+	  || bh->h_hash != h->h_hash
+	  || bh->h_refcount >= EXT2_XATTR_REFCOUNT_MAX
+	  || !ext2_xattr_block_checksum_valid (sb, b, bh))
+	{
+	  ext2_xattr_cache_remove (fs, entry->xc_hash, b);
+	  continue;
+	}
+      if (memcmp (block + sizeof (Ext2XattrHeader),
+		  buffer + sizeof (Ext2XattrHeader),
+		  sb->sb_blksize - sizeof (Ext2XattrHeader)) == 0)
+	return b;
+    }
+  return 0;
+}
+
+static int
+ext2_xattr_write_block (VFSSuperblock *sb, block_t block, char *buffer)
+{
+  Ext2XattrHeader *h = (Ext2XattrHeader *) buffer;
+  ext2_xattr_block_checksum_update (sb, block, h);
+  ext2_xattr_cache_insert (sb->sb_private, block, h);
+  return ext2_write_blocks (buffer, sb, block, 1);
+}
+
+/* Drops one reference to the attribute block BLOCK, freeing it if it was
+   the last one */
+
+static int
+ext2_xattr_release_block (VFSSuperblock *sb, block_t block)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2XattrHeader *h;
+  char *buffer = kmalloc (sb->sb_blksize);
+  int ret;
+  if (unlikely (buffer == NULL))
+    return -ENOMEM;
+  ret = ext2_read_blocks (buffer, sb, block, 1);
+  if (ret != 0)
+    goto end;
+  h = (Ext2XattrHeader *) buffer;
+  if (h->h_magic != EXT2_XATTR_MAGIC || h->h_blocks != 1)
+    {
+      ret = -EINVAL;
+      goto end;
+    }
+  if (h->h_refcount <= 1)
+    {
+      ext2_xattr_cache_remove (fs, h->h_hash, block);
+      ext2_block_alloc_stats (sb, block, -1);
+    }
+  else
+    {
+      h->h_refcount--;
+      ret = ext2_xattr_write_block (sb, block, buffer);
+    }
+
+ end:
+  kfree (buffer);
+  return ret;
+}
+
+/* Returns the offset of the first in-inode attribute entry in the on-disk
+   inode INODE, or zero if the inode has no room for attributes */
+
+static size_t
+ext2_xattr_ibody_start (Ext2Filesystem *fs, const Ext2LargeInode *inode)
+{
+  size_t size = EXT2_INODE_SIZE (fs->f_super);
+  size_t start;
+  if (size <= EXT2_OLD_INODE_SIZE)
+    return 0;
+  start = EXT2_OLD_INODE_SIZE + inode->i_extra_isize;
+  if ((inode->i_extra_isize & EXT2_XATTR_ROUND)
+      || start + sizeof (uint32_t) * 2 > size)
+    return 0;
+  return start + sizeof (uint32_t);
+}
+
+static int
+ext2_xattr_parse (const char *base, size_t first, size_t end, size_t valbase,
+		  int ibody, Ext2XattrItem *items, int *count)
+{
+  size_t offset = first;
+  while (offset + sizeof (uint32_t) <= end
+	 && *((const uint32_t *) (base + offset)) != 0)
+    {
+      const Ext2XattrEntry *entry = (const Ext2XattrEntry *) (base + offset);
+      Ext2XattrItem *item = &items[*count];
+      if (offset + sizeof (Ext2XattrEntry) > end
+	  || offset + EXT2_XATTR_LEN (entry->e_name_len) > end)
+	return -EINVAL;
+      if (entry->e_value_inum != 0)
+	return -ENOTSUP;
+      if (entry->e_value_size != 0
+	  && (valbase + entry->e_value_offs < offset
+	      || valbase + entry->e_value_offs + entry->e_value_size > end))
+	return -EINVAL;
+      item->xi_index = entry->e_name_index;
+      item->xi_name_len = entry->e_name_len;
+      item->xi_name = entry->e_name;
+      item->xi_value = base + valbase + entry->e_value_offs;
+      item->xi_value_len = entry->e_value_size;
+      item->xi_ibody = ibody;
+      (*count)++;
+      offset += EXT2_XATTR_LEN (entry->e_name_len);
+    }
+  return 0;
+}
+
+/* Copies the fields changed by storing attributes from the on-disk inode
+   DISK to the copy of the inode kept with the open file, which may have
+   been changed through another file with the same inode */
+
+static void
+ext2_xattr_refresh_inode (VFSInode *inode, const Ext2Inode *disk)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  Ext2Inode *ei = &file->f_inode;
+  ext2_file_acl_block_set (fs, ei, ext2_file_acl_block (fs, disk));
+  ei->i_blocks = disk->i_blocks;
+  ei->osd2.linux2.l_i_blocks_hi = disk->osd2.linux2.l_i_blocks_hi;
+  ei->i_ctime = disk->i_ctime;
+  inode->vi_ctime.tv_sec = ei->i_ctime;
+  inode->vi_ctime.tv_nsec = 0;
+  inode->vi_sectors = ei->i_blocks;
+  inode->vi_blocks = ei->i_blocks * ATA_SECTSIZE / inode->vi_sb->sb_blksize;
+}
+
+/* Returns the version counter of the bucket of inode INO. Copies of the
+   attributes of an inode are only reloaded after a change to an inode in
+   the same bucket. */
+
+static inline unsigned long *
+ext2_xattr_version (Ext2Filesystem *fs, ino64_t ino)
+{
+  return &fs->f_xattr_version[ino % EXT2_XATTR_VERSION_SIZE];
+}
+
+/* Makes sure the per-file copy of the inode and its attribute block is
+   current and returns it in BUFFER */
+
+static int
+ext2_xattr_load (VFSInode *inode, char **buffer)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  unsigned long version = *ext2_xattr_version (fs, inode->vi_ino);
+  size_t size = EXT2_INODE_SIZE (fs->f_super);
+  Ext2XattrHeader *h;
+  block_t block;
+  int ret;
+
+  *buffer = file->f_xattr;
+  if (file->f_xattr != NULL && file->f_xattr_version == version)
+    return 0;
+  if (file->f_xattr == NULL)
+    {
+      file->f_xattr = kmalloc (size + inode->vi_sb->sb_blksize);
+      if (unlikely (file->f_xattr == NULL))
+	return -ENOMEM;
+    }
+  file->f_xattr_version = 0;
+  ret = ext2_read_inode_full (inode->vi_sb, inode->vi_ino,
+			      (Ext2Inode *) file->f_xattr, size);
+  if (ret != 0)
+    return ret;
+  ext2_xattr_refresh_inode (inode, (Ext2Inode *) file->f_xattr);
+
+  block = ext2_file_acl_block (fs, &file->f_inode);
+  if (block != 0)
+    {
+      h = (Ext2XattrHeader *) (file->f_xattr + size);
+      ret = ext2_read_blocks (h, inode->vi_sb, block, 1);
+      if (ret != 0)
+	return ret;
+      if (h->h_magic != EXT2_XATTR_MAGIC || h->h_blocks != 1
+	  || !ext2_xattr_block_checksum_valid (inode->vi_sb, block, h))
+	return -EINVAL;
+      ext2_xattr_cache_insert (fs, block, h);
+    }
+  file->f_xattr_version = version;
+  *buffer = file->f_xattr;
+  return 0;
+}
+
+static int
+ext2_xattr_collect (VFSInode *inode, const char *buffer, Ext2XattrItem *items,
+		    int *count)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  size_t size = EXT2_INODE_SIZE (fs->f_super);
+  size_t start = ext2_xattr_ibody_start (fs, (const Ext2LargeInode *) buffer);
+  int ret;
+
+  *count = 0;
+  if (start != 0 && *((const uint32_t *) (buffer + start) - 1) ==
+      EXT2_XATTR_MAGIC)
+    {
+      ret = ext2_xattr_parse (buffer, start, size, start, 1, items, count);
+      if (ret != 0)
+	return ret;
+    }
+  if (ext2_file_acl_block (fs, (const Ext2Inode *) buffer) != 0)
+    return ext2_xattr_parse (buffer + size, sizeof (Ext2XattrHeader),
+			     inode->vi_sb->sb_blksize, 0, 0, items, count);
+  return 0;
+}
+
+static Ext2XattrItem *
+ext2_xattr_alloc_items (VFSInode *inode)
+{
+  Ext2Filesystem *fs = inode->vi_sb->sb_private;
+  size_t max = (EXT2_INODE_SIZE (fs->f_super) + inode->vi_sb->sb_blksize) /
+    sizeof (Ext2XattrEntry) + 1;
+  return kmalloc (sizeof (Ext2XattrItem) * max);
+}
+
+static Ext2XattrItem *
+ext2_xattr_find (Ext2XattrItem *items, int count, int index, const char *name)
+{
+  size_t len = strlen (name);
+  int i;
+  for (i = 0; i < count; i++)
+    {
+      if (items[i].xi_index == index && items[i].xi_name_len == len
+	  && memcmp (items[i].xi_name, name, len) == 0)
+	return &items[i];
+    }
+  return NULL;
+}
+
+/* Entries in attribute blocks must be sorted for lookups by other
+   implementations to work */
+
+static int
+ext2_xattr_cmp (const void *a, const void *b)
+{
+  const Ext2XattrItem *x = a;
+  const Ext2XattrItem *y = b;
+  if (x->xi_index != y->xi_index)
+    return x->xi_index - y->xi_index;
+  if (x->xi_name_len != y->xi_name_len)
+    return x->xi_name_len - y->xi_name_len;
+  return memcmp (x->xi_name, y->xi_name, x->xi_name_len);
+}
+
+/* Lays out the entries of the items placed in one region. Entries grow up
+   from FIRST and values grow down from END, with value offsets relative to
+   VALBASE. Returns the number of entries written or -ENOSPC. */
+
+static int
+ext2_xattr_build (char *base, size_t first, size_t end, size_t valbase,
+		  const Ext2XattrItem *items, int count, int ibody)
+{
+  size_t offset = first;
+  size_t valoff = end;
+  int n = 0;
+  int i;
+  memset (base + first, 0, end - first);
+  for (i = 0; i < count; i++)
+    {
+      Ext2XattrEntry *entry;
+      size_t len = EXT2_XATTR_LEN (items[i].xi_name_len);
+      size_t size = EXT2_XATTR_SIZE (items[i].xi_value_len);
+      if (items[i].xi_ibody != ibody)
+	continue;
+      if (offset + len + sizeof (uint32_t) + size > valoff)
+	return -ENOSPC;
+      valoff -= size;
+      entry = (Ext2XattrEntry *) (base + offset);
+      entry->e_name_len = items[i].xi_name_len;
+      entry->e_name_index = items[i].xi_index;
+      entry->e_value_offs = size == 0 ? 0 : valoff - valbase;
+      entry->e_value_size = items[i].xi_value_len;
+      memcpy (entry->e_name, items[i].xi_name, items[i].xi_name_len);
+      memcpy (base + valoff, items[i].xi_value, items[i].xi_value_len);
+      entry->e_hash = ext2_xattr_hash_entry (entry, base + valoff);
+      offset += len;
+      n++;
+    }
+  return n;
+}
+
+/* Writes the attributes in ITEMS back to the inode and its attribute block.
+   NEW is the item that changed, or NULL if one was removed. If IBODY is
+   nonzero, NEW must be stored in the inode. */
+
+static int
+ext2_xattr_store (VFSInode *inode, const char *old, Ext2XattrItem *items,
+		  int count, Ext2XattrItem *new, int ibody)
+{
+  VFSSuperblock *sb = inode->vi_sb;
+  Ext2Filesystem *fs = sb->sb_private;
+  Ext2File *file = inode->vi_private;
+  size_t size = EXT2_INODE_SIZE (fs->f_super);
+  size_t start = ext2_xattr_ibody_start (fs, (const Ext2LargeInode *) old);
+  block_t oldblock = ext2_file_acl_block (fs, (const Ext2Inode *) old);
+  block_t block = 0;
+  Ext2XattrHeader *h;
+  Ext2XattrItem item;
+  Ext2Inode *ei;
+  char *buffer;
+  char *temp;
+  int nblock;
+  int ret;
+
+  buffer = kmalloc (size + sb->sb_blksize * 2);
+  if (unlikely (buffer == NULL))
+    return -ENOMEM;
+  ei = (Ext2Inode *) buffer;
+  h = (Ext2XattrHeader *) (buffer + size);
+  temp = buffer + size + sb->sb_blksize;
+  memcpy (buffer, old, size);
+
+  /* New values go in the inode if there is room, and move to the block
+     when they no longer fit there */
+  if (new != NULL)
+    {
+      if (start == 0 && ibody)
+	{
+	  ret = -ENOSPC;
+	  goto end;
+	}
+      if (start == 0)
+	new->xi_ibody = 0;
+      item = *new;
+    }
+  else
+    memset (&item, 0, sizeof (Ext2XattrItem));
+  qsort (items, count, sizeof (Ext2XattrItem), ext2_xattr_cmp);
+  if (start != 0)
+    {
+      ret = ext2_xattr_build (buffer, start, size, start, items, count, 1);
+      if (ret == -ENOSPC && item.xi_ibody && !ibody)
+	{
+	  for (new = items; ext2_xattr_cmp (new, &item) != 0; new++)
+	    ;
+	  new->xi_ibody = 0;
+	  ret = ext2_xattr_build (buffer, start, size, start, items, count, 1);
+	}
+      if (ret < 0)
+	goto end;
+      *((uint32_t *) (buffer + start) - 1) = ret > 0 ? EXT2_XATTR_MAGIC : 0;
+    }
+
+  nblock = ext2_xattr_build ((char *) h, sizeof (Ext2XattrHeader),
+			     sb->sb_blksize, 0, items, count, 0);
+  if (nblock < 0)
+    {
+      ret = nblock;
+      goto end;
+    }
+  if (nblock > 0)
+    {
+      h->h_magic = EXT2_XATTR_MAGIC;
+      h->h_blocks = 1;
+      h->h_hash = ext2_xattr_hash_block ((char *) h);
+      h->h_checksum = 0;
+      memset (h->h_reserved, 0, sizeof (h->h_reserved));
+    }
+
+  if (nblock > 0 && oldblock != 0
+      && memcmp (old + size + sizeof (Ext2XattrHeader),
+		 (char *) h + sizeof (Ext2XattrHeader),
+		 sb->sb_blksize - sizeof (Ext2XattrHeader)) == 0)
+    {
+      memcpy (h, old + size, sb->sb_blksize);
+      block = oldblock;
+    }
+  else if (nblock > 0)
+    {
+      const Ext2XattrHeader *oldh = (const Ext2XattrHeader *) (old + size);
+      block = ext2_xattr_cache_share (sb, (char *) h, oldblock, temp);
+      if (block != 0)
+	{
+	  /* Another inode has the same attributes, take a reference to its
+	     block instead of writing a new one */
+	  ((Ext2XattrHeader *) temp)->h_refcount++;
+	  ret = ext2_xattr_write_block (sb, block, temp);
+	  if (ret != 0)
+	    goto end;
+	  memcpy (h, temp, sb->sb_blksize);
+	}
+      else if (oldblock != 0 && oldh->h_refcount == 1)
+	{
+	  /* Nobody else uses the old block, update it in place */
+	  ext2_xattr_cache_remove (fs, oldh->h_hash, oldblock);
+	  block = oldblock;
+	  h->h_refcount = 1;
+	  ret = ext2_xattr_write_block (sb, block, (char *) h);
+	  if (ret != 0)
+	    goto end;
+	}
+      else
+	{
+	  ret = ext2_new_block (sb, ext2_find_inode_goal (sb, inode->vi_ino,
+							  &file->f_inode, 0),
+				NULL, &block, NULL);
+	  if (ret != 0)
+	    goto end;
+	  h->h_refcount = 1;
+	  ret = ext2_xattr_write_block (sb, block, (char *) h);
+	  if (ret != 0)
+	    goto end;
+	  ret = ext2_block_alloc_stats (sb, block, 1);
+	  if (ret != 0)
+	    goto end;
+	}
+    }
+
+  /* Update the inode before dropping the reference to the old block */
+  memcpy (buffer, &file->f_inode, sizeof (Ext2Inode));
+  ext2_file_acl_block_set (fs, ei, block);
+  if (oldblock == 0 && block != 0)
+    ext2_iblk_add_blocks (sb, ei, 1);
+  else if (oldblock != 0 && block == 0)
+    ext2_iblk_sub_blocks (sb, ei, 1);
+  ei->i_ctime = time (NULL);
+  ret = ext2_update_inode (sb, inode->vi_ino, ei, size);
+  if (ret != 0)
+    goto end;
+  memcpy (&file->f_inode, ei, sizeof (Ext2Inode));
+  inode->vi_ctime.tv_sec = ei->i_ctime;
+  inode->vi_ctime.tv_nsec = 0;
+  inode->vi_sectors = ei->i_blocks;
+  inode->vi_blocks = ei->i_blocks * ATA_SECTSIZE / sb->sb_blksize;
+  if (oldblock != 0 && oldblock != block)
+    ret = ext2_xattr_release_block (sb, oldblock);
+
+  /* Other files with the same inode reload their copies, this one is
+     already up to date */
+  file->f_xattr_version = ++*ext2_xattr_version (fs, inode->vi_ino);
+  memcpy (file->f_xattr, buffer, size + sb->sb_blksize);
+
+ end:
+  kfree (buffer);
+  return ret;
+}
+
+int
+ext2_xattr_set_index (VFSInode *inode, int index, const char *name,
+		      const void *value, size_t len, int flags)
+{
+  Ext2XattrItem *items;
+  Ext2XattrItem *item;
+  char *buffer;
+  int count;
+  int ret;
+  if (len > inode->vi_sb->sb_blksize)
+    return -ENOSPC;
+
+  ret = ext2_xattr_load (inode, &buffer);
+  if (ret != 0)
+    return ret;
+  items = ext2_xattr_alloc_items (inode);
+  if (unlikely (items == NULL))
+    return -ENOMEM;
+  ret = ext2_xattr_collect (inode, buffer, items, &count);
+  if (ret != 0)
+    goto end;
+
+  item = ext2_xattr_find (items, count, index, name);
+  if (item != NULL && (flags & XATTR_CREATE))
+    {
+      ret = -EEXIST;
+      goto end;
+    }
+  if (item == NULL && (value == NULL || (flags & XATTR_REPLACE)))
+    {
+      ret = -ENODATA;
+      goto end;
+    }
+
+  if (value == NULL)
+    {
+      *item = items[--count];
+      item = NULL;
+    }
+  else if (item == NULL)
+    {
+      item = &items[count++];
+      item->xi_index = index;
+      item->xi_name_len = strlen (name);
+      item->xi_name = name;
+      item->xi_ibody = 1;
+    }
+  if (item != NULL)
+    {
+      item->xi_value = value;
+      item->xi_value_len = len;
+      if (flags & EXT2_XATTR_IBODY)
+	item->xi_ibody = 1;
+    }
+  ret = ext2_xattr_store (inode, buffer, items, count, item,
+			  flags & EXT2_XATTR_IBODY);
+
+ end:
+  kfree (items);
+  return ret;
+}
+
+int
+ext2_xattr_get_index (VFSInode *inode, int index, const char *name,
+		      void *buffer, size_t len)
+{
+  Ext2XattrItem *items;
+  Ext2XattrItem *item;
+  char *data;
+  int count;
+  int ret = ext2_xattr_load (inode, &data);
+  if (ret != 0)
+    return ret;
+  items = ext2_xattr_alloc_items (inode);
+  if (unlikely (items == NULL))
+    return -ENOMEM;
+  ret = ext2_xattr_collect (inode, data, items, &count);
+  if (ret != 0)
+    goto end;
+
+  item = ext2_xattr_find (items, count, index, name);
+  if (item == NULL)
+    ret = -ENODATA;
+  else if (len == 0)
+    ret = item->xi_value_len;
+  else if (len < item->xi_value_len)
+    ret = -ERANGE;
+  else
+    {
+      memcpy (buffer, item->xi_value, item->xi_value_len);
+      ret = item->xi_value_len;
+    }
+
+ end:
+  kfree (items);
+  return ret;
+}
+
+int
+ext2_xattr_set (VFSInode *inode, const char *name, const void *value,
+		size_t len, int flags)
+{
+  const char *suffix;
+  int index;
+  int ret = ext2_xattr_parse_name (name, &index, &suffix);
+  if (ret != 0)
+    return ret;
+  ret = ext2_xattr_access (inode, index, 1);
+  if (ret != 0)
+    return ret;
+  return ext2_xattr_set_index (inode, index, suffix, value, len,
+			       flags & (XATTR_CREATE | XATTR_REPLACE));
+}
+
+int
+ext2_xattr_delete_inode (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  block_t block = ext2_file_acl_block (fs, inode);
+  int ret;
+  if (block == 0)
+    return 0;
+  ret = ext2_xattr_release_block (sb, block);
+  if (ret != 0)
+    return ret;
+  ext2_file_acl_block_set (fs, inode, 0);
+  ext2_iblk_sub_blocks (sb, inode, 1);
+  ++*ext2_xattr_version (fs, ino);
+  return 0;
+}
+
+void
+ext2_xattr_free_cache (VFSSuperblock *sb)
+{
+  Ext2Filesystem *fs = sb->sb_private;
+  int i;
+  for (i = 0; i < EXT2_XATTR_CACHE_SIZE; i++)
+    {
+      while (fs->f_xattr_cache[i] != NULL)
+	{
+	  Ext2XattrCacheEntry *entry = fs->f_xattr_cache[i];
+	  fs->f_xattr_cache[i] = entry->xc_next;
+	  kfree (entry);
+	}
+    }
+  fs->f_xattr_cache_count = 0;
+}
+
+int
+ext2_xattr_get (VFSInode *inode, const char *name, void *buffer, size_t len)
+{
+  const char *suffix;
+  int index;
+  int ret = ext2_xattr_parse_name (name, &index, &suffix);
+  if (ret != 0)
+    return ret;
+  ret = ext2_xattr_access (inode, index, 0);
+  if (ret != 0)
+    return ret;
+  return ext2_xattr_get_index (inode, index, suffix, buffer, len);
+}
+
+int
+ext2_xattr_list (VFSInode *inode, char *buffer, size_t len)
+{
+  Ext2XattrItem *items;
+  size_t total = 0;
+  char *data;
+  int count;
+  int i;
+  int ret = ext2_xattr_load (inode, &data);
+  if (ret != 0)
+    return ret;
+  items = ext2_xattr_alloc_items (inode);
+  if (unlikely (items == NULL))
+    return -ENOMEM;
+  ret = ext2_xattr_collect (inode, data, items, &count);
+  if (ret != 0)
+    goto end;
+
+  for (i = 0; i < count; i++)
+    {
+      const char *prefix = ext2_xattr_prefix (items[i].xi_index);
+      size_t plen;
+      if (prefix == NULL || ext2_xattr_access (inode, items[i].xi_index, 0))
+	continue;
+      plen = strlen (prefix);
+      if (len != 0)
+	{
+	  if (total + plen + items[i].xi_name_len + 1 > len)
+	    {
+	      ret = -ERANGE;
+	      goto end;
+	    }
+	  memcpy (buffer + total, prefix, plen);
+	  memcpy (buffer + total + plen, items[i].xi_name,
+		  items[i].xi_name_len);
+	  buffer[total + plen + items[i].xi_name_len] = '\0';
+	}
+      total += plen + items[i].xi_name_len + 1;
+    }
+  ret = total;
+
+ end:
+  kfree (items);
+  return ret;
+}
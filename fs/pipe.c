@@ -30,7 +30,8 @@ const VFSSuperblockOps pipe_sops = {
 const VFSInodeOps pipe_iops = {
   .vfs_read = pipe_read,
   .vfs_write = pipe_write,
-  .vfs_getattr = pipe_getattr
+  .vfs_getattr = pipe_getattr,
+  .vfs_poll = pipe_poll
 };
 
 VFSSuperblock pipe_sb = {
@@ -76,12 +77,15 @@ pipe_destroy_inode (VFSInode *inode)
   else
     pipe->p_flags |= PIPE_READ_CLOSED;
 
-  /* Free the pipe if both ends are closed */
+  /* Free the pipe if both ends are closed, otherwise tell pollers of the
+     other end */
   if ((pipe->p_flags & PIPE_READ_CLOSED) && (pipe->p_flags & PIPE_WRITE_CLOSED))
     {
       kfree (pipe->p_data);
       kfree (pipe);
     }
+  else
+    wait_queue_wake (&pipe->p_waitq, POLLHUP | POLLERR);
 }
 
 int
@@ -103,6 +107,7 @@ pipe_read (VFSInode *inode, void *buffer, size_t len, off_t offset)
     }
   memcpy (buffer, pipe->p_data + pipe->p_readptr, len);
   pipe->p_readptr += len;
+  wait_queue_wake (&pipe->p_waitq, POLLOUT | POLLWRNORM);
   return len;
 }
 
@@ -128,6 +133,7 @@ pipe_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
     }
   memcpy (pipe->p_data + pipe->p_writeptr, buffer, len);
   pipe->p_writeptr += len;
+  wait_queue_wake (&pipe->p_waitq, POLLIN | POLLRDNORM);
   return len;
 
  err:
@@ -142,3 +148,28 @@ pipe_getattr (VFSInode *inode, struct stat64 *st)
   st->st_blksize = PIPE_BLKSIZE;
   return 0;
 }
+
+unsigned int
+pipe_poll (VFSInode *inode, PollTable *pt)
+{
+  Pipe *pipe = inode->vi_private;
+  unsigned int mask = 0;
+  poll_wait (pt, &pipe->p_waitq);
+  if (inode->vi_flags & PIPE_WRITE_END)
+    {
+      /* Writes compact the buffer, so all space not holding unread data
+	 is available */
+      if (pipe->p_flags & PIPE_READ_CLOSED)
+	mask |= POLLERR;
+      else if (pipe->p_writeptr - pipe->p_readptr < PIPE_LENGTH)
+	mask |= POLLOUT | POLLWRNORM;
+    }
+  else
+    {
+      if (pipe->p_writeptr > pipe->p_readptr)
+	mask |= POLLIN | POLLRDNORM;
+      if (pipe->p_flags & PIPE_WRITE_CLOSED)
+	mask |= POLLHUP;
+    }
+  return mask;
+}
@@ -25,6 +25,7 @@
 #include <sys/process.h>
 #include <sys/syscall.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
 
 VFSFilesystem fs_table[VFS_FS_TABLE_SIZE];
 VFSMount mount_table[VFS_MOUNT_TABLE_SIZE];
@@ -33,7 +34,8 @@ VFSInode *vfs_root_inode;
 static int vfs_default_lookup (VFSInode **inode, VFSInode *dir,
 			       VFSSuperblock *sb, const char *name,
 			       int symcount);
-static int vfs_default_readdir (VFSInode *inode, VFSDirEntryFillFunc func,
+static int vfs_default_readdir (VFSInode *inode, VFSDirCursor *cursor,
+				VFSDirEntryFillFunc func,
 				void *private);
 
 static VFSInodeOps vfs_default_iops = {
@@ -74,9 +76,16 @@ vfs_default_lookup (VFSInode **inode, VFSInode *dir, VFSSuperblock *sb,
 }
 
 static int
-vfs_default_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
+vfs_default_readdir (VFSInode *inode, VFSDirCursor *cursor,
+		     VFSDirEntryFillFunc func, void *private)
 {
-  return func ("dev", 3, 1, DT_DIR, 0, private);
+  int ret;
+  if (cursor->dc_pos > 0)
+    return 0;
+  ret = func ("dev", 3, 1, DT_DIR, 1, private);
+  if (ret == 0)
+    cursor->dc_pos = 1;
+  return ret < 0 ? ret : 0;
 }
 
 void
@@ -189,6 +198,9 @@ vfs_unmount (VFSSuperblock *sb, int flags)
 	  && process_fd_table[i].pf_inode->vi_sb == sb)
 	return -EBUSY;
     }
+  ret = page_cache_drop_sb (sb);
+  if (ret != 0)
+    return ret;
 
   /* Run file-specific unmount function */
   ret = sb->sb_fstype->vfs_unmount (&mount_table[sb->sb_mntslot], flags);
@@ -270,6 +282,7 @@ vfs_free_sb (VFSSuperblock *sb)
 void
 vfs_update_sb (VFSSuperblock *sb)
 {
+  page_cache_sync_sb (sb);
   if (sb->sb_ops->sb_update != NULL)
     sb->sb_ops->sb_update (sb);
 }
@@ -404,7 +417,69 @@ vfs_write (VFSInode *inode, const void *buffer, size_t len, off_t offset)
 }
 
 int
-vfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
+vfs_read_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+	       off_t offset)
+{
+  int count = 0;
+  int ret;
+  int i;
+  if (inode->vi_ops->vfs_read_iter == NULL)
+    {
+      /* Fall back to reading each buffer until a short read */
+      for (i = 0; i < vlen; i++)
+	{
+	  ret = vfs_read (inode, vec[i].iov_base, vec[i].iov_len,
+			  offset + count);
+	  if (ret < 0)
+	    return count == 0 ? ret : count;
+	  count += ret;
+	  if (ret < vec[i].iov_len)
+	    break;
+	}
+      return count;
+    }
+
+  ret = vfs_perm_check_read (inode, 0);
+  if (ret != 0)
+    return ret;
+  if (vfs_can_seek (inode) && offset > inode->vi_size)
+    return -EINVAL;
+  return inode->vi_ops->vfs_read_iter (inode, vec, vlen, offset);
+}
+
+int
+vfs_write_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		off_t offset)
+{
+  int count = 0;
+  int ret;
+  int i;
+  if (inode->vi_ops->vfs_write_iter == NULL)
+    {
+      for (i = 0; i < vlen; i++)
+	{
+	  ret = vfs_write (inode, vec[i].iov_base, vec[i].iov_len,
+			   offset + count);
+	  if (ret < 0)
+	    return count == 0 ? ret : count;
+	  count += ret;
+	  if (ret < vec[i].iov_len)
+	    break;
+	}
+      return count;
+    }
+
+  if (inode->vi_sb->sb_mntflags & MS_RDONLY)
+    return -EROFS;
+  ret = vfs_perm_check_write (inode, 0);
+  if (ret != 0)
+    return ret;
+  return inode->vi_ops->vfs_write_iter (inode, vec, vlen, offset);
+}
+
+int
+vfs_readdir (VFSInode *inode, VFSDirCursor *cursor, VFSDirEntryFillFunc func,
+	     void *private)
 {
   int ret = vfs_perm_check_read (inode, 0);
   if (ret != 0)
@@ -412,10 +487,20 @@ vfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private)
   if (!S_ISDIR (inode->vi_mode))
     return -ENOTDIR;
   if (inode->vi_ops->vfs_readdir != NULL)
-    return inode->vi_ops->vfs_readdir (inode, func, private);
+    return inode->vi_ops->vfs_readdir (inode, cursor, func, private);
   return -ENOSYS;
 }
 
+unsigned int
+vfs_poll (VFSInode *inode, PollTable *pt)
+{
+  if (inode->vi_ops->vfs_poll != NULL)
+    return inode->vi_ops->vfs_poll (inode, pt);
+
+  /* Regular files and devices without a poll operation never block */
+  return POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM;
+}
+
 int
 vfs_chmod (VFSInode *inode, mode_t mode)
 {
@@ -42,6 +42,19 @@ struct dirent
   char d_name[256];
 };
 
+/* Records returned by getdents64 are packed back to back. d_reclen is the
+   8-byte aligned size of the record and d_off is the directory offset of
+   the entry following it. */
+
+struct dirent64
+{
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
 #define d_fileno d_ino
 
 #endif
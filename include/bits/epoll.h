@@ -0,0 +1,57 @@
+/*************************************************************************
+ * epoll.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _BITS_EPOLL_H
+#define _BITS_EPOLL_H
+
+#include <bits/poll.h>
+#include <stdint.h>
+
+#define EPOLL_CLOEXEC 0x02000000
+
+#define EPOLL_CTL_ADD 1
+#define EPOLL_CTL_DEL 2
+#define EPOLL_CTL_MOD 3
+
+#define EPOLLIN      POLLIN
+#define EPOLLPRI     POLLPRI
+#define EPOLLOUT     POLLOUT
+#define EPOLLERR     POLLERR
+#define EPOLLHUP     POLLHUP
+#define EPOLLRDNORM  POLLRDNORM
+#define EPOLLRDBAND  POLLRDBAND
+#define EPOLLWRNORM  POLLWRNORM
+#define EPOLLWRBAND  POLLWRBAND
+#define EPOLLONESHOT (1U << 30)
+#define EPOLLET      (1U << 31)
+
+typedef union epoll_data
+{
+  void *ptr;
+  int fd;
+  uint32_t u32;
+  uint64_t u64;
+} epoll_data_t;
+
+struct epoll_event
+{
+  uint32_t events;
+  epoll_data_t data;
+};
+
+#endif
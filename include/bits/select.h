@@ -0,0 +1,39 @@
+/*************************************************************************
+ * select.h -- This file is part of OS/0.                                *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _BITS_SELECT_H
+#define _BITS_SELECT_H
+
+#define FD_SETSIZE 1024
+#define __NFDBITS  (8 * sizeof (unsigned long))
+
+typedef struct
+{
+  unsigned long fds_bits[FD_SETSIZE / __NFDBITS];
+} fd_set;
+
+#define FD_ZERO(set)							\
+  __builtin_memset ((set), 0, sizeof (fd_set))
+#define FD_SET(fd, set)							\
+  ((set)->fds_bits[(fd) / __NFDBITS] |= 1UL << ((fd) % __NFDBITS))
+#define FD_CLR(fd, set)							\
+  ((set)->fds_bits[(fd) / __NFDBITS] &= ~(1UL << ((fd) % __NFDBITS)))
+#define FD_ISSET(fd, set)						\
+  (((set)->fds_bits[(fd) / __NFDBITS] & (1UL << ((fd) % __NFDBITS))) != 0)
+
+#endif
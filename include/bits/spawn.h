@@ -0,0 +1,43 @@
+/*************************************************************************
+ * spawn.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _BITS_SPAWN_H
+#define _BITS_SPAWN_H
+
+#include <sys/types.h>
+
+#define SPAWN_ACTION_END   0
+#define SPAWN_ACTION_OPEN  1
+#define SPAWN_ACTION_CLOSE 2
+#define SPAWN_ACTION_DUP2  3
+
+/* File actions passed to posix_spawn are performed in order by the child
+   before it calls exec. The list ends with an action of type
+   SPAWN_ACTION_END. */
+
+struct spawn_file_action
+{
+  int sfa_type;
+  int sfa_fd;           /* Descriptor to open, close or duplicate */
+  int sfa_newfd;        /* Target of SPAWN_ACTION_DUP2 */
+  int sfa_flags;        /* Flags of SPAWN_ACTION_OPEN */
+  mode_t sfa_mode;      /* Mode of SPAWN_ACTION_OPEN */
+  const char *sfa_path; /* Path of SPAWN_ACTION_OPEN */
+};
+
+#endif
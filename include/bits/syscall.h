@@ -19,6 +19,11 @@
 #ifndef _BITS_SYSCALL_H
 #define _BITS_SYSCALL_H
 
+/* User programs can enter the kernel by calling the function at the start
+   of this read-only page with the same register arguments as int $0x80.
+   It uses SYSENTER when the CPU supports it. */
+#define VSYSCALL_PAGE_ADDR 0xff409000
+
 #define SYS_exit          1
 #define SYS_fork          2
 #define SYS_read          3
@@ -120,7 +125,9 @@
 #define SYS_sysfs         135
 #define SYS__llseek       140
 #define SYS_getdents      141
+#define SYS__newselect    142
 #define SYS_flock         143
+#define SYS_msync         144
 #define SYS_readv         145
 #define SYS_writev        146
 #define SYS_getsid        147
@@ -128,6 +135,7 @@
 #define SYS_nanosleep     162
 #define SYS_setresuid     164
 #define SYS_getresuid     165
+#define SYS_poll          168
 #define SYS_setresgid     170
 #define SYS_getresgid     171
 #define SYS_pread64       180
@@ -140,6 +148,8 @@
 #define SYS_stat64        195
 #define SYS_lstat64       196
 #define SYS_fstat64       197
+#define SYS_getdents64    220
+#define SYS_posix_spawn   223
 #define SYS_setxattr      226
 #define SYS_lsetxattr     227
 #define SYS_fsetxattr     228
@@ -152,6 +162,9 @@
 #define SYS_removexattr   235
 #define SYS_lremovexattr  236
 #define SYS_fremovexattr  237
+#define SYS_epoll_create  254
+#define SYS_epoll_ctl     255
+#define SYS_epoll_wait    256
 #define SYS_clock_getres  264
 #define SYS_clock_gettime 265
 #define SYS_statfs64      268
@@ -171,6 +184,7 @@
 #define SYS_fchmodat      306
 #define SYS_faccessat     307
 #define SYS_utimensat     320
+#define SYS_epoll_create1 329
 #define SYS_getrandom     355
 
 #define NR_syscalls 384
@@ -24,8 +24,10 @@
 #define CLOCKS_PER_SEC 1000
 #define CLK_TCK        CLOCKS_PER_SEC
 
-#define CLOCK_REALTIME  1
-#define CLOCK_MONOTONIC 2
+#define CLOCK_REALTIME           1
+#define CLOCK_MONOTONIC          2
+#define CLOCK_PROCESS_CPUTIME_ID 3
+#define CLOCK_THREAD_CPUTIME_ID  4
 
 #define ITIMER_REAL    0
 #define ITIMER_VIRTUAL 1
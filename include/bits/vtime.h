@@ -0,0 +1,50 @@
+/*************************************************************************
+ * vtime.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _BITS_VTIME_H
+#define _BITS_VTIME_H
+
+/* Every process has a read-only page mapped at this address which lets
+   clock_gettime(2) and gettimeofday(2) be computed without a system call */
+#define VTIME_PAGE_ADDR 0xff408000
+
+#define VTIME_FLAG_TSC  0x01 /* Monotonic time is derived from the TSC */
+
+#ifndef _ASM
+
+#include <stdint.h>
+
+/* If VTIME_FLAG_TSC is set, monotonic nanoseconds are computed from the
+   current TSC value as ((tsc - vt_tsc_base) * vt_mult) >> vt_shift,
+   otherwise vt_mono holds the monotonic time of the last timer tick.
+   Readers must retry if vt_seq is odd or changes while reading. */
+
+struct vtime_page
+{
+  volatile uint32_t vt_seq;
+  uint32_t vt_flags;
+  uint32_t vt_mult;
+  uint32_t vt_shift;
+  uint64_t vt_tsc_base;
+  volatile uint64_t vt_mono;
+  volatile int64_t vt_realtime_offset;
+};
+
+#endif
+
+#endif
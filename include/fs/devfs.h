@@ -49,7 +49,8 @@ int devfs_lookup (VFSInode **inode, VFSInode *dir, VFSSuperblock *sb,
 		  const char *name, int symcount);
 int devfs_read (VFSInode *inode, void *buffer, size_t len, off_t offset);
 int devfs_write (VFSInode *inode, const void *buffer, size_t len, off_t offset);
-int devfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private);
+int devfs_readdir (VFSInode *inode, VFSDirCursor *cursor,
+		   VFSDirEntryFillFunc func, void *private);
 int devfs_readlink (VFSInode *inode, char *buffer, size_t len);
 int devfs_getattr (VFSInode *inode, struct stat64 *st);
 
@@ -0,0 +1,78 @@
+/*************************************************************************
+ * epoll.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _FS_EPOLL_H
+#define _FS_EPOLL_H
+
+/* Pseudo-filesystem for epoll instances */
+
+#include <bits/epoll.h>
+#include <sys/process.h>
+
+#define EPOLL_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EPOLL_MAX_NESTS    4 /* Longest chain of epoll sets watching others */
+
+typedef struct _Epoll Epoll;
+typedef struct _EpollItem EpollItem;
+
+/* A file in the interest list of an epoll instance. Items on the ready
+   list are checked again when collected, so waking an item that is not
+   actually ready only costs a poll of that file. */
+
+struct _EpollItem
+{
+  Epoll *ei_epoll;             /* Owning epoll instance */
+  ProcessFile *ei_file;        /* Watched file */
+  int ei_fd;                   /* Descriptor the file was added with */
+  struct epoll_event ei_event; /* Requested events and user data */
+  WaitQueueEntry ei_wait;      /* Entry in the file's wait queue */
+  int ei_ready;                /* If item is on the ready list */
+  EpollItem *ei_prev;          /* Interest list links */
+  EpollItem *ei_next;
+  EpollItem *ei_rprev;         /* Ready list links */
+  EpollItem *ei_rnext;
+  EpollItem *ei_fnext;         /* Next item watching the same file */
+};
+
+struct _Epoll
+{
+  EpollItem *ep_items;         /* Interest list */
+  EpollItem *ep_rhead;         /* Ready list */
+  EpollItem *ep_rtail;
+  WaitQueue ep_waitq;          /* Waiters and pollers of the instance */
+  ProcessFile *ep_file;        /* File of the epoll instance */
+};
+
+__BEGIN_DECLS
+
+extern const VFSSuperblockOps epoll_sops;
+extern const VFSInodeOps epoll_iops;
+extern VFSSuperblock epoll_sb;
+
+void epoll_destroy_inode (VFSInode *inode);
+unsigned int epoll_poll (VFSInode *inode, PollTable *pt);
+void epoll_release_file (ProcessFile *file);
+
+int epoll_create1 (int flags);
+int epoll_ctl (int epfd, int op, int fd, struct epoll_event *event);
+int epoll_wait (int epfd, struct epoll_event *events, int maxevents,
+		int timeout);
+
+__END_DECLS
+
+#endif
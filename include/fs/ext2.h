@@ -47,6 +47,17 @@
 #define EXT2_DIRTYPE_SOCKET 6
 #define EXT2_DIRTYPE_LINK   7
 
+/* Extended attribute name indices */
+
+#define EXT2_XATTR_INDEX_USER              1
+#define EXT2_XATTR_INDEX_POSIX_ACL_ACCESS  2
+#define EXT2_XATTR_INDEX_POSIX_ACL_DEFAULT 3
+#define EXT2_XATTR_INDEX_TRUSTED           4
+#define EXT2_XATTR_INDEX_LUSTRE            5
+#define EXT2_XATTR_INDEX_SECURITY          6
+#define EXT2_XATTR_INDEX_SYSTEM            7
+#define EXT2_XATTR_INDEX_RICHACL           8
+
 /* Operating systems */
 
 #define EXT2_OS_LINUX      0
@@ -176,6 +187,11 @@
 #define EXT2_FILE_BUFFER_VALID 0x2000
 #define EXT2_FILE_BUFFER_DIRTY 0x4000
 
+#define EXT2_IO_MAX 65536 /* Largest run of blocks in one vectored transfer */
+
+#define EXT4_MIN_INLINE_DATA_SIZE 60 /* Inline data stored in i_block */
+#define EXT4_INLINE_DOTDOT_SIZE   4  /* Parent inode of inline directories */
+
 #define EXT2_OLD_REV     0
 #define EXT2_DYNAMIC_REV 1
 
@@ -217,8 +233,10 @@
 
 #define BMAP_RET_UNINIT 0x0001
 
-#define EXT2_BITMAP_BLOCK 0x0001
-#define EXT2_BITMAP_INODE 0x0002
+#define EXT2_BITMAP_BLOCK       0x0001
+#define EXT2_BITMAP_INODE       0x0002
+#define EXT2_BITMAP_BLOCK_DIRTY 0x0004
+#define EXT2_BITMAP_INODE_DIRTY 0x0008
 
 #define EXT2_BMAP_MAGIC_BLOCK   0x0001
 #define EXT2_BMAP_MAGIC_INODE   0x0002
@@ -350,6 +368,55 @@
 #define EXT2_DIRENT_TAIL(block, size)					\
   ((Ext2DirEntryTail *) ((char *) (block) + (size) - sizeof (Ext2DirEntryTail)))
 
+#define EXT2_XATTR_MAGIC        0xea020000
+#define EXT2_XATTR_REFCOUNT_MAX 1024
+#define EXT2_XATTR_PAD          4
+#define EXT2_XATTR_ROUND        (EXT2_XATTR_PAD - 1)
+#define EXT2_XATTR_CACHE_SIZE   64  /* Buckets of the shared block cache */
+#define EXT2_XATTR_CACHE_MAX    512 /* Most blocks remembered for sharing */
+#define EXT2_XATTR_VERSION_SIZE 64  /* Inode buckets with an xattr version */
+#define EXT2_XATTR_IBODY        0x100 /* Value must be stored in the inode */
+#define EXT2_XATTR_LEN(name_len)					\
+  (((name_len) + EXT2_XATTR_ROUND + sizeof (Ext2XattrEntry)) &		\
+   ~EXT2_XATTR_ROUND)
+#define EXT2_XATTR_SIZE(size) (((size) + EXT2_XATTR_ROUND) & ~EXT2_XATTR_ROUND)
+
+#define JBD2_MAGIC_NUMBER 0xc03b3998
+
+#define JBD2_DESCRIPTOR_BLOCK 1
+#define JBD2_COMMIT_BLOCK     2
+#define JBD2_SUPERBLOCK_V1    3
+#define JBD2_SUPERBLOCK_V2    4
+#define JBD2_REVOKE_BLOCK     5
+
+#define JBD2_FLAG_ESCAPE    0x01
+#define JBD2_FLAG_SAME_UUID 0x02
+#define JBD2_FLAG_DELETED   0x04
+#define JBD2_FLAG_LAST_TAG  0x08
+
+#define JBD2_FT_COMPAT_CHECKSUM        0x0001
+#define JBD2_FT_INCOMPAT_REVOKE        0x0001
+#define JBD2_FT_INCOMPAT_64BIT         0x0002
+#define JBD2_FT_INCOMPAT_ASYNC_COMMIT  0x0004
+#define JBD2_FT_INCOMPAT_CSUM_V2       0x0008
+#define JBD2_FT_INCOMPAT_CSUM_V3       0x0010
+#define JBD2_FT_INCOMPAT_FAST_COMMIT   0x0020
+
+#define JBD2_INCOMPAT_SUPPORTED (JBD2_FT_INCOMPAT_REVOKE		\
+				 | JBD2_FT_INCOMPAT_64BIT		\
+				 | JBD2_FT_INCOMPAT_ASYNC_COMMIT	\
+				 | JBD2_FT_INCOMPAT_CSUM_V2		\
+				 | JBD2_FT_INCOMPAT_CSUM_V3)
+
+#define JBD2_CRC32C_CHKSUM      4
+#define JBD2_MIN_JOURNAL_BLOCKS 1024
+#define JBD2_UUID_SIZE          16
+
+#define EXT2_JOURNAL_COMMIT_INTERVAL 5   /* Seconds between commits */
+#define EXT2_JOURNAL_MAX_BUFFERS     256 /* Most blocks in one transaction */
+#define EXT2_JOURNAL_HASH_SIZE       256 /* Must be a power of two */
+#define EXT2_JOURNAL_BATCH           32  /* Log blocks written per request */
+
 typedef struct
 {
   uint32_t s_inodes_count;
@@ -669,6 +736,153 @@ typedef struct
   uint32_t mmp_checksum;
 } Ext4MMPBlock;
 
+typedef struct
+{
+  uint32_t h_magic;
+  uint32_t h_refcount;
+  uint32_t h_blocks;
+  uint32_t h_hash;
+  uint32_t h_checksum;
+  uint32_t h_reserved[3];
+} Ext2XattrHeader;
+
+typedef struct
+{
+  unsigned char e_name_len;
+  unsigned char e_name_index;
+  uint16_t e_value_offs;
+  uint32_t e_value_inum;
+  uint32_t e_value_size;
+  uint32_t e_hash;
+  char e_name[];
+} Ext2XattrEntry;
+
+/* Remembers where a shareable extended attribute block with a given hash
+   was last seen, so identical attribute sets can point at one block */
+
+typedef struct _Ext2XattrCacheEntry
+{
+  uint32_t xc_hash;
+  block_t xc_block;
+  struct _Ext2XattrCacheEntry *xc_next;
+} Ext2XattrCacheEntry;
+
+/* All fields of on-disk journal structures are big-endian */
+
+typedef struct
+{
+  uint32_t h_magic;
+  uint32_t h_blocktype;
+  uint32_t h_sequence;
+} Jbd2Header;
+
+typedef struct
+{
+  Jbd2Header s_header;
+  uint32_t s_blocksize;
+  uint32_t s_maxlen;
+  uint32_t s_first;
+  uint32_t s_sequence;
+  uint32_t s_start;
+  int32_t s_errno;
+  uint32_t s_feature_compat;
+  uint32_t s_feature_incompat;
+  uint32_t s_feature_ro_compat;
+  unsigned char s_uuid[JBD2_UUID_SIZE];
+  uint32_t s_nr_users;
+  uint32_t s_dynsuper;
+  uint32_t s_max_transaction;
+  uint32_t s_max_trans_data;
+  unsigned char s_checksum_type;
+  unsigned char s_padding2[3];
+  uint32_t s_num_fc_blks;
+  uint32_t s_head;
+  uint32_t s_padding[40];
+  uint32_t s_checksum;
+  unsigned char s_users[JBD2_UUID_SIZE * 48];
+} Jbd2Superblock;
+
+typedef struct
+{
+  Jbd2Header h_header;
+  unsigned char h_chksum_type;
+  unsigned char h_chksum_size;
+  unsigned char h_padding[2];
+  uint32_t h_chksum[8];
+  uint64_t h_commit_sec;
+  uint32_t h_commit_nsec;
+} Jbd2CommitHeader;
+
+typedef struct
+{
+  uint32_t t_blocknr;
+  uint16_t t_checksum;
+  uint16_t t_flags;
+  uint32_t t_blocknr_high;
+} Jbd2BlockTag;
+
+typedef struct
+{
+  uint32_t t_blocknr;
+  uint32_t t_flags;
+  uint32_t t_blocknr_high;
+  uint32_t t_checksum;
+} Jbd2BlockTag3;
+
+typedef struct
+{
+  Jbd2Header r_header;
+  uint32_t r_count;
+} Jbd2RevokeHeader;
+
+typedef struct
+{
+  uint32_t t_checksum;
+} Jbd2BlockTail;
+
+/* A metadata block changed since the last checkpoint. Revoked buffers only
+   record that a logged block was freed, their data is not used. */
+
+typedef struct _Ext2JournalBuffer
+{
+  block_t jb_block;
+  uint32_t jb_tid;
+  int jb_logged;
+  int jb_revoked;
+  struct _Ext2JournalBuffer *jb_next;
+  char jb_data[];
+} Ext2JournalBuffer;
+
+typedef struct
+{
+  ino64_t j_ino;
+  Ext2Inode j_inode;
+  Jbd2Superblock *j_super;
+  block_t *j_map;       /* Physical block of each journal block */
+  block_t j_first;      /* First log block */
+  block_t j_last;       /* One past the last log block */
+  block_t j_head;       /* Next log block to write */
+  block_t j_tail;       /* Oldest unwritten transaction, or zero */
+  block_t j_free;
+  uint32_t j_tid;       /* Running transaction */
+  uint32_t j_csum_seed;
+  unsigned int j_tag_size;
+  unsigned int j_tags_per_block;
+  unsigned int j_max_transaction;
+  time_t j_commit_time;
+  int j_handles;
+  int j_commit_request;
+  int j_committing;
+  unsigned int j_count;   /* Buffers in the hash */
+  unsigned int j_running; /* Buffers changed by the running transaction */
+  Ext2JournalBuffer **j_group;
+  char *j_scratch;
+  char *j_batch;
+  block_t j_batch_block;
+  unsigned int j_batch_count;
+  Ext2JournalBuffer *j_hash[EXT2_JOURNAL_HASH_SIZE];
+} Ext2Journal;
+
 typedef struct
 {
   Ext2Inode f_inode;
@@ -679,6 +893,8 @@ typedef struct
   block_t f_physblock;
   int f_flags;
   char *f_buffer;
+  char *f_xattr; /* On-disk inode followed by its extended attribute block */
+  unsigned long f_xattr_version;
 } Ext2File;
 
 typedef struct
@@ -712,6 +928,10 @@ typedef enum
   EXT2_BMAP64_AUTODIR
 } Ext2BitmapType;
 
+/* With EXT2_BMAP64_AUTODIR, bitmaps larger than this many bytes as a bit
+   array are kept as extent trees */
+#define EXT2_BITARRAY_MAX_SIZE 32768
+
 typedef struct
 {
   int b_magic;
@@ -733,12 +953,12 @@ typedef struct
   Ext2BitmapType b_type;
   int (*b_new_bmap) (VFSSuperblock *, Ext2Bitmap64 *);
   void (*b_free_bmap) (Ext2Bitmap64 *);
-  void (*b_mark_bmap) (Ext2Bitmap64 *, uint64_t);
-  void (*b_unmark_bmap) (Ext2Bitmap64 *, uint64_t);
+  int (*b_mark_bmap) (Ext2Bitmap64 *, uint64_t);
+  int (*b_unmark_bmap) (Ext2Bitmap64 *, uint64_t);
   int (*b_test_bmap) (Ext2Bitmap64 *, uint64_t);
-  void (*b_mark_bmap_extent) (Ext2Bitmap64 *, uint64_t, unsigned int);
-  void (*b_unmark_bmap_extent) (Ext2Bitmap64 *, uint64_t, unsigned int);
-  void (*b_set_bmap_range) (Ext2Bitmap64 *, uint64_t, size_t, void *);
+  int (*b_mark_bmap_extent) (Ext2Bitmap64 *, uint64_t, unsigned int);
+  int (*b_unmark_bmap_extent) (Ext2Bitmap64 *, uint64_t, unsigned int);
+  int (*b_set_bmap_range) (Ext2Bitmap64 *, uint64_t, size_t, void *);
   void (*b_get_bmap_range) (Ext2Bitmap64 *, uint64_t, size_t, void *);
   int (*b_find_first_zero) (Ext2Bitmap64 *, uint64_t, uint64_t, uint64_t *);
   int (*b_find_first_set) (Ext2Bitmap64 *, uint64_t, uint64_t, uint64_t *);
@@ -777,11 +997,18 @@ typedef struct
   time_t f_now;
   int f_cluster_ratio_bits;
   uint16_t f_default_bitmap_type;
+  unsigned char *f_bitmap_loaded; /* EXT2_BITMAP_* flags of each group */
   Ext2InodeCache *f_icache;
   void *f_mmp_buffer;
   int f_mmp_fd;
   time_t f_mmp_last_written;
   uint32_t f_checksum_seed;
+  unsigned long f_dir_version; /* Incremented on each directory block write */
+  /* Incremented on each xattr change of an inode in the bucket */
+  unsigned long f_xattr_version[EXT2_XATTR_VERSION_SIZE];
+  Ext2XattrCacheEntry *f_xattr_cache[EXT2_XATTR_CACHE_SIZE];
+  unsigned int f_xattr_cache_count;
+  Ext2Journal *f_journal;
 } Ext2Filesystem;
 
 typedef struct
@@ -902,6 +1129,9 @@ typedef struct
 		 void *);
   void *d_private;
   int d_err;
+  blkcnt64_t *d_blkcnt;
+  blkcnt64_t d_start;
+  unsigned int d_start_offset;
 } Ext2DirContext;
 
 typedef struct
@@ -929,8 +1159,8 @@ typedef struct
 {
   VFSDirEntryFillFunc r_func;
   void *r_private;
-  block_t r_block;
-  uint32_t r_offset;
+  VFSDirCursor *r_cursor;
+  blkcnt64_t r_block;
   int r_err;
 } Ext2Readdir;
 
@@ -940,6 +1170,7 @@ extern const VFSSuperblockOps ext2_sops;
 extern const VFSInodeOps ext2_iops;
 extern const VFSFilesystem ext2_vfs;
 extern Ext2BitmapOps ext2_bitarray_ops;
+extern Ext2BitmapOps ext2_rbtree_ops;
 
 static inline blkcnt64_t
 ext2_blocks_count (const Ext2Superblock *s)
@@ -1069,6 +1300,24 @@ ext2_is_inline_symlink (const Ext2Inode *inode)
     && EXT2_I_SIZE (*inode) < sizeof (inode->i_block);
 }
 
+static inline block_t
+ext2_file_acl_block (const Ext2Filesystem *fs, const Ext2Inode *inode)
+{
+  block_t block = inode->i_file_acl;
+  if (fs->f_super.s_feature_incompat & EXT4_FT_INCOMPAT_64BIT)
+    block |= (block_t) inode->osd2.linux2.l_i_file_acl_hi << 32;
+  return block;
+}
+
+static inline void
+ext2_file_acl_block_set (const Ext2Filesystem *fs, Ext2Inode *inode,
+			 block_t block)
+{
+  inode->i_file_acl = block;
+  if (fs->f_super.s_feature_incompat & EXT4_FT_INCOMPAT_64BIT)
+    inode->osd2.linux2.l_i_file_acl_hi = block >> 32;
+}
+
 static inline int
 ext2_needs_large_file (uint64_t size)
 {
@@ -1121,12 +1370,15 @@ void ext2_bg_itable_unused_set (VFSSuperblock *sb, unsigned int group,
 int ext2_read_bitmap (VFSSuperblock *sb, int flags, unsigned int start,
 		      unsigned int end);
 int ext2_read_bitmaps (VFSSuperblock *sb);
+int ext2_load_group_bitmaps (VFSSuperblock *sb, int flags,
+			     unsigned int group);
+void ext2_free_bitmaps (VFSSuperblock *sb);
 int ext2_write_bitmaps (VFSSuperblock *sb);
-void ext2_mark_bitmap (Ext2Bitmap *bmap, uint64_t arg);
-void ext2_unmark_bitmap (Ext2Bitmap *bmap, uint64_t arg);
+int ext2_mark_bitmap (Ext2Bitmap *bmap, uint64_t arg);
+int ext2_unmark_bitmap (Ext2Bitmap *bmap, uint64_t arg);
 int ext2_test_bitmap (Ext2Bitmap *bmap, uint64_t arg);
-void ext2_mark_block_bitmap_range (Ext2Bitmap *bmap, block_t block,
-				   blkcnt64_t num);
+int ext2_mark_block_bitmap_range (Ext2Bitmap *bmap, block_t block,
+				  blkcnt64_t num);
 int ext2_set_bitmap_range (Ext2Bitmap *bmap, uint64_t start, unsigned int num,
 			   void *data);
 int ext2_get_bitmap_range (Ext2Bitmap *bmap, uint64_t start, unsigned int num,
@@ -1138,9 +1390,9 @@ void ext2_cluster_alloc (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
 			 block_t *physblock);
 int ext2_map_cluster_block (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
 			    block_t block, block_t *physblock);
-void ext2_inode_alloc_stats (VFSSuperblock *sb, ino64_t ino, int inuse,
-			     int isdir);
-void ext2_block_alloc_stats (VFSSuperblock *sb, block_t block, int inuse);
+int ext2_inode_alloc_stats (VFSSuperblock *sb, ino64_t ino, int inuse,
+			    int isdir);
+int ext2_block_alloc_stats (VFSSuperblock *sb, block_t block, int inuse);
 int ext2_write_backup_superblock (VFSSuperblock *sb, unsigned int group,
 				  block_t group_block, Ext2Superblock *s);
 int ext2_write_primary_superblock (VFSSuperblock *sb, Ext2Superblock *s);
@@ -1150,6 +1402,8 @@ int ext2_file_block_offset_too_big (VFSSuperblock *sb, Ext2Inode *inode,
 				    block_t offset);
 int ext2_file_set_size (Ext2File *file, off64_t size);
 int ext2_read_inode (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode);
+int ext2_read_inode_full (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
+			  size_t bufsize);
 int ext2_update_inode (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode,
 		       size_t bufsize);
 void ext2_update_vfs_inode (VFSInode *inode);
@@ -1222,6 +1476,8 @@ int ext2_read_blocks (void *buffer, VFSSuperblock *sb, uint32_t block,
 		      size_t nblocks);
 int ext2_write_blocks (const void *buffer, VFSSuperblock *sb, uint32_t block,
 		       size_t nblocks);
+int ext2_write_data_blocks (const void *buffer, VFSSuperblock *sb,
+			    uint32_t block, size_t nblocks);
 int ext2_get_rec_len (VFSSuperblock *sb, Ext2DirEntry *dirent,
 		      unsigned int *rec_len);
 int ext2_set_rec_len (VFSSuperblock *sb, unsigned int len,
@@ -1235,6 +1491,12 @@ int ext2_dir_iterate (VFSSuperblock *sb, VFSInode *dir, int flags,
 						   Ext2DirEntry *, int,
 						   blksize_t, char *, void *),
 		      void *private);
+int ext2_dir_iterate_from (VFSSuperblock *sb, VFSInode *dir, int flags,
+			   char *blockbuf, blkcnt64_t *blkcnt,
+			   unsigned int offset,
+			   int (*func) (VFSInode *, int, Ext2DirEntry *, int,
+					blksize_t, char *, void *),
+			   void *private);
 uint32_t ext2_bgdt_size (Ext2Superblock *esb);
 uint32_t ext2_superblock_checksum (Ext2Superblock *s);
 int ext2_superblock_checksum_valid (Ext2Filesystem *fs);
@@ -1257,6 +1519,12 @@ int ext3_extent_block_checksum_valid (VFSSuperblock *sb, ino64_t ino,
 				      Ext3ExtentHeader *eh);
 int ext3_extent_block_checksum_update (VFSSuperblock *sb, ino64_t ino,
 				       Ext3ExtentHeader *eh);
+uint32_t ext2_xattr_block_checksum (VFSSuperblock *sb, block_t block,
+				    Ext2XattrHeader *h);
+int ext2_xattr_block_checksum_valid (VFSSuperblock *sb, block_t block,
+				     Ext2XattrHeader *h);
+void ext2_xattr_block_checksum_update (VFSSuperblock *sb, block_t block,
+				       Ext2XattrHeader *h);
 uint32_t ext2_block_bitmap_checksum (VFSSuperblock *sb, unsigned int group);
 int ext2_block_bitmap_checksum_valid (VFSSuperblock *sb, unsigned int group,
 				      char *bitmap, int size);
@@ -1288,6 +1556,37 @@ int ext2_dir_block_checksum_valid (VFSSuperblock *sb, VFSInode *dir,
 				   Ext2DirEntry *dirent);
 int ext2_dir_block_checksum_update (VFSSuperblock *sb, VFSInode *dir,
 				    Ext2DirEntry *dirent);
+int ext2_xattr_get (VFSInode *inode, const char *name, void *buffer,
+		    size_t len);
+int ext2_xattr_set (VFSInode *inode, const char *name, const void *value,
+		    size_t len, int flags);
+int ext2_xattr_list (VFSInode *inode, char *buffer, size_t len);
+int ext2_xattr_get_index (VFSInode *inode, int index, const char *name,
+			  void *buffer, size_t len);
+int ext2_xattr_set_index (VFSInode *inode, int index, const char *name,
+			  const void *value, size_t len, int flags);
+int ext2_xattr_delete_inode (VFSSuperblock *sb, ino64_t ino, Ext2Inode *inode);
+void ext2_xattr_free_cache (VFSSuperblock *sb);
+int ext2_inline_data_get (VFSInode *inode, char **data, size_t *size);
+int ext2_inline_data_set (VFSInode *inode, const char *data, size_t size);
+int ext2_inline_data_read (VFSInode *inode, void *buffer, size_t len,
+			   off_t offset);
+int ext2_inline_data_write (VFSInode *inode, const void *buffer, size_t len,
+			    off_t offset);
+int ext2_inline_data_set_size (VFSInode *inode, off64_t size);
+int ext2_inline_data_expand (VFSInode *inode);
+int ext2_journal_load (VFSSuperblock *sb);
+void ext2_journal_free (VFSSuperblock *sb);
+int ext2_journal_close (VFSSuperblock *sb);
+void ext2_journal_start (VFSSuperblock *sb);
+int ext2_journal_stop (VFSSuperblock *sb);
+int ext2_journal_end (VFSSuperblock *sb, int ret);
+int ext2_journal_commit (VFSSuperblock *sb);
+void ext2_journal_read_blocks (VFSSuperblock *sb, void *buffer, block_t block,
+			       size_t nblocks);
+int ext2_journal_write_blocks (VFSSuperblock *sb, const void *buffer,
+			       block_t block, size_t nblocks);
+void ext2_journal_forget (VFSSuperblock *sb, block_t block, size_t nblocks);
 
 int ext2_mount (VFSMount *mp, int flags, void *data);
 int ext2_unmount (VFSMount *mp, int flags);
@@ -1296,6 +1595,7 @@ void ext2_destroy_inode (VFSInode *inode);
 int ext2_fill_inode (VFSInode *inode);
 int ext2_write_inode (VFSInode *inode);
 void ext2_free (VFSSuperblock *sb);
+void ext2_flush_files (VFSSuperblock *sb);
 void ext2_update (VFSSuperblock *sb);
 int ext2_statfs (VFSSuperblock *sb, struct statfs64 *st);
 int ext2_remount (VFSSuperblock *sb, int *flags, void *data);
@@ -1308,7 +1608,14 @@ int ext2_unlink (VFSInode *dir, const char *name);
 int ext2_symlink (VFSInode *dir, const char *old, const char *new);
 int ext2_read (VFSInode *inode, void *buffer, size_t len, off_t offset);
 int ext2_write (VFSInode *inode, const void *buffer, size_t len, off_t offset);
-int ext2_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private);
+int ext2_read_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		    off_t offset);
+int ext2_write_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		     off_t offset);
+int ext2_readpage (VFSInode *inode, void *buffer, off64_t offset);
+int ext2_writepage (VFSInode *inode, const void *buffer, off64_t offset);
+int ext2_readdir (VFSInode *inode, VFSDirCursor *cursor,
+		  VFSDirEntryFillFunc func, void *private);
 int ext2_chmod (VFSInode *inode, mode_t mode);
 int ext2_chown (VFSInode *inode, uid_t uid, gid_t gid);
 int ext2_mkdir (VFSInode *dir, const char *name, mode_t mode);
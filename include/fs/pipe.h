@@ -45,6 +45,7 @@ typedef struct
   size_t p_writeptr; /* Offset in data where next write starts */
   void *p_data;      /* Data area reserved for pipe */
   int p_flags;       /* Pipe flags */
+  WaitQueue p_waitq; /* Pollers of either end */
 } Pipe;
 
 __BEGIN_DECLS
@@ -59,6 +60,7 @@ void pipe_destroy_inode (VFSInode *inode);
 int pipe_read (VFSInode *inode, void *buffer, size_t len, off_t offset);
 int pipe_write (VFSInode *inode, const void *buffer, size_t len, off_t offset);
 int pipe_getattr (VFSInode *inode, struct stat64 *st);
+unsigned int pipe_poll (VFSInode *inode, PollTable *pt);
 
 __END_DECLS
 
@@ -21,6 +21,7 @@
 
 #include <sys/cdefs.h>
 #include <sys/device.h>
+#include <sys/poll.h>
 #include <sys/stat.h>
 #include <sys/statfs.h>
 #include <time.h>
@@ -41,9 +42,24 @@ typedef struct _VFSMount VFSMount;
 typedef struct _VFSSuperblock VFSSuperblock;
 typedef struct _VFSInode VFSInode;
 
+/* Called for each directory entry with its name, inode number, type and
+   the directory offset of the entry after it. Returns zero to continue, a
+   positive value to stop before consuming the entry, or an error code. */
+
 typedef int (*VFSDirEntryFillFunc) (const char *, size_t, ino64_t,
 				    unsigned char, off64_t, void *);
 
+/* Resume point of a directory stream. Filesystems save a version number
+   of their directory contents in dc_version along with dc_pos, and may only
+   assume dc_pos lies on an entry boundary while the version is unchanged.
+   A version of zero is never valid. */
+
+typedef struct
+{
+  off64_t dc_pos;
+  unsigned long dc_version;
+} VFSDirCursor;
+
 typedef struct
 {
   VFSInode *(*sb_alloc_inode) (VFSSuperblock *);
@@ -66,7 +82,13 @@ typedef struct
   int (*vfs_symlink) (VFSInode *, const char *, const char *);
   int (*vfs_read) (VFSInode *, void *, size_t, off_t);
   int (*vfs_write) (VFSInode *, const void *, size_t, off_t);
-  int (*vfs_readdir) (VFSInode *, VFSDirEntryFillFunc, void *);
+  int (*vfs_read_iter) (VFSInode *, const struct iovec *, int, off_t);
+  int (*vfs_write_iter) (VFSInode *, const struct iovec *, int, off_t);
+  int (*vfs_readpage) (VFSInode *, void *, off64_t);
+  int (*vfs_writepage) (VFSInode *, const void *, off64_t);
+  int (*vfs_readdir) (VFSInode *, VFSDirCursor *, VFSDirEntryFillFunc,
+		      void *);
+  unsigned int (*vfs_poll) (VFSInode *, PollTable *);
   int (*vfs_chmod) (VFSInode *, mode_t);
   int (*vfs_chown) (VFSInode *, uid_t, gid_t);
   int (*vfs_mkdir) (VFSInode *, const char *, mode_t);
@@ -174,7 +196,13 @@ int vfs_unlink (VFSInode *dir, const char *name);
 int vfs_symlink (VFSInode *dir, const char *old, const char *new);
 int vfs_read (VFSInode *inode, void *buffer, size_t len, off_t offset);
 int vfs_write (VFSInode *inode, const void *buffer, size_t len, off_t offset);
-int vfs_readdir (VFSInode *inode, VFSDirEntryFillFunc func, void *private);
+int vfs_read_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		   off_t offset);
+int vfs_write_iter (VFSInode *inode, const struct iovec *vec, int vlen,
+		    off_t offset);
+int vfs_readdir (VFSInode *inode, VFSDirCursor *cursor,
+		 VFSDirEntryFillFunc func, void *private);
+unsigned int vfs_poll (VFSInode *inode, PollTable *pt);
 int vfs_chmod (VFSInode *inode, mode_t mode);
 int vfs_chown (VFSInode *inode, uid_t uid, gid_t gid);
 int vfs_mkdir (VFSInode *dir, const char *name, mode_t mode);
@@ -19,17 +19,35 @@
 #ifndef _I386_FEATURES_H
 #define _I386_FEATURES_H
 
+#ifndef _ASM
 #include <sys/cdefs.h>
 #include <stdint.h>
+#endif
+
+/* CPUID leaf 1 EDX bits not provided by <cpuid.h> */
+#define CPU_FEATURE_TSC (1 << 4)
+#define CPU_FEATURE_SEP (1 << 11)
+#define CPU_FEATURE_PGE (1 << 13)
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+#ifndef _ASM
 
 __BEGIN_DECLS
 
 extern uint32_t cpu_features_edx;
 extern uint32_t cpu_features_ecx;
+extern int cpu_sysenter;
 
+void cpu_enable_pge (void);
 void cpu_enable_sse (void);
+void cpu_enable_sysenter (void);
 int cpu_random (unsigned long *n);
 
 __END_DECLS
 
 #endif
+
+#endif
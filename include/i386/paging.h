@@ -39,7 +39,15 @@
 #define PAGE_FLAG_WTHRU   (1 << 3)
 #define PAGE_FLAG_NOCACHE (1 << 4)
 #define PAGE_FLAG_ACCESS  (1 << 5)
-#define PAGE_FLAG_4M      (1 << 6)
+#define PAGE_FLAG_DIRTY   (1 << 6) /* Page table entries only */
+#define PAGE_FLAG_4M      (1 << 6) /* Page directory entries only */
+#define PAGE_FLAG_GLOBAL  (1 << 8) /* Page table entries only */
+
+/* Available for software use */
+
+#define PAGE_FLAG_SHARED  (1 << 9)  /* Maps a page cache frame */
+#define PAGE_FLAG_ZERO    (1 << 10) /* Maps the shared zero page */
+#define PAGE_FLAG_SWAP    (1 << 11) /* Not present, holds a swap entry */
 
 /* Page fault flags */
 
@@ -89,10 +97,45 @@ vm_page_inval (uint32_t addr)
 #define vm_page_inval_386(addr) vm_tlb_reset ()
 #endif
 
+/* Collects the pages whose mappings change during a batch of page table
+   updates so they can be invalidated together by tlb_gather_flush. Only
+   pages below RELOC_VADDR may be gathered, since a full flush leaves
+   global kernel mappings in the TLB. */
+
+#define TLB_GATHER_MAX 32 /* Larger batches flush the entire TLB */
+
+typedef struct
+{
+  uint32_t tg_addrs[TLB_GATHER_MAX];
+  int tg_count; /* Above TLB_GATHER_MAX once the array overflowed */
+} TLBGather;
+
+static inline void
+tlb_gather_init (TLBGather *tlb)
+{
+  tlb->tg_count = 0;
+}
+
+static inline void
+tlb_gather_page (TLBGather *tlb, uint32_t addr)
+{
+  addr &= 0xfffff000;
+  if (tlb->tg_count > TLB_GATHER_MAX)
+    return;
+  if (tlb->tg_count > 0 && tlb->tg_addrs[tlb->tg_count - 1] == addr)
+    return;
+  if (tlb->tg_count < TLB_GATHER_MAX)
+    tlb->tg_addrs[tlb->tg_count] = addr;
+  tlb->tg_count++;
+}
+
 uint32_t *page_table_clone (uint32_t index, uint32_t *orig);
 uint32_t *page_dir_clone (uint32_t *orig);
+uint32_t *page_dir_vfork (uint32_t *orig);
+void page_dir_vfork_return (uint32_t *dir, uint32_t *orig);
 void page_dir_free (uint32_t *dir);
 void page_dir_exec_free (uint32_t *dir);
+void tlb_gather_flush (TLBGather *tlb);
 
 __END_DECLS
 
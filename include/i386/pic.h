@@ -49,12 +49,36 @@ typedef struct
 
 __BEGIN_DECLS
 
+extern volatile int irq_depth; /* Nesting level of running IRQ handlers */
+
 static inline void
 idt_load (DTPtr *addr)
 {
   __asm__ volatile ("lidt (%0)" :: "r" (addr));
 }
 
+static inline int
+irq_enabled (void)
+{
+  uint32_t flags;
+  __asm__ volatile ("pushfl; popl %0" : "=r" (flags));
+  return flags & 0x200;
+}
+
+static inline uint32_t
+irq_save (void)
+{
+  uint32_t flags;
+  __asm__ volatile ("pushfl; popl %0; cli" : "=r" (flags) :: "memory");
+  return flags;
+}
+
+static inline void
+irq_restore (uint32_t flags)
+{
+  __asm__ volatile ("pushl %0; popfl" :: "r" (flags) : "memory", "cc");
+}
+
 __END_DECLS
 
 #endif
@@ -0,0 +1,60 @@
+/*************************************************************************
+ * rbtree.h -- This file is part of OS/0.                                *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+#ifndef _LIBK_RBTREE_H
+#define _LIBK_RBTREE_H
+
+#include <libk/types.h>
+#include <sys/cdefs.h>
+
+#define rb_entry(node, type, member)					\
+  ((type *) ((char *) (node) - __builtin_offsetof (type, member)))
+
+typedef struct _RBNode RBNode;
+
+struct _RBNode
+{
+  RBNode *rb_parent;
+  RBNode *rb_left;
+  RBNode *rb_right;
+  int rb_red;
+};
+
+/* Nodes are embedded in the objects stored in the tree. If rbt_augment is
+   set, it is called to recompute a value kept in a node from the node and
+   its two children whenever those children change. */
+
+typedef struct
+{
+  RBNode *rbt_root;
+  size_t rbt_count;
+  void (*rbt_augment) (RBNode *);
+} RBTree;
+
+__BEGIN_DECLS
+
+void rb_link (RBTree *tree, RBNode *node, RBNode *parent, RBNode **link);
+void rb_erase (RBTree *tree, RBNode *node);
+void rb_propagate (RBTree *tree, RBNode *node);
+RBNode *rb_first (const RBTree *tree);
+RBNode *rb_last (const RBTree *tree);
+RBNode *rb_next (const RBNode *node);
+RBNode *rb_prev (const RBNode *node);
+
+__END_DECLS
+
+#endif
@@ -175,6 +175,8 @@ int ata_poll (unsigned char channel, unsigned char chkerr);
 int ata_perror (unsigned char drive, int err);
 int ata_access (unsigned char op, unsigned char drive, uint32_t lba,
 		unsigned char nsects, void *buffer);
+int ata_access_vec (unsigned char op, unsigned char drive, uint32_t lba,
+		    unsigned char nsects, const struct iovec *vec, int vlen);
 void ata_await (void);
 void ata_interrupt (int channel);
 
@@ -189,6 +191,10 @@ int ata_write_sectors (unsigned char drive, unsigned char nsects, uint32_t lba,
 int ata_device_read (SpecDevice *dev, void *buffer, size_t len, off_t offset);
 int ata_device_write (SpecDevice *dev, const void *buffer, size_t len,
 		      off_t offset);
+int ata_device_readv (SpecDevice *dev, const struct iovec *vec, int vlen,
+		      off_t offset);
+int ata_device_writev (SpecDevice *dev, const struct iovec *vec, int vlen,
+		       off_t offset);
 
 __END_DECLS
 
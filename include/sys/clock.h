@@ -0,0 +1,54 @@
+/*************************************************************************
+ * clock.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _SYS_CLOCK_H
+#define _SYS_CLOCK_H
+
+#include <bits/vtime.h>
+#include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* The vtime data is mapped into every process, so it is padded to a whole
+   page to keep the kernel data after it out of user space */
+
+typedef union
+{
+  struct vtime_page cv_vtime;
+  char cv_pad[PAGE_SIZE];
+} ClockVtimePage;
+
+__BEGIN_DECLS
+
+extern ClockVtimePage clock_vtime;
+extern uint64_t clock_tsc_hz;
+
+void clock_init (void);
+void clock_tick (void);
+uint64_t clock_monotonic (void);
+uint64_t clock_realtime (void);
+uint64_t clock_resolution (void);
+void clock_task_switch (pid_t prev, pid_t next);
+uint64_t clock_process_cputime (pid_t pid);
+
+__END_DECLS
+
+#endif
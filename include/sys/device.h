@@ -19,6 +19,7 @@
 #ifndef _SYS_DEVICE_H
 #define _SYS_DEVICE_H
 
+#include <bits/uio.h>
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
@@ -56,6 +57,8 @@ struct _SpecDevice
   void *sd_private;
   int (*sd_read) (SpecDevice *, void *, size_t, off_t);
   int (*sd_write) (SpecDevice *, const void *, size_t, off_t);
+  int (*sd_readv) (SpecDevice *, const struct iovec *, int, off_t);
+  int (*sd_writev) (SpecDevice *, const struct iovec *, int, off_t);
 };
 
 __BEGIN_DECLS
@@ -70,6 +73,10 @@ SpecDevice *device_register (dev_t major, dev_t minor, unsigned char type,
 			     int (*write) (SpecDevice *, const void *, size_t,
 					   off_t));
 SpecDevice *device_lookup (dev_t major, dev_t minor);
+int device_readv (SpecDevice *dev, const struct iovec *vec, int vlen,
+		  off_t offset);
+int device_writev (SpecDevice *dev, const struct iovec *vec, int vlen,
+		   off_t offset);
 
 __END_DECLS
 
@@ -0,0 +1,76 @@
+/*************************************************************************
+ * kmsg.h -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _SYS_KMSG_H
+#define _SYS_KMSG_H
+
+#include <sys/cdefs.h>
+#include <sys/device.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+/* Log level prefixes for printk */
+#define KERN_EMERG   "<0>"
+#define KERN_ALERT   "<1>"
+#define KERN_CRIT    "<2>"
+#define KERN_ERR     "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_NOTICE  "<5>"
+#define KERN_INFO    "<6>"
+#define KERN_DEBUG   "<7>"
+
+#define KMSG_DEFAULT_LEVEL 6
+#define KMSG_CONSOLE_LEVEL 7 /* Only levels below this reach the console */
+
+#define KMSG_RECORDS  256 /* Must be a power of two */
+#define KMSG_TEXT_MAX 240
+#define KMSG_NEST_MAX 4   /* Nested printk contexts (task, IRQ, exception) */
+
+#define KMSG_MAJOR 1
+#define KMSG_MINOR 11
+
+/* A single log record. km_commit is zero while the record is being written
+   and km_seq + 1 once it is complete, so readers can detect torn or
+   overwritten records without taking a lock. */
+
+typedef struct
+{
+  volatile uint32_t km_commit;
+  uint32_t km_seq;
+  uint32_t km_pos;
+  unsigned long km_tick;
+  unsigned char km_level;
+  unsigned char km_prefix;
+  uint16_t km_len;
+  char km_text[KMSG_TEXT_MAX];
+} KmsgRecord;
+
+__BEGIN_DECLS
+
+extern int kmsg_deferred;
+extern int kmsg_console_level;
+
+int kmsg_vprintk (const char *fmt, va_list args);
+void kmsg_flush (void);
+void kmsg_sync (void);
+int kmsg_device_read (SpecDevice *dev, void *buffer, size_t len,
+		      off_t offset);
+
+__END_DECLS
+
+#endif
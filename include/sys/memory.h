@@ -41,6 +41,9 @@
 #define RELOC_LEN   ((uint32_t) &_kernel_end - RELOC_VADDR)
 #endif
 
+/* User memory mappings end where the kernel page tables start */
+#define PROCESS_MMAP_END RELOC_VADDR
+
 #define KHEAP_DATA_PADDR 0x00808000
 #define KHEAP_DATA_VADDR 0xd0000000
 #define KHEAP_DATA_LEN   0x10000000
@@ -53,6 +56,9 @@
 #define ATA_PRDT_VADDR 0xe0020000
 #define ATA_PRDT_LEN   0x4000
 
+/* Kernel-only window where swap maps frames being written out */
+#define SWAP_COPY_VADDR 0xe0024000
+
 #define PAGE_STACK_PADDR 0x10808000
 #define PAGE_STACK_VADDR 0xe0400000
 #define PAGE_STACK_NELEM 0x100000
@@ -60,9 +66,10 @@
 #define PAGE_STACK_LEN   (PAGE_STACK_NELEM * sizeof (void *))
 #endif
 
-#define EXEC_DATA_PADDR 0x10908000
+/* Window where exec builds the initial stack of the new program in pages
+   that are then moved to the top of its user stack */
 #define EXEC_DATA_VADDR 0xff410000
-#define EXEC_DATA_LEN   ARG_MAX
+#define EXEC_DATA_LEN   (ARG_MAX + PAGE_SIZE)
 
 #define MEM_ALLOC_START 0x1c000000
 
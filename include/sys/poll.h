@@ -0,0 +1,78 @@
+/*************************************************************************
+ * poll.h -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _SYS_POLL_H
+#define _SYS_POLL_H
+
+#include <bits/poll.h>
+#include <bits/select.h>
+#include <bits/time.h>
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+typedef struct _WaitQueueEntry WaitQueueEntry;
+typedef struct _PollTable PollTable;
+
+/* Objects that can change readiness keep a queue of interested waiters.
+   Wakeup functions may be called from interrupt handlers. */
+
+typedef struct
+{
+  WaitQueueEntry *wq_head;
+} WaitQueue;
+
+struct _WaitQueueEntry
+{
+  WaitQueueEntry *we_prev;
+  WaitQueueEntry *we_next;
+  WaitQueue *we_queue;
+  void (*we_func) (WaitQueueEntry *, unsigned int);
+  void *we_private;
+};
+
+/* Passed to the poll operation of an inode, which calls poll_wait () on
+   each queue that will be woken when its readiness changes */
+
+struct _PollTable
+{
+  void (*pt_func) (PollTable *, WaitQueue *);
+  void *pt_private;
+  volatile int pt_woken;
+};
+
+__BEGIN_DECLS
+
+void wait_queue_add (WaitQueue *wq, WaitQueueEntry *entry);
+void wait_queue_remove (WaitQueueEntry *entry);
+void wait_queue_wake (WaitQueue *wq, unsigned int events);
+
+int poll_sleep (PollTable *pt, uint64_t deadline);
+int poll (struct pollfd *fds, nfds_t nfds, int timeout);
+int select (int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+	    struct timeval *timeout);
+
+static inline void
+poll_wait (PollTable *pt, WaitQueue *wq)
+{
+  if (pt != NULL && pt->pt_func != NULL)
+    pt->pt_func (pt, wq);
+}
+
+__END_DECLS
+
+#endif
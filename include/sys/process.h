@@ -23,12 +23,15 @@
 
 #include <fs/vfs.h>
 #include <libk/array.h>
+#include <libk/rbtree.h>
+#include <sys/memory.h>
 #include <sys/resource.h>
 #include <sys/signal.h>
 #include <sys/task.h>
 #include <termios.h>
 
 #define PROCESS_BREAK_LIMIT    0x40000000
+#define PROCESS_FD_TABLE_MIN   32 /* Initial size of descriptor tables */
 
 /* XXX Process file descriptors are shared on fork */
 
@@ -38,33 +41,43 @@ typedef struct
   char *pf_path;          /* Path used to open fd */
   int pf_mode;            /* Access mode */
   off64_t pf_offset;      /* Current offset position */
+  VFSDirCursor pf_dir;    /* Directory stream resume point */
   int pf_refcnt;          /* Reference count */
+  int pf_writer;          /* Counted as a writer of the inode */
+  void *pf_next;          /* Next free file when unused */
+  void *pf_epoll;         /* Epoll items watching this file */
 } ProcessFile;
 
 typedef struct
 {
-  uint32_t pm_base; /* Base address */
-  uint32_t pm_len;  /* Length of memory region */
-  int pm_prot;      /* Memory protection options */
-  int pm_flags;     /* Flags set by mmap(2) */
-  VFSInode *pm_ino; /* Inode used for mapping */
-  off_t pm_offset;  /* Offset into inode */
+  uint32_t pm_base;   /* Base address */
+  uint32_t pm_len;    /* Length of memory region */
+  int pm_prot;        /* Memory protection options */
+  int pm_flags;       /* Flags set by mmap(2) */
+  VFSInode *pm_ino;   /* Inode used for mapping */
+  off_t pm_offset;    /* Offset into inode */
+  RBNode pm_node;     /* Node in tree of regions ordered by address */
+  uint32_t pm_gap;    /* Unmapped bytes below region */
+  uint32_t pm_maxgap; /* Largest gap in subtree */
 } ProcessMemoryRegion;
 
 typedef struct
 {
-  ProcessFile *p_files[PROCESS_FILE_LIMIT];  /* File descriptors */
-  int p_fdflags[PROCESS_FILE_LIMIT];         /* File descriptor flags */
+  ProcessFile **p_files;                     /* File descriptors */
+  int *p_fdflags;                            /* File descriptor flags */
+  uint32_t *p_fdmap;                         /* Bitmap of used descriptors */
+  int p_fdsize;                              /* Size of descriptor table */
   struct sigaction p_sigactions[NSIG];       /* Signal handler table */
   sigset_t p_sigblocked;                     /* Signal block mask */
   sigset_t p_sigpending;                     /* Signal pending mask */
   volatile ProcessTask *p_task;              /* Scheduler task */
-  SortedArray *p_mregions;                   /* List of mmap'd regions */
+  RBTree p_mregions;                         /* Tree of mmap'd regions */
   VFSInode *p_cwd;                           /* Working directory */
   char *p_cwdpath;                           /* Path to working directory */
   uint32_t p_break;                          /* Location of program break */
   uint32_t p_initbreak;                      /* Starting address of break */
   uint32_t p_maxbreak;                       /* Maximum address of break */
+  uint32_t p_vmsize;                         /* Bytes of reserved memory */
   uint32_t p_maxfds;                         /* Maximum file descriptors */
   struct rlimit p_addrspace;                 /* Limits of address space */
   struct rlimit p_coresize;                  /* Limits on core dump size */
@@ -78,6 +91,21 @@ typedef struct
   int p_sig;                                 /* Signal to be handled */
   siginfo_t p_siginfo;                       /* Signal info */
   size_t p_children;                         /* Number of child processes */
+  pid_t p_child;                             /* First running child */
+  pid_t p_zombies;                           /* First exited child that has
+						not been waited for */
+  pid_t p_sibling_prev;                      /* Links in list of running or
+						exited children of parent */
+  pid_t p_sibling_next;
+  WaitQueue p_waitq;                         /* Woken when a child exits */
+  pid_t p_vfork;                             /* vfork child borrowing the
+						address space */
+  int p_spawnerr;                            /* Error of posix_spawn child */
+  int p_exited;                              /* If process has exited */
+  int p_zombie;                              /* If process has been freed
+						but not waited for */
+  int p_orphan;                              /* If taken over by the kernel
+						task after its parent exited */
   int p_term;                                /* If process is terminated */
   int p_waitstat;                            /* Value to set wait status to */
   mode_t p_umask;                            /* File creation mask */
@@ -90,6 +118,8 @@ typedef struct
   pid_t p_pgid;                              /* Process group id */
   pid_t p_sid;                               /* Session id */
   struct itimerval p_itimers[__NR_itimers];  /* Interval timers */
+  uint64_t p_runtime;                        /* CPU time used (ns) */
+  uint64_t p_runstart;                       /* Time last scheduled in */
 } Process;
 
 __BEGIN_DECLS
@@ -98,25 +128,70 @@ extern Process process_table[PROCESS_LIMIT];
 extern ProcessFile process_fd_table[PROCESS_SYS_FILE_LIMIT];
 
 int process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
-		  char *const *envp, DynamicLinkInfo *dlinfo);
+		  char *const *envp, DynamicLinkInfo *dlinfo, ExecArgs *args);
 int process_exec_sh (VFSInode *inode, uint32_t *entry, char *const *argv,
-		     char *const *envp, DynamicLinkInfo *dlinfo);
+		     char *const *envp, DynamicLinkInfo *dlinfo,
+		     ExecArgs *args);
 int process_valid (pid_t pid);
 void process_clear (pid_t pid, int partial);
 void process_free (pid_t pid);
+void process_exit (pid_t pid, int waitstat);
+int process_vfork_return (pid_t pid, int exec);
+void process_add_child (pid_t ppid, pid_t pid);
+void process_reap (pid_t ppid, pid_t pid);
 void process_region_free (void *elem, void *data);
+void process_region_unmap (uint32_t *dir, uint32_t vaddr);
+ProcessMemoryRegion *process_find_region (Process *proc, uint32_t addr);
+int process_page_fault (uint32_t addr, uint32_t err);
+int process_vm_reserve (Process *proc, uint32_t len);
+ProcessMemoryRegion *process_region_alloc (void);
+void process_region_dealloc (ProcessMemoryRegion *region);
+int process_region_ref (ProcessMemoryRegion *region);
+void process_region_unref (ProcessMemoryRegion *region);
+int process_write_denied (VFSInode *inode);
+int process_write_busy (VFSInode *inode);
+int process_get_write_access (VFSInode *inode);
+void process_put_write_access (VFSInode *inode);
+void process_region_init (RBTree *tree);
+void process_region_insert (RBTree *tree, ProcessMemoryRegion *region);
+void process_region_remove (RBTree *tree, ProcessMemoryRegion *region);
+void process_region_resize (RBTree *tree, ProcessMemoryRegion *region,
+			    uint32_t len);
+ProcessMemoryRegion *process_region_lookup (const RBTree *tree,
+					    uint32_t addr);
+ProcessMemoryRegion *process_region_first (const RBTree *tree);
+ProcessMemoryRegion *process_region_next (const ProcessMemoryRegion *region);
+uint32_t process_region_find_gap (const RBTree *tree, uint32_t low,
+				  uint32_t len);
+int process_region_clone (RBTree *tree, const RBTree *orig);
+void process_region_destroy (RBTree *tree, uint32_t *dir);
 int process_setup_std_streams (pid_t pid);
 uint32_t process_set_break (uint32_t addr);
-int process_mregion_cmp (const void *a, const void *b);
 void process_add_rusage (struct rusage *usage, const Process *proc);
-void process_remap_segments (void *base, SortedArray *mregions);
+void process_remap_segments (void *base, RBTree *mregions);
+int process_map_text (VFSInode *inode, RBTree *mregions, Elf32_Phdr *phdr,
+		      uint32_t bias);
+int process_find_fd (Process *proc, int fd);
 int process_alloc_fd (Process *proc, int fd);
 int process_free_fd (Process *proc, int fd);
+void process_set_fd (Process *proc, int fd, ProcessFile *file, int flags);
+int process_copy_fds (Process *proc, const Process *parent);
+void process_free_fds (Process *proc);
 int process_terminated (pid_t pid);
 int process_send_signal (pid_t pid, int sig);
 void process_clear_sighandlers (pid_t pid);
 void process_handle_signal (void);
 
+/* Returns the open file of descriptor FD, or NULL if FD is not open */
+
+static inline ProcessFile *
+process_get_file (Process *proc, int fd)
+{
+  if (fd < 0 || fd >= proc->p_fdsize)
+    return NULL;
+  return proc->p_files[fd];
+}
+
 __END_DECLS
 
 #endif
@@ -21,7 +21,8 @@
 
 #include <kconfig.h>
 
-#include <libk/array.h>
+#include <fs/vfs.h>
+#include <libk/rbtree.h>
 #include <sys/memory.h>
 #include <elf.h>
 
@@ -35,6 +36,8 @@
 #define LD_SO_LOAD_ADDR    0x00008000
 #define LD_SO_ENTRY_SYMBOL "rtld_main"
 
+#define RTLD_CACHE_SEGMENTS 4
+
 typedef struct
 {
   char *st_table;
@@ -87,14 +90,37 @@ typedef struct
   PLTRelTable dl_pltrel;    /* Relocation table for PLT */
 } DynamicLinkInfo;
 
+typedef struct
+{
+  Elf32_Phdr rs_phdr;
+  void *rs_data;            /* Relocated contents, NULL if read from file */
+} RtldSegment;
+
+/* The dynamic linker as loaded and relocated by the last exec that needed
+   it. Later execs with the same interpreter only map it again: its text is
+   shared from the page cache and its other segments are copied from their
+   relocated contents. */
+
+typedef struct
+{
+  VFSSuperblock *rc_sb;
+  ino64_t rc_ino;
+  struct timespec rc_mtime;
+  off64_t rc_size;
+  uint32_t rc_entry;
+  unsigned int rc_refcnt;
+  int rc_nsegs;
+  RtldSegment rc_segs[RTLD_CACHE_SEGMENTS];
+} RtldCache;
+
 __BEGIN_DECLS
 
-int rtld_setup (Elf32_Ehdr *ehdr, SortedArray *mregions, uint32_t *entry,
-		DynamicLinkInfo *dlinfo);
-int rtld_load_interp (Elf32_Ehdr *ehdr, SortedArray *mregions,
-		      DynamicLinkInfo *dlinfo, DynamicLinkInfo *interp_dlinfo);
+int rtld_setup (RBTree *mregions, uint32_t *entry, DynamicLinkInfo *dlinfo);
+int rtld_load_interp (VFSInode *inode, Elf32_Ehdr *ehdr, RBTree *mregions,
+		      DynamicLinkInfo *interp_dlinfo, RtldCache *cache);
 int rtld_perform_interp_reloc (DynamicLinkInfo *dlinfo);
 void rtld_setup_dynamic_linker (void);
+void rtld_cache_invalidate (VFSSuperblock *sb, ino64_t ino);
 
 __END_DECLS
 
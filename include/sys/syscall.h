@@ -19,6 +19,8 @@
 #ifndef _SYS_SYSCALL_H
 #define _SYS_SYSCALL_H
 
+#include <bits/epoll.h>
+#include <bits/spawn.h>
 #include <bits/syscall.h>
 #include <bits/uio.h>
 #include <bits/utime.h>
@@ -32,13 +34,14 @@
 #include <sys/stat.h>
 #include <dirent.h>
 
+/* For getdents the counts are in entries, for getdents64 in bytes */
+
 typedef struct
 {
   unsigned int d_curr_count;
   unsigned int d_max_count;
-  off64_t d_curr_offset;
-  off64_t d_min_offset;
-  struct dirent *d_dirp;
+  void *d_dirp;
+  int d_overflow; /* An entry was left out because the buffer was full */
 } DirIterContext;
 
 __BEGIN_DECLS
@@ -137,12 +140,16 @@ int sys_fchdir (int fd);
 int sys__llseek (int fd, unsigned long offset_high, unsigned long offset_low,
 		 off64_t *result, int whence);
 int sys_getdents (int fd, struct dirent *dirp, unsigned int count);
+int sys__newselect (int nfds, fd_set *readfds, fd_set *writefds,
+		    fd_set *exceptfds, struct timeval *timeout);
+int sys_msync (void *addr, size_t len, int flags);
 ssize_t sys_readv (int fd, const struct iovec *vec, int vlen);
 ssize_t sys_writev (int fd, const struct iovec *vec, int vlen);
 pid_t sys_getsid (pid_t pid);
 int sys_nanosleep (const struct timespec *req, struct timespec *rem);
 int sys_setresuid (uid_t ruid, uid_t euid, uid_t suid);
 int sys_getresuid (uid_t *ruid, uid_t *euid, uid_t *suid);
+int sys_poll (struct pollfd *fds, nfds_t nfds, int timeout);
 int sys_setresgid (gid_t rgid, gid_t egid, gid_t sgid);
 int sys_getresgid (gid_t *rgid, gid_t *egid, gid_t *sgid);
 ssize_t sys_pread64 (int fd, void *buffer, size_t len, off64_t offset);
@@ -155,6 +162,10 @@ int sys_ftruncate64 (int fd, off64_t len);
 int sys_stat64 (const char *path, struct stat64 *st);
 int sys_lstat64 (const char *path, struct stat64 *st);
 int sys_fstat64 (int fd, struct stat64 *st);
+int sys_getdents64 (int fd, void *dirp, unsigned int count);
+int sys_posix_spawn (pid_t *pid, const char *path,
+		     const struct spawn_file_action *actions, char *const *argv,
+		     char *const *envp);
 int sys_setxattr (const char *path, const char *name, const void *value,
 		  size_t len, int flags);
 int sys_lsetxattr (const char *path, const char *name, const void *value,
@@ -170,6 +181,10 @@ int sys_flistxattr (int fd, char *buffer, size_t len);
 int sys_removexattr (const char *path, const char *name);
 int sys_lremovexattr (const char *path, const char *name);
 int sys_fremovexattr (int fd, const char *name);
+int sys_epoll_create (int size);
+int sys_epoll_ctl (int epfd, int op, int fd, struct epoll_event *event);
+int sys_epoll_wait (int epfd, struct epoll_event *events, int maxevents,
+		    int timeout);
 int sys_clock_getres (clockid_t id, struct timespec *tp);
 int sys_clock_gettime (clockid_t id, struct timespec *tp);
 int sys_statfs64 (const char *path, struct statfs64 *st);
@@ -192,6 +207,7 @@ int sys_fchmodat (int fd, const char *path, mode_t mode, int flags);
 int sys_faccessat (int fd, const char *path, int mode, int flags);
 int sys_utimensat (int fd, const char *path, const struct timespec times[2],
 		   int flags);
+int sys_epoll_create1 (int flags);
 ssize_t sys_getrandom (void *buffer, size_t len, unsigned int flags);
 
 /* Utility functions */
@@ -200,6 +216,8 @@ int sys_path_sep (const char *path, VFSInode **dir, char **name);
 VFSInode *inode_from_fd (int fd);
 int sys_read_dir_entry (const char *name, size_t namelen, ino64_t ino,
 			unsigned char type, off64_t offset, void *private);
+int sys_read_dir_entry64 (const char *name, size_t namelen, ino64_t ino,
+			  unsigned char type, off64_t offset, void *private);
 
 __END_DECLS
 
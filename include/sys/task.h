@@ -19,6 +19,10 @@
 #ifndef _SYS_TASK_H
 #define _SYS_TASK_H
 
+#include <bits/syscall.h>
+#include <bits/vtime.h>
+#include <sys/memory.h>
+
 #ifndef _ASM
 #include <sys/rtld.h>
 #include <sys/types.h>
@@ -31,8 +35,20 @@
 #define SYSCALL_STACK_ADDR 0xff404000
 #define SYSCALL_STACK_SIZE 0x1000
 
+/* The pages holding the arguments of a program take the top of the user
+   stack, which is moved down by as many pages */
+#define TASK_STACK_LIMIT   (TASK_STACK_BOTTOM - EXEC_DATA_LEN)
+
+/* Copy of the dynamic linking info at the top of the initial stack */
+#define TASK_EXEC_DLINFO      (SYSCALL_STACK_ADDR - TASK_EXEC_DLINFO_SIZE)
+#define TASK_EXEC_DLINFO_SIZE 128
+
+#define TASK_AUXV_MAX 20
+
 #define TASK_EXIT_PAGE      0xff406000
 #define TASK_SIGINFO_PAGE   0xff407000
+#define TASK_TIME_PAGE      VTIME_PAGE_ADDR
+#define TASK_VSYSCALL_PAGE  VSYSCALL_PAGE_ADDR
 
 #ifndef _ASM
 
@@ -48,8 +64,21 @@ typedef struct _ProcessTask
   int t_priority;
   volatile struct _ProcessTask *t_prev;
   volatile struct _ProcessTask *t_next;
+  pid_t t_vfork;
 } ProcessTask;
 
+/* Initial stack of a program being executed. It is built in the exec data
+   window with its pointers set to where it will be once its pages are
+   moved to the top of the user stack. */
+
+typedef struct
+{
+  uint32_t ea_pages;     /* Pages used by the initial stack */
+  uint32_t ea_esp;       /* Initial stack pointer */
+  Elf32_auxv_t *ea_auxv; /* Auxiliary vector in the exec data window */
+  int ea_nauxv;          /* Number of auxiliary vector entries set */
+} ExecArgs;
+
 #define DISABLE_TASK_SWITCH (task_switch_enabled = 0)
 #define ENABLE_TASK_SWITCH  (task_switch_enabled = 1)
 
@@ -58,16 +87,20 @@ __BEGIN_DECLS
 extern volatile int task_switch_enabled;
 
 void scheduler_init (void);
-void task_timer_tick (void);
+void task_timer_tick (unsigned long usec);
+unsigned long task_timer_next (void);
 int task_fork (int copy_pgdir);
 void task_yield (void);
 int task_new (uint32_t eip);
-void task_exec (uint32_t eip, char *const *argv, char *const *envp,
-		DynamicLinkInfo *dlinfo) __attribute__ ((noreturn));
+void task_exec (uint32_t eip, ExecArgs *args, DynamicLinkInfo *dlinfo)
+  __attribute__ ((noreturn));
 void task_free (ProcessTask *task);
 pid_t task_getpid (void);
 pid_t task_getppid (void);
-int task_setup_exec (char *const *argv, char *const *envp);
+int task_setup_exec (ExecArgs *args, char *const *argv, char *const *envp);
+void task_set_auxv (ExecArgs *args, uint32_t type, uint32_t value);
+uint32_t task_map_exec_args (const ExecArgs *args,
+			     const DynamicLinkInfo *dlinfo);
 
 __END_DECLS
 
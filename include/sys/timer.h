@@ -36,6 +36,8 @@ uint32_t timer_get_rem_ms (void);
 
 void msleep (uint32_t ms);
 unsigned long timer_poll (void);
+void timer_idle (void);
+void timer_idle_exit (void);
 
 void speaker_init (void);
 void speaker_beep (void);
@@ -0,0 +1,91 @@
+/*************************************************************************
+ * trace.h -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _SYS_TRACE_H
+#define _SYS_TRACE_H
+
+#include <kconfig.h>
+
+#define TRACE_SYSCALL_ENTRY 0
+#define TRACE_SYSCALL_EXIT  1
+#define TRACE_SWITCH        2
+#define TRACE_ATA_SUBMIT    3
+#define TRACE_ATA_COMPLETE  4
+#define TRACE_PAGE_FAULT    5
+#define TRACE_KMALLOC       6
+#define TRACE_KFREE         7
+
+#define TRACE_EVENT_COUNT   8
+
+#define TRACE_RING_SIZE     512 /* Must be a power of two */
+#define TRACE_HIST_BUCKETS  32  /* Bucket n counts latencies in [2^n, 2^n+1) */
+
+#define TRACE_MAJOR         1
+#define TRACE_EVENTS_MINOR  12
+#define TRACE_SYSLAT_MINOR  13
+
+#ifndef _ASM
+
+#include <sys/device.h>
+#include <stdint.h>
+
+/* Records read from /dev/trace have this layout. Each event has its own ring
+   of TRACE_RING_SIZE records which are returned oldest first, one ring after
+   the other in event number order. Unused slots have te_tsc set to zero. */
+
+typedef struct
+{
+  uint64_t te_tsc;
+  uint32_t te_arg[2];
+  pid_t te_pid;
+  uint16_t te_event;
+} TraceEvent;
+
+typedef struct
+{
+  volatile uint32_t tr_head;
+  TraceEvent tr_events[TRACE_RING_SIZE];
+} TraceRing;
+
+#ifdef TRACEPOINTS
+#define TRACE(event, a, b)						\
+  trace_event (event, (uint32_t) (a), (uint32_t) (b))
+#else
+#define TRACE(event, a, b) ((void) 0)
+#endif
+
+__BEGIN_DECLS
+
+uint64_t trace_clock (void);
+void trace_event (int event, uint32_t arg0, uint32_t arg1);
+void trace_syscall_entry (int nr);
+void trace_syscall_exit (int nr, int ret);
+int trace_events_read (SpecDevice *dev, void *buffer, size_t len,
+		       off_t offset);
+int trace_events_write (SpecDevice *dev, const void *buffer, size_t len,
+			off_t offset);
+int trace_syslat_read (SpecDevice *dev, void *buffer, size_t len,
+		       off_t offset);
+int trace_syslat_write (SpecDevice *dev, const void *buffer, size_t len,
+			off_t offset);
+
+__END_DECLS
+
+#endif
+
+#endif
@@ -61,6 +61,7 @@ struct _TTY
   unsigned char t_statebuf[8];        /* Terminal-specific extra data */
   size_t t_curritem;                  /* Current index in extra data */
   void (*t_write_char) (TTY *, char); /* Terminal write structure */
+  WaitQueue t_waitq;                  /* Pollers waiting for input */
 };
 
 #define CURRENT_TTY (ttys[active_tty])
@@ -90,6 +91,7 @@ void tty_set_active (int term);
 int tty_read (VFSInode *inode, void *buffer, size_t len, off_t offset);
 int tty_write (VFSInode *inode, const void *buffer, size_t len, off_t offset);
 int tty_getattr (VFSInode *inode, struct stat64 *st);
+unsigned int tty_poll (VFSInode *inode, PollTable *pt);
 
 void vt100_write_char (TTY *tty, char c);
 
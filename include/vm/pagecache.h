@@ -0,0 +1,94 @@
+/*************************************************************************
+ * pagecache.h -- This file is part of OS/0.                             *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _VM_PAGECACHE_H
+#define _VM_PAGECACHE_H
+
+#include <kconfig.h>
+
+#include <fs/vfs.h>
+#include <sys/cdefs.h>
+#include <stdint.h>
+
+#define PAGE_CACHE_SHIFT     12
+#define PAGE_CACHE_HASH_SIZE 1024 /* Must be a power of two */
+
+#define CACHE_PAGE_DIRTY (1 << 0)
+
+typedef struct _CachePage CachePage;
+typedef struct _FileCache FileCache;
+
+/* Pages of regular files are cached by superblock and inode number since
+   every open of a file has its own VFS inode. A page whose file is
+   truncated or deleted while it is still mapped is detached from its file
+   and freed when the last mapping goes away. */
+
+struct _CachePage
+{
+  FileCache *cp_file;
+  uint32_t cp_index;      /* Page number in file */
+  void *cp_data;          /* Kernel address of page */
+  uint32_t cp_paddr;      /* Physical address of page */
+  unsigned int cp_refcnt; /* Mappings and other users of the page */
+  int cp_flags;
+  CachePage *cp_hnext;    /* Next page in index hash chain */
+  CachePage *cp_fnext;    /* Next page in frame hash chain */
+  CachePage *cp_prev;     /* Links in list of pages of the file */
+  CachePage *cp_next;
+  CachePage *cp_lprev;    /* Links in LRU list */
+  CachePage *cp_lnext;
+  CachePage *cp_dprev;    /* Links in list of dirty pages of the file */
+  CachePage *cp_dnext;
+};
+
+struct _FileCache
+{
+  VFSSuperblock *fc_sb;
+  ino64_t fc_ino;
+  VFSInode *fc_inode;     /* Inode used to write back pages */
+  CachePage *fc_pages;
+  unsigned long fc_npages;
+  unsigned long fc_nbusy; /* Pages with a nonzero reference count */
+  unsigned long fc_ndirty;
+  CachePage *fc_dirty;    /* Dirty pages, oldest first */
+  CachePage *fc_dirty_tail;
+  FileCache *fc_next;
+};
+
+__BEGIN_DECLS
+
+int page_cache_get (VFSInode *inode, uint32_t index, CachePage **result);
+void page_cache_put (CachePage *page);
+void page_cache_ref_frame (uint32_t paddr);
+void page_cache_dirty_frame (uint32_t paddr);
+void page_cache_unmap_frame (uint32_t paddr, int dirty);
+
+int page_cache_read (VFSInode *inode, void *buffer, size_t len,
+		     off64_t offset);
+void page_cache_update (VFSInode *inode, const void *buffer, size_t len,
+			off64_t offset);
+int page_cache_busy (VFSInode *inode, int write);
+int page_cache_sync (VFSInode *inode, off64_t start, off64_t end);
+void page_cache_truncate (VFSInode *inode, off64_t size);
+void page_cache_invalidate (VFSSuperblock *sb, ino64_t ino);
+int page_cache_sync_sb (VFSSuperblock *sb);
+int page_cache_drop_sb (VFSSuperblock *sb);
+
+__END_DECLS
+
+#endif
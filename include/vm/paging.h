@@ -36,18 +36,22 @@ extern uint32_t kernel_page_table[2][PAGE_TBL_SIZE]
   __attribute__ ((aligned (PAGE_SIZE)));
 extern uint32_t kernel_stack_table[PAGE_TBL_SIZE]
   __attribute__ ((aligned (PAGE_SIZE)));
-extern uint32_t kernel_vmap[PAGE_DIR_SIZE]
+extern uint32_t kernel_vmap[PAGE_DIR_SIZE * 2]
   __attribute__ ((aligned (PAGE_SIZE)));
 extern uint32_t kheap_page_table[65][PAGE_TBL_SIZE]
   __attribute__ ((aligned (PAGE_SIZE)));
 extern uint32_t page_stack_table[PAGE_TBL_SIZE]
   __attribute__ ((aligned (PAGE_SIZE)));
 extern uint32_t *curr_page_dir;
+extern const char page_empty[PAGE_SIZE];
 
 void paging_loaddir (uint32_t addr);
 void paging_enable (void);
+void paging_enable_global (void);
+int paging_sync_kernel (uint32_t addr);
 
 uint32_t get_paddr (uint32_t *dir, void *vaddr);
+uint32_t *get_pte (uint32_t *dir, uint32_t vaddr);
 void map_page (uint32_t *dir, uint32_t paddr, uint32_t vaddr, uint32_t flags);
 void unmap_page (uint32_t *dir, uint32_t vaddr);
 
@@ -0,0 +1,101 @@
+/*************************************************************************
+ * swap.h -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#ifndef _VM_SWAP_H
+#define _VM_SWAP_H
+
+#include <kconfig.h>
+
+#include <sys/cdefs.h>
+#include <sys/device.h>
+#include <vm/paging.h>
+#include <limits.h>
+#include <stdint.h>
+
+#define SWAP_MAGIC      "SWAPSPACE2"
+#define SWAP_VERSION    1
+#define SWAP_PART_TYPE  0x82    /* MBR partition type of swap areas */
+#define SWAP_AREA_LIMIT 4
+#define SWAP_PAGE_LIMIT 0x80000 /* Keeps byte offsets within off_t */
+#define SWAP_CLUSTER    16      /* Pages reclaimed and written at once */
+
+#define SWAP_MAP_BAD    0xffff
+
+/* A page table entry of a swapped out page is not present and holds the
+   swap area index and the page slot in the area. The processor ignores the
+   other bits of entries that are not present, so the area index is kept in
+   bits 1-2, clear of the software bits used by present entries. */
+
+#define SWAP_ENTRY(area, slot) ((slot) << 12 | (area) << 1 | PAGE_FLAG_SWAP)
+#define SWAP_ENTRY_AREA(e)     ((e) >> 1 & 3)
+#define SWAP_ENTRY_SLOT(e)     ((e) >> 12)
+
+/* Header in the first page of a swap area, compatible with mkswap(8) */
+
+typedef union
+{
+  struct
+  {
+    char reserved[PAGE_SIZE - 10];
+    char magic[10];
+  } sh_magic;
+  struct
+  {
+    char bootbits[1024];
+    uint32_t version;
+    uint32_t lastpage;
+    uint32_t nbadpages;
+    unsigned char uuid[16];
+    char label[16];
+    uint32_t padding[117];
+    uint32_t badpages[1];
+  } sh_info;
+} SwapHeader;
+
+/* Frames of user buffers that a device transfers to or from directly. Swap
+   reclaim leaves them in memory until they are unpinned. */
+
+typedef struct _SwapPin
+{
+  uint32_t *sp_frames;
+  int sp_count;
+  struct _SwapPin *sp_next;
+} SwapPin;
+
+typedef struct
+{
+  SpecDevice *sa_dev;
+  uint16_t *sa_map;   /* Reference count of each slot */
+  uint32_t sa_npages;
+  uint32_t sa_nfree;
+  uint32_t sa_next;   /* Slot to start searching for a free one at */
+} SwapArea;
+
+__BEGIN_DECLS
+
+int swap_probe (SpecDevice *dev, uint32_t sects);
+int swap_reclaim (void);
+int swap_in (uint32_t *pte, uint32_t vaddr, uint32_t flags);
+void swap_dup (uint32_t entry);
+void swap_free (uint32_t entry);
+int swap_pin_iov (SwapPin *pin, const struct iovec *vec, int vlen, int write);
+void swap_unpin (SwapPin *pin);
+
+__END_DECLS
+
+#endif
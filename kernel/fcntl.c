@@ -28,15 +28,10 @@ fcntl_dupfd (Process *proc, int fd, int arg, int cloexec)
     return -EINVAL;
   if (fd == arg)
     return fd;
-  for (nfd = arg; nfd < PROCESS_FILE_LIMIT; nfd++)
-    {
-      if (proc->p_files[nfd] == NULL)
-	break;
-    }
-  if (unlikely (nfd == PROCESS_FILE_LIMIT))
-    return -EMFILE;
-  proc->p_files[nfd] = proc->p_files[fd];
-  proc->p_fdflags[nfd] = cloexec ? FD_CLOEXEC : 0;
+  nfd = process_find_fd (proc, arg);
+  if (unlikely (nfd < 0))
+    return nfd;
+  process_set_fd (proc, nfd, proc->p_files[fd], cloexec ? FD_CLOEXEC : 0);
   proc->p_files[nfd]->pf_refcnt++;
   return nfd;
 }
@@ -45,7 +40,7 @@ int
 fcntl (int fd, int cmd, int arg)
 {
   Process *proc = &process_table[task_getpid ()];
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+  if (process_get_file (proc, fd) == NULL)
     return -EBADF;
   switch (cmd)
     {
@@ -19,6 +19,7 @@
 #include <kconfig.h>
 
 #include <libk/libk.h>
+#include <sys/trace.h>
 #include <vm/heap.h>
 #include <vm/paging.h>
 
@@ -324,13 +325,17 @@ heap_free (MemHeap *heap, void *ptr)
 void *
 kmalloc (size_t size)
 {
-  return heap_alloc (&kernel_heap, size, 0);
+  void *ptr = heap_alloc (&kernel_heap, size, 0);
+  TRACE (TRACE_KMALLOC, size, ptr);
+  return ptr;
 }
 
 void *
 kvalloc (size_t size)
 {
-  return heap_alloc (&kernel_heap, size, 1);
+  void *ptr = heap_alloc (&kernel_heap, size, 1);
+  TRACE (TRACE_KMALLOC, size, ptr);
+  return ptr;
 }
 
 void *
@@ -352,6 +357,7 @@ krealloc (void *ptr, size_t size)
 void
 kfree (void *ptr)
 {
+  TRACE (TRACE_KFREE, ptr, 0);
   heap_free (&kernel_heap, ptr);
 }
 
@@ -86,7 +86,7 @@ int
 ioctl (int fd, unsigned long req, void *data)
 {
   Process *proc = &process_table[task_getpid ()];
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+  if (process_get_file (proc, fd) == NULL)
     return -EBADF;
   switch (req)
     {
@@ -0,0 +1,258 @@
+/*************************************************************************
+ * kmsg.c -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/kmsg.h>
+#include <sys/timer.h>
+#include <video/serial.h>
+#include <video/vga.h>
+
+int kmsg_deferred;
+int kmsg_console_level = KMSG_CONSOLE_LEVEL;
+
+static KmsgRecord kmsg_ring[KMSG_RECORDS];
+static volatile uint32_t kmsg_next_seq;
+static uint32_t kmsg_next_pos;
+static uint32_t kmsg_console_seq;
+static volatile int kmsg_draining;
+static int kmsg_line_open;
+
+/* Each nesting level of printk (a task, an IRQ interrupting it, an exception
+   inside the IRQ) formats into its own buffer so no context has to wait for
+   another one to finish */
+static char kmsg_buffers[KMSG_NEST_MAX][KMSG_TEXT_MAX];
+static size_t kmsg_buflen[KMSG_NEST_MAX];
+static volatile int kmsg_depth;
+
+static inline uint32_t
+kmsg_oldest (void)
+{
+  uint32_t next = kmsg_next_seq;
+  return next > KMSG_RECORDS ? next - KMSG_RECORDS : 0;
+}
+
+static void
+kmsg_buffer_write (const char *str, size_t len)
+{
+  int depth = kmsg_depth - 1;
+  size_t rem = KMSG_TEXT_MAX - kmsg_buflen[depth];
+  if (len > rem)
+    len = rem;
+  memcpy (kmsg_buffers[depth] + kmsg_buflen[depth], str, len);
+  kmsg_buflen[depth] += len;
+}
+
+static void
+kmsg_write_prefix (int level, unsigned long tick)
+{
+  uint32_t freq = timer_get_freq (TIMER_PORT_CHANNEL0);
+  unsigned long ms = 0;
+  char buffer[16];
+  char c;
+
+  c = '0' + level;
+  kmsg_buffer_write ("<", 1);
+  kmsg_buffer_write (&c, 1);
+  kmsg_buffer_write (">[", 2);
+  if (freq != 0)
+    {
+      ms = tick % freq * 1000 / freq;
+      tick /= freq;
+    }
+  else
+    tick = 0;
+  utoa (tick, buffer, 10);
+  kmsg_buffer_write (buffer, strlen (buffer));
+  buffer[0] = '.';
+  buffer[1] = '0' + ms / 100;
+  buffer[2] = '0' + ms / 10 % 10;
+  buffer[3] = '0' + ms % 10;
+  kmsg_buffer_write (buffer, 4);
+  kmsg_buffer_write ("] ", 2);
+}
+
+/* Copies record number SEQ into REC. Returns zero on success, a positive
+   value if the record is still being written, and a negative value if it
+   has already been overwritten by a newer record. */
+
+static int
+kmsg_snapshot (uint32_t seq, KmsgRecord *rec)
+{
+  KmsgRecord *slot = &kmsg_ring[seq & (KMSG_RECORDS - 1)];
+  uint32_t commit;
+  if (kmsg_next_seq - seq > KMSG_RECORDS)
+    return -1;
+  commit = slot->km_commit;
+  if (commit == 0)
+    return 1;
+  if (commit != seq + 1)
+    return -1;
+  memcpy (rec, slot, offsetof (KmsgRecord, km_text) + slot->km_len);
+  __asm__ volatile ("" ::: "memory");
+  return slot->km_commit == commit ? 0 : -1;
+}
+
+static void
+kmsg_console_write (const char *text, size_t len)
+{
+  vga_write (CURRENT_TTY, text, len);
+  serial_write_data (text, len);
+}
+
+int
+kmsg_vprintk (const char *fmt, va_list args)
+{
+  KmsgRecord *rec;
+  unsigned long tick = timer_poll ();
+  int level = KMSG_DEFAULT_LEVEL;
+  char *buffer;
+  size_t prefix = 0;
+  size_t len;
+  uint32_t flags;
+  uint32_t seq;
+  int depth;
+  int ret;
+
+  if (fmt[0] == '<' && fmt[1] >= '0' && fmt[1] <= '7' && fmt[2] == '>')
+    {
+      level = fmt[1] - '0';
+      fmt += 3;
+    }
+
+  depth = ++kmsg_depth;
+  if (unlikely (depth > KMSG_NEST_MAX))
+    {
+      kmsg_depth--;
+      return -1;
+    }
+  buffer = kmsg_buffers[depth - 1];
+  kmsg_buflen[depth - 1] = 0;
+
+  /* Continuation fragments of a line don't get a new prefix */
+  if (!kmsg_line_open)
+    {
+      kmsg_write_prefix (level, tick);
+      prefix = kmsg_buflen[depth - 1];
+    }
+  ret = __vprintk (kmsg_buffer_write, fmt, args);
+  len = kmsg_buflen[depth - 1];
+  if (len == prefix)
+    goto end;
+
+  /* Reserve a sequence number and stream position. Interrupts are masked
+     only for these few instructions, never while formatting or copying. */
+  flags = irq_save ();
+  seq = kmsg_next_seq++;
+  rec = &kmsg_ring[seq & (KMSG_RECORDS - 1)];
+  rec->km_commit = 0;
+  rec->km_pos = kmsg_next_pos;
+  kmsg_next_pos += len;
+  kmsg_line_open = buffer[len - 1] != '\n';
+  irq_restore (flags);
+
+  rec->km_seq = seq;
+  rec->km_tick = tick;
+  rec->km_level = level;
+  rec->km_prefix = prefix;
+  rec->km_len = len;
+  memcpy (rec->km_text, buffer, len);
+  __asm__ volatile ("" ::: "memory");
+  rec->km_commit = seq + 1;
+
+ end:
+  kmsg_depth--;
+  if (!kmsg_deferred)
+    kmsg_flush ();
+  return ret;
+}
+
+void
+kmsg_flush (void)
+{
+  KmsgRecord rec;
+  uint32_t flags = irq_save ();
+  if (kmsg_draining)
+    {
+      /* Another context is already draining and will pick up our records */
+      irq_restore (flags);
+      return;
+    }
+  kmsg_draining = 1;
+  irq_restore (flags);
+
+  while (kmsg_console_seq != kmsg_next_seq)
+    {
+      int ret = kmsg_snapshot (kmsg_console_seq, &rec);
+      if (ret > 0)
+	break;
+      if (ret < 0)
+	{
+	  kmsg_console_seq = kmsg_oldest ();
+	  continue;
+	}
+      if (rec.km_level < kmsg_console_level)
+	kmsg_console_write (rec.km_text + rec.km_prefix,
+			    rec.km_len - rec.km_prefix);
+      kmsg_console_seq++;
+    }
+  kmsg_draining = 0;
+}
+
+void
+kmsg_sync (void)
+{
+  kmsg_deferred = 0;
+  kmsg_draining = 0;
+  kmsg_flush ();
+}
+
+int
+kmsg_device_read (SpecDevice *dev, void *buffer, size_t len, off_t offset)
+{
+  KmsgRecord rec;
+  uint32_t seq = kmsg_oldest ();
+  uint32_t pos = offset;
+  size_t total = 0;
+  while (seq != kmsg_next_seq && total < len)
+    {
+      size_t start;
+      size_t amt;
+      int ret = kmsg_snapshot (seq, &rec);
+      if (ret > 0)
+	break;
+      if (ret < 0)
+	{
+	  seq = kmsg_oldest ();
+	  continue;
+	}
+      seq++;
+      if (rec.km_pos + rec.km_len <= pos)
+	continue;
+
+      /* Readers that fell behind the ring resume at the oldest record */
+      start = pos > rec.km_pos ? pos - rec.km_pos : 0;
+      amt = rec.km_len - start;
+      if (amt > len - total)
+	amt = len - total;
+      memcpy (buffer + total, rec.km_text + start, amt);
+      total += amt;
+      pos = rec.km_pos + start + amt;
+    }
+  return total;
+}
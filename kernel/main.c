@@ -19,10 +19,13 @@
 #include <kconfig.h>
 
 #include <fs/devfs.h>
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/acpi.h>
 #include <sys/ata.h>
+#include <sys/clock.h>
 #include <sys/cmdline.h>
+#include <sys/kmsg.h>
 #include <sys/multiboot.h>
 #include <sys/process.h>
 #include <sys/syscall.h>
@@ -151,6 +154,13 @@ mount_rootfs (void)
   process_free_fd (process_table, fd);
 }
 
+static void
+init_wake (WaitQueueEntry *entry, unsigned int events)
+{
+  PollTable *pt = entry->we_private;
+  pt->pt_woken = 1;
+}
+
 static void
 init (void)
 {
@@ -164,8 +174,39 @@ init (void)
     }
   else
     {
+      WaitQueueEntry entry;
+      PollTable pt;
       int status;
-      sys_waitpid (pid, &status, 0);
+
+      /* The kernel task drains the log ring to the console while it waits,
+	 so printk callers never block on VGA or serial output. Otherwise it
+	 halts with the periodic tick stopped and only checks for init
+	 exiting when its wait queue is woken. */
+      pt.pt_func = NULL;
+      pt.pt_private = NULL;
+      pt.pt_woken = 1;
+      entry.we_func = init_wake;
+      entry.we_private = &pt;
+      wait_queue_add (&process_table[0].p_waitq, &entry);
+      while (1)
+	{
+	  uint32_t flags;
+	  kmsg_flush ();
+	  if (pt.pt_woken)
+	    {
+	      pt.pt_woken = 0;
+	      if (sys_waitpid (pid, &status, WNOHANG) != 0)
+		break;
+	    }
+
+	  /* timer_idle enables interrupts and halts in one step, so a wakeup
+	     after the check is not lost */
+	  flags = irq_save ();
+	  if (!pt.pt_woken)
+	    timer_idle ();
+	  irq_restore (flags);
+	}
+      wait_queue_remove (&entry);
       if (WIFEXITED (status))
 	panic ("/sbin/init exited with status %d", WEXITSTATUS (status));
       else if (WIFSIGNALED (status))
@@ -179,6 +220,7 @@ kmain (MultibootInfo *info)
   assert (info->mi_flags & MULTIBOOT_FLAG_MEMORY);
 
   timer_set_freq (TIMER_PORT_CHANNEL0, 1000);
+  clock_init ();
   speaker_init ();
   vga_init ();
   serial_init ();
@@ -199,5 +241,6 @@ kmain (MultibootInfo *info)
   mount_rootfs ();
   process_setup_std_streams (0);
 
+  kmsg_deferred = 1;
   init ();
 }
@@ -16,11 +16,13 @@
  * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
  *************************************************************************/
 
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/memory.h>
 #include <sys/process.h>
 #include <limits.h>
 #include <vm/paging.h>
+#include <vm/swap.h>
 
 static Stack *page_stack;
 static uint32_t mem_curraddr;
@@ -43,12 +45,21 @@ uint32_t
 alloc_page (void)
 {
   uint32_t addr = (uint32_t) stack_pop (page_stack);
-  if (addr == 0)
+  if (addr != 0)
+    return addr;
+  if (mem_curraddr + PAGE_SIZE <= mem_maxaddr)
     {
       addr = mem_curraddr;
       mem_curraddr += PAGE_SIZE;
+      return addr;
     }
-  return addr;
+
+  /* Out of memory, push some anonymous pages out to swap. This waits for
+     disk I/O, so it can't be done in IRQ handlers or with interrupts
+     disabled. */
+  if (irq_depth == 0 && irq_enabled () && swap_reclaim () > 0)
+    return (uint32_t) stack_pop (page_stack);
+  return 0;
 }
 
 void
@@ -0,0 +1,489 @@
+/*************************************************************************
+ * mregion.c -- This file is part of OS/0.                               *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+#include <bits/mman.h>
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/process.h>
+#include <vm/heap.h>
+
+#define REGION_ALLOC_BATCH 64
+
+#define region_entry(node) rb_entry (node, ProcessMemoryRegion, pm_node)
+
+/* Files mapped with MAP_DENYWRITE, such as running executables, and files
+   open for writing. They are counted by superblock and inode number since
+   every open of a file has its own VFS inode. A file can't have both. */
+
+typedef struct _DenyWriteFile
+{
+  VFSSuperblock *dw_sb;
+  ino64_t dw_ino;
+  unsigned int dw_count;   /* Regions mapped with MAP_DENYWRITE */
+  unsigned int dw_writers; /* Open files with write access */
+  struct _DenyWriteFile *dw_next;
+} DenyWriteFile;
+
+/* Unused region structures are kept on a list chained through pm_node */
+static ProcessMemoryRegion *process_region_free_list;
+static DenyWriteFile *process_deny_write_files;
+
+/* Must be called with interrupts disabled */
+
+static DenyWriteFile **
+process_find_deny_write (VFSInode *inode)
+{
+  DenyWriteFile **file;
+  for (file = &process_deny_write_files; *file != NULL;
+       file = &(*file)->dw_next)
+    {
+      if ((*file)->dw_sb == inode->vi_sb && (*file)->dw_ino == inode->vi_ino)
+	break;
+    }
+  return file;
+}
+
+/* Returns the entry of INODE, creating it if needed, with interrupts
+   disabled and their previous state in FLAGS. An entry allocated but not
+   used is returned in SPARE for the caller to free. */
+
+static DenyWriteFile *
+process_get_deny_write (VFSInode *inode, uint32_t *flags,
+			DenyWriteFile **spare)
+{
+  DenyWriteFile *file;
+  *spare = NULL;
+  while (1)
+    {
+      *flags = irq_save ();
+      file = *process_find_deny_write (inode);
+      if (file != NULL)
+	return file;
+      if (*spare != NULL)
+	break;
+      irq_restore (*flags);
+      *spare = kmalloc (sizeof (DenyWriteFile));
+      if (unlikely (*spare == NULL))
+	return NULL;
+    }
+  file = *spare;
+  *spare = NULL;
+  file->dw_sb = inode->vi_sb;
+  file->dw_ino = inode->vi_ino;
+  file->dw_count = 0;
+  file->dw_writers = 0;
+  file->dw_next = process_deny_write_files;
+  process_deny_write_files = file;
+  return file;
+}
+
+/* Unlinks the entry of INODE if it no longer counts anything and returns
+   it to be freed. Must be called with interrupts disabled. */
+
+static DenyWriteFile *
+process_put_deny_write (VFSInode *inode)
+{
+  DenyWriteFile **link = process_find_deny_write (inode);
+  DenyWriteFile *file = *link;
+  if (file == NULL || file->dw_count > 0 || file->dw_writers > 0)
+    return NULL;
+  *link = file->dw_next;
+  return file;
+}
+
+static inline uint32_t
+process_region_end (const ProcessMemoryRegion *region)
+{
+  return region->pm_base + region->pm_len;
+}
+
+static void
+process_region_augment (RBNode *node)
+{
+  ProcessMemoryRegion *region = region_entry (node);
+  uint32_t gap = region->pm_gap;
+  if (node->rb_left != NULL)
+    gap = MAX (gap, region_entry (node->rb_left)->pm_maxgap);
+  if (node->rb_right != NULL)
+    gap = MAX (gap, region_entry (node->rb_right)->pm_maxgap);
+  region->pm_maxgap = gap;
+}
+
+/* Recomputes the gap between REGION and the region before it */
+
+static void
+process_region_update_gap (RBTree *tree, ProcessMemoryRegion *region)
+{
+  RBNode *prev = rb_prev (&region->pm_node);
+  region->pm_gap = region->pm_base -
+    (prev == NULL ? 0 : process_region_end (region_entry (prev)));
+  rb_propagate (tree, &region->pm_node);
+}
+
+/* Returns the lowest address at or above LOW where LEN bytes fit in one of
+   the gaps below the regions in the subtree of NODE, or zero */
+
+static uint32_t
+process_region_gap_search (const RBNode *node, uint32_t low, uint32_t len)
+{
+  const ProcessMemoryRegion *region;
+  uint32_t start;
+  uint32_t addr;
+  if (node == NULL)
+    return 0;
+  region = region_entry (node);
+  if (region->pm_maxgap < len)
+    return 0;
+
+  /* Gaps in the left subtree all end below this region */
+  if (region->pm_base > low)
+    {
+      addr = process_region_gap_search (node->rb_left, low, len);
+      if (addr != 0)
+	return addr;
+    }
+  start = MAX (region->pm_base - region->pm_gap, low);
+  if (start < region->pm_base && region->pm_base - start >= len)
+    return start;
+  return process_region_gap_search (node->rb_right, low, len);
+}
+
+static int
+process_region_clone_subtree (RBNode **link, const RBNode *node,
+			      RBNode *parent)
+{
+  ProcessMemoryRegion *region;
+  int ret;
+  *link = NULL;
+  if (node == NULL)
+    return 0;
+  region = process_region_alloc ();
+  if (unlikely (region == NULL))
+    return -ENOMEM;
+  memcpy (region, region_entry (node), sizeof (ProcessMemoryRegion));
+  ret = process_region_ref (region);
+  if (ret != 0)
+    {
+      process_region_dealloc (region);
+      return ret;
+    }
+  region->pm_node.rb_parent = parent;
+  region->pm_node.rb_left = NULL;
+  region->pm_node.rb_right = NULL;
+  *link = &region->pm_node;
+  ret = process_region_clone_subtree (&region->pm_node.rb_left,
+				      node->rb_left, &region->pm_node);
+  if (ret != 0)
+    return ret;
+  return process_region_clone_subtree (&region->pm_node.rb_right,
+				       node->rb_right, &region->pm_node);
+}
+
+ProcessMemoryRegion *
+process_region_alloc (void)
+{
+  ProcessMemoryRegion *region;
+  uint32_t flags = irq_save ();
+  if (process_region_free_list == NULL)
+    {
+      ProcessMemoryRegion *batch;
+      int i;
+      irq_restore (flags);
+      batch = kmalloc (sizeof (ProcessMemoryRegion) * REGION_ALLOC_BATCH);
+      if (unlikely (batch == NULL))
+	return NULL;
+      flags = irq_save ();
+      for (i = 0; i < REGION_ALLOC_BATCH; i++)
+	{
+	  batch[i].pm_node.rb_parent = (RBNode *) process_region_free_list;
+	  process_region_free_list = &batch[i];
+	}
+    }
+  region = process_region_free_list;
+  process_region_free_list = (ProcessMemoryRegion *) region->pm_node.rb_parent;
+  irq_restore (flags);
+  return region;
+}
+
+void
+process_region_dealloc (ProcessMemoryRegion *region)
+{
+  uint32_t flags = irq_save ();
+  region->pm_node.rb_parent = (RBNode *) process_region_free_list;
+  process_region_free_list = region;
+  irq_restore (flags);
+}
+
+/* Takes a reference to the inode mapped by REGION. As long as a region
+   mapped with MAP_DENYWRITE holds one, the file can't be opened for writing
+   or truncated. Such a region can't be mapped while the file is open for
+   writing. */
+
+int
+process_region_ref (ProcessMemoryRegion *region)
+{
+  VFSInode *inode = region->pm_ino;
+  DenyWriteFile *spare;
+  DenyWriteFile *file;
+  uint32_t flags;
+  int ret = 0;
+  if (inode == NULL)
+    return 0;
+  if (region->pm_flags & MAP_DENYWRITE)
+    {
+      file = process_get_deny_write (inode, &flags, &spare);
+      if (unlikely (file == NULL))
+	return -ENOMEM;
+      if (file->dw_writers > 0)
+	ret = -ETXTBSY;
+      else
+	file->dw_count++;
+      irq_restore (flags);
+      kfree (spare);
+      if (ret != 0)
+	return ret;
+    }
+  vfs_ref_inode (inode);
+  return 0;
+}
+
+void
+process_region_unref (ProcessMemoryRegion *region)
+{
+  VFSInode *inode = region->pm_ino;
+  DenyWriteFile *file = NULL;
+  if (inode != NULL && (region->pm_flags & MAP_DENYWRITE))
+    {
+      uint32_t flags = irq_save ();
+      file = *process_find_deny_write (inode);
+      if (file != NULL && file->dw_count > 0)
+	file->dw_count--;
+      file = process_put_deny_write (inode);
+      irq_restore (flags);
+      kfree (file);
+    }
+  vfs_unref_inode (inode);
+}
+
+/* Returns nonzero if INODE is mapped by a region with MAP_DENYWRITE */
+
+int
+process_write_denied (VFSInode *inode)
+{
+  uint32_t flags = irq_save ();
+  DenyWriteFile *file = *process_find_deny_write (inode);
+  int ret = file != NULL && file->dw_count > 0;
+  irq_restore (flags);
+  return ret;
+}
+
+/* Returns nonzero if INODE is open for writing */
+
+int
+process_write_busy (VFSInode *inode)
+{
+  uint32_t flags = irq_save ();
+  DenyWriteFile *file = *process_find_deny_write (inode);
+  int ret = file != NULL && file->dw_writers > 0;
+  irq_restore (flags);
+  return ret;
+}
+
+/* Counts an open of INODE with write access. Fails if the file is mapped by
+   a region with MAP_DENYWRITE. */
+
+int
+process_get_write_access (VFSInode *inode)
+{
+  DenyWriteFile *spare;
+  DenyWriteFile *file;
+  uint32_t flags;
+  int ret = 0;
+  file = process_get_deny_write (inode, &flags, &spare);
+  if (unlikely (file == NULL))
+    return -ENOMEM;
+  if (file->dw_count > 0)
+    ret = -ETXTBSY;
+  else
+    file->dw_writers++;
+  irq_restore (flags);
+  kfree (spare);
+  return ret;
+}
+
+void
+process_put_write_access (VFSInode *inode)
+{
+  uint32_t flags = irq_save ();
+  DenyWriteFile *file = *process_find_deny_write (inode);
+  if (file != NULL && file->dw_writers > 0)
+    file->dw_writers--;
+  file = process_put_deny_write (inode);
+  irq_restore (flags);
+  kfree (file);
+}
+
+void
+process_region_init (RBTree *tree)
+{
+  tree->rbt_root = NULL;
+  tree->rbt_count = 0;
+  tree->rbt_augment = process_region_augment;
+}
+
+void
+process_region_insert (RBTree *tree, ProcessMemoryRegion *region)
+{
+  RBNode **link = &tree->rbt_root;
+  RBNode *parent = NULL;
+  RBNode *next;
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (region->pm_base < region_entry (parent)->pm_base)
+	link = &parent->rb_left;
+      else
+	link = &parent->rb_right;
+    }
+  region->pm_gap = 0;
+  rb_link (tree, &region->pm_node, parent, link);
+  process_region_update_gap (tree, region);
+  next = rb_next (&region->pm_node);
+  if (next != NULL)
+    process_region_update_gap (tree, region_entry (next));
+}
+
+void
+process_region_remove (RBTree *tree, ProcessMemoryRegion *region)
+{
+  RBNode *next = rb_next (&region->pm_node);
+  rb_erase (tree, &region->pm_node);
+  if (next != NULL)
+    process_region_update_gap (tree, region_entry (next));
+}
+
+/* Changes the length of REGION, which must not overlap the next region */
+
+void
+process_region_resize (RBTree *tree, ProcessMemoryRegion *region,
+		       uint32_t len)
+{
+  RBNode *next = rb_next (&region->pm_node);
+  region->pm_len = len;
+  if (next != NULL)
+    process_region_update_gap (tree, region_entry (next));
+}
+
+ProcessMemoryRegion *
+process_region_lookup (const RBTree *tree, uint32_t addr)
+{
+  RBNode *node = tree->rbt_root;
+  while (node != NULL)
+    {
+      ProcessMemoryRegion *region = region_entry (node);
+      if (addr < region->pm_base)
+	node = node->rb_left;
+      else if (addr >= process_region_end (region))
+	node = node->rb_right;
+      else
+	return region;
+    }
+  return NULL;
+}
+
+ProcessMemoryRegion *
+process_region_first (const RBTree *tree)
+{
+  RBNode *node = rb_first (tree);
+  return node == NULL ? NULL : region_entry (node);
+}
+
+ProcessMemoryRegion *
+process_region_next (const ProcessMemoryRegion *region)
+{
+  RBNode *node = rb_next (&region->pm_node);
+  return node == NULL ? NULL : region_entry (node);
+}
+
+/* Returns the lowest address at or above LOW where LEN bytes are not
+   mapped by any region and end below PROCESS_MMAP_END, or zero if there is
+   no such address */
+
+uint32_t
+process_region_find_gap (const RBTree *tree, uint32_t low, uint32_t len)
+{
+  RBNode *last;
+  uint32_t addr;
+  if (len > PROCESS_MMAP_END)
+    return 0;
+  addr = process_region_gap_search (tree->rbt_root, low, len);
+  if (addr == 0)
+    {
+      /* Try the space above the highest region */
+      last = rb_last (tree);
+      addr = last == NULL ? low
+	: MAX (low, process_region_end (region_entry (last)));
+    }
+  if (addr > PROCESS_MMAP_END - len)
+    return 0;
+  return addr;
+}
+
+/* Copies the regions of ORIG into TREE, taking new references to their
+   inodes. The copy has the same shape as ORIG so no rebalancing is done. */
+
+int
+process_region_clone (RBTree *tree, const RBTree *orig)
+{
+  process_region_init (tree);
+  tree->rbt_count = orig->rbt_count;
+  return process_region_clone_subtree (&tree->rbt_root, orig->rbt_root, NULL);
+}
+
+/* Frees every region in TREE, unmapping their pages from DIR */
+
+void
+process_region_destroy (RBTree *tree, uint32_t *dir)
+{
+  RBNode *node = tree->rbt_root;
+  while (node != NULL)
+    {
+      RBNode *parent;
+      if (node->rb_left != NULL)
+	{
+	  node = node->rb_left;
+	  continue;
+	}
+      if (node->rb_right != NULL)
+	{
+	  node = node->rb_right;
+	  continue;
+	}
+      parent = node->rb_parent;
+      if (parent != NULL)
+	{
+	  if (parent->rb_left == node)
+	    parent->rb_left = NULL;
+	  else
+	    parent->rb_right = NULL;
+	}
+      process_region_free (region_entry (node), dir);
+      node = parent;
+    }
+  tree->rbt_root = NULL;
+  tree->rbt_count = 0;
+}
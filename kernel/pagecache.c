@@ -0,0 +1,776 @@
+/*************************************************************************
+ * pagecache.c -- This file is part of OS/0.                             *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <vm/heap.h>
+#include <vm/pagecache.h>
+#include <vm/paging.h>
+
+static FileCache *page_cache_files[PAGE_CACHE_HASH_SIZE];
+static CachePage *page_cache_index[PAGE_CACHE_HASH_SIZE];
+static CachePage *page_cache_frames[PAGE_CACHE_HASH_SIZE];
+static CachePage *page_cache_lru_head;
+static CachePage *page_cache_lru_tail;
+static unsigned long page_cache_npages;
+
+/* Unless stated otherwise, the static functions below must be called with
+   interrupts disabled */
+
+static inline uint32_t
+page_cache_file_hash (VFSSuperblock *sb, ino64_t ino)
+{
+  return (((uint32_t) sb >> 4) ^ (uint32_t) ino) & (PAGE_CACHE_HASH_SIZE - 1);
+}
+
+static inline uint32_t
+page_cache_index_hash (FileCache *file, uint32_t index)
+{
+  return (((uint32_t) file >> 4) + index) & (PAGE_CACHE_HASH_SIZE - 1);
+}
+
+static inline uint32_t
+page_cache_frame_hash (uint32_t paddr)
+{
+  return paddr >> PAGE_CACHE_SHIFT & (PAGE_CACHE_HASH_SIZE - 1);
+}
+
+static FileCache *
+page_cache_find_file (VFSSuperblock *sb, ino64_t ino)
+{
+  FileCache *file;
+  for (file = page_cache_files[page_cache_file_hash (sb, ino)]; file != NULL;
+       file = file->fc_next)
+    {
+      if (file->fc_sb == sb && file->fc_ino == ino)
+	return file;
+    }
+  return NULL;
+}
+
+static CachePage *
+page_cache_lookup (FileCache *file, uint32_t index)
+{
+  CachePage *page;
+  for (page = page_cache_index[page_cache_index_hash (file, index)];
+       page != NULL; page = page->cp_hnext)
+    {
+      if (page->cp_file == file && page->cp_index == index)
+	return page;
+    }
+  return NULL;
+}
+
+static CachePage *
+page_cache_find_frame (uint32_t paddr)
+{
+  CachePage *page;
+  for (page = page_cache_frames[page_cache_frame_hash (paddr)]; page != NULL;
+       page = page->cp_fnext)
+    {
+      if (page->cp_paddr == paddr)
+	return page;
+    }
+  return NULL;
+}
+
+static void
+page_cache_lru_remove (CachePage *page)
+{
+  if (page->cp_lprev == NULL)
+    page_cache_lru_head = page->cp_lnext;
+  else
+    page->cp_lprev->cp_lnext = page->cp_lnext;
+  if (page->cp_lnext == NULL)
+    page_cache_lru_tail = page->cp_lprev;
+  else
+    page->cp_lnext->cp_lprev = page->cp_lprev;
+  page->cp_lprev = NULL;
+  page->cp_lnext = NULL;
+}
+
+static void
+page_cache_lru_append (CachePage *page)
+{
+  page->cp_lprev = page_cache_lru_tail;
+  page->cp_lnext = NULL;
+  if (page_cache_lru_tail == NULL)
+    page_cache_lru_head = page;
+  else
+    page_cache_lru_tail->cp_lnext = page;
+  page_cache_lru_tail = page;
+}
+
+static void
+page_cache_dirty_remove (FileCache *file, CachePage *page)
+{
+  if (page->cp_dprev == NULL)
+    file->fc_dirty = page->cp_dnext;
+  else
+    page->cp_dprev->cp_dnext = page->cp_dnext;
+  if (page->cp_dnext == NULL)
+    file->fc_dirty_tail = page->cp_dprev;
+  else
+    page->cp_dnext->cp_dprev = page->cp_dprev;
+  page->cp_dprev = NULL;
+  page->cp_dnext = NULL;
+}
+
+static void
+page_cache_dirty_append (FileCache *file, CachePage *page)
+{
+  page->cp_dprev = file->fc_dirty_tail;
+  page->cp_dnext = NULL;
+  if (file->fc_dirty_tail == NULL)
+    file->fc_dirty = page;
+  else
+    file->fc_dirty_tail->cp_dnext = page;
+  file->fc_dirty_tail = page;
+}
+
+static void
+page_cache_hold (CachePage *page)
+{
+  if (page->cp_refcnt++ == 0 && page->cp_file != NULL)
+    page->cp_file->fc_nbusy++;
+}
+
+/* Drops a reference to PAGE. Returns nonzero if the page has been detached
+   from its file and is no longer used, in which case it must be freed. */
+
+static int
+page_cache_unhold (CachePage *page)
+{
+  if (--page->cp_refcnt > 0)
+    return 0;
+  if (page->cp_file == NULL)
+    return 1;
+  page->cp_file->fc_nbusy--;
+  return 0;
+}
+
+static void
+page_cache_insert (FileCache *file, CachePage *page)
+{
+  CachePage **bucket = &page_cache_index[page_cache_index_hash (file,
+								 page->cp_index)];
+  page->cp_file = file;
+  page->cp_hnext = *bucket;
+  *bucket = page;
+  bucket = &page_cache_frames[page_cache_frame_hash (page->cp_paddr)];
+  page->cp_fnext = *bucket;
+  *bucket = page;
+  page->cp_prev = NULL;
+  page->cp_next = file->fc_pages;
+  if (file->fc_pages != NULL)
+    file->fc_pages->cp_prev = page;
+  file->fc_pages = page;
+  file->fc_npages++;
+  page_cache_lru_append (page);
+}
+
+/* Removes PAGE from its file. If that leaves the file with no pages, the
+   file is also removed from the cache and returned so the caller can free
+   it once interrupts are enabled again. */
+
+static FileCache *
+page_cache_detach (CachePage *page)
+{
+  FileCache *file = page->cp_file;
+  FileCache **f;
+  CachePage **p;
+  for (p = &page_cache_index[page_cache_index_hash (file, page->cp_index)];
+       *p != page; p = &(*p)->cp_hnext)
+    ;
+  *p = page->cp_hnext;
+  if (page->cp_prev == NULL)
+    file->fc_pages = page->cp_next;
+  else
+    page->cp_prev->cp_next = page->cp_next;
+  if (page->cp_next != NULL)
+    page->cp_next->cp_prev = page->cp_prev;
+  page_cache_lru_remove (page);
+  if (page->cp_refcnt > 0)
+    file->fc_nbusy--;
+  if (page->cp_flags & CACHE_PAGE_DIRTY)
+    {
+      page_cache_dirty_remove (file, page);
+      file->fc_ndirty--;
+    }
+  page->cp_flags &= ~CACHE_PAGE_DIRTY;
+  page->cp_file = NULL;
+  if (--file->fc_npages > 0)
+    return NULL;
+
+  for (f = &page_cache_files[page_cache_file_hash (file->fc_sb,
+						   file->fc_ino)];
+       *f != file; f = &(*f)->fc_next)
+    ;
+  *f = file->fc_next;
+  return file;
+}
+
+static void
+page_cache_unhash_frame (CachePage *page)
+{
+  CachePage **p;
+  for (p = &page_cache_frames[page_cache_frame_hash (page->cp_paddr)];
+       *p != NULL; p = &(*p)->cp_fnext)
+    {
+      if (*p == page)
+	{
+	  *p = page->cp_fnext;
+	  break;
+	}
+    }
+}
+
+static void
+page_cache_mark_dirty (CachePage *page)
+{
+  if (page->cp_file != NULL && !(page->cp_flags & CACHE_PAGE_DIRTY))
+    {
+      page->cp_flags |= CACHE_PAGE_DIRTY;
+      page->cp_file->fc_ndirty++;
+      page_cache_dirty_append (page->cp_file, page);
+    }
+}
+
+/* Returns a held dirty page of FILE with an index in [FIRST, LAST]. Dirty
+   pages outside the range are moved to the end of the list, so a sync
+   that calls this until it fails looks at each of them at most twice. */
+
+static CachePage *
+page_cache_find_dirty (FileCache *file, uint32_t first, uint32_t last)
+{
+  unsigned long n;
+  for (n = file->fc_ndirty; n > 0; n--)
+    {
+      CachePage *page = file->fc_dirty;
+      if (page->cp_index >= first && page->cp_index <= last)
+	{
+	  page_cache_hold (page);
+	  return page;
+	}
+      page_cache_dirty_remove (file, page);
+      page_cache_dirty_append (file, page);
+    }
+  return NULL;
+}
+
+/* The functions below are called with interrupts enabled */
+
+static void
+page_cache_free_page (CachePage *page)
+{
+  uint32_t flags = irq_save ();
+  page_cache_unhash_frame (page);
+  page_cache_npages--;
+  irq_restore (flags);
+  kfree (page->cp_data);
+  kfree (page);
+}
+
+static void
+page_cache_free_file (FileCache *file)
+{
+  if (file != NULL)
+    {
+      vfs_unref_inode (file->fc_inode);
+      kfree (file);
+    }
+}
+
+/* Writes PAGE back to its file. The caller must hold a reference to it. */
+
+static int
+page_cache_writeback (CachePage *page)
+{
+  VFSInode *inode;
+  off64_t offset = (off64_t) page->cp_index << PAGE_CACHE_SHIFT;
+  uint32_t flags = irq_save ();
+  int ret;
+  if (page->cp_file == NULL || !(page->cp_flags & CACHE_PAGE_DIRTY))
+    {
+      irq_restore (flags);
+      return 0;
+    }
+  inode = page->cp_file->fc_inode;
+  vfs_ref_inode (inode);
+  page->cp_flags &= ~CACHE_PAGE_DIRTY;
+  page->cp_file->fc_ndirty--;
+  page_cache_dirty_remove (page->cp_file, page);
+  irq_restore (flags);
+
+  ret = inode->vi_ops->vfs_writepage (inode, page->cp_data, offset);
+  if (ret != 0)
+    {
+      flags = irq_save ();
+      page_cache_mark_dirty (page);
+      irq_restore (flags);
+    }
+  vfs_unref_inode (inode);
+  return ret;
+}
+
+/* Drops the least recently used page that is not in use, writing it back
+   first if it is dirty. If every page is in use the cache is allowed to
+   grow past its limit. */
+
+static void
+page_cache_evict (void)
+{
+  FileCache *file = NULL;
+  CachePage *page;
+  uint32_t flags = irq_save ();
+  int free = 0;
+  int ret;
+  for (page = page_cache_lru_head; page != NULL; page = page->cp_lnext)
+    {
+      if (page->cp_refcnt == 0)
+	break;
+    }
+  if (page == NULL)
+    {
+      irq_restore (flags);
+      return;
+    }
+  page_cache_hold (page);
+  irq_restore (flags);
+
+  ret = page_cache_writeback (page);
+  flags = irq_save ();
+  if (page_cache_unhold (page))
+    free = 1;
+  else if (ret == 0 && page->cp_refcnt == 0 && page->cp_file != NULL
+	   && !(page->cp_flags & CACHE_PAGE_DIRTY))
+    {
+      file = page_cache_detach (page);
+      free = 1;
+    }
+  irq_restore (flags);
+  if (free)
+    {
+      page_cache_free_page (page);
+      page_cache_free_file (file);
+    }
+}
+
+static CachePage *
+page_cache_alloc (uint32_t index)
+{
+  CachePage *page;
+  if (page_cache_npages >= PAGE_CACHE_LIMIT)
+    page_cache_evict ();
+  page = kzalloc (sizeof (CachePage));
+  if (unlikely (page == NULL))
+    return NULL;
+  page->cp_data = kvalloc (PAGE_SIZE);
+  if (unlikely (page->cp_data == NULL))
+    {
+      kfree (page);
+      return NULL;
+    }
+  page->cp_paddr = get_paddr (curr_page_dir, page->cp_data);
+  page->cp_index = index;
+  page_cache_npages++;
+  return page;
+}
+
+int
+page_cache_get (VFSInode *inode, uint32_t index, CachePage **result)
+{
+  FileCache *spare = NULL;
+  FileCache *file;
+  CachePage *page;
+  CachePage *new;
+  uint32_t flags;
+  int ret;
+  if (inode->vi_ops->vfs_readpage == NULL)
+    return -ENODEV;
+
+  flags = irq_save ();
+  file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+  page = file == NULL ? NULL : page_cache_lookup (file, index);
+  if (page != NULL)
+    {
+      page_cache_hold (page);
+      page_cache_lru_remove (page);
+      page_cache_lru_append (page);
+      irq_restore (flags);
+      *result = page;
+      return 0;
+    }
+  irq_restore (flags);
+
+  /* Fill the page before adding it so nobody sees it half read */
+  new = page_cache_alloc (index);
+  if (unlikely (new == NULL))
+    return -ENOMEM;
+  ret = inode->vi_ops->vfs_readpage (inode, new->cp_data,
+				     (off64_t) index << PAGE_CACHE_SHIFT);
+  if (ret != 0)
+    {
+      page_cache_free_page (new);
+      return ret;
+    }
+
+  while (1)
+    {
+      flags = irq_save ();
+      file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+      if (file != NULL || spare != NULL)
+	break;
+      irq_restore (flags);
+      spare = kzalloc (sizeof (FileCache));
+      if (unlikely (spare == NULL))
+	{
+	  page_cache_free_page (new);
+	  return -ENOMEM;
+	}
+    }
+  if (file == NULL)
+    {
+      FileCache **bucket =
+	&page_cache_files[page_cache_file_hash (inode->vi_sb, inode->vi_ino)];
+      file = spare;
+      spare = NULL;
+      file->fc_sb = inode->vi_sb;
+      file->fc_ino = inode->vi_ino;
+      file->fc_inode = inode;
+      vfs_ref_inode (inode);
+      file->fc_next = *bucket;
+      *bucket = file;
+    }
+
+  /* Someone else may have read the same page in the meantime */
+  page = page_cache_lookup (file, index);
+  if (page == NULL)
+    {
+      page = new;
+      new = NULL;
+      page_cache_insert (file, page);
+    }
+  page_cache_hold (page);
+  irq_restore (flags);
+
+  if (spare != NULL)
+    kfree (spare);
+  if (new != NULL)
+    page_cache_free_page (new);
+  *result = page;
+  return 0;
+}
+
+void
+page_cache_put (CachePage *page)
+{
+  uint32_t flags = irq_save ();
+  int free = page_cache_unhold (page);
+  irq_restore (flags);
+  if (free)
+    page_cache_free_page (page);
+}
+
+void
+page_cache_ref_frame (uint32_t paddr)
+{
+  uint32_t flags = irq_save ();
+  CachePage *page = page_cache_find_frame (paddr);
+  if (page != NULL)
+    page_cache_hold (page);
+  irq_restore (flags);
+}
+
+void
+page_cache_dirty_frame (uint32_t paddr)
+{
+  uint32_t flags = irq_save ();
+  CachePage *page = page_cache_find_frame (paddr);
+  if (page != NULL)
+    page_cache_mark_dirty (page);
+  irq_restore (flags);
+}
+
+void
+page_cache_unmap_frame (uint32_t paddr, int dirty)
+{
+  uint32_t flags = irq_save ();
+  CachePage *page = page_cache_find_frame (paddr);
+  int free = 0;
+  if (page != NULL)
+    {
+      if (dirty)
+	page_cache_mark_dirty (page);
+      free = page_cache_unhold (page);
+    }
+  irq_restore (flags);
+  if (free)
+    page_cache_free_page (page);
+}
+
+int
+page_cache_read (VFSInode *inode, void *buffer, size_t len, off64_t offset)
+{
+  size_t count = 0;
+  while (count < len)
+    {
+      CachePage *page;
+      uint32_t start = (offset + count) & (PAGE_SIZE - 1);
+      size_t amt = MIN (PAGE_SIZE - start, len - count);
+      int ret = page_cache_get (inode, (offset + count) >> PAGE_CACHE_SHIFT,
+				&page);
+      if (ret != 0)
+	return ret;
+      memcpy (buffer + count, page->cp_data + start, amt);
+      page_cache_put (page);
+      count += amt;
+    }
+  return count;
+}
+
+/* Copies data just written to a file into the pages of it that are cached.
+   Pages that are not cached are left alone. */
+
+void
+page_cache_update (VFSInode *inode, const void *buffer, size_t len,
+		   off64_t offset)
+{
+  FileCache *file;
+  size_t count = 0;
+  uint32_t flags = irq_save ();
+  file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+  irq_restore (flags);
+  if (file == NULL)
+    return;
+
+  while (count < len)
+    {
+      CachePage *page;
+      uint32_t start = (offset + count) & (PAGE_SIZE - 1);
+      size_t amt = MIN (PAGE_SIZE - start, len - count);
+      flags = irq_save ();
+      file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+      page = file == NULL ? NULL :
+	page_cache_lookup (file, (offset + count) >> PAGE_CACHE_SHIFT);
+      if (page != NULL)
+	page_cache_hold (page);
+      irq_restore (flags);
+      if (page != NULL)
+	{
+	  memcpy (page->cp_data + start, buffer + count, amt);
+	  page_cache_put (page);
+	}
+      count += amt;
+    }
+}
+
+/* Returns nonzero if a transfer that bypasses the cache could disagree with
+   it. Reads only need to avoid pages that are mapped or dirty, but writes
+   must not leave any cached page stale. */
+
+int
+page_cache_busy (VFSInode *inode, int write)
+{
+  FileCache *file;
+  int ret = 0;
+  uint32_t flags = irq_save ();
+  file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+  if (file != NULL)
+    ret = write ? file->fc_npages > 0
+      : file->fc_nbusy > 0 || file->fc_ndirty > 0;
+  irq_restore (flags);
+  return ret;
+}
+
+int
+page_cache_sync (VFSInode *inode, off64_t start, off64_t end)
+{
+  uint32_t first = start >> PAGE_CACHE_SHIFT;
+  uint32_t last = (end - 1) >> PAGE_CACHE_SHIFT;
+  if (end <= start)
+    return 0;
+  while (1)
+    {
+      FileCache *file;
+      CachePage *page = NULL;
+      uint32_t flags = irq_save ();
+      int ret;
+      file = page_cache_find_file (inode->vi_sb, inode->vi_ino);
+      if (file != NULL)
+	page = page_cache_find_dirty (file, first, last);
+      irq_restore (flags);
+      if (page == NULL)
+	return 0;
+      ret = page_cache_writeback (page);
+      page_cache_put (page);
+      if (ret != 0)
+	return ret;
+    }
+}
+
+/* Drops cached pages at or beyond SIZE without writing them back and
+   zeroes the part of the last page past the end of the file */
+
+static void
+page_cache_truncate_file (VFSSuperblock *sb, ino64_t ino, off64_t size)
+{
+  uint32_t first = (size + PAGE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+  uint32_t tail = size & (PAGE_SIZE - 1);
+  FileCache *file;
+  FileCache *empty = NULL;
+  CachePage *page;
+  CachePage *next;
+  CachePage *dead = NULL;
+  uint32_t flags = irq_save ();
+  file = page_cache_find_file (sb, ino);
+  if (file == NULL)
+    {
+      irq_restore (flags);
+      return;
+    }
+  for (page = file->fc_pages; page != NULL; page = next)
+    {
+      next = page->cp_next;
+      if (page->cp_index < first)
+	{
+	  if (tail != 0 && page->cp_index == first - 1)
+	    memset (page->cp_data + tail, 0, PAGE_SIZE - tail);
+	  continue;
+	}
+      empty = page_cache_detach (page);
+      if (page->cp_refcnt == 0)
+	{
+	  page->cp_next = dead;
+	  dead = page;
+	}
+    }
+  irq_restore (flags);
+
+  for (page = dead; page != NULL; page = next)
+    {
+      next = page->cp_next;
+      page_cache_free_page (page);
+    }
+  page_cache_free_file (empty);
+}
+
+void
+page_cache_truncate (VFSInode *inode, off64_t size)
+{
+  page_cache_truncate_file (inode->vi_sb, inode->vi_ino, size);
+}
+
+void
+page_cache_invalidate (VFSSuperblock *sb, ino64_t ino)
+{
+  page_cache_truncate_file (sb, ino, 0);
+}
+
+int
+page_cache_sync_sb (VFSSuperblock *sb)
+{
+  int i;
+  for (i = 0; i < PAGE_CACHE_HASH_SIZE; i++)
+    {
+      while (1)
+	{
+	  FileCache *file;
+	  CachePage *page = NULL;
+	  uint32_t flags = irq_save ();
+	  int ret;
+	  for (file = page_cache_files[i]; file != NULL && page == NULL;
+	       file = file->fc_next)
+	    {
+	      if (file->fc_sb == sb)
+		page = page_cache_find_dirty (file, 0, UINT32_MAX);
+	    }
+	  irq_restore (flags);
+	  if (page == NULL)
+	    break;
+	  ret = page_cache_writeback (page);
+	  page_cache_put (page);
+	  if (ret != 0)
+	    return ret;
+	}
+    }
+  return 0;
+}
+
+/* Writes back and drops every cached page of files on SB. Fails if any of
+   them are still in use. */
+
+int
+page_cache_drop_sb (VFSSuperblock *sb)
+{
+  FileCache *file;
+  FileCache *empty = NULL;
+  CachePage *dead = NULL;
+  CachePage *next;
+  uint32_t flags;
+  int ret = page_cache_sync_sb (sb);
+  int i;
+  if (ret != 0)
+    return ret;
+
+  flags = irq_save ();
+  for (i = 0; i < PAGE_CACHE_HASH_SIZE; i++)
+    {
+      for (file = page_cache_files[i]; file != NULL; file = file->fc_next)
+	{
+	  if (file->fc_sb == sb && file->fc_nbusy > 0)
+	    {
+	      irq_restore (flags);
+	      return -EBUSY;
+	    }
+	}
+    }
+  for (i = 0; i < PAGE_CACHE_HASH_SIZE; i++)
+    {
+      FileCache *fnext;
+      for (file = page_cache_files[i]; file != NULL; file = fnext)
+	{
+	  fnext = file->fc_next;
+	  if (file->fc_sb != sb)
+	    continue;
+	  while (file->fc_pages != NULL)
+	    {
+	      CachePage *page = file->fc_pages;
+	      if (page_cache_detach (page) != NULL)
+		{
+		  file->fc_next = empty;
+		  empty = file;
+		}
+	      page->cp_next = dead;
+	      dead = page;
+	    }
+	}
+    }
+  irq_restore (flags);
+
+  for (; dead != NULL; dead = next)
+    {
+      next = dead->cp_next;
+      page_cache_free_page (dead);
+    }
+  for (file = empty; file != NULL; file = empty)
+    {
+      empty = file->fc_next;
+      page_cache_free_file (file);
+    }
+  return 0;
+}
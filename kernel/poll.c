@@ -0,0 +1,345 @@
+/*************************************************************************
+ * poll.c -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/clock.h>
+#include <sys/poll.h>
+#include <sys/process.h>
+#include <vm/heap.h>
+
+#define POLL_READ_SET   (POLLIN | POLLRDNORM | POLLHUP | POLLERR)
+#define POLL_WRITE_SET  (POLLOUT | POLLWRNORM | POLLERR)
+#define POLL_EXCEPT_SET POLLPRI
+
+typedef struct _PollEntry
+{
+  WaitQueueEntry pe_wait;
+  struct _PollEntry *pe_next;
+} PollEntry;
+
+/* State of one poll or select call. Every queue registered during the first
+   scan gets an entry that wakes the caller. */
+
+typedef struct
+{
+  PollTable pw_table;
+  PollEntry *pw_entries;
+  int pw_err;
+} PollWaiter;
+
+static void
+poll_wake (WaitQueueEntry *entry, unsigned int events)
+{
+  PollTable *pt = entry->we_private;
+  pt->pt_woken = 1;
+}
+
+static void
+poll_queue (PollTable *pt, WaitQueue *wq)
+{
+  PollWaiter *waiter = pt->pt_private;
+  PollEntry *entry = kmalloc (sizeof (PollEntry));
+  if (unlikely (entry == NULL))
+    {
+      waiter->pw_err = -ENOMEM;
+      return;
+    }
+  entry->pe_wait.we_func = poll_wake;
+  entry->pe_wait.we_private = pt;
+  entry->pe_next = waiter->pw_entries;
+  waiter->pw_entries = entry;
+  wait_queue_add (wq, &entry->pe_wait);
+}
+
+static void
+poll_waiter_init (PollWaiter *waiter)
+{
+  waiter->pw_table.pt_func = poll_queue;
+  waiter->pw_table.pt_private = waiter;
+  waiter->pw_table.pt_woken = 0;
+  waiter->pw_entries = NULL;
+  waiter->pw_err = 0;
+}
+
+static void
+poll_waiter_free (PollWaiter *waiter)
+{
+  while (waiter->pw_entries != NULL)
+    {
+      PollEntry *entry = waiter->pw_entries;
+      waiter->pw_entries = entry->pe_next;
+      wait_queue_remove (&entry->pe_wait);
+      kfree (entry);
+    }
+}
+
+static unsigned int
+poll_file (Process *proc, int fd, PollTable *pt)
+{
+  ProcessFile *file = process_get_file (proc, fd);
+  if (file == NULL)
+    return POLLNVAL;
+  return vfs_poll (file->pf_inode, pt);
+}
+
+static uint64_t
+poll_deadline (uint64_t ns)
+{
+  return clock_monotonic () + ns;
+}
+
+void
+wait_queue_add (WaitQueue *wq, WaitQueueEntry *entry)
+{
+  uint32_t flags = irq_save ();
+  entry->we_queue = wq;
+  entry->we_prev = NULL;
+  entry->we_next = wq->wq_head;
+  if (wq->wq_head != NULL)
+    wq->wq_head->we_prev = entry;
+  wq->wq_head = entry;
+  irq_restore (flags);
+}
+
+void
+wait_queue_remove (WaitQueueEntry *entry)
+{
+  uint32_t flags = irq_save ();
+  if (entry->we_queue != NULL)
+    {
+      if (entry->we_prev != NULL)
+	entry->we_prev->we_next = entry->we_next;
+      else
+	entry->we_queue->wq_head = entry->we_next;
+      if (entry->we_next != NULL)
+	entry->we_next->we_prev = entry->we_prev;
+      entry->we_queue = NULL;
+    }
+  irq_restore (flags);
+}
+
+void
+wait_queue_wake (WaitQueue *wq, unsigned int events)
+{
+  WaitQueueEntry *entry;
+  uint32_t flags = irq_save ();
+  for (entry = wq->wq_head; entry != NULL; entry = entry->we_next)
+    entry->we_func (entry, events);
+  irq_restore (flags);
+}
+
+/* Gives up the processor until PT is woken, the monotonic clock reaches
+   DEADLINE or a signal handler runs. A deadline of zero never expires. */
+
+int
+poll_sleep (PollTable *pt, uint64_t deadline)
+{
+  Process *proc = &process_table[task_getpid ()];
+  int ret = 0;
+  proc->p_pause = 1;
+  while (!pt->pt_woken)
+    {
+      if (!proc->p_pause)
+	{
+	  ret = -EINTR;
+	  break;
+	}
+      if (deadline != 0 && clock_monotonic () >= deadline)
+	{
+	  ret = -ETIMEDOUT;
+	  break;
+	}
+      task_yield ();
+    }
+  proc->p_pause = 0;
+  pt->pt_woken = 0;
+  return ret;
+}
+
+int
+poll (struct pollfd *fds, nfds_t nfds, int timeout)
+{
+  Process *proc = &process_table[task_getpid ()];
+  PollWaiter waiter;
+  uint64_t deadline = 0;
+  int count;
+  int ret;
+  nfds_t i;
+  if (nfds > proc->p_maxfds)
+    return -EINVAL;
+  if (timeout > 0)
+    deadline = poll_deadline (timeout * 1000000ULL);
+
+  poll_waiter_init (&waiter);
+  while (1)
+    {
+      count = 0;
+      for (i = 0; i < nfds; i++)
+	{
+	  unsigned int mask = 0;
+	  if (fds[i].fd >= 0)
+	    {
+	      mask = poll_file (proc, fds[i].fd, &waiter.pw_table);
+	      mask &= fds[i].events | POLLERR | POLLHUP | POLLNVAL;
+	    }
+	  fds[i].revents = mask;
+	  if (mask != 0)
+	    {
+	      /* No need to wait on the remaining files */
+	      waiter.pw_table.pt_func = NULL;
+	      count++;
+	    }
+	}
+      waiter.pw_table.pt_func = NULL;
+      if (count > 0 || timeout == 0)
+	break;
+      if (unlikely (waiter.pw_err != 0))
+	{
+	  count = waiter.pw_err;
+	  break;
+	}
+
+      ret = poll_sleep (&waiter.pw_table, deadline);
+      if (ret == -ETIMEDOUT)
+	break;
+      if (ret != 0)
+	{
+	  count = ret;
+	  break;
+	}
+    }
+  poll_waiter_free (&waiter);
+  return count;
+}
+
+int
+select (int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+	struct timeval *timeout)
+{
+  Process *proc = &process_table[task_getpid ()];
+  fd_set *sets[3] = {readfds, writefds, exceptfds};
+  unsigned int masks[3] = {POLL_READ_SET, POLL_WRITE_SET, POLL_EXCEPT_SET};
+  unsigned long *result;
+  PollWaiter waiter;
+  uint64_t deadline = 0;
+  size_t words;
+  int nowait = 0;
+  int count;
+  int ret;
+  int fd;
+  int i;
+  if (nfds < 0)
+    return -EINVAL;
+  if (timeout != NULL)
+    {
+      if (timeout->tv_sec < 0 || timeout->tv_usec < 0)
+	return -EINVAL;
+      nowait = timeout->tv_sec == 0 && timeout->tv_usec == 0;
+      deadline = poll_deadline (timeout->tv_sec * NSEC_PER_SEC
+				+ timeout->tv_usec * 1000ULL);
+    }
+
+  /* Descriptors past the end of the table cannot be open */
+  for (fd = proc->p_fdsize; fd < nfds; fd++)
+    {
+      unsigned long bit = 1UL << (fd % __NFDBITS);
+      for (i = 0; i < 3; i++)
+	{
+	  if (sets[i] != NULL && (sets[i]->fds_bits[fd / __NFDBITS] & bit))
+	    return -EBADF;
+	}
+    }
+  nfds = MIN (nfds, proc->p_fdsize);
+  words = (nfds + __NFDBITS - 1) / __NFDBITS;
+  result = kzalloc (sizeof (unsigned long) * (words * 3 + 1));
+  if (unlikely (result == NULL))
+    return -ENOMEM;
+
+  poll_waiter_init (&waiter);
+  while (1)
+    {
+      count = 0;
+      for (fd = 0; fd < nfds; fd++)
+	{
+	  unsigned long bit = 1UL << (fd % __NFDBITS);
+	  unsigned int want = 0;
+	  unsigned int mask;
+	  for (i = 0; i < 3; i++)
+	    {
+	      if (sets[i] != NULL && (sets[i]->fds_bits[fd / __NFDBITS] & bit))
+		want |= masks[i];
+	    }
+	  if (want == 0)
+	    continue;
+
+	  mask = poll_file (proc, fd, &waiter.pw_table);
+	  if (mask & POLLNVAL)
+	    {
+	      count = -EBADF;
+	      goto end;
+	    }
+	  for (i = 0; i < 3; i++)
+	    {
+	      if ((want & masks[i]) && (mask & masks[i]))
+		{
+		  result[i * words + fd / __NFDBITS] |= bit;
+		  waiter.pw_table.pt_func = NULL;
+		  count++;
+		}
+	    }
+	}
+      waiter.pw_table.pt_func = NULL;
+      if (count > 0 || nowait)
+	break;
+      if (unlikely (waiter.pw_err != 0))
+	{
+	  count = waiter.pw_err;
+	  goto end;
+	}
+
+      ret = poll_sleep (&waiter.pw_table, deadline);
+      if (ret == -ETIMEDOUT)
+	break;
+      if (ret != 0)
+	{
+	  count = ret;
+	  goto end;
+	}
+    }
+
+  /* Replace the caller's sets with the ready descriptors */
+  for (i = 0; i < 3; i++)
+    {
+      if (sets[i] != NULL)
+	memcpy (sets[i]->fds_bits, result + i * words,
+		sizeof (unsigned long) * words);
+    }
+  if (timeout != NULL)
+    {
+      uint64_t now = clock_monotonic ();
+      uint64_t rem = now < deadline ? deadline - now : 0;
+      timeout->tv_sec = rem / NSEC_PER_SEC;
+      timeout->tv_usec = rem % NSEC_PER_SEC / 1000;
+    }
+
+ end:
+  poll_waiter_free (&waiter);
+  kfree (result);
+  return count;
+}
@@ -20,40 +20,82 @@
 
 #include <bits/mman.h>
 #include <bits/mount.h>
+#include <fs/epoll.h>
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/process.h>
 #include <sys/wait.h>
 #include <video/vga.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
 #include <vm/paging.h>
+#include <vm/swap.h>
 
 Process process_table[PROCESS_LIMIT];
 ProcessFile process_fd_table[PROCESS_SYS_FILE_LIMIT];
-ProcessFile *process_fd_next = process_fd_table;
+static ProcessFile *process_fd_free;
+static ProcessFile *process_fd_next = process_fd_table;
 void *process_signal_handler;
 int process_signal;
 void *signal_return_addr;
 
-extern int exit_task;
+/* Children of a process are on one of two lists of its own, linked through
+   the process table by PID since PID 0 is never a child. Must be called with
+   interrupts disabled. */
+
+static void
+process_link_child (pid_t *head, pid_t pid)
+{
+  Process *proc = &process_table[pid];
+  proc->p_sibling_prev = 0;
+  proc->p_sibling_next = *head;
+  if (*head != 0)
+    process_table[*head].p_sibling_prev = pid;
+  *head = pid;
+}
+
+static void
+process_unlink_child (pid_t *head, pid_t pid)
+{
+  Process *proc = &process_table[pid];
+  if (proc->p_sibling_prev == 0)
+    *head = proc->p_sibling_next;
+  else
+    process_table[proc->p_sibling_prev].p_sibling_next = proc->p_sibling_next;
+  if (proc->p_sibling_next != 0)
+    process_table[proc->p_sibling_next].p_sibling_prev = proc->p_sibling_prev;
+}
 
 static int
-process_load_segment (VFSInode *inode, SortedArray *mregions, Elf32_Phdr *phdr)
+process_load_segment (VFSInode *inode, RBTree *mregions, Elf32_Phdr *phdr)
 {
   uint32_t addr;
   ProcessMemoryRegion *segment;
+  TLBGather tlb;
   int prot = 0;
+  int ret;
 
+  ret = process_map_text (inode, mregions, phdr, 0);
+  if (ret < 0)
+    return ret;
+  if (ret == 0)
+    return phdr->p_vaddr + phdr->p_memsz;
+
+  tlb_gather_init (&tlb);
   for (addr = phdr->p_vaddr & 0xfffff000; addr < phdr->p_vaddr + phdr->p_memsz;
        addr += PAGE_SIZE)
     {
       uint32_t paddr = alloc_page ();
       if (unlikely (paddr == 0))
-	return -ENOMEM;
+	{
+	  tlb_gather_flush (&tlb);
+	  return -ENOMEM;
+	}
       /* Map with write permission to copy data first */
       map_page (curr_page_dir, paddr, addr, PAGE_FLAG_USER | PAGE_FLAG_WRITE);
-      vm_page_inval (addr);
+      tlb_gather_page (&tlb, addr);
     }
-  vm_tlb_reset_386 ();
+  tlb_gather_flush (&tlb);
 
   if (phdr->p_flags & PF_R)
     prot |= PROT_READ;
@@ -62,7 +104,7 @@ process_load_segment (VFSInode *inode, SortedArray *mregions, Elf32_Phdr *phdr)
   if (phdr->p_flags & PF_X)
     prot |= PROT_EXEC;
 
-  segment = kmalloc (sizeof (ProcessMemoryRegion));
+  segment = process_region_alloc ();
   if (segment == NULL)
     return -ENOMEM;
   segment->pm_base = phdr->p_vaddr & 0xfffff000;
@@ -71,7 +113,7 @@ process_load_segment (VFSInode *inode, SortedArray *mregions, Elf32_Phdr *phdr)
   segment->pm_flags = MAP_PRIVATE | MAP_ANONYMOUS;
   segment->pm_ino = NULL;
   segment->pm_offset = 0;
-  sorted_array_insert (mregions, segment);
+  process_region_insert (mregions, segment);
 
   if (phdr->p_filesz > 0)
     {
@@ -90,15 +132,15 @@ process_load_segment (VFSInode *inode, SortedArray *mregions, Elf32_Phdr *phdr)
 	{
 	  uint32_t paddr = get_paddr (curr_page_dir, (void *) addr);
 	  map_page (curr_page_dir, paddr, addr, PAGE_FLAG_USER);
-	  vm_page_inval (addr);
+	  tlb_gather_page (&tlb, addr);
 	}
-      vm_tlb_reset_386 ();
+      tlb_gather_flush (&tlb);
     }
   return phdr->p_vaddr + phdr->p_memsz; /* Potential program break address */
 }
 
 static int
-process_load_phdrs (VFSInode *inode, SortedArray *mregions, Elf32_Ehdr *ehdr,
+process_load_phdrs (VFSInode *inode, RBTree *mregions, Elf32_Ehdr *ehdr,
 		    DynamicLinkInfo *dlinfo)
 {
   Elf32_Phdr *phdr;
@@ -160,23 +202,33 @@ process_load_phdrs (VFSInode *inode, SortedArray *mregions, Elf32_Ehdr *ehdr,
 
 int
 process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
-	      char *const *envp, DynamicLinkInfo *dlinfo)
+	      char *const *envp, DynamicLinkInfo *dlinfo, ExecArgs *args)
 {
   Elf32_Ehdr *ehdr = NULL;
-  SortedArray *mregions;
+  ProcessMemoryRegion *region;
+  RBTree mregions;
   Process *proc;
   char hashbang[2];
   pid_t pid = task_getpid ();
   int ret;
   int i;
 
+  /* Files open for writing can't be executed */
+  if (process_write_busy (inode))
+    return -ETXTBSY;
+
   /* Check for a hashbang */
   if (vfs_read (inode, hashbang, 2, 0) < 0)
     return -EIO;
   if (hashbang[0] == '#' && hashbang[1] == '!')
-    return process_exec_sh (inode, entry, argv, envp, dlinfo);
+    return process_exec_sh (inode, entry, argv, envp, dlinfo, args);
 
-  ret = task_setup_exec (argv, envp);
+  ret = task_setup_exec (args, argv, envp);
+  if (ret < 0)
+    return ret;
+
+  /* A vfork child stops using the address space of its parent here */
+  ret = process_vfork_return (pid, 1);
   if (ret < 0)
     return ret;
 
@@ -185,18 +237,13 @@ process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
 
   /* Close all close-on-exec file descriptors */
   proc = &process_table[pid];
-  for (i = 0; i < PROCESS_FILE_LIMIT; i++)
+  for (i = 0; i < proc->p_fdsize; i++)
     {
       if (proc->p_fdflags[i] & FD_CLOEXEC)
 	process_free_fd (proc, i);
     }
 
-  mregions = sorted_array_new (PROCESS_MMAP_LIMIT, process_mregion_cmp);
-  if (unlikely (mregions == NULL))
-    {
-      ret = -ENOMEM;
-      goto end;
-    }
+  process_region_init (&mregions);
 
   /* Read ELF header */
   ehdr = kmalloc (sizeof (Elf32_Ehdr));
@@ -228,7 +275,7 @@ process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
     }
 
   /* Load program headers and set entry point */
-  ret = process_load_phdrs (inode, mregions, ehdr, dlinfo);
+  ret = process_load_phdrs (inode, &mregions, ehdr, dlinfo);
   if (ret < 0)
     goto end;
   *entry = ehdr->e_entry;
@@ -254,7 +301,7 @@ process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
 
       /* Load interpreter into memory */
       dlinfo->dl_entry = (void *) *entry;
-      ret = rtld_setup (ehdr, mregions, entry, dlinfo);
+      ret = rtld_setup (&mregions, entry, dlinfo);
       if (ret < 0)
 	goto end;
 
@@ -265,10 +312,12 @@ process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
       *entry = (uint32_t) rtld_setup_dynamic_linker;
     }
   else
-    process_remap_segments (dlinfo->dl_loadbase, mregions);
+    process_remap_segments (dlinfo->dl_loadbase, &mregions);
 
+  for (region = process_region_first (&mregions); region != NULL;
+       region = process_region_next (region))
+    proc->p_vmsize += region->pm_len;
   proc->p_mregions = mregions;
-  kfree (ehdr);
 
   /* If the executable is setuid/setgid and the filesystem is not mounted with
      nosuid, change the process UID/GID */
@@ -279,17 +328,36 @@ process_exec (VFSInode *inode, uint32_t *entry, char *const *argv,
       if (inode->vi_mode & S_ISGID)
 	proc->p_egid = inode->vi_gid;
     }
+
+  /* Tell the startup code of the program where it was loaded */
+  if (dlinfo->dl_loadbase != NULL)
+    {
+      task_set_auxv (args, AT_PHDR,
+		     (uint32_t) dlinfo->dl_loadbase + ehdr->e_phoff);
+      task_set_auxv (args, AT_PHENT, ehdr->e_phentsize);
+      task_set_auxv (args, AT_PHNUM, ehdr->e_phnum);
+    }
+  if (dlinfo->dl_active)
+    task_set_auxv (args, AT_BASE, LD_SO_LOAD_ADDR);
+  task_set_auxv (args, AT_ENTRY, ehdr->e_entry);
+  task_set_auxv (args, AT_UID, proc->p_uid);
+  task_set_auxv (args, AT_EUID, proc->p_euid);
+  task_set_auxv (args, AT_GID, proc->p_gid);
+  task_set_auxv (args, AT_EGID, proc->p_egid);
+  task_set_auxv (args, AT_SECURE, proc->p_euid != proc->p_uid
+		 || proc->p_egid != proc->p_gid);
+  kfree (ehdr);
   return 0;
 
  end:
-  sorted_array_destroy (mregions, process_region_free, curr_page_dir);
+  process_region_destroy (&mregions, curr_page_dir);
   kfree (ehdr);
   return ret;
 }
 
 int
 process_exec_sh (VFSInode *inode, uint32_t *entry, char *const *argv,
-		 char *const *envp, DynamicLinkInfo *dlinfo)
+		 char *const *envp, DynamicLinkInfo *dlinfo, ExecArgs *args)
 {
   char buffer[127];
   char *new_argv[256];
@@ -336,7 +404,7 @@ process_exec_sh (VFSInode *inode, uint32_t *entry, char *const *argv,
 
   /* TODO Replace new_argv[1] with the full path to the program if needed */
 
-  ret = process_exec (new_inode, entry, new_argv, envp, dlinfo);
+  ret = process_exec (new_inode, entry, new_argv, envp, dlinfo, args);
   vfs_unref_inode (new_inode);
   return ret;
 }
@@ -351,18 +419,18 @@ void
 process_clear (pid_t pid, int partial)
 {
   Process *proc = &process_table[pid];
+  TLBGather tlb;
   uint32_t vaddr;
-  sorted_array_destroy (proc->p_mregions, process_region_free,
-			proc->p_task->t_pgdir);
-  proc->p_mregions = NULL;
+  process_region_destroy (&proc->p_mregions, proc->p_task->t_pgdir);
 
   /* Free process heap */
+  tlb_gather_init (&tlb);
   for (vaddr = proc->p_initbreak; vaddr < proc->p_break; vaddr += PAGE_SIZE)
     {
-      uint32_t paddr = get_paddr (proc->p_task->t_pgdir, (void *) vaddr);
-      if (paddr != 0)
-	free_page (paddr);
+      process_region_unmap (proc->p_task->t_pgdir, vaddr);
+      tlb_gather_page (&tlb, vaddr);
     }
+  tlb_gather_flush (&tlb);
 
   if (partial)
     {
@@ -374,17 +442,22 @@ process_clear (pid_t pid, int partial)
       /* Remove scheduler task */
       task_free ((ProcessTask *) proc->p_task);
       proc->p_task = NULL;
+      proc->p_maxfds = 0;
+      proc->p_maxbreak = 0;
+      memset (&proc->p_addrspace, 0, sizeof (struct rlimit));
+      memset (&proc->p_coresize, 0, sizeof (struct rlimit));
+      memset (&proc->p_cputime, 0, sizeof (struct rlimit));
+      memset (&proc->p_filesize, 0, sizeof (struct rlimit));
+      memset (&proc->p_memlock, 0, sizeof (struct rlimit));
     }
 
   /* Reset process data */
   proc->p_initbreak = 0;
   proc->p_break = 0;
-  proc->p_maxbreak = 0;
-  proc->p_maxfds = 0;
+  proc->p_vmsize = 0;
   proc->p_pause = 0;
   proc->p_sig = 0;
   proc->p_term = 0;
-  proc->p_waitstat = 0;
   proc->p_umask = 0;
   proc->p_uid = 0;
   proc->p_euid = 0;
@@ -392,15 +465,17 @@ process_clear (pid_t pid, int partial)
   proc->p_gid = 0;
   proc->p_egid = 0;
   proc->p_sgid = 0;
-  proc->p_pgid = 0;
   proc->p_sid = 0;
-  memset (&proc->p_addrspace, 0, sizeof (struct rlimit));
-  memset (&proc->p_coresize, 0, sizeof (struct rlimit));
-  memset (&proc->p_cputime, 0, sizeof (struct rlimit));
-  memset (&proc->p_filesize, 0, sizeof (struct rlimit));
-  memset (&proc->p_memlock, 0, sizeof (struct rlimit));
-  memset (&proc->p_rusage, 0, sizeof (struct rusage));
-  memset (&proc->p_cusage, 0, sizeof (struct rusage));
+
+  /* An exited process keeps its wait status, resource usage and process
+     group until its parent waits for it */
+  if (partial)
+    {
+      proc->p_waitstat = 0;
+      proc->p_pgid = 0;
+      memset (&proc->p_rusage, 0, sizeof (struct rusage));
+      memset (&proc->p_cusage, 0, sizeof (struct rusage));
+    }
 
   /* Clear all signal handlers and info */
   process_clear_sighandlers (pid);
@@ -409,65 +484,319 @@ process_clear (pid_t pid, int partial)
   memset (&proc->p_siginfo, 0, sizeof (siginfo_t));
 }
 
+/* Releases the resources of PID if it has exited. This is called by the
+   scheduler, since an exiting process can't free its own stack. The process
+   is then moved to the exited children of its parent to be waited for. */
+
 void
 process_free (pid_t pid)
 {
   Process *proc = &process_table[pid];
+  Process *parent;
+  Process *kernel = &process_table[0];
   pid_t ppid;
-  pid_t temp;
-  int i;
-  if (!process_valid (pid))
+  pid_t child;
+  if (!process_valid (pid) || !proc->p_exited || proc->p_vfork != 0)
     return;
+  process_vfork_return (pid, 0);
   ppid = proc->p_task->t_ppid;
+  parent = &process_table[ppid];
 
-  /* Decrement child process count of all parent processes */
-  temp = ppid;
-  while (temp != 0)
+  /* Exited children are reaped now, running ones are taken over by the
+     kernel task, which reaps them as soon as they exit */
+  while (proc->p_zombies != 0)
+    process_reap (pid, proc->p_zombies);
+  while (proc->p_child != 0)
     {
-      process_table[temp].p_children--;
-      temp = process_table[temp].p_task->t_ppid;
+      child = proc->p_child;
+      process_unlink_child (&proc->p_child, child);
+      process_link_child (&kernel->p_child, child);
+      process_table[child].p_task->t_ppid = 0;
+      process_table[child].p_orphan = 1;
+      proc->p_children--;
+      kernel->p_children++;
     }
-  process_table[0].p_children--;
-
-  /* Add self rusage values to parent's child rusage */
-  process_add_rusage (&process_table[ppid].p_cusage, proc);
 
   /* Clear process data */
   process_clear (pid, 0);
   vfs_unref_inode (proc->p_cwd);
   kfree (proc->p_cwdpath);
 
-  /* Clear all open file descriptors */
-  for (i = 0; i < PROCESS_FILE_LIMIT; i++)
-    process_free_fd (proc, i);
-  memset (proc->p_fdflags, 0, sizeof (int) * PROCESS_FILE_LIMIT);
+  /* Close all open file descriptors and release the table */
+  process_free_fds (proc);
+
+  proc->p_exited = 0;
+  proc->p_zombie = 1;
+  process_unlink_child (&parent->p_child, pid);
+  process_link_child (&parent->p_zombies, pid);
+
+  /* Only orphans are reaped here, the kernel waits for its own children */
+  if (proc->p_orphan)
+    process_reap (0, pid);
+  else
+    wait_queue_wake (&parent->p_waitq, POLLIN);
+}
+
+/* Marks PID as exited with wait status WAITSTAT and notifies its parent.
+   The process is not scheduled again and is freed by the scheduler. A
+   posix_spawn child that failed before exec is reaped by its parent, which
+   only sees the error, so no signal is sent for it. */
+
+void
+process_exit (pid_t pid, int waitstat)
+{
+  Process *proc = &process_table[pid];
+  pid_t ppid = proc->p_task->t_ppid;
+  Process *parent = &process_table[ppid];
+  if (proc->p_exited)
+    return;
+  proc->p_term = 1;
+  proc->p_exited = 1;
+  proc->p_waitstat = waitstat;
+  if (ppid != 0 && (parent->p_vfork != pid || parent->p_spawnerr == 0))
+    process_send_signal (ppid, SIGCHLD);
+}
+
+/* Gives the address space borrowed by the vfork child PID back to its
+   parent and lets the parent run again. If EXEC is nonzero, PID is the
+   current process and gets a new user stack for the program it runs. */
+
+int
+process_vfork_return (pid_t pid, int exec)
+{
+  ProcessTask *task = (ProcessTask *) process_table[pid].p_task;
+  Process *parent;
+  uint32_t paddr;
+  uint32_t vaddr;
+  if (task->t_vfork == 0)
+    return 0;
+  parent = &process_table[task->t_vfork];
+  page_dir_vfork_return (task->t_pgdir, parent->p_task->t_pgdir);
+  for (vaddr = TASK_STACK_LIMIT; vaddr < SYSCALL_STACK_ADDR;
+       vaddr += PAGE_SIZE)
+    unmap_page (task->t_pgdir, vaddr);
+  task->t_vfork = 0;
+  parent->p_vfork = 0;
+  if (!exec)
+    return 0;
+
+  for (vaddr = TASK_STACK_BOTTOM; vaddr < SYSCALL_STACK_ADDR;
+       vaddr += PAGE_SIZE)
+    {
+      paddr = alloc_page ();
+      if (unlikely (paddr == 0))
+	{
+	  vm_tlb_reset ();
+	  return -ENOMEM;
+	}
+      map_page (task->t_pgdir, paddr, vaddr,
+		PAGE_FLAG_WRITE | PAGE_FLAG_USER);
+    }
+  vm_tlb_reset ();
+  memset ((void *) TASK_STACK_BOTTOM, 0,
+	  SYSCALL_STACK_ADDR - TASK_STACK_BOTTOM);
+  return 0;
+}
+
+void
+process_add_child (pid_t ppid, pid_t pid)
+{
+  Process *parent = &process_table[ppid];
+  uint32_t flags = irq_save ();
+  process_link_child (&parent->p_child, pid);
+  parent->p_children++;
+  irq_restore (flags);
+}
+
+/* Frees the process table entry of PID, which must be an exited child of
+   PPID that has been freed, and adds its resource usage to that of the
+   children of PPID. Must be called with interrupts disabled. */
+
+void
+process_reap (pid_t ppid, pid_t pid)
+{
+  Process *parent = &process_table[ppid];
+  Process *proc = &process_table[pid];
+  process_unlink_child (&parent->p_zombies, pid);
+  parent->p_children--;
+  process_add_rusage (&parent->p_cusage, proc);
+  proc->p_zombie = 0;
+  proc->p_orphan = 0;
+  proc->p_waitstat = 0;
+  proc->p_pgid = 0;
+  memset (&proc->p_rusage, 0, sizeof (struct rusage));
+  memset (&proc->p_cusage, 0, sizeof (struct rusage));
 }
 
 void
 process_region_free (void *elem, void *data)
 {
   ProcessMemoryRegion *region = elem;
+  TLBGather tlb;
   uint32_t addr;
+  tlb_gather_init (&tlb);
   for (addr = region->pm_base; addr < region->pm_base + region->pm_len;
        addr += PAGE_SIZE)
     {
-      uint32_t paddr = get_paddr (data, (void *) addr);
-      if (paddr != 0)
-	free_page (paddr);
-      unmap_page (data, addr);
-      vm_page_inval (addr);
+      process_region_unmap (data, addr);
+      tlb_gather_page (&tlb, addr);
+    }
+  tlb_gather_flush (&tlb);
+  process_region_unref (region);
+  process_region_dealloc (region);
+}
+
+/* Unmaps the page at VADDR of a memory region and releases its frame. Pages
+   written through shared file mappings are marked dirty in the page cache
+   but not written back. The caller must invalidate the TLB entry. */
+
+void
+process_region_unmap (uint32_t *dir, uint32_t vaddr)
+{
+  uint32_t *pte = get_pte (dir, vaddr);
+  if (pte != NULL && (*pte & PAGE_FLAG_SWAP))
+    {
+      swap_free (*pte);
+      unmap_page (dir, vaddr);
+      return;
+    }
+  if (pte == NULL || !(*pte & PAGE_FLAG_PRESENT))
+    return;
+  if (*pte & PAGE_FLAG_SHARED)
+    page_cache_unmap_frame (*pte & 0xfffff000, *pte & PAGE_FLAG_DIRTY);
+  else if (!(*pte & PAGE_FLAG_ZERO))
+    free_page (*pte & 0xfffff000);
+  unmap_page (dir, vaddr);
+}
+
+ProcessMemoryRegion *
+process_find_region (Process *proc, uint32_t addr)
+{
+  return process_region_lookup (&proc->p_mregions, addr);
+}
+
+/* Resolves a fault on the anonymous page at VADDR. Swapped out pages are
+   read back in. Otherwise reads map the zero page read-only, and writes to
+   it or to a page that is not present map a new zeroed frame with FLAGS. */
+
+static int
+process_zero_fill (uint32_t vaddr, uint32_t err, uint32_t flags)
+{
+  uint32_t *pte = get_pte (curr_page_dir, vaddr);
+  uint32_t paddr;
+  if (pte != NULL && (*pte & PAGE_FLAG_SWAP))
+    return swap_in (pte, vaddr, flags);
+  if ((err & PF_FLAG_PROT)
+      && (pte == NULL || !(*pte & PAGE_FLAG_ZERO) || !(err & PF_FLAG_WRITE)))
+    return -EFAULT;
+  if (!(err & PF_FLAG_WRITE))
+    {
+      map_page (curr_page_dir, get_paddr (curr_page_dir, (void *) page_empty),
+		vaddr, (flags & ~PAGE_FLAG_WRITE) | PAGE_FLAG_ZERO);
+      vm_page_inval_386 (vaddr);
+      return 0;
+    }
+
+  paddr = alloc_page ();
+  if (unlikely (paddr == 0))
+    return -ENOMEM;
+  map_page (curr_page_dir, paddr, vaddr, PAGE_FLAG_WRITE);
+  vm_page_inval_386 (vaddr);
+  memset ((void *) vaddr, 0, PAGE_SIZE);
+  map_page (curr_page_dir, paddr, vaddr, flags);
+  vm_page_inval_386 (vaddr);
+  return 0;
+}
+
+/* Maps in the page of an anonymous or file mapping or of the heap containing
+   ADDR on first access. Returns nonzero if the fault was not caused by such
+   a page. */
+
+int
+process_page_fault (uint32_t addr, uint32_t err)
+{
+  Process *proc = &process_table[task_getpid ()];
+  ProcessMemoryRegion *region;
+  CachePage *page;
+  uint32_t vaddr = addr & ~(PAGE_SIZE - 1);
+  uint32_t pgflags = PAGE_FLAG_USER;
+  uint32_t cached = 0;
+  uint32_t paddr;
+  off64_t offset;
+  int ret;
+
+  /* A vfork child faults in pages of its parent's address space */
+  if (proc->p_task->t_vfork != 0)
+    proc = &process_table[proc->p_task->t_vfork];
+  if (addr >= proc->p_initbreak
+      && addr < (((proc->p_break - 1) | (PAGE_SIZE - 1)) + 1))
+    return process_zero_fill (vaddr, err, PAGE_FLAG_USER | PAGE_FLAG_WRITE);
+  region = process_find_region (proc, addr);
+  if (region == NULL || region->pm_prot == PROT_NONE)
+    return -EFAULT;
+  if ((err & PF_FLAG_WRITE) && !(region->pm_prot & PROT_WRITE))
+    return -EFAULT;
+  if (region->pm_prot & PROT_WRITE)
+    pgflags |= PAGE_FLAG_WRITE;
+  if (region->pm_ino == NULL)
+    return process_zero_fill (vaddr, err, pgflags);
+  if (err & PF_FLAG_PROT)
+    {
+      /* Only writes to a cached page mapped by a private mapping are
+	 resolved, by replacing it with a copy */
+      uint32_t *pte = get_pte (curr_page_dir, vaddr);
+      if (!(err & PF_FLAG_WRITE) || (region->pm_flags & MAP_SHARED)
+	  || pte == NULL || !(*pte & PAGE_FLAG_SHARED))
+	return -EFAULT;
+      cached = *pte & 0xfffff000;
+    }
+
+  offset = region->pm_offset + (off64_t) (vaddr - region->pm_base);
+  ret = page_cache_get (region->pm_ino, offset >> PAGE_CACHE_SHIFT, &page);
+  if (ret != 0)
+    return ret;
+
+  /* Mappings keep the reference to the cached page until they are
+     unmapped. Private ones map it read-only and get a copy of it when they
+     first write to it. */
+  if (region->pm_flags & MAP_SHARED)
+    {
+      map_page (curr_page_dir, page->cp_paddr, vaddr,
+		pgflags | PAGE_FLAG_SHARED);
+      vm_page_inval_386 (vaddr);
+      return 0;
     }
-  vm_tlb_reset_386 ();
-  kfree (region);
+  if (!(err & PF_FLAG_WRITE))
+    {
+      map_page (curr_page_dir, page->cp_paddr, vaddr,
+		(pgflags & ~PAGE_FLAG_WRITE) | PAGE_FLAG_SHARED);
+      vm_page_inval_386 (vaddr);
+      return 0;
+    }
+  paddr = alloc_page ();
+  if (unlikely (paddr == 0))
+    {
+      page_cache_put (page);
+      return -ENOMEM;
+    }
+  map_page (curr_page_dir, paddr, vaddr, PAGE_FLAG_WRITE);
+  vm_page_inval_386 (vaddr);
+  memcpy ((void *) vaddr, page->cp_data, PAGE_SIZE);
+  page_cache_put (page);
+  if (cached != 0)
+    page_cache_unmap_frame (cached, 0);
+  map_page (curr_page_dir, paddr, vaddr, pgflags);
+  vm_page_inval_386 (vaddr);
+  return 0;
 }
 
 int
 process_setup_std_streams (pid_t pid)
 {
   Process *proc = &process_table[pid];
-  if (proc->p_files[STDIN_FILENO] != NULL
-      || proc->p_files[STDOUT_FILENO] != NULL
-      || proc->p_files[STDERR_FILENO] != NULL)
+  if (process_get_file (proc, STDIN_FILENO) != NULL
+      || process_get_file (proc, STDOUT_FILENO) != NULL
+      || process_get_file (proc, STDERR_FILENO) != NULL)
     return -EINVAL; /* File descriptors for std streams are used */
 
   /* Create stdin */
@@ -505,41 +834,38 @@ process_setup_std_streams (pid_t pid)
   return 0;
 }
 
+/* Reserves LEN more bytes of address space for PROC, failing if that would
+   exceed its RLIMIT_AS */
+
+int
+process_vm_reserve (Process *proc, uint32_t len)
+{
+  if (proc->p_addrspace.rlim_cur != RLIM_INFINITY
+      && (uint64_t) proc->p_vmsize + len
+      > (uint32_t) proc->p_addrspace.rlim_cur)
+    return -ENOMEM;
+  proc->p_vmsize += len;
+  return 0;
+}
+
 uint32_t
 process_set_break (uint32_t addr)
 {
   Process *proc = &process_table[task_getpid ()];
-  uint32_t i;
+  uint32_t start = ((proc->p_break - 1) | (PAGE_SIZE - 1)) + 1;
+  uint32_t end = ((addr - 1) | (PAGE_SIZE - 1)) + 1;
 
   /* Fail if address is behind current break or is too high */
   if (addr < proc->p_break || addr >= PROCESS_BREAK_LIMIT)
     return proc->p_break;
 
-  /* Map pages until the new program break is reached */
-  for (i = ((proc->p_break - 1) | (PAGE_SIZE - 1)) + 1; i < addr;
-       i += PAGE_SIZE)
-    {
-      uint32_t paddr = alloc_page ();
-      if (paddr == 0)
-	return proc->p_break;
-      map_page (curr_page_dir, paddr, i, PAGE_FLAG_USER | PAGE_FLAG_WRITE);
-      vm_page_inval (i);
-    }
-  vm_tlb_reset_386 ();
-  memset ((void *) proc->p_break, 0, addr - proc->p_break);
-
+  /* New heap pages are filled with zeros when first accessed */
+  if (end > start && process_vm_reserve (proc, end - start) != 0)
+    return proc->p_break;
   proc->p_break = addr;
   return proc->p_break;
 }
 
-int
-process_mregion_cmp (const void *a, const void *b)
-{
-  uint32_t ba = ((const ProcessMemoryRegion *) a)->pm_base;
-  uint32_t bb = ((const ProcessMemoryRegion *) b)->pm_base;
-  return ba < bb;
-}
-
 void
 process_add_rusage (struct rusage *usage, const Process *proc)
 {
@@ -573,81 +899,268 @@ process_add_rusage (struct rusage *usage, const Process *proc)
 }
 
 void
-process_remap_segments (void *base, SortedArray *mregions)
+process_remap_segments (void *base, RBTree *mregions)
 {
+  ProcessMemoryRegion *segment;
+  TLBGather tlb;
   uint32_t vaddr;
-  int i;
-  for (i = 0; i < mregions->sa_size; i++)
+  tlb_gather_init (&tlb);
+  for (segment = process_region_first (mregions); segment != NULL;
+       segment = process_region_next (segment))
     {
-      ProcessMemoryRegion *segment = mregions->sa_elems[i];
-      if (!(segment->pm_prot & PROT_WRITE))
+      if (!(segment->pm_prot & PROT_WRITE) && segment->pm_ino == NULL)
 	{
 	  /* Segment is not writable, remap segment memory region without
-	     write permission */
+	     write permission. Segments mapped from the page cache are
+	     already read-only. */
 	  for (vaddr = LD_SO_LOAD_ADDR;
 	       vaddr < LD_SO_LOAD_ADDR + segment->pm_len; vaddr += PAGE_SIZE)
 	    {
 	      uint32_t paddr = get_paddr (curr_page_dir, (void *) vaddr);
 	      map_page (curr_page_dir, paddr, vaddr, PAGE_FLAG_USER);
-	      vm_page_inval (vaddr);
+	      tlb_gather_page (&tlb, vaddr);
 	    }
 	}
     }
-  vm_tlb_reset_386 ();
+  tlb_gather_flush (&tlb);
 }
 
+/* Maps the PT_LOAD segment PHDR of INODE at its address plus BIAS straight
+   from the page cache if it is read-only and laid out in the file the same
+   way as in memory, so every process running the file shares its pages.
+   The region is mapped with MAP_DENYWRITE. Returns a positive value if the
+   segment has to be copied instead. */
+
 int
-process_alloc_fd (Process *proc, int fd)
+process_map_text (VFSInode *inode, RBTree *mregions, Elf32_Phdr *phdr,
+		  uint32_t bias)
 {
-  ProcessFile *file;
-  int nfd;
-  for (file = process_fd_next; file < process_fd_table + PROCESS_SYS_FILE_LIMIT;
-       file++)
+  ProcessMemoryRegion *segment;
+  TLBGather tlb;
+  uint32_t base = (phdr->p_vaddr + bias) & 0xfffff000;
+  uint32_t end = phdr->p_vaddr + bias + phdr->p_memsz;
+  uint32_t vaddr;
+  int prot = 0;
+  int ret = 0;
+
+  if ((phdr->p_flags & PF_W) || phdr->p_filesz == 0
+      || phdr->p_filesz != phdr->p_memsz
+      || (phdr->p_offset & (PAGE_SIZE - 1))
+      != (phdr->p_vaddr & (PAGE_SIZE - 1))
+      || inode->vi_ops->vfs_readpage == NULL)
+    return 1;
+
+  if (phdr->p_flags & PF_R)
+    prot |= PROT_READ;
+  if (phdr->p_flags & PF_X)
+    prot |= PROT_EXEC;
+
+  segment = process_region_alloc ();
+  if (unlikely (segment == NULL))
+    return -ENOMEM;
+  segment->pm_base = base;
+  segment->pm_len = ((end - base - 1) | (PAGE_SIZE - 1)) + 1;
+  segment->pm_prot = prot;
+  segment->pm_flags = MAP_PRIVATE | MAP_DENYWRITE;
+  segment->pm_ino = inode;
+  segment->pm_offset = phdr->p_offset & 0xfffff000;
+  ret = process_region_ref (segment);
+  if (ret != 0)
     {
-      if (file->pf_refcnt == 0)
-	goto found;
+      process_region_dealloc (segment);
+      return ret;
     }
-  return -ENFILE; /* System file descriptor limit reached */
+  process_region_insert (mregions, segment);
 
- found:
-  for (nfd = fd; nfd < PROCESS_FILE_LIMIT; nfd++)
+  /* The region is not yet part of the process, so map every page now
+     instead of on first access. Each mapping keeps its page referenced. */
+  tlb_gather_init (&tlb);
+  for (vaddr = base; vaddr < end; vaddr += PAGE_SIZE)
     {
-      if (proc->p_files[nfd] == NULL)
+      CachePage *page;
+      off64_t offset = segment->pm_offset + (off64_t) (vaddr - base);
+      ret = page_cache_get (inode, offset >> PAGE_CACHE_SHIFT, &page);
+      if (ret != 0)
 	break;
+      map_page (curr_page_dir, page->cp_paddr, vaddr,
+		PAGE_FLAG_USER | PAGE_FLAG_SHARED);
+      tlb_gather_page (&tlb, vaddr);
     }
-  if (unlikely (nfd == PROCESS_FILE_LIMIT))
+  tlb_gather_flush (&tlb);
+  return ret;
+}
+
+/* Resizes the descriptor table of PROC to hold SIZE descriptors. The file,
+   flag and bitmap arrays share one allocation. */
+
+static int
+process_resize_fds (Process *proc, int size)
+{
+  ProcessFile **files;
+  int *flags;
+  uint32_t *map;
+  int old = MIN (proc->p_fdsize, size);
+  files = kzalloc (size * (sizeof (ProcessFile *) + sizeof (int))
+		   + size / 8);
+  if (unlikely (files == NULL))
+    return -ENOMEM;
+  flags = (int *) (files + size);
+  map = (uint32_t *) (flags + size);
+  if (proc->p_files != NULL)
+    {
+      memcpy (files, proc->p_files, sizeof (ProcessFile *) * old);
+      memcpy (flags, proc->p_fdflags, sizeof (int) * old);
+      memcpy (map, proc->p_fdmap, old / 8);
+      kfree (proc->p_files);
+    }
+  proc->p_files = files;
+  proc->p_fdflags = flags;
+  proc->p_fdmap = map;
+  proc->p_fdsize = size;
+  return 0;
+}
+
+/* Returns the lowest unused descriptor not less than FD, growing the
+   descriptor table up to the RLIMIT_NOFILE limit if required */
+
+int
+process_find_fd (Process *proc, int fd)
+{
+  int limit = MIN (proc->p_maxfds, (uint32_t) PROCESS_FILE_LIMIT);
+  int size;
+  int i;
+  int ret;
+  if (fd < 0)
+    return -EINVAL;
+  for (i = fd / 32; i < proc->p_fdsize / 32; i++)
+    {
+      uint32_t used = proc->p_fdmap[i];
+      if (i == fd / 32)
+	used |= (1U << (fd % 32)) - 1;
+      if (used != 0xffffffff)
+	{
+	  fd = i * 32 + __builtin_ctz (~used);
+	  return fd < limit ? fd : -EMFILE;
+	}
+    }
+
+  fd = MAX (fd, proc->p_fdsize);
+  if (fd >= limit)
     return -EMFILE; /* Process file descriptor limit reached */
-  proc->p_files[nfd] = file;
-  proc->p_files[nfd]->pf_refcnt = 1;
-  process_fd_next = file + 1; /* Start the next search after this nfd */
+  size = proc->p_fdsize == 0 ? PROCESS_FD_TABLE_MIN : proc->p_fdsize;
+  while (size <= fd)
+    size *= 2;
+  ret = process_resize_fds (proc, size);
+  if (ret != 0)
+    return ret;
+  return fd;
+}
+
+void
+process_set_fd (Process *proc, int fd, ProcessFile *file, int flags)
+{
+  proc->p_files[fd] = file;
+  proc->p_fdflags[fd] = flags;
+  proc->p_fdmap[fd / 32] |= 1U << (fd % 32);
+}
+
+int
+process_alloc_fd (Process *proc, int fd)
+{
+  ProcessFile *file;
+  int nfd = process_find_fd (proc, fd);
+  if (nfd < 0)
+    return nfd;
+
+  /* Take a file from the free list, or one that has never been used */
+  if (process_fd_free != NULL)
+    {
+      file = process_fd_free;
+      process_fd_free = file->pf_next;
+    }
+  else if (process_fd_next < process_fd_table + PROCESS_SYS_FILE_LIMIT)
+    file = process_fd_next++;
+  else
+    return -ENFILE; /* System file descriptor limit reached */
+
+  file->pf_next = NULL;
+  file->pf_refcnt = 1;
+  process_set_fd (proc, nfd, file, 0);
   return nfd;
 }
 
 int
 process_free_fd (Process *proc, int fd)
 {
-  ProcessFile *file = proc->p_files[fd];
+  ProcessFile *file = process_get_file (proc, fd);
   if (file == NULL)
     return -EBADF;
   proc->p_files[fd] = NULL;
+  proc->p_fdflags[fd] = 0;
+  proc->p_fdmap[fd / 32] &= ~(1U << (fd % 32));
   if (--file->pf_refcnt == 0)
     {
+      epoll_release_file (file);
+      if (file->pf_writer)
+	process_put_write_access (file->pf_inode);
+      file->pf_writer = 0;
       vfs_unref_inode (file->pf_inode);
       file->pf_inode = NULL;
       kfree (file->pf_path);
       file->pf_path = NULL;
       file->pf_mode = 0;
       file->pf_offset = 0;
+      file->pf_dir.dc_pos = 0;
+      file->pf_dir.dc_version = 0;
+      file->pf_next = process_fd_free;
+      process_fd_free = file;
+    }
+  return 0;
+}
+
+/* Gives PROC a copy of the descriptor table of PARENT, sharing the open
+   files */
+
+int
+process_copy_fds (Process *proc, const Process *parent)
+{
+  int ret;
+  int i;
+  if (parent->p_fdsize == 0)
+    return 0;
+  ret = process_resize_fds (proc, parent->p_fdsize);
+  if (ret != 0)
+    return ret;
+  memcpy (proc->p_files, parent->p_files,
+	  sizeof (ProcessFile *) * parent->p_fdsize);
+  memcpy (proc->p_fdflags, parent->p_fdflags, sizeof (int) * parent->p_fdsize);
+  memcpy (proc->p_fdmap, parent->p_fdmap, parent->p_fdsize / 8);
+  for (i = 0; i < proc->p_fdsize; i++)
+    {
+      if (proc->p_files[i] != NULL)
+	proc->p_files[i]->pf_refcnt++;
     }
-  if (file < process_fd_next)
-    process_fd_next = file; /* Start the next search at this fd */
   return 0;
 }
 
+void
+process_free_fds (Process *proc)
+{
+  int i;
+  for (i = 0; i < proc->p_fdsize; i++)
+    process_free_fd (proc, i);
+  kfree (proc->p_files);
+  proc->p_files = NULL;
+  proc->p_fdflags = NULL;
+  proc->p_fdmap = NULL;
+  proc->p_fdsize = 0;
+}
+
 int
 process_terminated (pid_t pid)
 {
-  return process_table[pid].p_term;
+  /* A vfork parent doesn't run until its child calls exec or exits */
+  return process_table[pid].p_term || process_table[pid].p_vfork != 0;
 }
 
 int
@@ -721,14 +1234,7 @@ process_send_signal (pid_t pid, int sig)
     }
 
   if (exit)
-    {
-      pid_t ppid = process_table[pid].p_task->t_ppid;
-      process_table[pid].p_term = 1;
-      process_table[pid].p_waitstat = sig;
-      exit_task = pid;
-      if (ppid != 0)
-	process_send_signal (ppid, SIGCHLD);
-    }
+    process_exit (pid, sig);
   else if (stop)
     {
       process_table[pid].p_term = 1;
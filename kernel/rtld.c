@@ -17,6 +17,7 @@
  *************************************************************************/
 
 #include <bits/mman.h>
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/process.h>
 #include <vm/heap.h>
@@ -29,16 +30,33 @@ rtld_get_symbol (DynamicLinkInfo *dlinfo, Elf32_Word index)
 			index * dlinfo->dl_symtab.sym_entsize);
 }
 
+static RtldCache *rtld_cache;
+
+/* Loads the segment PHDR of the dynamic linker. If DATA is not NULL, it
+   holds the relocated contents of the segment to use instead of the file. */
+
 static void *
-rtld_load_interp_segment (VFSInode *inode, SortedArray *mregions,
-			  Elf32_Phdr *phdr)
+rtld_load_interp_segment (VFSInode *inode, RBTree *mregions,
+			  Elf32_Phdr *phdr, const void *data)
 {
   uint32_t vaddr;
   ProcessMemoryRegion *segment;
   void *start = (void *) (LD_SO_LOAD_ADDR + phdr->p_vaddr);
+  TLBGather tlb;
   uint32_t i;
   int prot = 0;
+  int ret;
+
+  if (data == NULL)
+    {
+      ret = process_map_text (inode, mregions, phdr, LD_SO_LOAD_ADDR);
+      if (ret < 0)
+	return NULL;
+      if (ret == 0)
+	return start;
+    }
 
+  tlb_gather_init (&tlb);
   for (vaddr = LD_SO_LOAD_ADDR; vaddr < LD_SO_LOAD_ADDR + phdr->p_memsz;
        vaddr += PAGE_SIZE)
     {
@@ -47,16 +65,21 @@ rtld_load_interp_segment (VFSInode *inode, SortedArray *mregions,
       if (unlikely (paddr == 0))
 	goto err;
       map_page (curr_page_dir, paddr, addr, PAGE_FLAG_USER | PAGE_FLAG_WRITE);
-      vm_page_inval (addr);
+      tlb_gather_page (&tlb, addr);
     }
-  vm_tlb_reset_386 ();
+  tlb_gather_flush (&tlb);
 
-  if (phdr->p_filesz > 0)
+  if (data != NULL)
+    memcpy (start, data, phdr->p_memsz);
+  else
     {
-      if (vfs_read (inode, start, phdr->p_filesz, phdr->p_offset) < 0)
-	goto err;
+      if (phdr->p_filesz > 0)
+	{
+	  if (vfs_read (inode, start, phdr->p_filesz, phdr->p_offset) < 0)
+	    goto err;
+	}
+      memset (start + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
     }
-  memset (start + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
 
   if (phdr->p_flags & PF_R)
     prot |= PROT_READ;
@@ -65,7 +88,7 @@ rtld_load_interp_segment (VFSInode *inode, SortedArray *mregions,
   if (phdr->p_flags & PF_X)
     prot |= PROT_EXEC;
 
-  segment = kmalloc (sizeof (ProcessMemoryRegion));
+  segment = process_region_alloc ();
   if (unlikely (segment == NULL))
     goto err;
   segment->pm_base = (uint32_t) start;
@@ -74,7 +97,7 @@ rtld_load_interp_segment (VFSInode *inode, SortedArray *mregions,
   segment->pm_flags = MAP_PRIVATE | MAP_ANONYMOUS;
   segment->pm_ino = NULL;
   segment->pm_offset = 0;
-  sorted_array_insert (mregions, segment);
+  process_region_insert (mregions, segment);
   return start;
 
  err:
@@ -98,6 +121,8 @@ rtld_load_interp_dynamic (Elf32_Dyn *dynamic, DynamicLinkInfo *dlinfo)
 	{
 	case DT_NEEDED:
 	  return -1; /* ld.so is not allowed to use shared libraries */
+	case DT_TEXTREL:
+	  return -1; /* Text pages are shared and can't be relocated */
 	case DT_PLTRELSZ:
 	  dlinfo->dl_pltrel.pt_size = entry->d_un.d_val;
 	  break;
@@ -175,8 +200,8 @@ rtld_load_interp_dynamic (Elf32_Dyn *dynamic, DynamicLinkInfo *dlinfo)
 
 static int
 rtld_load_interp_phdrs (VFSInode *inode, Elf32_Ehdr *ehdr,
-			SortedArray *mregions, DynamicLinkInfo *dlinfo,
-			DynamicLinkInfo *interp_dlinfo)
+			RBTree *mregions, DynamicLinkInfo *interp_dlinfo,
+			RtldCache *cache)
 {
   Elf32_Phdr *phdr = kmalloc (sizeof (Elf32_Phdr));
   Elf32_Dyn *dynamic = NULL;
@@ -191,8 +216,15 @@ rtld_load_interp_phdrs (VFSInode *inode, Elf32_Ehdr *ehdr,
 	goto err;
       if (phdr->p_type == PT_LOAD)
 	{
-	  if (rtld_load_interp_segment (inode, mregions, phdr) == NULL)
+	  if (rtld_load_interp_segment (inode, mregions, phdr, NULL) == NULL)
 	    goto err;
+	  if (cache != NULL)
+	    {
+	      if (cache->rc_nsegs < RTLD_CACHE_SEGMENTS)
+		memcpy (&cache->rc_segs[cache->rc_nsegs].rs_phdr, phdr,
+			sizeof (Elf32_Phdr));
+	      cache->rc_nsegs++;
+	    }
 	}
       else if (phdr->p_type == PT_DYNAMIC)
         dynamic = (Elf32_Dyn *) (LD_SO_LOAD_ADDR + phdr->p_vaddr);
@@ -279,71 +311,200 @@ rtld_get_entry_point (DynamicLinkInfo *dlinfo)
   return NULL; /* Could not find symbol */
 }
 
+/* Returns a reference to the cached dynamic linker if it was loaded from
+   INODE and the file has not changed since */
+
+static RtldCache *
+rtld_cache_get (VFSInode *inode)
+{
+  RtldCache *cache;
+  uint32_t flags = irq_save ();
+  cache = rtld_cache;
+  if (cache != NULL
+      && (cache->rc_sb != inode->vi_sb || cache->rc_ino != inode->vi_ino
+	  || cache->rc_size != inode->vi_size
+	  || cache->rc_mtime.tv_sec != inode->vi_mtime.tv_sec
+	  || cache->rc_mtime.tv_nsec != inode->vi_mtime.tv_nsec))
+    cache = NULL;
+  if (cache != NULL)
+    cache->rc_refcnt++;
+  irq_restore (flags);
+  return cache;
+}
+
+static void
+rtld_cache_put (RtldCache *cache)
+{
+  uint32_t flags = irq_save ();
+  int i;
+  if (--cache->rc_refcnt > 0)
+    {
+      irq_restore (flags);
+      return;
+    }
+  irq_restore (flags);
+  for (i = 0; i < cache->rc_nsegs; i++)
+    kfree (cache->rc_segs[i].rs_data);
+  kfree (cache);
+}
+
+/* Drops the cached dynamic linker if it was loaded from inode INO of SB,
+   which is being written, truncated or removed. The modification time has
+   only a resolution of seconds on some filesystems, so it can't be relied
+   on to notice the change. */
+
+void
+rtld_cache_invalidate (VFSSuperblock *sb, ino64_t ino)
+{
+  RtldCache *cache;
+  uint32_t flags = irq_save ();
+  cache = rtld_cache;
+  if (cache != NULL && cache->rc_sb == sb && cache->rc_ino == ino)
+    rtld_cache = NULL;
+  else
+    cache = NULL;
+  irq_restore (flags);
+  if (cache != NULL)
+    rtld_cache_put (cache);
+}
+
+/* Saves the relocated segments of the dynamic linker just loaded from INODE
+   into MREGIONS and makes CACHE the cached dynamic linker, replacing the
+   previous one. Segments shared from the page cache need no copy. */
+
+static void
+rtld_cache_fill (RtldCache *cache, VFSInode *inode, RBTree *mregions,
+		 uint32_t entry)
+{
+  RtldCache *old;
+  uint32_t flags;
+  int i;
+  cache->rc_sb = inode->vi_sb;
+  cache->rc_ino = inode->vi_ino;
+  cache->rc_mtime = inode->vi_mtime;
+  cache->rc_size = inode->vi_size;
+  cache->rc_entry = entry;
+  cache->rc_refcnt = 1;
+  for (i = 0; i < cache->rc_nsegs; i++)
+    {
+      RtldSegment *segment = &cache->rc_segs[i];
+      void *start = (void *) (LD_SO_LOAD_ADDR + segment->rs_phdr.p_vaddr);
+      ProcessMemoryRegion *region =
+	process_region_lookup (mregions, (uint32_t) start);
+      if (segment->rs_phdr.p_memsz == 0
+	  || (region != NULL && region->pm_ino != NULL))
+	continue;
+      segment->rs_data = kmalloc (segment->rs_phdr.p_memsz);
+      if (unlikely (segment->rs_data == NULL))
+	{
+	  rtld_cache_put (cache);
+	  return;
+	}
+      memcpy (segment->rs_data, start, segment->rs_phdr.p_memsz);
+    }
+
+  flags = irq_save ();
+  old = rtld_cache;
+  rtld_cache = cache;
+  irq_restore (flags);
+  if (old != NULL)
+    rtld_cache_put (old);
+}
+
 int
-rtld_setup (Elf32_Ehdr *ehdr, SortedArray *mregions, uint32_t *entry,
-	    DynamicLinkInfo *dlinfo)
+rtld_setup (RBTree *mregions, uint32_t *entry, DynamicLinkInfo *dlinfo)
 {
   DynamicLinkInfo interp_dlinfo;
+  Elf32_Ehdr ehdr;
+  RtldCache *cache;
+  VFSInode *inode;
   void *rtld_entry_addr;
   int ret;
+  int i;
+
+  ret = vfs_open_file (&inode, dlinfo->dl_interp, 1);
+  if (ret < 0)
+    return ret;
+
+  /* Map the cached dynamic linker, which is already relocated */
+  cache = rtld_cache_get (inode);
+  if (cache != NULL)
+    {
+      for (i = 0; i < cache->rc_nsegs; i++)
+	{
+	  RtldSegment *segment = &cache->rc_segs[i];
+	  if (rtld_load_interp_segment (inode, mregions, &segment->rs_phdr,
+					segment->rs_data) == NULL)
+	    {
+	      ret = -ENOEXEC;
+	      break;
+	    }
+	}
+      if (ret == 0)
+	*entry = cache->rc_entry;
+      rtld_cache_put (cache);
+      vfs_unref_inode (inode);
+      return ret;
+    }
+
+  /* Caching is skipped if this fails */
+  cache = kzalloc (sizeof (RtldCache));
 
   /* Load ELF interpreter */
   memset (&interp_dlinfo, 0, sizeof (DynamicLinkInfo));
-  ret = rtld_load_interp (ehdr, mregions, dlinfo, &interp_dlinfo);
+  ret = rtld_load_interp (inode, &ehdr, mregions, &interp_dlinfo, cache);
   if (unlikely (ret < 0))
-    return ret;
+    goto end;
 
   /* Perform relocations on ELF interpreter */
   ret = rtld_perform_interp_reloc (&interp_dlinfo);
   if (unlikely (ret < 0))
-    return ret;
+    goto end;
 
   /* Load entry point of ELF interpreter */
   rtld_entry_addr = rtld_get_entry_point (&interp_dlinfo);
   if (unlikely (rtld_entry_addr == NULL))
-    return -ENOEXEC;
+    {
+      ret = -ENOEXEC;
+      goto end;
+    }
   *entry = (uint32_t) rtld_entry_addr;
-  return 0;
+
+  if (cache != NULL && cache->rc_nsegs <= RTLD_CACHE_SEGMENTS)
+    {
+      rtld_cache_fill (cache, inode, mregions, *entry);
+      cache = NULL;
+    }
+
+ end:
+  kfree (cache);
+  vfs_unref_inode (inode);
+  return ret;
 }
 
 int
-rtld_load_interp (Elf32_Ehdr *ehdr, SortedArray *mregions,
-		  DynamicLinkInfo *dlinfo, DynamicLinkInfo *interp_dlinfo)
+rtld_load_interp (VFSInode *inode, Elf32_Ehdr *ehdr, RBTree *mregions,
+		  DynamicLinkInfo *interp_dlinfo, RtldCache *cache)
 {
-  VFSInode *inode;
-  int ret = vfs_open_file (&inode, dlinfo->dl_interp, 1);
-  if (ret < 0)
-    return ret;
-
   /* Read ELF header */
-  ret = vfs_read (inode, ehdr, sizeof (Elf32_Ehdr), 0);
+  int ret = vfs_read (inode, ehdr, sizeof (Elf32_Ehdr), 0);
   if (ret < 0)
-    goto end;
+    return ret;
 
   /* Check magic number */
   if (ehdr->e_ident[EI_MAG0] != ELFMAG0 || ehdr->e_ident[EI_MAG1] != ELFMAG1
       || ehdr->e_ident[EI_MAG2] != ELFMAG2 || ehdr->e_ident[EI_MAG3] != ELFMAG3)
-    {
-      ret = -ENOEXEC;
-      goto end;
-    }
+    return -ENOEXEC;
 
   /* Check for 32-bit little-endian ELF shared object for correct machine */
   if (ehdr->e_ident[EI_CLASS] != ELFCLASS32
       || ehdr->e_ident[EI_DATA] != ELFDATA2LSB
       || ehdr->e_type != ET_DYN
       || ehdr->e_machine != MACHTYPE)
-    {
-      ret = -ENOEXEC;
-      goto end;
-    }
+    return -ENOEXEC;
 
   /* Load program headers */
-  ret = rtld_load_interp_phdrs (inode, ehdr, mregions, dlinfo, interp_dlinfo);
-
- end:
-  vfs_unref_inode (inode);
-  return ret;
+  return rtld_load_interp_phdrs (inode, ehdr, mregions, interp_dlinfo, cache);
 }
 
 int
@@ -0,0 +1,524 @@
+/*************************************************************************
+ * swap.c -- This file is part of OS/0.                                  *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/process.h>
+#include <vm/heap.h>
+#include <vm/swap.h>
+
+typedef struct
+{
+  uint32_t sc_vaddr;
+  uint32_t sc_paddr;
+  uint32_t sc_slot;
+} SwapCandidate;
+
+static SwapArea swap_areas[SWAP_AREA_LIMIT];
+static int swap_nareas;
+static char *swap_buffer;
+static int swap_reclaiming;
+static TLBGather swap_tlb; /* Pages of the current task changed by reclaim */
+static SwapPin *swap_pins;
+
+/* Position of the clock hand, the next page to be checked */
+static pid_t swap_hand_pid = 1;
+static uint32_t swap_hand_addr;
+
+static int
+swap_alloc_slot (SwapArea *area, uint32_t *slot)
+{
+  uint32_t i;
+  if (area->sa_nfree == 0)
+    return -ENOSPC;
+  for (i = 0; i < area->sa_npages; i++)
+    {
+      uint32_t s = (area->sa_next + i) % area->sa_npages;
+      if (area->sa_map[s] == 0)
+	{
+	  area->sa_map[s] = 1;
+	  area->sa_nfree--;
+	  area->sa_next = s + 1;
+	  *slot = s;
+	  return 0;
+	}
+    }
+  return -ENOSPC;
+}
+
+static void
+swap_release_slot (SwapArea *area, uint32_t slot)
+{
+  if (--area->sa_map[slot] == 0)
+    area->sa_nfree++;
+}
+
+static int
+swap_frame_pinned (uint32_t paddr)
+{
+  SwapPin *pin;
+  int i;
+  for (pin = swap_pins; pin != NULL; pin = pin->sp_next)
+    {
+      for (i = 0; i < pin->sp_count; i++)
+	{
+	  if (pin->sp_frames[i] == paddr)
+	    return 1;
+	}
+    }
+  return 0;
+}
+
+/* Adds the pages of PID between START and END that are due to be swapped
+   out to BATCH. Pages accessed since the hand last passed them have their
+   accessed bit cleared and get another chance. Returns nonzero once the
+   batch is full. */
+
+static int
+swap_scan_range (pid_t pid, uint32_t start, uint32_t end,
+		 SwapCandidate *batch, int *count)
+{
+  uint32_t *dir = process_table[pid].p_task->t_pgdir;
+  uint32_t vaddr;
+  int i;
+  for (vaddr = MAX (start, swap_hand_addr); vaddr < end; vaddr += PAGE_SIZE)
+    {
+      uint32_t *pte = get_pte (dir, vaddr);
+      uint32_t paddr;
+      if (pte == NULL)
+	{
+	  /* Skip to the next page table */
+	  vaddr = (vaddr | 0x3fffff) + 1 - PAGE_SIZE;
+	  continue;
+	}
+      if (!(*pte & PAGE_FLAG_PRESENT)
+	  || (*pte & (PAGE_FLAG_SHARED | PAGE_FLAG_ZERO)))
+	continue;
+      if (*pte & PAGE_FLAG_ACCESS)
+	{
+	  *pte &= ~PAGE_FLAG_ACCESS;
+	  if (dir == curr_page_dir)
+	    tlb_gather_page (&swap_tlb, vaddr);
+	  continue;
+	}
+
+      /* Pages linked by fork may be found again in another process */
+      paddr = *pte & 0xfffff000;
+      if (swap_frame_pinned (paddr))
+	continue;
+      for (i = 0; i < *count; i++)
+	{
+	  if (batch[i].sc_paddr == paddr)
+	    break;
+	}
+      if (i < *count)
+	continue;
+      batch[*count].sc_vaddr = vaddr;
+      batch[*count].sc_paddr = paddr;
+      if (++*count == SWAP_CLUSTER)
+	{
+	  swap_hand_addr = vaddr + PAGE_SIZE;
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+/* Scans the anonymous regions and heap of PID in address order */
+
+static int
+swap_scan_process (pid_t pid, SwapCandidate *batch, int *count)
+{
+  Process *proc = &process_table[pid];
+  ProcessMemoryRegion *region;
+  uint32_t heap_start = proc->p_initbreak;
+  uint32_t heap_end = ((proc->p_break - 1) | (PAGE_SIZE - 1)) + 1;
+  int heap_done = heap_start >= heap_end;
+  for (region = process_region_first (&proc->p_mregions); region != NULL;
+       region = process_region_next (region))
+    {
+      if (!heap_done && heap_start < region->pm_base)
+	{
+	  if (swap_scan_range (pid, heap_start, heap_end, batch, count))
+	    return 1;
+	  heap_done = 1;
+	}
+      if (region->pm_ino != NULL)
+	continue;
+      if (swap_scan_range (pid, region->pm_base,
+			   region->pm_base + region->pm_len, batch, count))
+	return 1;
+    }
+  if (!heap_done)
+    return swap_scan_range (pid, heap_start, heap_end, batch, count);
+  return 0;
+}
+
+/* Replaces every mapping of the frame of CAND with a swap entry. Frames
+   linked by fork are mapped at the same address in each process. */
+
+static void
+swap_unmap_frame (int areano, SwapCandidate *cand)
+{
+  uint32_t entry = SWAP_ENTRY (areano, cand->sc_slot);
+  int refs = 0;
+  pid_t pid;
+  for (pid = 1; pid < PROCESS_LIMIT; pid++)
+    {
+      uint32_t *dir;
+      uint32_t *pte;
+      if (!process_valid (pid))
+	continue;
+      dir = process_table[pid].p_task->t_pgdir;
+      pte = get_pte (dir, cand->sc_vaddr);
+      if (pte == NULL || !(*pte & PAGE_FLAG_PRESENT)
+	  || (*pte & 0xfffff000) != cand->sc_paddr)
+	continue;
+      if (refs++ > 0)
+	swap_areas[areano].sa_map[cand->sc_slot]++;
+      *pte = entry;
+      if (dir == curr_page_dir)
+	tlb_gather_page (&swap_tlb, cand->sc_vaddr);
+    }
+}
+
+/* Copies the pages in BATCH to the swap area and frees their frames.
+   Consecutive slots are written with a single request. */
+
+static int
+swap_write_batch (SwapArea *area, SwapCandidate *batch, int count)
+{
+  int freed = 0;
+  int i;
+  int j;
+  int n;
+
+  for (n = 0; n < count; n++)
+    {
+      if (swap_alloc_slot (area, &batch[n].sc_slot) != 0)
+	break;
+      map_page (curr_page_dir, batch[n].sc_paddr, SWAP_COPY_VADDR,
+		PAGE_FLAG_WRITE);
+      vm_page_inval_386 (SWAP_COPY_VADDR);
+      memcpy (swap_buffer + n * PAGE_SIZE, (void *) SWAP_COPY_VADDR,
+	      PAGE_SIZE);
+    }
+  unmap_page (curr_page_dir, SWAP_COPY_VADDR);
+  vm_page_inval_386 (SWAP_COPY_VADDR);
+
+  for (i = 0; i < n; i = j)
+    {
+      for (j = i + 1; j < n && batch[j].sc_slot == batch[j - 1].sc_slot + 1;
+	   j++)
+	;
+      if (area->sa_dev->sd_write (area->sa_dev, swap_buffer + i * PAGE_SIZE,
+				  (j - i) * PAGE_SIZE,
+				  batch[i].sc_slot * PAGE_SIZE) == 0)
+	continue;
+
+      /* Leave pages that could not be written in memory */
+      for (; i < j; i++)
+	{
+	  swap_release_slot (area, batch[i].sc_slot);
+	  batch[i].sc_paddr = 0;
+	}
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (batch[i].sc_paddr == 0)
+	continue;
+      swap_unmap_frame (area - swap_areas, &batch[i]);
+      free_page (batch[i].sc_paddr);
+      freed++;
+    }
+  tlb_gather_flush (&swap_tlb);
+  return freed;
+}
+
+int
+swap_probe (SpecDevice *dev, uint32_t npages)
+{
+  SwapHeader *header;
+  SwapArea *area;
+  uint32_t nbad;
+  uint32_t i;
+  int ret;
+
+  if (swap_nareas == SWAP_AREA_LIMIT)
+    return -ENOSPC;
+  header = kmalloc (sizeof (SwapHeader));
+  if (unlikely (header == NULL))
+    return -ENOMEM;
+  ret = dev->sd_read (dev, header, sizeof (SwapHeader), 0);
+  if (ret != 0)
+    goto end;
+  if (memcmp (header->sh_magic.magic, SWAP_MAGIC, 10) != 0
+      || header->sh_info.version != SWAP_VERSION)
+    {
+      ret = -EINVAL;
+      goto end;
+    }
+
+  npages = MIN (npages, header->sh_info.lastpage + 1);
+  npages = MIN (npages, SWAP_PAGE_LIMIT);
+  if (npages < 2)
+    {
+      ret = -EINVAL;
+      goto end;
+    }
+  if (swap_buffer == NULL)
+    {
+      swap_buffer = kvalloc (SWAP_CLUSTER * PAGE_SIZE);
+      if (unlikely (swap_buffer == NULL))
+	{
+	  ret = -ENOMEM;
+	  goto end;
+	}
+    }
+
+  area = &swap_areas[swap_nareas];
+  area->sa_map = kmalloc (npages * sizeof (uint16_t));
+  if (unlikely (area->sa_map == NULL))
+    {
+      ret = -ENOMEM;
+      goto end;
+    }
+  memset (area->sa_map, 0, npages * sizeof (uint16_t));
+
+  /* The first page holds the header and is never used */
+  area->sa_map[0] = SWAP_MAP_BAD;
+  nbad = MIN (header->sh_info.nbadpages,
+	      (sizeof (SwapHeader) -
+	       offsetof (SwapHeader, sh_info.badpages)) / sizeof (uint32_t));
+  for (i = 0; i < nbad; i++)
+    {
+      if (header->sh_info.badpages[i] < npages)
+	area->sa_map[header->sh_info.badpages[i]] = SWAP_MAP_BAD;
+    }
+  area->sa_nfree = 0;
+  for (i = 0; i < npages; i++)
+    {
+      if (area->sa_map[i] == 0)
+	area->sa_nfree++;
+    }
+  area->sa_dev = dev;
+  area->sa_npages = npages;
+  area->sa_next = 1;
+  swap_nareas++;
+  printk ("swap: using %s, %luK\n", dev->sd_name,
+	  (unsigned long) area->sa_nfree * (PAGE_SIZE >> 10));
+
+ end:
+  kfree (header);
+  return ret;
+}
+
+/* Frees up to SWAP_CLUSTER frames by writing out anonymous pages that were
+   not accessed during the last turn of the clock hand. Returns the number
+   of frames freed. */
+
+int
+swap_reclaim (void)
+{
+  SwapCandidate batch[SWAP_CLUSTER];
+  SwapArea *area = NULL;
+  int switch_enabled;
+  int count = 0;
+  int freed = 0;
+  int steps;
+  int i;
+
+  if (swap_reclaiming)
+    return 0;
+  for (i = 0; i < swap_nareas; i++)
+    {
+      if (area == NULL || swap_areas[i].sa_nfree > area->sa_nfree)
+	area = &swap_areas[i];
+    }
+  if (area == NULL || area->sa_nfree == 0)
+    return 0;
+
+  /* No other task may touch the pages being written out */
+  swap_reclaiming = 1;
+  switch_enabled = task_switch_enabled;
+  task_switch_enabled = 0;
+  tlb_gather_init (&swap_tlb);
+
+  /* The first turn of the hand may only clear accessed bits, so stop after
+     two turns */
+  for (steps = 0; steps < 2 * PROCESS_LIMIT; steps++)
+    {
+      pid_t pid = swap_hand_pid;
+      if (pid != 0 && process_valid (pid)
+	  && swap_scan_process (pid, batch, &count))
+	break;
+      swap_hand_pid = (pid + 1) % PROCESS_LIMIT;
+      swap_hand_addr = 0;
+    }
+  tlb_gather_flush (&swap_tlb);
+
+  if (count > 0)
+    freed = swap_write_batch (area, batch, count);
+  task_switch_enabled = switch_enabled;
+  swap_reclaiming = 0;
+  return freed;
+}
+
+/* Reads the page at VADDR, whose page table entry PTE holds a swap entry,
+   back into memory and maps it with FLAGS. Other processes that still have
+   the same entry at VADDR were linked to the page by fork, so the frame is
+   mapped in them too. */
+
+int
+swap_in (uint32_t *pte, uint32_t vaddr, uint32_t flags)
+{
+  uint32_t entry = *pte;
+  SwapArea *area = &swap_areas[SWAP_ENTRY_AREA (entry)];
+  uint32_t paddr = alloc_page ();
+  uint32_t eflags;
+  pid_t pid;
+  if (unlikely (paddr == 0))
+    return -ENOMEM;
+  map_page (curr_page_dir, paddr, vaddr, PAGE_FLAG_WRITE);
+  vm_page_inval_386 (vaddr);
+  if (area->sa_dev->sd_read (area->sa_dev, (void *) vaddr, PAGE_SIZE,
+			     SWAP_ENTRY_SLOT (entry) * PAGE_SIZE) != 0)
+    {
+      *pte = entry;
+      vm_page_inval_386 (vaddr);
+      free_page (paddr);
+      return -EIO;
+    }
+  map_page (curr_page_dir, paddr, vaddr, flags);
+  vm_page_inval_386 (vaddr);
+  swap_free (entry);
+
+  eflags = irq_save ();
+  for (pid = 1; pid < PROCESS_LIMIT; pid++)
+    {
+      uint32_t *dir;
+      uint32_t *other;
+      if (!process_valid (pid))
+	continue;
+      dir = process_table[pid].p_task->t_pgdir;
+      if (dir == curr_page_dir)
+	continue;
+      other = get_pte (dir, vaddr);
+      if (other == NULL || *other != entry)
+	continue;
+      map_page (dir, paddr, vaddr, flags);
+      swap_release_slot (area, SWAP_ENTRY_SLOT (entry));
+    }
+  irq_restore (eflags);
+  return 0;
+}
+
+void
+swap_dup (uint32_t entry)
+{
+  uint32_t flags = irq_save ();
+  swap_areas[SWAP_ENTRY_AREA (entry)].sa_map[SWAP_ENTRY_SLOT (entry)]++;
+  irq_restore (flags);
+}
+
+void
+swap_free (uint32_t entry)
+{
+  uint32_t flags = irq_save ();
+  swap_release_slot (&swap_areas[SWAP_ENTRY_AREA (entry)],
+		     SWAP_ENTRY_SLOT (entry));
+  irq_restore (flags);
+}
+
+/* Faults in the pages of the user buffers in VEC and pins their frames so
+   a device can access them directly. If WRITE is nonzero the transfer
+   stores to the buffers, so each page is made private and writable first.
+   Kernel memory is never swapped out and is not pinned. */
+
+int
+swap_pin_iov (SwapPin *pin, const struct iovec *vec, int vlen, int write)
+{
+  uint32_t flags;
+  uint32_t addr;
+  uint32_t end;
+  uint32_t *pte;
+  int npages = 0;
+  int i;
+  for (i = 0; i < vlen; i++)
+    {
+      addr = (uint32_t) vec[i].iov_base & ~(PAGE_SIZE - 1);
+      end = (uint32_t) vec[i].iov_base + vec[i].iov_len;
+      if (end > addr)
+	npages += (end - addr + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
+  pin->sp_frames = NULL;
+  pin->sp_count = 0;
+  if (npages > 0)
+    {
+      pin->sp_frames = kmalloc (sizeof (uint32_t) * npages);
+      if (unlikely (pin->sp_frames == NULL))
+	return -ENOMEM;
+    }
+  flags = irq_save ();
+  pin->sp_next = swap_pins;
+  swap_pins = pin;
+  irq_restore (flags);
+
+  for (i = 0; i < vlen; i++)
+    {
+      addr = (uint32_t) vec[i].iov_base & ~(PAGE_SIZE - 1);
+      end = (uint32_t) vec[i].iov_base + vec[i].iov_len;
+      for (; addr < end && addr < PROCESS_MMAP_END; addr += PAGE_SIZE)
+	{
+	  volatile char *ptr =
+	    (volatile char *) MAX (addr, (uint32_t) vec[i].iov_base);
+
+	  /* Touching the page faults it in. Reclaim could run before it is
+	     pinned, so check it is still mapped with interrupts off. */
+	  while (1)
+	    {
+	      if (write)
+		*ptr = *ptr;
+	      else
+		(void) *ptr;
+	      flags = irq_save ();
+	      pte = get_pte (curr_page_dir, addr);
+	      if (pte != NULL && (*pte & PAGE_FLAG_PRESENT)
+		  && (!write || ((*pte & PAGE_FLAG_WRITE)
+				 && !(*pte & PAGE_FLAG_ZERO))))
+		break;
+	      irq_restore (flags);
+	    }
+	  pin->sp_frames[pin->sp_count++] = *pte & 0xfffff000;
+	  irq_restore (flags);
+	}
+    }
+  return 0;
+}
+
+void
+swap_unpin (SwapPin *pin)
+{
+  SwapPin **link;
+  uint32_t flags = irq_save ();
+  for (link = &swap_pins; *link != pin; link = &(*link)->sp_next)
+    ;
+  *link = pin->sp_next;
+  irq_restore (flags);
+  kfree (pin->sp_frames);
+}
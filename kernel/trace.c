@@ -0,0 +1,206 @@
+/*************************************************************************
+ * trace.c -- This file is part of OS/0.                                 *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+
+#include <i386/features.h>
+#include <i386/pic.h>
+#include <libk/libk.h>
+#include <sys/process.h>
+#include <sys/syscall.h>
+#include <sys/timer.h>
+#include <sys/trace.h>
+
+extern volatile ProcessTask *task_current;
+
+static TraceRing trace_rings[TRACE_EVENT_COUNT];
+static uint64_t trace_syscall_start[PROCESS_LIMIT];
+static uint32_t trace_syscall_calls[NR_syscalls];
+static uint32_t trace_syscall_hist[NR_syscalls][TRACE_HIST_BUCKETS];
+
+static void
+trace_record (int event, uint64_t tsc, uint32_t arg0, uint32_t arg1)
+{
+  TraceRing *ring = &trace_rings[event];
+  TraceEvent *e;
+  uint32_t flags = irq_save ();
+  e = &ring->tr_events[ring->tr_head++ & (TRACE_RING_SIZE - 1)];
+  e->te_tsc = tsc;
+  e->te_arg[0] = arg0;
+  e->te_arg[1] = arg1;
+  e->te_pid = task_current == NULL ? 0 : task_current->t_pid;
+  e->te_event = event;
+  irq_restore (flags);
+}
+
+static size_t
+trace_append_num (char *buffer, size_t len, unsigned long n)
+{
+  buffer[len++] = ' ';
+  utoa (n, buffer + len, 10);
+  return len + strlen (buffer + len);
+}
+
+/* Copies the part of LINE that overlaps the requested read window. POS is
+   the stream position of the start of the line and is advanced past it. */
+
+static size_t
+trace_copy_line (const char *line, size_t linelen, off_t *pos, char *buffer,
+		 size_t len, off_t offset, size_t total)
+{
+  off_t end = *pos + linelen;
+  size_t start;
+  size_t amt;
+  if (end > offset && total < len)
+    {
+      start = offset > *pos ? offset - *pos : 0;
+      amt = MIN (linelen - start, len - total);
+      memcpy (buffer + total, line + start, amt);
+      total += amt;
+    }
+  *pos = end;
+  return total;
+}
+
+uint64_t
+trace_clock (void)
+{
+  uint64_t tsc;
+  if (!(cpu_features_edx & CPU_FEATURE_TSC))
+    return timer_poll ();
+  __asm__ volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+void
+trace_event (int event, uint32_t arg0, uint32_t arg1)
+{
+  trace_record (event, trace_clock (), arg0, arg1);
+}
+
+void
+trace_syscall_entry (int nr)
+{
+  uint64_t now = trace_clock ();
+  if (task_current != NULL)
+    trace_syscall_start[task_current->t_pid] = now;
+  trace_record (TRACE_SYSCALL_ENTRY, now, nr, 0);
+}
+
+void
+trace_syscall_exit (int nr, int ret)
+{
+  uint64_t now = trace_clock ();
+  uint64_t delta;
+  uint32_t high;
+  int bucket;
+  trace_record (TRACE_SYSCALL_EXIT, now, nr, ret);
+  if (task_current == NULL || nr < 0 || nr >= NR_syscalls)
+    return;
+
+  /* Bucket by the position of the highest set bit of the latency */
+  delta = now - trace_syscall_start[task_current->t_pid];
+  high = delta >> 32;
+  if (high != 0)
+    bucket = TRACE_HIST_BUCKETS - 1;
+  else if ((uint32_t) delta == 0)
+    bucket = 0;
+  else
+    bucket = 31 - __builtin_clz ((uint32_t) delta);
+  if (bucket >= TRACE_HIST_BUCKETS)
+    bucket = TRACE_HIST_BUCKETS - 1;
+  trace_syscall_calls[nr]++;
+  trace_syscall_hist[nr][bucket]++;
+}
+
+int
+trace_events_read (SpecDevice *dev, void *buffer, size_t len, off_t offset)
+{
+  size_t total = 0;
+  uint32_t i = offset / sizeof (TraceEvent);
+  size_t start = offset % sizeof (TraceEvent);
+  while (i < TRACE_EVENT_COUNT * TRACE_RING_SIZE && total < len)
+    {
+      TraceRing *ring = &trace_rings[i / TRACE_RING_SIZE];
+      TraceEvent e;
+      uint32_t flags = irq_save ();
+      uint32_t head = ring->tr_head;
+      uint32_t slot = i % TRACE_RING_SIZE;
+      size_t amt;
+
+      /* Once a ring has wrapped its oldest record is at the head */
+      if (head >= TRACE_RING_SIZE)
+	slot = (head + slot) & (TRACE_RING_SIZE - 1);
+      memcpy (&e, &ring->tr_events[slot], sizeof (TraceEvent));
+      irq_restore (flags);
+
+      amt = MIN (sizeof (TraceEvent) - start, len - total);
+      memcpy (buffer + total, (char *) &e + start, amt);
+      total += amt;
+      start = 0;
+      i++;
+    }
+  return total;
+}
+
+int
+trace_events_write (SpecDevice *dev, const void *buffer, size_t len,
+		    off_t offset)
+{
+  /* Any write clears all event rings */
+  uint32_t flags = irq_save ();
+  memset (trace_rings, 0, sizeof (trace_rings));
+  irq_restore (flags);
+  return len;
+}
+
+int
+trace_syslat_read (SpecDevice *dev, void *buffer, size_t len, off_t offset)
+{
+  static const char header[] = "# nr calls log2(cycles) buckets 0-31\n";
+  char line[(TRACE_HIST_BUCKETS + 2) * 11 + 2];
+  off_t pos = 0;
+  size_t total;
+  int i;
+  int j;
+
+  total = trace_copy_line (header, sizeof (header) - 1, &pos, buffer, len,
+			   offset, 0);
+  for (i = 0; i < NR_syscalls && total < len; i++)
+    {
+      size_t linelen;
+      if (trace_syscall_calls[i] == 0)
+	continue;
+      utoa (i, line, 10);
+      linelen = trace_append_num (line, strlen (line), trace_syscall_calls[i]);
+      for (j = 0; j < TRACE_HIST_BUCKETS; j++)
+	linelen = trace_append_num (line, linelen, trace_syscall_hist[i][j]);
+      line[linelen++] = '\n';
+      total = trace_copy_line (line, linelen, &pos, buffer, len, offset,
+			       total);
+    }
+  return total;
+}
+
+int
+trace_syslat_write (SpecDevice *dev, const void *buffer, size_t len,
+		    off_t offset)
+{
+  /* Any write resets the latency histograms */
+  memset (trace_syscall_calls, 0, sizeof (trace_syscall_calls));
+  memset (trace_syscall_hist, 0, sizeof (trace_syscall_hist));
+  return len;
+}
@@ -16,62 +16,98 @@
  * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
  *************************************************************************/
 
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/process.h>
 #include <sys/wait.h>
 
-int exit_task;
-
-static pid_t
-wait_get_status (pid_t pid, int *status, struct rusage *usage)
+static void
+wait_wake (WaitQueueEntry *entry, unsigned int events)
 {
-  pid_t curr = task_getpid ();
-  pid_t temp = exit_task;
-  if (exit_task == 0)
-    return 0; /* No process has terminated yet */
+  PollTable *pt = entry->we_private;
+  pt->pt_woken = 1;
+}
 
-  switch (pid)
-    {
-    case -1:
-    case 0:
-      /* Check if the exited process is a child of the current process */
-      while (temp != 0 && process_table[temp].p_task->t_ppid != curr)
-	temp = process_table[temp].p_task->t_ppid;
-      if (temp == 0)
-	return 0;
+/* Returns nonzero if CHILD matches the PID argument of wait4 () called by
+   PROC. A PID of zero or below -1 selects a process group. */
 
-      /* Make sure the exited process is in the same group as the caller if
-	 pid is zero */
-      if (pid != -1 && process_table[curr].p_pgid != process_table[temp].p_pgid)
-	return 0;
-      break;
-    default:
-      if (temp != pid)
-	return 0;
-    }
+static int
+wait_match (Process *proc, pid_t child, pid_t pid)
+{
+  if (pid > 0)
+    return child == pid;
+  if (pid == -1)
+    return 1;
+  if (pid == 0)
+    return process_table[child].p_pgid == proc->p_pgid;
+  return process_table[child].p_pgid == -pid;
+}
+
+/* Returns the first child of PROC on the list starting at CHILD that is
+   matched by PID, or zero */
 
-  if (usage != NULL)
-    memcpy (usage, &process_table[temp].p_rusage, sizeof (struct rusage));
-  *status = process_table[temp].p_waitstat;
-  return temp;
+static pid_t
+wait_find (Process *proc, pid_t child, pid_t pid)
+{
+  if (pid == -1)
+    return child;
+  while (child != 0 && !wait_match (proc, child, pid))
+    child = process_table[child].p_sibling_next;
+  return child;
 }
 
 pid_t
 wait4 (pid_t pid, int *status, int options, struct rusage *usage)
 {
-  __asm__ volatile ("sti");
-  if (pid < -1)
-    pid = -pid;
-  if (process_table[task_getpid ()].p_children == 0)
-    return -ECHILD;
-  if (pid > 0 && !process_valid (pid))
-    return -ESRCH;
-  if (options & WNOHANG)
-    return wait_get_status (pid, status, usage);
+  pid_t self = task_getpid ();
+  Process *proc = &process_table[self];
+  WaitQueueEntry entry;
+  PollTable pt;
+  struct rusage child_usage;
+  int child_status;
+  pid_t child;
+  int ret = 0;
+
+  pt.pt_func = NULL;
+  pt.pt_private = NULL;
+  pt.pt_woken = 0;
+  entry.we_func = wait_wake;
+  entry.we_private = &pt;
+  wait_queue_add (&proc->p_waitq, &entry);
   while (1)
     {
-      pid_t ret = wait_get_status (pid, status, usage);
+      /* Exited children are queued by the scheduler when it frees them */
+      uint32_t flags = irq_save ();
+      child = wait_find (proc, proc->p_zombies, pid);
+      if (child != 0)
+	{
+	  child_status = process_table[child].p_waitstat;
+	  memcpy (&child_usage, &process_table[child].p_rusage,
+		  sizeof (struct rusage));
+	  process_reap (self, child);
+	  irq_restore (flags);
+	  if (status != NULL)
+	    *status = child_status;
+	  if (usage != NULL)
+	    memcpy (usage, &child_usage, sizeof (struct rusage));
+	  ret = child;
+	  break;
+	}
+      if (wait_find (proc, proc->p_child, pid) == 0)
+	{
+	  irq_restore (flags);
+	  ret = -ECHILD;
+	  break;
+	}
+      irq_restore (flags);
+      if (options & WNOHANG)
+	break;
+
+      /* Sleep until a child is freed */
+      ret = poll_sleep (&pt, 0);
       if (ret != 0)
-	return ret;
+	break;
     }
+  wait_queue_remove (&entry);
+  return ret;
 }
@@ -17,6 +17,7 @@
  *************************************************************************/
 
 #include <libk/libk.h>
+#include <sys/kmsg.h>
 
 void print_registers (void);
 void halt (void) __attribute__ ((noreturn));
@@ -26,6 +27,7 @@ panic (const char *__restrict fmt, ...)
 {
   va_list args;
   va_start (args, fmt);
+  kmsg_sync ();
   printk ("\n============[ KERNEL PANIC ]============\n");
   vprintk (fmt, args);
   print_registers ();
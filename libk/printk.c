@@ -17,24 +17,16 @@
  *************************************************************************/
 
 #include <libk/libk.h>
-#include <video/vga.h>
 #include <limits.h>
 
-static char itoa_buffer[32];
-
 #ifndef TEST
-
-static void
-__vga_write (const char *str, size_t len)
-{
-  vga_write (CURRENT_TTY, str, len);
-}
-
+#include <sys/kmsg.h>
 #endif
 
 int
 __vprintk (void (*write) (const char *, size_t), const char *fmt, va_list args)
 {
+  char itoa_buffer[32];
   int written = 0;
   while (*fmt != '\0')
     {
@@ -211,7 +203,7 @@ printk (const char *__restrict fmt, ...)
 int
 vprintk (const char *fmt, va_list args)
 {
-  return __vprintk (__vga_write, fmt, args);
+  return kmsg_vprintk (fmt, args);
 }
 
 #endif
@@ -0,0 +1,330 @@
+/*************************************************************************
+ * rbtree.c -- This file is part of OS/0.                                *
+ * Copyright (C) 2021 XNSC                                               *
+ *                                                                       *
+ * OS/0 is free software: you can redistribute it and/or modify          *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * OS/0 is distributed in the hope that it will be useful,               *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the          *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with OS/0. If not, see <https://www.gnu.org/licenses/>.         *
+ *************************************************************************/
+#include <libk/rbtree.h>
+
+static inline int
+rb_is_red (const RBNode *node)
+{
+  return node != NULL && node->rb_red;
+}
+
+static inline void
+rb_augment (RBTree *tree, RBNode *node)
+{
+  if (tree->rbt_augment != NULL)
+    tree->rbt_augment (node);
+}
+
+static void
+rb_replace_child (RBTree *tree, RBNode *parent, RBNode *old, RBNode *new)
+{
+  if (parent == NULL)
+    tree->rbt_root = new;
+  else if (parent->rb_left == old)
+    parent->rb_left = new;
+  else
+    parent->rb_right = new;
+}
+
+/* Rotations only move nodes within the subtree being rotated, so only the
+   two nodes that change places need their augmented values recomputed */
+
+static void
+rb_rotate_left (RBTree *tree, RBNode *node)
+{
+  RBNode *child = node->rb_right;
+  node->rb_right = child->rb_left;
+  if (child->rb_left != NULL)
+    child->rb_left->rb_parent = node;
+  child->rb_parent = node->rb_parent;
+  rb_replace_child (tree, node->rb_parent, node, child);
+  child->rb_left = node;
+  node->rb_parent = child;
+  rb_augment (tree, node);
+  rb_augment (tree, child);
+}
+
+static void
+rb_rotate_right (RBTree *tree, RBNode *node)
+{
+  RBNode *child = node->rb_left;
+  node->rb_left = child->rb_right;
+  if (child->rb_right != NULL)
+    child->rb_right->rb_parent = node;
+  child->rb_parent = node->rb_parent;
+  rb_replace_child (tree, node->rb_parent, node, child);
+  child->rb_right = node;
+  node->rb_parent = child;
+  rb_augment (tree, node);
+  rb_augment (tree, child);
+}
+
+static void
+rb_insert_fixup (RBTree *tree, RBNode *node)
+{
+  RBNode *parent;
+  while ((parent = node->rb_parent) != NULL && parent->rb_red)
+    {
+      RBNode *gparent = parent->rb_parent;
+      RBNode *uncle;
+      if (parent == gparent->rb_left)
+	{
+	  uncle = gparent->rb_right;
+	  if (rb_is_red (uncle))
+	    {
+	      parent->rb_red = 0;
+	      uncle->rb_red = 0;
+	      gparent->rb_red = 1;
+	      node = gparent;
+	      continue;
+	    }
+	  if (node == parent->rb_right)
+	    {
+	      rb_rotate_left (tree, parent);
+	      node = parent;
+	      parent = node->rb_parent;
+	    }
+	  parent->rb_red = 0;
+	  gparent->rb_red = 1;
+	  rb_rotate_right (tree, gparent);
+	}
+      else
+	{
+	  uncle = gparent->rb_left;
+	  if (rb_is_red (uncle))
+	    {
+	      parent->rb_red = 0;
+	      uncle->rb_red = 0;
+	      gparent->rb_red = 1;
+	      node = gparent;
+	      continue;
+	    }
+	  if (node == parent->rb_left)
+	    {
+	      rb_rotate_right (tree, parent);
+	      node = parent;
+	      parent = node->rb_parent;
+	    }
+	  parent->rb_red = 0;
+	  gparent->rb_red = 1;
+	  rb_rotate_left (tree, gparent);
+	}
+    }
+  tree->rbt_root->rb_red = 0;
+}
+
+/* Restores the tree after a black node was removed from above NODE, which
+   may be NULL, so its parent is passed separately */
+
+static void
+rb_erase_fixup (RBTree *tree, RBNode *node, RBNode *parent)
+{
+  RBNode *sibling;
+  while (node != tree->rbt_root && !rb_is_red (node))
+    {
+      if (node == parent->rb_left)
+	{
+	  sibling = parent->rb_right;
+	  if (sibling->rb_red)
+	    {
+	      sibling->rb_red = 0;
+	      parent->rb_red = 1;
+	      rb_rotate_left (tree, parent);
+	      sibling = parent->rb_right;
+	    }
+	  if (!rb_is_red (sibling->rb_left) && !rb_is_red (sibling->rb_right))
+	    {
+	      sibling->rb_red = 1;
+	      node = parent;
+	      parent = node->rb_parent;
+	      continue;
+	    }
+	  if (!rb_is_red (sibling->rb_right))
+	    {
+	      sibling->rb_left->rb_red = 0;
+	      sibling->rb_red = 1;
+	      rb_rotate_right (tree, sibling);
+	      sibling = parent->rb_right;
+	    }
+	  sibling->rb_red = parent->rb_red;
+	  parent->rb_red = 0;
+	  sibling->rb_right->rb_red = 0;
+	  rb_rotate_left (tree, parent);
+	}
+      else
+	{
+	  sibling = parent->rb_left;
+	  if (sibling->rb_red)
+	    {
+	      sibling->rb_red = 0;
+	      parent->rb_red = 1;
+	      rb_rotate_right (tree, parent);
+	      sibling = parent->rb_left;
+	    }
+	  if (!rb_is_red (sibling->rb_left) && !rb_is_red (sibling->rb_right))
+	    {
+	      sibling->rb_red = 1;
+	      node = parent;
+	      parent = node->rb_parent;
+	      continue;
+	    }
+	  if (!rb_is_red (sibling->rb_left))
+	    {
+	      sibling->rb_right->rb_red = 0;
+	      sibling->rb_red = 1;
+	      rb_rotate_left (tree, sibling);
+	      sibling = parent->rb_left;
+	    }
+	  sibling->rb_red = parent->rb_red;
+	  parent->rb_red = 0;
+	  sibling->rb_left->rb_red = 0;
+	  rb_rotate_right (tree, parent);
+	}
+      node = tree->rbt_root;
+      break;
+    }
+  if (node != NULL)
+    node->rb_red = 0;
+}
+
+/* Adds NODE to TREE as a child of PARENT. LINK points to the empty child
+   pointer of PARENT (or the root pointer) found while searching the tree. */
+
+void
+rb_link (RBTree *tree, RBNode *node, RBNode *parent, RBNode **link)
+{
+  node->rb_parent = parent;
+  node->rb_left = NULL;
+  node->rb_right = NULL;
+  node->rb_red = 1;
+  *link = node;
+  tree->rbt_count++;
+  rb_propagate (tree, node);
+  rb_insert_fixup (tree, node);
+}
+
+void
+rb_erase (RBTree *tree, RBNode *node)
+{
+  RBNode *child;
+  RBNode *parent;
+  int red;
+  if (node->rb_left == NULL || node->rb_right == NULL)
+    {
+      child = node->rb_left != NULL ? node->rb_left : node->rb_right;
+      parent = node->rb_parent;
+      red = node->rb_red;
+      if (child != NULL)
+	child->rb_parent = parent;
+      rb_replace_child (tree, parent, node, child);
+    }
+  else
+    {
+      /* Move the successor of the node into its place */
+      RBNode *succ = node->rb_right;
+      while (succ->rb_left != NULL)
+	succ = succ->rb_left;
+      child = succ->rb_right;
+      red = succ->rb_red;
+      if (succ->rb_parent == node)
+	parent = succ;
+      else
+	{
+	  parent = succ->rb_parent;
+	  parent->rb_left = child;
+	  if (child != NULL)
+	    child->rb_parent = parent;
+	  succ->rb_right = node->rb_right;
+	  node->rb_right->rb_parent = succ;
+	}
+      succ->rb_left = node->rb_left;
+      node->rb_left->rb_parent = succ;
+      succ->rb_parent = node->rb_parent;
+      succ->rb_red = node->rb_red;
+      rb_replace_child (tree, node->rb_parent, node, succ);
+    }
+  tree->rbt_count--;
+  rb_propagate (tree, parent);
+  if (!red)
+    rb_erase_fixup (tree, child, parent);
+}
+
+/* Recomputes the augmented values of NODE and all of its ancestors */
+
+void
+rb_propagate (RBTree *tree, RBNode *node)
+{
+  if (tree->rbt_augment == NULL)
+    return;
+  for (; node != NULL; node = node->rb_parent)
+    tree->rbt_augment (node);
+}
+
+RBNode *
+rb_first (const RBTree *tree)
+{
+  RBNode *node = tree->rbt_root;
+  if (node == NULL)
+    return NULL;
+  while (node->rb_left != NULL)
+    node = node->rb_left;
+  return node;
+}
+
+RBNode *
+rb_last (const RBTree *tree)
+{
+  RBNode *node = tree->rbt_root;
+  if (node == NULL)
+    return NULL;
+  while (node->rb_right != NULL)
+    node = node->rb_right;
+  return node;
+}
+
+RBNode *
+rb_next (const RBNode *node)
+{
+  const RBNode *parent;
+  if (node->rb_right != NULL)
+    {
+      node = node->rb_right;
+      while (node->rb_left != NULL)
+	node = node->rb_left;
+      return (RBNode *) node;
+    }
+  while ((parent = node->rb_parent) != NULL && node == parent->rb_right)
+    node = parent;
+  return (RBNode *) parent;
+}
+
+RBNode *
+rb_prev (const RBNode *node)
+{
+  const RBNode *parent;
+  if (node->rb_left != NULL)
+    {
+      node = node->rb_left;
+      while (node->rb_right != NULL)
+	node = node->rb_right;
+      return (RBNode *) node;
+    }
+  while ((parent = node->rb_parent) != NULL && node == parent->rb_left)
+    node = parent;
+  return (RBNode *) parent;
+}
@@ -19,7 +19,9 @@
 #include <bits/mman.h>
 #include <bits/mount.h>
 #include <bits/random.h>
+#include <fs/epoll.h>
 #include <fs/pipe.h>
+#include <i386/pic.h>
 #include <libk/libk.h>
 #include <sys/acpi.h>
 #include <sys/process.h>
@@ -33,20 +35,13 @@
 #include <cpuid.h>
 #endif
 
-extern int exit_task;
-
 void
 sys_exit (int code)
 {
   pid_t pid = task_getpid ();
-  pid_t ppid = process_table[pid].p_task->t_ppid;
   if (pid == 0)
     panic ("Attempted to exit from kernel task");
-  process_table[pid].p_term = 1;
-  process_table[pid].p_waitstat = (code & 0xff) << 8;
-  exit_task = pid;
-  if (ppid != 0)
-    process_send_signal (ppid, SIGCHLD);
+  process_exit (pid, (code & 0xff) << 8);
   task_yield ();
 }
 
@@ -70,9 +65,9 @@ int
 sys_execve (const char *path, char *const *argv, char *const *envp)
 {
   DynamicLinkInfo dlinfo;
+  ExecArgs args;
   uint32_t eip;
   VFSInode *inode;
-  char **nenvp;
   int ret = vfs_open_file (&inode, path, 1);
   if (ret != 0)
     return ret;
@@ -94,12 +89,11 @@ sys_execve (const char *path, char *const *argv, char *const *envp)
     }
   memset (&dlinfo, 0, sizeof (DynamicLinkInfo));
   DISABLE_TASK_SWITCH;
-  ret = process_exec (inode, &eip, argv, envp, &dlinfo);
+  ret = process_exec (inode, &eip, argv, envp, &dlinfo, &args);
   vfs_unref_inode (inode);
   if (ret != 0)
     return ret;
-  nenvp = envp == NULL ? NULL : ((char ***) EXEC_DATA_VADDR)[1];
-  task_exec (eip, ((char ***) EXEC_DATA_VADDR)[0], nenvp, &dlinfo);
+  task_exec (eip, &args, &dlinfo);
 }
 
 int
@@ -507,16 +501,154 @@ sys_uname (struct utsname *name)
   return 0;
 }
 
+int
+sys__newselect (int nfds, fd_set *readfds, fd_set *writefds,
+		fd_set *exceptfds, struct timeval *timeout)
+{
+  return select (nfds, readfds, writefds, exceptfds, timeout);
+}
+
+int
+sys_poll (struct pollfd *fds, nfds_t nfds, int timeout)
+{
+  return poll (fds, nfds, timeout);
+}
+
 int
 sys_vfork (void)
 {
+  Process *proc = &process_table[task_getpid ()];
   int ret;
   task_switch_enabled = 0;
   ret = task_fork (0);
+  if (ret > 0)
+    {
+      /* Wait for the child to call exec or exit */
+      proc->p_vfork = ret;
+      task_switch_enabled = 1;
+      task_yield ();
+      return ret;
+    }
   task_switch_enabled = 1;
   return ret;
 }
 
+static int
+posix_spawn_file_actions (const struct spawn_file_action *actions)
+{
+  int ret;
+  int fd;
+  if (actions == NULL)
+    return 0;
+  for (; actions->sfa_type != SPAWN_ACTION_END; actions++)
+    {
+      switch (actions->sfa_type)
+	{
+	case SPAWN_ACTION_OPEN:
+	  fd = sys_open (actions->sfa_path, actions->sfa_flags,
+			 actions->sfa_mode);
+	  if (fd < 0 || fd == actions->sfa_fd)
+	    {
+	      ret = fd;
+	      break;
+	    }
+	  ret = sys_dup2 (fd, actions->sfa_fd);
+	  sys_close (fd);
+	  break;
+	case SPAWN_ACTION_CLOSE:
+	  ret = sys_close (actions->sfa_fd);
+	  break;
+	case SPAWN_ACTION_DUP2:
+	  ret = sys_dup2 (actions->sfa_fd, actions->sfa_newfd);
+	  break;
+	default:
+	  ret = -EINVAL;
+	}
+      if (ret < 0)
+	return ret;
+    }
+  return 0;
+}
+
+/* Runs PATH in a new process that borrows the address space of the caller
+   like a vfork child, so nothing has to be copied. The caller doesn't run
+   again until the child has called exec, and gets the error instead of a
+   child if the file actions or the exec fail before that. */
+
+int
+sys_posix_spawn (pid_t *pid, const char *path,
+		 const struct spawn_file_action *actions, char *const *argv,
+		 char *const *envp)
+{
+  Process *proc = &process_table[task_getpid ()];
+  Process *parent;
+  uint32_t flags;
+  int ret;
+  task_switch_enabled = 0;
+  ret = task_fork (0);
+  if (ret == 0)
+    {
+      task_switch_enabled = 1;
+      ret = posix_spawn_file_actions (actions);
+      if (ret == 0)
+	ret = sys_execve (path, argv, envp);
+      parent = &process_table[task_getppid ()];
+      if (parent->p_vfork == task_getpid ())
+	parent->p_spawnerr = ret;
+      sys_exit (127);
+    }
+  if (ret < 0)
+    {
+      task_switch_enabled = 1;
+      return ret;
+    }
+
+  proc->p_vfork = ret;
+  proc->p_spawnerr = 0;
+  task_switch_enabled = 1;
+  task_yield ();
+  if (proc->p_spawnerr != 0)
+    {
+      /* The child has already been freed, don't leave it to be waited for */
+      flags = irq_save ();
+      process_reap (task_getpid (), ret);
+      irq_restore (flags);
+      ret = proc->p_spawnerr;
+      proc->p_spawnerr = 0;
+      return ret;
+    }
+  if (pid != NULL)
+    *pid = ret;
+  return 0;
+}
+
+int
+sys_epoll_create (int size)
+{
+  if (size <= 0)
+    return -EINVAL;
+  return epoll_create1 (0);
+}
+
+int
+sys_epoll_ctl (int epfd, int op, int fd, struct epoll_event *event)
+{
+  return epoll_ctl (epfd, op, fd, event);
+}
+
+int
+sys_epoll_wait (int epfd, struct epoll_event *events, int maxevents,
+		int timeout)
+{
+  return epoll_wait (epfd, events, maxevents, timeout);
+}
+
+int
+sys_epoll_create1 (int flags)
+{
+  return epoll_create1 (flags);
+}
+
 ssize_t
 sys_getrandom (void *buffer, size_t len, unsigned int flags)
 {
@@ -21,6 +21,7 @@
 #include <sys/process.h>
 #include <sys/syscall.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
 #include <vm/paging.h>
 
 void *
@@ -30,12 +31,6 @@ sys_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t offset)
   VFSInode *inode = NULL;
   ProcessMemoryRegion *region;
   uint32_t base;
-  uint32_t vaddr;
-  uint32_t i;
-  int first = 0;
-  int last = proc->p_mregions->sa_size - 1;
-  int pgflags = flags != PROT_NONE ? PAGE_FLAG_USER : 0;
-  size_t bytes = len;
 
   /* Make sure arguments are valid */
   if (!(flags & MAP_ANONYMOUS))
@@ -50,7 +45,7 @@ sys_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t offset)
     }
   if (len == 0)
     return (void *) -EINVAL;
-  if (proc->p_mregions->sa_size >= PROCESS_MMAP_LIMIT)
+  if (proc->p_mregions.rbt_count >= PROCESS_MMAP_LIMIT)
     return (void *) -ENOMEM;
   if (inode != NULL)
     {
@@ -60,9 +55,15 @@ sys_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t offset)
       if (!(prot & PROT_READ)
 	  && ((proc->p_files[fd]->pf_mode & O_ACCMODE) == O_RDONLY))
 	return (void *) -EACCES;
+      if ((flags & MAP_SHARED) && (prot & PROT_WRITE)
+	  && (proc->p_files[fd]->pf_mode & O_ACCMODE) != O_RDWR)
+	return (void *) -EACCES;
+      if (inode->vi_ops->vfs_readpage == NULL)
+	return (void *) -ENODEV;
     }
   if (!(flags & MAP_SHARED) && !(flags & MAP_PRIVATE))
     return (void *) -EINVAL;
+  flags &= ~MAP_DENYWRITE; /* Only used for executables */
   len = ((len - 1) | (PAGE_SIZE - 1)) + 1;
   prot &= __PROT_MASK;
 
@@ -73,105 +74,37 @@ sys_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t offset)
       base = (uint32_t) addr;
       if (base & (PAGE_SIZE - 1))
 	return (void *) -EINVAL; /* Address is not page aligned */
+      if (len > PROCESS_MMAP_END || base > PROCESS_MMAP_END - len)
+	return (void *) -ENOMEM; /* Would reach the kernel page tables */
     }
   else
     base = PROCESS_BREAK_LIMIT;
-  if (proc->p_mregions->sa_size == 0)
-    goto map;
-
-  /* Search for the first mmap'd region with a base address above the
-     address we calculated above */
-  while (first <= last)
-    {
-      int mid = (first + last) / 2;
-      ProcessMemoryRegion *region = proc->p_mregions->sa_elems[mid];
-      if (region->pm_base > base)
-	last = mid - 1;
-      else
-	first = mid + 1;
-    }
-
-  /* Search each mapped region until we find a gap between regions at least
-     len bytes long */
-  if (last < proc->p_mregions->sa_size - 1)
-    {
-      ProcessMemoryRegion *before = proc->p_mregions->sa_elems[last];
-      vaddr = before->pm_base + before->pm_len;
-    }
-  else
-    vaddr = base;
-  for (i = last + 1; i < proc->p_mregions->sa_size;
-       vaddr = region->pm_base + region->pm_len, i++)
-    {
-      region = proc->p_mregions->sa_elems[i];
-      if (region->pm_base - vaddr >= len)
-	break;
-    }
-  base = vaddr;
-
- map:
-  if (prot & PROT_WRITE)
-    pgflags |= PAGE_FLAG_WRITE;
-  for (vaddr = base; vaddr < base + len; vaddr += PAGE_SIZE)
-    {
-      uint32_t paddr = alloc_page ();
-      if (unlikely (paddr == 0))
-	goto err;
-      map_page (curr_page_dir, paddr, vaddr, PAGE_FLAG_WRITE);
-      /* XXX Is invalidating page necessary when it should be not present? */
-      vm_page_inval (vaddr);
-    }
-  vm_tlb_reset_386 ();
 
-  if (inode == NULL)
-    {
-      /* Zero memory region unless requested to be uninitialized */
-      if (!(flags & MAP_UNINITIALIZED))
-	memset ((void *) base, 0, len);
-    }
-  else
-    {
-      /* Read file into memory area if specified
-	 TODO Support MAP_SHARED flag */
-      int ret;
-      ret = vfs_read (inode, (void *) base, bytes, offset);
-      if (ret < 0)
-	return (void *) ret;
-      /* Zero remaining bytes in region unless requested to be uninitialized */
-      if (!(flags & MAP_UNINITIALIZED))
-	memset ((void *) (base + bytes), 0, len - ret);
-    }
+  /* Find the lowest gap between regions at or above that address that is
+     large enough to hold the mapping */
+  base = process_region_find_gap (&proc->p_mregions, base, len);
+  if (base == 0)
+    return (void *) -ENOMEM;
 
-  /* Remap memory region with requested protection */
-  for (vaddr = base; vaddr < base + len; vaddr += PAGE_SIZE)
+  /* Only address space is reserved here. Anonymous pages are filled with
+     zeros and file pages are read from the page cache on first access. */
+  if (process_vm_reserve (proc, len) != 0)
+    return (void *) -ENOMEM;
+  region = process_region_alloc ();
+  if (unlikely (region == NULL))
     {
-      uint32_t paddr = get_paddr (curr_page_dir, (void *) vaddr);
-      map_page (curr_page_dir, paddr, vaddr, pgflags);
-      vm_page_inval (vaddr);
+      proc->p_vmsize -= len;
+      return (void *) -ENOMEM;
     }
-  vm_tlb_reset_386 ();
-
-  /* Add the new region to the list of mapped areas */
-  region = kmalloc (sizeof (ProcessMemoryRegion));
-  if (unlikely (region == NULL))
-    goto err;
   region->pm_base = base;
   region->pm_len = len;
   region->pm_prot = prot;
   region->pm_flags = flags;
   region->pm_ino = inode;
   region->pm_offset = offset;
-  sorted_array_insert (proc->p_mregions, region);
+  vfs_ref_inode (inode);
+  process_region_insert (&proc->p_mregions, region);
   return (void *) base;
-
- err:
-  for (i = base; i < vaddr; i += PAGE_SIZE)
-    {
-      uint32_t paddr = get_paddr (curr_page_dir, (void *) i);
-      if (likely (paddr != 0))
-	free_page (paddr);
-    }
-  return (void *) -ENOMEM;
 }
 
 int
@@ -179,11 +112,9 @@ sys_munmap (void *addr, size_t len)
 {
   Process *proc = &process_table[task_getpid ()];
   ProcessMemoryRegion *region;
-  int first = 0;
-  int last = proc->p_mregions->sa_size - 1;
+  TLBGather tlb;
   uint32_t vaddr;
   uint32_t temp;
-  int mid;
 
   /* Require the address to be page aligned */
   if (addr == NULL || (uint32_t) addr & (PAGE_SIZE - 1))
@@ -191,47 +122,42 @@ sys_munmap (void *addr, size_t len)
   len = ((len - 1) | (PAGE_SIZE - 1)) + 1;
 
   /* Search for the memory region containing the given address */
-  while (first <= last)
-    {
-      mid = (first + last) / 2;
-      region = proc->p_mregions->sa_elems[mid];
-      if (region->pm_base <= (uint32_t) addr
-	  && (uint32_t) addr < region->pm_base + region->pm_len)
-	goto unmap;
-      else if (region->pm_base > (uint32_t) addr)
-	last = mid - 1;
-      else
-	first = mid + 1;
-    }
-  /* If we get here, no memory region has a base address that matches */
-  return -EINVAL;
+  region = process_region_lookup (&proc->p_mregions, (uint32_t) addr);
+  if (region == NULL)
+    return -EINVAL;
 
- unmap:
   temp = (uint32_t) addr;
+  tlb_gather_init (&tlb);
   for (vaddr = temp; vaddr < (uint32_t) addr + len; vaddr += PAGE_SIZE)
     {
-      uint32_t paddr;
       if (vaddr >= region->pm_base + region->pm_len)
 	{
 	  /* We have overlapped into another adjacent memory area, unmap
 	     the remaining pages from that area */
-	  int ret = sys_munmap ((void *) vaddr, len - region->pm_len);
+	  int ret;
+	  tlb_gather_flush (&tlb);
+	  ret = sys_munmap ((void *) vaddr, len - region->pm_len);
 	  if (ret < 0)
 	    return ret;
 	  break;
 	}
-      paddr = get_paddr (curr_page_dir, (void *) vaddr);
-      free_page (paddr);
-      unmap_page (curr_page_dir, vaddr);
-      vm_page_inval (vaddr);
+      process_region_unmap (curr_page_dir, vaddr);
+      tlb_gather_page (&tlb, vaddr);
     }
-  vm_tlb_reset_386 ();
+  tlb_gather_flush (&tlb);
+  proc->p_vmsize -= vaddr - temp;
+
+  /* Write back pages dirtied through a shared file mapping */
+  if (region->pm_ino != NULL && (region->pm_flags & MAP_SHARED))
+    page_cache_sync (region->pm_ino,
+		     (off64_t) region->pm_offset + temp - region->pm_base,
+		     (off64_t) region->pm_offset + vaddr - region->pm_base);
 
   /* If there are more pages beyond the unmapped region, mark them as part
      of a separate region */
   if (vaddr < region->pm_base + region->pm_len)
     {
-      ProcessMemoryRegion *new = kmalloc (sizeof (ProcessMemoryRegion));
+      ProcessMemoryRegion *new = process_region_alloc ();
       if (unlikely (new == NULL))
 	return -ENOMEM;
       new->pm_base = vaddr;
@@ -240,19 +166,25 @@ sys_munmap (void *addr, size_t len)
       new->pm_flags = region->pm_flags;
       new->pm_ino = region->pm_ino;
       new->pm_offset = region->pm_offset + vaddr - region->pm_base;
-      vfs_ref_inode (new->pm_ino);
-      sorted_array_insert (proc->p_mregions, new);
+      if (unlikely (process_region_ref (new) != 0))
+	{
+	  process_region_dealloc (new);
+	  return -ENOMEM;
+	}
+      process_region_resize (&proc->p_mregions, region,
+			     vaddr - region->pm_base);
+      process_region_insert (&proc->p_mregions, new);
     }
 
   /* If there are pages beneath the unmapped region, update the length
-     of the region accordingly, otherwise remove the entry from the array */
+     of the region accordingly, otherwise remove the entry from the tree */
   if (temp > region->pm_base)
-    region->pm_len = temp - region->pm_base;
+    process_region_resize (&proc->p_mregions, region, temp - region->pm_base);
   else
     {
-      sorted_array_remove (proc->p_mregions, mid);
-      vfs_unref_inode (region->pm_ino);
-      kfree (region);
+      process_region_remove (&proc->p_mregions, region);
+      process_region_unref (region);
+      process_region_dealloc (region);
     }
 
   return 0;
@@ -264,9 +196,8 @@ sys_mprotect (void *addr, size_t len, int prot)
   Process *proc = &process_table[task_getpid ()];
   uint32_t rem;
   uint32_t vaddr;
-  int first = 0;
-  int last = proc->p_mregions->sa_size - 1;
   ProcessMemoryRegion *region;
+  TLBGather tlb;
   int pgflags = prot != PROT_NONE ? PAGE_FLAG_USER : 0;
   if ((uint32_t) addr & (PAGE_SIZE - 1))
     return -EINVAL;
@@ -276,22 +207,10 @@ sys_mprotect (void *addr, size_t len, int prot)
   prot &= __PROT_MASK;
 
   /* Search for the memory region containing the given address */
-  while (first <= last)
-    {
-      int mid = (first + last) / 2;
-      region = proc->p_mregions->sa_elems[mid];
-      if (region->pm_base <= (uint32_t) addr
-	  && (uint32_t) addr < region->pm_base + region->pm_len)
-	goto protect;
-      else if (region->pm_base > (uint32_t) addr)
-	last = mid - 1;
-      else
-	first = mid + 1;
-    }
-  /* If we get here, no memory region has a base address that matches */
-  return -EINVAL;
+  region = process_region_lookup (&proc->p_mregions, (uint32_t) addr);
+  if (region == NULL)
+    return -EINVAL;
 
- protect:
   /* Change protection of part of the overlapping memory area if the length 
      exceeds the remaining number of bytes in the current one */
   rem = region->pm_base + region->pm_len - (uint32_t) addr;
@@ -310,14 +229,84 @@ sys_mprotect (void *addr, size_t len, int prot)
   /* Remap memory region with requested protection */
   if (prot & PROT_WRITE)
     pgflags |= PAGE_FLAG_WRITE;
+  tlb_gather_init (&tlb);
   for (vaddr = (uint32_t) addr; vaddr < (uint32_t) addr + len;
        vaddr += PAGE_SIZE)
     {
-      uint32_t paddr = get_paddr (curr_page_dir, (void *) vaddr);
-      map_page (curr_page_dir, paddr, vaddr, pgflags);
-      vm_page_inval (vaddr);
+      /* Pages of file mappings that were never accessed are not present */
+      uint32_t *pte = get_pte (curr_page_dir, vaddr);
+      if (pte == NULL || !(*pte & PAGE_FLAG_PRESENT))
+	continue;
+      *pte = (*pte & ~(PAGE_FLAG_USER | PAGE_FLAG_WRITE)) | pgflags;
+
+      /* The zero page and cached pages of private file mappings stay
+	 read-only until a write fault copies them */
+      if ((*pte & PAGE_FLAG_ZERO)
+	  || ((*pte & PAGE_FLAG_SHARED) && !(region->pm_flags & MAP_SHARED)))
+	*pte &= ~PAGE_FLAG_WRITE;
+      tlb_gather_page (&tlb, vaddr);
     }
-  vm_tlb_reset_386 ();
+  tlb_gather_flush (&tlb);
   region->pm_prot = prot;
   return 0;
 }
+
+int
+sys_msync (void *addr, size_t len, int flags)
+{
+  Process *proc = &process_table[task_getpid ()];
+  TLBGather tlb;
+  uint32_t end;
+  uint32_t vaddr = (uint32_t) addr;
+  int ret;
+  if (vaddr & (PAGE_SIZE - 1))
+    return -EINVAL;
+  if (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)
+      || ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+    return -EINVAL;
+  if (len == 0)
+    return 0;
+  end = vaddr + (((len - 1) | (PAGE_SIZE - 1)) + 1);
+
+  /* Shared mappings use the cached pages directly, so MS_INVALIDATE has
+     nothing to do. Dirty bits are moved from the page tables to the page
+     cache, and unless MS_ASYNC is given the pages are written back. */
+  while (vaddr < end)
+    {
+      ProcessMemoryRegion *region = process_find_region (proc, vaddr);
+      uint32_t start = vaddr;
+      uint32_t rend;
+      if (region == NULL)
+	return -ENOMEM;
+      rend = MIN (end, region->pm_base + region->pm_len);
+      if (region->pm_ino == NULL || !(region->pm_flags & MAP_SHARED))
+	{
+	  vaddr = rend;
+	  continue;
+	}
+      tlb_gather_init (&tlb);
+      for (; vaddr < rend; vaddr += PAGE_SIZE)
+	{
+	  uint32_t *pte = get_pte (curr_page_dir, vaddr);
+	  if (pte == NULL || (*pte & (PAGE_FLAG_PRESENT | PAGE_FLAG_SHARED
+				      | PAGE_FLAG_DIRTY))
+	      != (PAGE_FLAG_PRESENT | PAGE_FLAG_SHARED | PAGE_FLAG_DIRTY))
+	    continue;
+	  page_cache_dirty_frame (*pte & 0xfffff000);
+	  *pte &= ~PAGE_FLAG_DIRTY;
+	  tlb_gather_page (&tlb, vaddr);
+	}
+      tlb_gather_flush (&tlb);
+      if (!(flags & MS_ASYNC))
+	{
+	  ret = page_cache_sync (region->pm_ino,
+				 (off64_t) region->pm_offset + start
+				 - region->pm_base,
+				 (off64_t) region->pm_offset + rend
+				 - region->pm_base);
+	  if (ret != 0)
+	    return ret;
+	}
+    }
+  return 0;
+}
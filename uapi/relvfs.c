@@ -37,7 +37,7 @@ sys_openat (int fd, const char *path, int flags, mode_t mode)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
       proc->p_cwdpath = proc->p_files[fd]->pf_path;
@@ -56,7 +56,7 @@ sys_mkdirat (int fd, const char *path, mode_t mode)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -73,7 +73,7 @@ sys_mknodat (int fd, const char *path, mode_t mode, dev_t dev)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -91,7 +91,7 @@ sys_fchownat (int fd, const char *path, uid_t uid, gid_t gid, int flags)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -119,7 +119,7 @@ sys_futimesat (int fd, const char *path, const struct timeval times[2])
     return -EINVAL;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -156,7 +156,7 @@ sys_fstatat64 (int fd, const char *path, struct stat64 *st, int flags)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -176,7 +176,7 @@ sys_unlinkat (int fd, const char *path, int flags)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -201,8 +201,7 @@ sys_renameat (int oldfd, const char *old, int newfd, const char *new)
 
   if (oldfd != AT_FDCWD)
     {
-      if (oldfd < 0 || oldfd >= PROCESS_FILE_LIMIT
-	  || proc->p_files[oldfd] == NULL)
+      if (process_get_file (proc, oldfd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[oldfd]->pf_inode;
     }
@@ -215,8 +214,7 @@ sys_renameat (int oldfd, const char *old, int newfd, const char *new)
 
   if (newfd != AT_FDCWD)
     {
-      if (newfd < 0 || newfd >= PROCESS_FILE_LIMIT
-	  || proc->p_files[newfd] == NULL)
+      if (process_get_file (proc, newfd) == NULL)
 	{
 	  vfs_unref_inode (old_inode);
 	  kfree (old_name);
@@ -256,8 +254,7 @@ sys_linkat (int oldfd, const char *old, int newfd, const char *new, int flags)
 
   if (oldfd != AT_FDCWD)
     {
-      if (oldfd < 0 || oldfd >= PROCESS_FILE_LIMIT
-	  || proc->p_files[oldfd] == NULL)
+      if (process_get_file (proc, oldfd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[oldfd]->pf_inode;
     }
@@ -270,8 +267,7 @@ sys_linkat (int oldfd, const char *old, int newfd, const char *new, int flags)
 
   if (newfd != AT_FDCWD)
     {
-      if (newfd < 0 || newfd >= PROCESS_FILE_LIMIT
-	  || proc->p_files[newfd] == NULL)
+      if (process_get_file (proc, newfd) == NULL)
 	{
 	  vfs_unref_inode (old_inode);
 	  proc->p_cwd = cwd;
@@ -313,7 +309,7 @@ sys_symlinkat (const char *old, int fd, const char *new)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -331,7 +327,7 @@ sys_readlinkat (int fd, const char *__restrict path, char *__restrict buffer,
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -349,7 +345,7 @@ sys_fchmodat (int fd, const char *path, mode_t mode, int flags)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -376,7 +372,7 @@ sys_faccessat (int fd, const char *path, int mode, int flags)
   int ret;
   if (fd != AT_FDCWD)
     {
-      if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+      if (process_get_file (proc, fd) == NULL)
 	return -EBADF;
       proc->p_cwd = proc->p_files[fd]->pf_inode;
     }
@@ -427,7 +423,7 @@ sys_utimensat (int fd, const char *path, const struct timespec times[2],
       cwd = proc->p_cwd;
       if (fd != AT_FDCWD)
 	{
-	  if (fd < 0 || fd >= PROCESS_FILE_LIMIT || proc->p_files[fd] == NULL)
+	  if (process_get_file (proc, fd) == NULL)
 	    return -EBADF;
 	  proc->p_cwd = proc->p_files[fd]->pf_inode;
 	}
@@ -106,10 +106,13 @@ void *syscall_table[NR_syscalls] = {
   [SYS_fchdir] = sys_fchdir,
   [SYS__llseek] = sys__llseek,
   [SYS_getdents] = sys_getdents,
+  [SYS__newselect] = sys__newselect,
+  [SYS_msync] = sys_msync,
   [SYS_getsid] = sys_getsid,
   [SYS_nanosleep] = sys_nanosleep,
   [SYS_setresuid] = sys_setresuid,
   [SYS_getresuid] = sys_getresuid,
+  [SYS_poll] = sys_poll,
   [SYS_setresgid] = sys_setresgid,
   [SYS_getresgid] = sys_getresgid,
   [SYS_pread64] = sys_pread64,
@@ -122,6 +125,8 @@ void *syscall_table[NR_syscalls] = {
   [SYS_stat64] = sys_stat64,
   [SYS_lstat64] = sys_lstat64,
   [SYS_fstat64] = sys_fstat64,
+  [SYS_getdents64] = sys_getdents64,
+  [SYS_posix_spawn] = sys_posix_spawn,
   [SYS_setxattr] = sys_setxattr,
   [SYS_lsetxattr] = sys_lsetxattr,
   [SYS_fsetxattr] = sys_fsetxattr,
@@ -134,6 +139,9 @@ void *syscall_table[NR_syscalls] = {
   [SYS_removexattr] = sys_removexattr,
   [SYS_lremovexattr] = sys_lremovexattr,
   [SYS_fremovexattr] = sys_fremovexattr,
+  [SYS_epoll_create] = sys_epoll_create,
+  [SYS_epoll_ctl] = sys_epoll_ctl,
+  [SYS_epoll_wait] = sys_epoll_wait,
   [SYS_clock_getres] = sys_clock_getres,
   [SYS_clock_gettime] = sys_clock_gettime,
   [SYS_statfs64] = sys_statfs64,
@@ -153,5 +161,6 @@ void *syscall_table[NR_syscalls] = {
   [SYS_fchmodat] = sys_fchmodat,
   [SYS_faccessat] = sys_faccessat,
   [SYS_utimensat] = sys_utimensat,
+  [SYS_epoll_create1] = sys_epoll_create1,
   [SYS_getrandom] = sys_getrandom
 };
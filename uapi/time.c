@@ -17,6 +17,7 @@
  *************************************************************************/
 
 #include <libk/libk.h>
+#include <sys/clock.h>
 #include <sys/process.h>
 #include <sys/syscall.h>
 #include <sys/timer.h>
@@ -59,8 +60,9 @@ sys_gettimeofday (struct timeval *__restrict tv, struct timezone *__restrict tz)
 {
   if (tv != NULL)
     {
-      tv->tv_sec = time (NULL);
-      tv->tv_usec = 0;
+      uint64_t ns = clock_realtime ();
+      tv->tv_sec = ns / NSEC_PER_SEC;
+      tv->tv_usec = ns % NSEC_PER_SEC / 1000;
     }
   if (tz != NULL)
     {
@@ -107,8 +109,10 @@ sys_clock_getres (clockid_t id, struct timespec *tp)
     {
     case CLOCK_REALTIME:
     case CLOCK_MONOTONIC:
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
       tp->tv_sec = 0;
-      tp->tv_nsec = 1000000;
+      tp->tv_nsec = clock_resolution ();
       return 0;
     default:
       return -EINVAL;
@@ -118,14 +122,23 @@ sys_clock_getres (clockid_t id, struct timespec *tp)
 int
 sys_clock_gettime (clockid_t id, struct timespec *tp)
 {
+  uint64_t ns;
   switch (id)
     {
     case CLOCK_REALTIME:
+      ns = clock_realtime ();
+      break;
     case CLOCK_MONOTONIC:
-      tp->tv_sec = time (NULL);
-      tp->tv_nsec = timer_get_rem_ms () * 1000000;
-      return 0;
+      ns = clock_monotonic ();
+      break;
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+      ns = clock_process_cputime (task_getpid ());
+      break;
     default:
       return -EINVAL;
     }
+  tp->tv_sec = ns / NSEC_PER_SEC;
+  tp->tv_nsec = ns % NSEC_PER_SEC;
+  return 0;
 }
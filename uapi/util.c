@@ -63,10 +63,7 @@ sys_path_sep (const char *path, VFSInode **dir, char **name)
 VFSInode *
 inode_from_fd (int fd)
 {
-  ProcessFile *file;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return NULL;
-  file = process_table[task_getpid ()].p_files[fd];
+  ProcessFile *file = process_get_file (&process_table[task_getpid ()], fd);
   return file == NULL ? NULL : file->pf_inode;
 }
 
@@ -76,13 +73,36 @@ sys_read_dir_entry (const char *name, size_t namelen, ino64_t ino,
 {
   DirIterContext *ctx = private;
   struct dirent *d;
-  ctx->d_curr_offset = offset;
-  if (ctx->d_curr_offset < ctx->d_min_offset)
-    return 0;
-  d = &ctx->d_dirp[ctx->d_curr_count];
+  if (ctx->d_curr_count == ctx->d_max_count)
+    return 1;
+  d = (struct dirent *) ctx->d_dirp + ctx->d_curr_count++;
   d->d_ino = ino;
   d->d_namlen = namelen;
+  d->d_type = type;
   memcpy (d->d_name, name, namelen);
-  memset (&d->d_name[namelen], 0, 256 - namelen);
-  return ++ctx->d_curr_count == ctx->d_max_count;
+  d->d_name[namelen] = '\0';
+  return 0;
+}
+
+int
+sys_read_dir_entry64 (const char *name, size_t namelen, ino64_t ino,
+		      unsigned char type, off64_t offset, void *private)
+{
+  DirIterContext *ctx = private;
+  struct dirent64 *d;
+  size_t reclen = (offsetof (struct dirent64, d_name) + namelen + 8) & ~7;
+  if (ctx->d_curr_count + reclen > ctx->d_max_count)
+    {
+      ctx->d_overflow = 1;
+      return 1;
+    }
+  d = (struct dirent64 *) ((char *) ctx->d_dirp + ctx->d_curr_count);
+  d->d_ino = ino;
+  d->d_off = offset;
+  d->d_reclen = reclen;
+  d->d_type = type;
+  memcpy (d->d_name, name, namelen);
+  d->d_name[namelen] = '\0';
+  ctx->d_curr_count += reclen;
+  return 0;
 }
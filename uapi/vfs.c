@@ -21,6 +21,7 @@
 #include <sys/process.h>
 #include <sys/syscall.h>
 #include <vm/heap.h>
+#include <vm/pagecache.h>
 
 static int
 __sys_xchown (const char *path, uid_t uid, gid_t gid, int follow_symlinks)
@@ -34,14 +35,34 @@ __sys_xchown (const char *path, uid_t uid, gid_t gid, int follow_symlinks)
   return ret;
 }
 
+static int
+__sys_getdents (int fd, VFSDirEntryFillFunc func, DirIterContext *ctx)
+{
+  ProcessFile *file;
+  int ret;
+  file = process_get_file (&process_table[task_getpid ()], fd);
+  if (file == NULL)
+    return -EBADF;
+  if (!S_ISDIR (file->pf_inode->vi_mode))
+    return -ENOTDIR;
+
+  /* The cursor can't be trusted if the offset was changed with lseek */
+  if (file->pf_dir.dc_pos != file->pf_offset)
+    {
+      file->pf_dir.dc_pos = file->pf_offset;
+      file->pf_dir.dc_version = 0;
+    }
+  ret = vfs_readdir (file->pf_inode, &file->pf_dir, func, ctx);
+  file->pf_offset = file->pf_dir.dc_pos;
+  return ret;
+}
+
 ssize_t
 sys_read (int fd, void *buffer, size_t len)
 {
   ProcessFile *file;
   int ret;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_WRONLY)
     return -EBADF;
   ret = vfs_read (file->pf_inode, buffer, len, file->pf_offset);
@@ -56,9 +77,7 @@ sys_write (int fd, const void *buffer, size_t len)
 {
   ProcessFile *file;
   int ret;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_RDONLY)
     return -EBADF;
   ret = vfs_write (file->pf_inode, buffer, len, file->pf_offset);
@@ -120,17 +139,6 @@ sys_open (const char *path, int flags, mode_t mode)
       process_free_fd (proc, i);
       return ret;
     }
-  if (flags & O_TRUNC)
-    {
-      inode->vi_size = 0;
-      ret = vfs_truncate (inode);
-      if (ret != 0)
-	{
-	  vfs_unref_inode (inode);
-	  process_free_fd (proc, i);
-	  return ret;
-	}
-    }
 
   /* Don't allow opening device files if the filesystem is mounted with nodev */
   if ((inode->vi_sb->sb_mntflags & MS_NODEV)
@@ -170,6 +178,34 @@ sys_open (const char *path, int flags, mode_t mode)
       process_free_fd (proc, i);
       return -EINVAL;
     }
+
+  /* Files being executed can't be changed, and files open for writing
+     can't be executed */
+  if (proc->p_files[i]->pf_mode != O_RDONLY)
+    {
+      ret = process_get_write_access (inode);
+      if (ret != 0)
+	{
+	  process_free_fd (proc, i);
+	  return ret;
+	}
+      proc->p_files[i]->pf_writer = 1;
+    }
+  else if ((flags & O_TRUNC) && process_write_denied (inode))
+    {
+      process_free_fd (proc, i);
+      return -ETXTBSY;
+    }
+  if (flags & O_TRUNC)
+    {
+      inode->vi_size = 0;
+      ret = vfs_truncate (inode);
+      if (ret != 0)
+	{
+	  process_free_fd (proc, i);
+	  return ret;
+	}
+    }
   proc->p_files[i]->pf_offset =
     flags & O_APPEND ? proc->p_files[i]->pf_inode->vi_size : 0;
 
@@ -188,8 +224,6 @@ sys_open (const char *path, int flags, mode_t mode)
 int
 sys_close (int fd)
 {
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
   return process_free_fd (&process_table[task_getpid ()], fd);
 }
 
@@ -654,8 +688,12 @@ int
 sys_fsync (int fd)
 {
   VFSInode *inode = inode_from_fd (fd);
+  int ret;
   if (inode == NULL)
     return -EBADF;
+  ret = page_cache_sync (inode, 0, INT64_MAX);
+  if (ret != 0)
+    return ret;
   return vfs_write_inode (inode);
 }
 
@@ -719,25 +757,15 @@ sys__llseek (int fd, unsigned long offset_high, unsigned long offset_low,
 int
 sys_getdents (int fd, struct dirent *dirp, unsigned int count)
 {
-  Process *proc = &process_table[task_getpid ()];
-  VFSInode *dir = inode_from_fd (fd);
   DirIterContext ctx;
   int ret;
-  if (dir == NULL)
-    return -EBADF;
-  if (!S_ISDIR (dir->vi_mode))
-    return -ENOTDIR;
-
   ctx.d_curr_count = 0;
   ctx.d_max_count = count;
-  ctx.d_curr_offset = 0;
-  ctx.d_min_offset = proc->p_files[fd]->pf_offset;
   ctx.d_dirp = dirp;
-
-  ret = vfs_readdir (dir, sys_read_dir_entry, &ctx);
+  ctx.d_overflow = 0;
+  ret = __sys_getdents (fd, sys_read_dir_entry, &ctx);
   if (ret != 0)
     return ret;
-  proc->p_files[fd]->pf_offset = ctx.d_curr_offset + 1;
   return ctx.d_curr_count;
 }
 
@@ -745,61 +773,41 @@ ssize_t
 sys_readv (int fd, const struct iovec *vec, int vlen)
 {
   ProcessFile *file;
-  int bytes = 0;
   int ret;
-  size_t i;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_WRONLY)
     return -EBADF;
-  if (vlen < 0)
+  if (vlen < 0 || vlen > IOV_MAX)
     return -EINVAL;
-  for (i = 0; i < vlen; i++)
-    {
-      ret = vfs_read (file->pf_inode, vec[i].iov_base, vec[i].iov_len,
-		      file->pf_offset);
-      if (ret < 0)
-	return ret;
-      file->pf_offset += vec[i].iov_len;
-      bytes += ret;
-    }
-  return bytes;
+  ret = vfs_read_iter (file->pf_inode, vec, vlen, file->pf_offset);
+  if (ret < 0)
+    return ret;
+  file->pf_offset += ret;
+  return ret;
 }
 
 ssize_t
 sys_writev (int fd, const struct iovec *vec, int vlen)
 {
   ProcessFile *file;
-  int bytes = 0;
   int ret;
-  size_t i;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_RDONLY)
     return -EBADF;
-  if (vlen < 0)
+  if (vlen < 0 || vlen > IOV_MAX)
     return -EINVAL;
-  for (i = 0; i < vlen; i++)
-    {
-      ret = vfs_write (file->pf_inode, vec[i].iov_base, vec[i].iov_len,
-		       file->pf_offset);
-      if (ret < 0)
-	return ret;
-      file->pf_offset += vec[i].iov_len;
-      bytes += ret;
-    }
-  return bytes;
+  ret = vfs_write_iter (file->pf_inode, vec, vlen, file->pf_offset);
+  if (ret < 0)
+    return ret;
+  file->pf_offset += ret;
+  return ret;
 }
 
 ssize_t
 sys_pread64 (int fd, void *buffer, size_t len, off64_t offset)
 {
   ProcessFile *file;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_WRONLY)
     return -EBADF;
   return vfs_read (file->pf_inode, buffer, len, offset);
@@ -809,9 +817,7 @@ ssize_t
 sys_pwrite64 (int fd, const void *buffer, size_t len, off64_t offset)
 {
   ProcessFile *file;
-  if (fd < 0 || fd >= PROCESS_FILE_LIMIT)
-    return -EBADF;
-  file = process_table[task_getpid ()].p_files[fd];
+  file = process_get_file (&process_table[task_getpid ()], fd);
   if (file == NULL || (file->pf_mode & O_ACCMODE) == O_RDONLY)
     return -EBADF;
   return vfs_write (file->pf_inode, buffer, len, offset);
@@ -845,6 +851,11 @@ sys_truncate64 (const char *path, off64_t len)
   int ret = vfs_open_file (&inode, path, 1);
   if (ret != 0)
     return ret;
+  if (process_write_denied (inode))
+    {
+      vfs_unref_inode (inode);
+      return -ETXTBSY;
+    }
   inode->vi_size = len;
   ret = vfs_truncate (inode);
   vfs_unref_inode (inode);
@@ -857,6 +868,8 @@ sys_ftruncate64 (int fd, off64_t len)
   VFSInode *inode = inode_from_fd (fd);
   if (inode == NULL)
     return -EBADF;
+  if (process_write_denied (inode))
+    return -ETXTBSY;
   inode->vi_size = len;
   return vfs_truncate (inode);
 }
@@ -894,6 +907,23 @@ sys_fstat64 (int fd, struct stat64 *st)
   return vfs_getattr (inode, st);
 }
 
+int
+sys_getdents64 (int fd, void *dirp, unsigned int count)
+{
+  DirIterContext ctx;
+  int ret;
+  ctx.d_curr_count = 0;
+  ctx.d_max_count = count;
+  ctx.d_dirp = dirp;
+  ctx.d_overflow = 0;
+  ret = __sys_getdents (fd, sys_read_dir_entry64, &ctx);
+  if (ret != 0)
+    return ret;
+  if (ctx.d_curr_count == 0 && ctx.d_overflow)
+    return -EINVAL; /* Buffer too small for the next entry */
+  return ctx.d_curr_count;
+}
+
 int
 sys_statfs64 (const char *path, struct statfs64 *st)
 {